@@ -2,6 +2,7 @@
 #include "acceleration_wrap.h"
 #include "vkapp.h"
 #include <numeric>
+#include <chrono>
 
 //--------------------------------------------------------------------------------------------------
 // Initializing the allocator and querying the raytracing properties
@@ -23,10 +24,30 @@ void RaytracingBuilderKHR::destroy()
         blas.accelBuf.destroy(VK->m_device);
         vkDestroyAccelerationStructureKHR(VK->m_device, blas.accelStr, nullptr); }
     
-    m_tlas.accelBuf.destroy(VK->m_device);
-    vkDestroyAccelerationStructureKHR(VK->m_device, m_tlas.accelStr, nullptr);
+    destroyTlas();
 
     m_blas.clear();
+    m_blasStats.clear();
+}
+
+//--------------------------------------------------------------------------------------------------
+// Destroy some of the BLAS's (those of a model removed from the scene)
+//
+void RaytracingBuilderKHR::removeBlas(uint32_t first, uint32_t count)
+{
+    assert(size_t(first) + count <= m_blas.size());
+    for (uint32_t i = first; i < first + count; i++) {
+        m_blas[i].accelBuf.destroy(VK->m_device);
+        vkDestroyAccelerationStructureKHR(VK->m_device, m_blas[i].accelStr, nullptr); }
+    m_blas.erase(m_blas.begin() + first, m_blas.begin() + first + count);
+    m_blasStats.erase(m_blasStats.begin() + first, m_blasStats.begin() + first + count);
+}
+
+void RaytracingBuilderKHR::destroyTlas()
+{
+    m_tlas.accelBuf.destroy(VK->m_device);
+    vkDestroyAccelerationStructureKHR(VK->m_device, m_tlas.accelStr, nullptr);
+    m_tlas = AccelWrap{};
 }
 
 //--------------------------------------------------------------------------------------------------
@@ -104,7 +125,7 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
     VK->initBufferWrap(VK->m_scratch1, maxScratchSize,
                    VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                    | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemCategory::Scratch);
   
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
         nullptr, VK->m_scratch1.buffer};
@@ -122,6 +143,13 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
             vkCreateQueryPool(m_device, &qpci, nullptr, &queryPool);
         }
 
+    // A query pool for timestamps before and after each BLAS build.
+    VkQueryPool timePool{VK_NULL_HANDLE};
+    VkQueryPoolCreateInfo tpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    tpci.queryCount = 2*nbBlas;
+    tpci.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    vkCreateQueryPool(m_device, &tpci, nullptr, &timePool);
+
     // Batching creation/compaction of BLAS to allow staying in restricted amount of memory
     std::vector<uint32_t> indices;  // Indices of the BLAS to create
     VkDeviceSize          batchSize{0};
@@ -134,7 +162,7 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
             if(batchSize >= batchLimit || idx == nbBlas - 1)
                 {
                     VkCommandBuffer cmdBuf = VK->createTempCmdBuffer();
-                    cmdCreateBlas(cmdBuf, indices, buildAs, scratchAddress, queryPool);
+                    cmdCreateBlas(cmdBuf, indices, buildAs, scratchAddress, queryPool, timePool);
                     VK->submitTempCmdBuffer(cmdBuf);
 
                     if (queryPool)
@@ -161,10 +189,23 @@ void RaytracingBuilderKHR::buildBlas(const std::vector<BlasInput>& input,
             });
         }
 
+    // Build times from the timestamps
+    std::vector<uint64_t> timestamps(2*nbBlas, 0);
+    vkGetQueryPoolResults(m_device, timePool, 0, 2*nbBlas, timestamps.size()*sizeof(uint64_t),
+                          timestamps.data(), sizeof(uint64_t), VK_QUERY_RESULT_64_BIT);
+    vkDestroyQueryPool(m_device, timePool, nullptr);
+
     // Keeping all the created acceleration structures
-    for(auto& b : buildAs)
+    for(uint32_t idx = 0; idx < nbBlas; idx++)
         {
-            m_blas.emplace_back(b.as);
+            m_blas.emplace_back(buildAs[idx].as);
+
+            BlasStats stats;
+            for (const auto& range : input[idx].asBuildOffsetInfo)
+                stats.nbTriangles += range.primitiveCount;
+            stats.size    = buildAs[idx].sizeInfo.accelerationStructureSize;
+            stats.buildMs = (timestamps[2*idx+1] - timestamps[2*idx]) * VK->m_timestampPeriod * 1e-6;
+            m_blasStats.push_back(stats);
         }
 
     // Clean up
@@ -183,7 +224,7 @@ AccelWrap createAcceleration(VkApp* VK,
     VK->initBufferWrap(accelWrap.accelBuf, accelInfo.size,
                       VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_STORAGE_BIT_KHR
                       | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT,
-                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemCategory::AccelStructures);
 
     // Create the acceleration structure
     accelInfo.buffer = accelWrap.accelBuf.buffer;
@@ -201,7 +242,8 @@ void RaytracingBuilderKHR::cmdCreateBlas(VkCommandBuffer
                                          std::vector<uint32_t>                    indices,
                                          std::vector<BuildAccelerationStructure>& buildAs,
                                          VkDeviceAddress                          scratchAddress,
-                                         VkQueryPool                              queryPool)
+                                         VkQueryPool                              queryPool,
+                                         VkQueryPool                              timePool)
 {
     printf("    Call cmdCreateBlas\n");
     if(queryPool)  // For querying the compaction size
@@ -224,7 +266,10 @@ void RaytracingBuilderKHR::cmdCreateBlas(VkCommandBuffer
             // All build use the same scratch buffer
             buildAs[idx].buildInfo.scratchData.deviceAddress = scratchAddress;
 
-            // Building the bottom-level-acceleration-structure
+            // Building the bottom-level-acceleration-structure, between two timestamps
+            vkCmdResetQueryPool(cmdBuf, timePool, 2*idx, 2);
+            vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                timePool, 2*idx);
             printf("        vkCmdBuildAccelerationStructuresKHR build BLAS\n");
             vkCmdBuildAccelerationStructuresKHR(cmdBuf, 1, &buildAs[idx].buildInfo,
                                                 &buildAs[idx].rangeInfo);
@@ -239,6 +284,8 @@ void RaytracingBuilderKHR::cmdCreateBlas(VkCommandBuffer
             vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
                                  VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
                                  0, 1, &barrier, 0, nullptr, 0, nullptr);
+            vkCmdWriteTimestamp(cmdBuf, VK_PIPELINE_STAGE_ACCELERATION_STRUCTURE_BUILD_BIT_KHR,
+                                timePool, 2*idx+1);
 
             if(queryPool)
                 {
@@ -350,7 +397,7 @@ void RaytracingBuilderKHR::cmdCreateTlas(VkCommandBuffer                      cm
     VK->initBufferWrap(VK->m_scratch2, sizeInfo.buildScratchSize,
                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                        | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemCategory::Scratch);
 
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
         nullptr, VK->m_scratch2.buffer};
@@ -404,7 +451,7 @@ void RaytracingBuilderKHR::updateBlas(uint32_t blasIdx, BlasInput& blas, VkBuild
     VK->initBufferWrap(scratch, sizeInfo.buildScratchSize,
                        VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
                        | VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
-                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, MemCategory::Scratch);
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO};
     bufferInfo.buffer = scratch.buffer;
     buildInfos.scratchData.deviceAddress = vkGetBufferDeviceAddress(m_device, &bufferInfo);
@@ -439,9 +486,10 @@ void RaytracingBuilderKHR::buildTlas(
     // Create a buffer holding the actual instance data (matrices++) for use by the AS builder
     printf("    Create a buffer (staged) for the instances\n");
     BufferWrap instancesBuffer;
-    VK->initBufferWrapFromData(instancesBuffer, cmdBuf, instances,
+    VK->initBufferWrapFromData(instancesBuffer, instances,
                            VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
-                           | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR);
+                           | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR,
+                           MemCategory::AccelStructures);
     VkBufferDeviceAddressInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO, nullptr,
         instancesBuffer.buffer};
     printf("    vkGetBufferDeviceAddress of that instance buffer\n");
@@ -471,11 +519,18 @@ void RaytracingBuilderKHR::buildTlas(
 //-------------------------------------------------------------------------------------------------
 // Convert an OBJ model into the ray tracing geometry used to build the BLAS
 //
-BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
+// The BLAS input of one object's triangles: its full detail ones, or
+// (MESH_LODS) those of level >= 1.
+BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model, uint32_t level)
 {
     // BLAS builder requires raw device addresses.
+#ifdef COMPACT_VERTICES
+    VkBufferDeviceAddressInfo _b1{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
+        nullptr, model.positionBuffer.buffer};
+#else
     VkBufferDeviceAddressInfo _b1{VK_STRUCTURE_TYPE_BUFFER_DEVICE_ADDRESS_INFO,
         nullptr, model.vertexBuffer.buffer};
+#endif
     printf("      Get vkGetBufferDeviceAddress of object's vertex buffer\n");
     VkDeviceAddress vertexAddress = vkGetBufferDeviceAddress(m_device, &_b1);
 
@@ -486,12 +541,21 @@ BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
     VkDeviceAddress indexAddress  = vkGetBufferDeviceAddress(m_device, &_b2);
 
     uint32_t maxPrimitiveCount = model.nbIndices / 3;
+    uint32_t primitiveOffset = 0;  // In bytes
+    if (level != 0) {
+        const ObjLod& lod = model.lods[level-1];
+        maxPrimitiveCount = lod.nbIndices / 3;
+        primitiveOffset = lod.firstIndex * sizeof(uint32_t); }
 
-    // Describe buffer as array of Vertex.
+    // Describe buffer as array of Vertex (or of vec3 positions).
     VkAccelerationStructureGeometryTrianglesDataKHR triangles{VK_STRUCTURE_TYPE_ACCELERATION_STRUCTURE_GEOMETRY_TRIANGLES_DATA_KHR};
     triangles.vertexFormat             = VK_FORMAT_R32G32B32_SFLOAT;  // vec3 vertex position data.
     triangles.vertexData.deviceAddress = vertexAddress;
+#ifdef COMPACT_VERTICES
+    triangles.vertexStride             = sizeof(vec3);
+#else
     triangles.vertexStride             = sizeof(Vertex);
+#endif
     // Describe index data (32-bit unsigned int)
     triangles.indexType               = VK_INDEX_TYPE_UINT32;
     triangles.indexData.deviceAddress = indexAddress;
@@ -507,7 +571,7 @@ BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
     VkAccelerationStructureBuildRangeInfoKHR offset;
     offset.firstVertex     = 0;
     offset.primitiveCount  = maxPrimitiveCount;
-    offset.primitiveOffset = 0;
+    offset.primitiveOffset = primitiveOffset;
     offset.transformOffset = 0;
 
     // Our blas is made from only one geometry, but could be made of many geometries
@@ -519,23 +583,85 @@ BlasInput VkApp::objectToVkGeometryKHR(const ObjData& model)
     return input;
 }
 
+// Summary of the BLAS's built for the scene: totals, and the few
+// slowest to build.  Compare runs with and without SPLIT_MESHES to
+// weigh many small BLAS's against one large one, and with and without
+// INSTANCE_MESHES for the build time saved by instancing.
+static void printBlasStats(const std::vector<BlasStats>& stats, double wallMs)
+{
+    uint64_t triangles = 0;
+    VkDeviceSize bytes = 0;
+    double gpuMs = 0.0;
+    for (const auto& s : stats) {
+        triangles += s.nbTriangles;
+        bytes += s.size;
+        gpuMs += s.buildMs; }
+
+    printf("\nBLAS statistics: %zd BLAS's, %llu triangles, %.2f MB\n", stats.size(),
+           (unsigned long long)triangles, bytes/(1024.0*1024.0));
+    printf("  build: %.2f ms GPU, %.2f ms wall (incl. allocation and submits)\n", gpuMs, wallMs);
+
+    std::vector<uint32_t> order(stats.size());
+    std::iota(order.begin(), order.end(), 0);
+    std::sort(order.begin(), order.end(), [&](uint32_t a, uint32_t b) {
+        return stats[a].buildMs > stats[b].buildMs; });
+    order.resize(std::min<size_t>(order.size(), 10));
+    printf("  %8s %10s %10s %10s\n", "object", "triangles", "KB", "build ms");
+    for (uint32_t i : order)
+        printf("  %8u %10u %10.1f %10.3f\n", i, stats[i].nbTriangles,
+               stats[i].size/1024.0, stats[i].buildMs);
+}
+
 void VkApp::createRtAccelerationStructure()
 {
     printf("\nVkApp::createRtAccelerationStructure\n");
+    double blasMs = createBottomLevelAS(0);
+    createLodBlas();
+    createTopLevelAS();
+    printBlasStats(m_rtBuilder.getBlasStats(), blasMs);
+    printf("  TLAS: %zd instances of %zd BLAS's\n", m_objInst.size(), m_objData.size());
+    printf("\nEnd of VkApp::createRtAccelerationStructure\n\n");
+
+    // @@ Destroy all the acceleration structure parts with m_rtBuilder.destroy()
+}
+
+// Builds the BLAS's of objects firstObject onward (appended to those
+// already built), and returns the wall time taken.
+double VkApp::createBottomLevelAS(size_t firstObject)
+{
     // BLAS - Storing each primitive in a geometry
     std::vector<BlasInput> allBlas;
-    allBlas.reserve(m_objData.size());
-    printf("\n  Build vector<BlasInput> for list of objects (of length %ld).\n", m_objData.size());
-    for (const auto& obj : m_objData)  {
+    allBlas.reserve(m_objData.size() - firstObject);
+    printf("\n  Build vector<BlasInput> for list of objects (of length %ld).\n",
+           m_objData.size() - firstObject);
+    for (size_t i = firstObject;  i < m_objData.size();  i++)  {
         printf("    Call VkApp::objectToVkGeometryKHR to return a BlasInput entry.\n");
-        BlasInput blas = objectToVkGeometryKHR(obj);
+        BlasInput blas = objectToVkGeometryKHR(m_objData[i]);
         allBlas.emplace_back(blas); }
 
     printf("\n  Call buildBlas to build vector<AccelWrap> m_blas\n");
     printf("                    from vector<BlasInput>\n");
-    m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    auto blasStart = std::chrono::steady_clock::now();
+    if (!allBlas.empty())
+        m_rtBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    m_scratch1.destroy(m_device);
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - blasStart).count();
+}
+
+// (Re)builds the TLAS from all of m_objInst.  A TLAS is rebuilt
+// rather than refit when objects come or go, as refitting cannot
+// change its number of instances.
+//
+// With m_rtLod (MESH_LODS), each instance appears twice: with mask
+// 0x01 at full detail, for camera rays, and with mask 0x02 at level
+// m_rtLod, for secondary rays.  The second copies follow all of the
+// first, with ObjDesc's numbered by objectDescriptions, and
+// instanceTransforms repeats the transforms to match.
+void VkApp::createTopLevelAS()
+{
+    m_rtBuilder.destroyTlas();
 
-    // TLAS
     printf("\n  Create vector<VkAccelerationStructureInstanceKHR> tlas to hold all BLASes\n");
     std::vector<VkAccelerationStructureInstanceKHR> tlas;
     tlas.reserve(m_objInst.size());
@@ -546,20 +672,26 @@ void VkApp::createRtAccelerationStructure()
         _i.instanceCustomIndex = inst.objIndex; 
         _i.accelerationStructureReference = m_rtBuilder.getBlasDeviceAddress(inst.objIndex);
         _i.flags = VK_GEOMETRY_INSTANCE_TRIANGLE_FACING_CULL_DISABLE_BIT_KHR;
-        _i.mask  = 0xFF;       //  Only be hit if rayMask & instance.mask != 0
+        _i.mask  = m_rtLod ? 0x01 : 0xFF; //  Only be hit if rayMask & instance.mask != 0
         _i.instanceShaderBindingTableRecordOffset = 0; // Use the same hit group for all objects
         printf("    append object's BLAS-address and transformation to the tlas vector\n");
         tlas.emplace_back(_i);
     }
+    for (size_t i = 0;  m_rtLod != 0 && i < m_objInst.size();  i++) {
+        const ObjInst& inst = m_objInst[i];
+        const ObjData& object = m_objData[inst.objIndex];
+        VkAccelerationStructureInstanceKHR _i = tlas[i];
+        _i.mask = 0x02;
+        if (m_lodBlas[inst.objIndex] != ~0u) {
+            uint32_t level = std::min<uint32_t>(m_rtLod, uint32_t(object.lods.size()));
+            _i.instanceCustomIndex = object.lodDesc + level - 1;
+            _i.accelerationStructureReference = m_lodBuilder.getBlasDeviceAddress(m_lodBlas[inst.objIndex]); }
+        tlas.push_back(_i); }
     
     printf("\n  Call buildTlas with a list of BLAS instances\n");
     m_rtBuilder.buildTlas(tlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR,
                           false, false);
-    m_scratch1.destroy(m_device);
     m_scratch2.destroy(m_device);
-    printf("\nEnd of VkApp::createRtAccelerationStructure\n\n");
-
-    // @@ Destroy all the acceleration structure parts with m_rtBuilder.destroy()
 }
 
 
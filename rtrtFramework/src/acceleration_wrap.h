@@ -55,6 +55,14 @@ struct BlasInput
 };
 
 
+// Numbers gathered for each BLAS by buildBlas.
+struct BlasStats
+{
+    uint32_t     nbTriangles{0};
+    VkDeviceSize size{0};       // Bytes of the acceleration structure
+    double       buildMs{0.0};  // GPU time taken by its build
+};
+
 // Ray tracing BLAS and TLAS builder
 class RaytracingBuilderKHR
 {
@@ -72,11 +80,20 @@ public:
     // Return the Acceleration Structure Device Address of a BLAS Id
     VkDeviceAddress getBlasDeviceAddress(uint32_t blasId);
 
+    // Sizes and build times of all BLAS's, indexed like m_blas.
+    const std::vector<BlasStats>& getBlasStats() const { return m_blasStats; }
+
     // Create all the BLAS from the vector of BlasInput
     void buildBlas(const std::vector<BlasInput>&        input,
                    VkBuildAccelerationStructureFlagsKHR flags
                        = VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
 
+    // Destroy BLAS's first ... first+count-1; later ones move down.
+    void removeBlas(uint32_t first, uint32_t count);
+
+    // Destroy the TLAS so buildTlas can make a new one.
+    void destroyTlas();
+
     // Refit BLAS number blasIdx from updated buffer contents.
     void updateBlas(uint32_t blasIdx, BlasInput& blas, VkBuildAccelerationStructureFlagsKHR flags);
 
@@ -103,7 +120,8 @@ public:
 
 protected:
     std::vector<AccelWrap> m_blas;  // Bottom-level acceleration structure
-    AccelWrap              m_tlas;  // Top-level acceleration structure
+    std::vector<BlasStats> m_blasStats;
+    AccelWrap              m_tlas{};  // Top-level acceleration structure
     
     // Setup
     VkDevice                 m_device{VK_NULL_HANDLE};
@@ -125,7 +143,8 @@ protected:
                        std::vector<uint32_t>                    indices,
                        std::vector<BuildAccelerationStructure>& buildAs,
                        VkDeviceAddress                          scratchAddress,
-                       VkQueryPool                              queryPool);
+                       VkQueryPool                              queryPool,
+                       VkQueryPool                              timePool);
     void cmdCompactBlas(VkCommandBuffer cmdBuf, std::vector<uint32_t> indices,
                         std::vector<BuildAccelerationStructure>& buildAs, VkQueryPool queryPool);
     void destroyNonCompacted(std::vector<uint32_t> indices,
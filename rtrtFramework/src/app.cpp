@@ -4,6 +4,7 @@
 #include "vkapp.h"
 #include "app.h"
 #include "extensions_vk.hpp"
+#include "model_data.h"
 
 // GLFW Callback functions
 static void onErrorCallback(int error, const char* description)
@@ -25,10 +26,62 @@ void drawGUI(VkApp& VK)
     //ImGui::TextWrapped(VK.m_console_out.c_str());
     //VK.m_console_out.clear();
     // An example check box:
+    if (VK.useRaytracer)
+        ImGui::Text("Trace %.3f ms (%zd objects)", VK.m_traceMs, VK.m_objInst.size());
+    // Background loading progress (ASYNC_LOAD) and its timings.
+    if (VK.m_loadStage == VkApp::LoadStage::Geometry)
+        ImGui::Text("Loading model ...");
+    else if (VK.m_loadStage == VkApp::LoadStage::Textures)
+        ImGui::Text("Loading textures ...");
+    ImGui::Text("First frame %.1f ms, full scene %.1f ms", VK.m_firstFrameMs, VK.m_fullSceneMs);
     ImGui::Checkbox("Ray Tracer mode", &VK.useRaytracer);
     ImGui::Checkbox("Explicit mode", &VK.m_pcRay.explicitMode);
     ImGui::Checkbox("Denoise", &VK.useDenoiser);
 
+    // GPU memory by category, as counted by MemoryStats.
+    const MemoryStats& mem = MemoryStats::global();
+    if (ImGui::CollapsingHeader("GPU memory")) {
+        for (int c=0;  c<int(MemCategory::Count);  c++)
+            if (mem.count(MemCategory(c)) != 0)
+                ImGui::Text("%-15s %9.2f MB", memCategoryName(MemCategory(c)),
+                            mem.bytes(MemCategory(c))/(1024.0*1024.0));
+        ImGui::Text("%-15s %9.2f MB", "total", mem.total()/(1024.0*1024.0));
+        bool mipsDropped = false;
+        for (const auto& model : VK.m_sceneModels)
+            mipsDropped |= model.textureMipDrop != 0;
+        if (mem.budget() != 0)
+            ImGui::Text("%-15s %9.2f MB%s", "budget", mem.budget()/(1024.0*1024.0),
+                        mipsDropped ? " (texture mips dropped)" : ""); }
+
+    // The scene's models; each can be removed while the app runs.
+    if (ImGui::CollapsingHeader("Scene")) {
+        for (size_t m=0;  m<VK.m_sceneModels.size();  m++) {
+            const VkApp::SceneModel& model = VK.m_sceneModels[m];
+            ImGui::Text("%s: %zd objects, %zd instances", model.filename.c_str(),
+                        model.nbObjects, model.nbInstances);
+            ImGui::SameLine();
+            ImGui::PushID(int(m));
+            bool remove = VK.m_loadStage == VkApp::LoadStage::Done && ImGui::SmallButton("Remove");
+            ImGui::PopID();
+            if (remove) {
+                VK.removeModel(m);
+                break; } }
+        const VkApp::SceneEditTiming& t = VK.m_lastEdit;
+        if (t.totalMs != 0.0)
+            ImGui::Text("Last add: %.2f ms (read %.2f, upload %.2f, BLAS %.2f, TLAS %.2f, desc %.2f)",
+                        t.totalMs, t.readMs, t.uploadMs, t.blasMs, t.tlasMs, t.descMs); }
+
+    // Levels of detail (MESH_LODS): compare triangle counts and frame
+    // times across settings.
+    if (VK.m_lodLevels > 1 && ImGui::CollapsingHeader("Levels of detail")) {
+        ImGui::Text("Raster: %llu triangles drawn; frame %.2f ms",
+                    (unsigned long long)VK.m_drawnTriangles, 1000.0f/ImGui::GetIO().Framerate);
+        ImGui::SliderFloat("LOD pixel error", &VK.m_lodPixelError, 0.0f, 8.0f, "%.2f");
+        int rtLod = int(VK.m_rtLod);
+        if (ImGui::SliderInt("Secondary ray LOD", &rtLod, 0, int(VK.m_lodLevels)-1)
+            && VK.m_loadStage == VkApp::LoadStage::Done)
+            VK.setRtLod(uint32_t(rtLod)); }
+
     // An example slider:
     if (ImGui::SliderFloat("Exposure", &VK.m_pcRay.exposure, 0.5f, 8.0f, "%.5f"))
        VK.m_pcRay.clear = true;
@@ -179,6 +232,14 @@ App::App(int argc, char** argv)
         std::string arg = argv[argi++];
         if (arg == "-d")
             doApiDump = true;
+        else if (arg == "-bench" && argi<argc)
+            exit(runLoaderBenchmarks(argv[argi++]));
+        else if (arg == "-budget" && argi<argc)
+            memoryBudgetMB = atof(argv[argi++]);
+        else if (arg == "-budget-strict")
+            strictBudget = true;
+        else if (arg == "-add" && argi<argc)
+            addModels.push_back(argv[argi++]);
         else {
             printf("Unknown argument: %s\n", arg.c_str());
             exit(-1); } }
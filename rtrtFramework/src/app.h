@@ -1,3 +1,5 @@
+#include <string>
+#include <vector>
 
 #include "camera.h"
 
@@ -7,6 +9,9 @@ public:
     GLFWwindow* GLFW_window;
     App(int argc, char** argv);
     bool doApiDump;
+    double memoryBudgetMB{0};   // -budget MB: GPU memory budget (0: none)
+    bool strictBudget{false};   // -budget-strict: exceeding the budget is fatal
+    std::vector<std::string> addModels;  // -add file: models added once the scene is loaded
     
     bool m_show_gui = true;
     Camera myCamera;
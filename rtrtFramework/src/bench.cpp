@@ -0,0 +1,1858 @@
+//////////////////////////////////////////////////////////////////////
+// Loader timing runs.  These need no GPU; they are selected with
+//   rtrt.exe -bench models/living_room/living_room.obj
+// and print their results before exiting.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <random>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "model_data.h"
+#include "vertex_compress.h"
+#include "vertex_transform.h"
+#include "light_sampling.h"
+#include "material_table.h"
+#include "morton_sort.h"
+#include "mesh_optimize.h"
+#include "texture_decode.h"
+#include "mip_builder.h"
+#include "block_compress.h"
+#include "texture_registry.h"
+#include "virtual_texture.h"
+#include "texture_atlas.h"
+
+// Milliseconds taken by one call of f.
+static double timeMs(const std::function<void()>& f)
+{
+    auto start = std::chrono::steady_clock::now();
+    f();
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+// The same bytes in two arrays (the scene cache stores the structures
+// as they are, padding included).
+template <typename T>
+static bool sameBytes(const std::vector<T>& a, const std::vector<T>& b)
+{
+    return a.size() == b.size()
+        && (a.empty() || memcmp(a.data(), b.data(), sizeof(T)*a.size()) == 0);
+}
+
+// Cold path (the OBJ reader or Assimp, as on a first run) against
+// warm path (the binary scene cache), without and with the sky light
+// option.  The cache is written to a temporary file, not next to the
+// model, so the renderer's own cache is left alone.  The sky light
+// must add its two emitting triangles, survive the round trip, and
+// make the cache unusable without the option.
+static bool benchSceneCache(const std::string& modelPath)
+{
+    printf("\n== Scene cache: %s\n", modelPath.c_str());
+
+    std::error_code ec;
+    std::string cacheFile = (fs::temp_directory_path(ec) / "rtrt_bench.rtcache").string();
+    size_t plainEmitters = 0;
+    bool ok = true;
+    for (bool skyLight : {false, true}) {
+        ModelData cold;
+        cold.skyLight = skyLight;
+        const char* reader = "";
+        double coldMs = timeMs([&]() { ok = cold.readModelFile(modelPath, &reader); });
+        if (!ok) return true;  // No model to time
+
+        double writeMs = timeMs([&]() { ok = writeSceneCache(modelPath, cold, cacheFile); });
+        if (!ok) {
+            printf("Scene cache could not be written\n");
+            return false; }
+
+        ModelData warm, other;
+        warm.skyLight = skyLight;
+        other.skyLight = !skyLight;
+        double warmMs = timeMs([&]() { ok = readSceneCache(modelPath, warm, cacheFile); });
+        bool otherRead = readSceneCache(modelPath, other, cacheFile);
+        fs::remove(cacheFile, ec);
+        if (!ok) {
+            printf("Scene cache could not be read back\n");
+            return false; }
+
+        bool same = sameBytes(warm.vertices, cold.vertices)
+            && warm.indices == cold.indices
+            && sameBytes(warm.materials, cold.materials)
+            && warm.matIndx == cold.matIndx
+            && warm.textures == cold.textures
+            && sameBytes(warm.emitters, cold.emitters)
+            && sameBytes(warm.meshRanges, cold.meshRanges)
+            && sameBytes(warm.meshInstances, cold.meshInstances)
+            && warm.lodIndices == cold.lodIndices
+            && warm.lodMatIndx == cold.lodMatIndx
+            && sameBytes(warm.meshLods, cold.meshLods)
+            && cold.skyLight == skyLight && warm.skyLight == skyLight;
+        bool skyOk = true;
+        if (skyLight) skyOk = cold.emitters.size() == plainEmitters + 2;
+        else plainEmitters = cold.emitters.size();
+
+        printf("  %s\n", skyLight ? "with the sky light" : "without the sky light");
+        printf("    cold read:          %9.1f ms   (%s)\n", coldMs, reader);
+        printf("    cache write:        %9.1f ms\n", writeMs);
+        printf("    warm (scene cache): %9.1f ms   %.1fx faster\n", warmMs, coldMs/warmMs);
+        printf("    contents match:     %s\n", same ? "yes" : "NO");
+        printf("    emitters:           %zd%s\n", cold.emitters.size(), skyOk ? "" : "  (NO SKY LIGHT)");
+        printf("    read with skyLight=%d: %s\n", int(!skyLight), otherRead ? "ACCEPTED" : "rejected");
+        ok = same && skyOk && !otherRead;
+        if (!ok) return false; }
+    return true;
+}
+
+// Writes a one triangle OBJ whose mtllib names mtlName, and that
+// material library, giving the material color kd.
+static bool writeKeyObj(const std::string& objPath, const std::string& mtlName, float kd)
+{
+    FILE* f = fopen(objPath.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "mtllib %s\nv 0 0 0\nv 1 0 0\nv 0 1 0\nusemtl paint\nf 1 2 3\n", mtlName.c_str());
+    bool ok = fclose(f) == 0;
+    fs::path mtlPath = objPath;
+    mtlPath.replace_filename(mtlName);
+    f = fopen(mtlPath.string().c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "newmtl paint\nKd %.1f 0.5 0.5\n", kd);
+    return fclose(f) == 0 && ok;
+}
+
+// The scene cache must go out of date when a material library the
+// OBJ names (not one named after the OBJ) changes.
+static bool benchSceneCacheKey()
+{
+    printf("\n== Scene cache key: an OBJ's mtllib\n");
+    fs::path dir = fs::temp_directory_path();
+    std::string objPath = (dir / "rtrt_bench_key.obj").string();
+    std::string cacheFile = (dir / "rtrt_bench_key.rtcache").string();
+    const std::string mtlName = "rtrt_bench_key_paint.mtl";
+
+    ModelData md, warm, changed;
+    bool ok = writeKeyObj(objPath, mtlName, 0.2f) && md.readModelFile(objPath)
+        && writeSceneCache(objPath, md, cacheFile);
+    bool hit = ok && readSceneCache(objPath, warm, cacheFile);
+    ok &= writeKeyObj(objPath, mtlName, 0.8f);
+    bool stale = ok && !readSceneCache(objPath, changed, cacheFile);
+
+    std::error_code ec;
+    fs::remove(objPath, ec);
+    fs::remove(dir / mtlName, ec);
+    fs::remove(cacheFile, ec);
+    printf("  cache used while the library is unchanged: %s\n", hit ? "yes" : "NO");
+    printf("  cache out of date once it changes:         %s\n", stale ? "yes" : "NO");
+    return ok && hit && stale;
+}
+
+// The model as the renderer would load it: from the scene cache if possible.
+static bool loadForBench(const std::string& modelPath, ModelData& md)
+{
+    return readSceneCache(modelPath, md) || md.readModelFile(modelPath);
+}
+
+// Round trips of the CompactVertex encoders, over the model's own
+// vertices and over random and axis aligned normals, checked against
+// the error bounds in vertex_compress.h.  Returns false on failure.
+static bool benchCompactVertices(const std::string& modelPath)
+{
+    printf("\n== Compact vertices\n");
+
+    std::vector<Vertex> vertices;
+    ModelData md;
+    if (loadForBench(modelPath, md))
+        vertices = md.vertices;
+    size_t modelCount = vertices.size();
+
+    std::mt19937 rng(1234);
+    std::normal_distribution<float> gauss;
+    std::uniform_real_distribution<float> uniform(-64.0f, 64.0f);
+    for (int i=0;  i<1000000;  i++) {
+        glm::vec3 n(gauss(rng), gauss(rng), gauss(rng));
+        vertices.push_back({n, n, glm::vec2(uniform(rng), uniform(rng)/64.0f)}); }
+    for (int a=0;  a<3;  a++)
+        for (float s : {-1.0f, 1.0f}) {
+            glm::vec3 n(0.0f);
+            n[a] = s;
+            vertices.push_back({n, n, glm::vec2(s, 0.0f)}); }
+
+    std::vector<glm::vec3> positions;
+    std::vector<CompactVertex> attributes;
+    CompactErrors err;
+    double ms = timeMs([&]() { err = compactVertices(vertices, positions, attributes); });
+
+    bool ok = err.normal <= octNormalMaxError && err.texCoord <= texCoordMaxRelError;
+    printf("  %zd model + %zd synthetic vertices in %.1f ms\n",
+           modelCount, vertices.size()-modelCount, ms);
+    printf("  bytes per vertex:   %zd -> %zd (+%zd for the position stream)\n",
+           sizeof(Vertex), sizeof(CompactVertex), sizeof(glm::vec3));
+    printf("  max normal error:   %.3g deg  (bound %.3g)\n",
+           glm::degrees(err.normal), glm::degrees(octNormalMaxError));
+    printf("  max texCoord error: %.3g rel  (bound %.3g)\n", err.texCoord, texCoordMaxRelError);
+    if (err.texCoordClamped)
+        printf("  %zd texCoords beyond the half float range\n", err.texCoordClamped);
+    printf("  within bounds:      %s\n", ok ? "yes" : "NO");
+    return ok;
+}
+
+// Largest angle between two directions, in radians.
+static double angleBetween(const glm::dvec3& a, const glm::dvec3& b)
+{
+    return atan2(glm::length(glm::cross(a, b)), glm::dot(a, b));
+}
+
+// One ray hit: a triangle and the barycentric coordinates in it.
+struct BenchHit
+{
+    uint32_t  primitive;
+    glm::vec3 bc;
+};
+
+// Distinct 64 byte cache lines covered by a set of reads.  Each read
+// is a buffer (its base taken to be line aligned), an offset and a size.
+struct CacheLineCounter
+{
+    std::vector<uint64_t> lines;
+    size_t bytes{0};
+
+    void read(int buffer, size_t offset, size_t size) {
+        bytes += size;
+        for (size_t l = offset/64;  l <= (offset+size-1)/64;  l++) {
+            uint64_t line = (uint64_t(buffer) << 48) | l;
+            if (std::find(lines.begin(), lines.end(), line) == lines.end())
+                lines.push_back(line); } }
+};
+
+// A jittered n by n grid of vertices with random normals and texture
+// coordinates, two triangles per quad, as a stand-in model.
+static void makeBenchMesh(int n, std::mt19937& rng, ModelData& md)
+{
+    std::normal_distribution<float> gauss;
+    std::uniform_real_distribution<float> uniform(0.0f, 4.0f);
+    for (int y=0;  y<n;  y++)
+        for (int x=0;  x<n;  x++)
+            md.vertices.push_back({glm::vec3(x, y, 0.1f*gauss(rng)),
+                                   glm::vec3(0.2f*gauss(rng), 0.2f*gauss(rng), 1.0f),
+                                   glm::vec2(uniform(rng), uniform(rng))});
+    for (int y=0;  y<n-1;  y++)
+        for (int x=0;  x<n-1;  x++) {
+            uint32_t a = y*n + x;
+            for (uint32_t i : {a, a+1, a+n+1, a, a+n+1, a+uint32_t(n)})
+                md.indices.push_back(i);
+            md.matIndx.push_back(x&3);
+            md.matIndx.push_back(y&3); }
+    md.materials.resize(4);
+}
+
+// What GetHitObjectData reads for a hit with and without HIT_RECORDS:
+// the bytes and cache lines per hit, and the time a CPU emulation of
+// each takes over random hits.  The record path's normals and texture
+// coordinates must equal the COMPACT_VERTICES path's exactly.  Returns
+// false if they do not, or if an encoded geometric normal is off by
+// more than octNormalMaxError.
+static bool benchHitRecords(const std::string& modelPath)
+{
+    std::mt19937 rng(4321);
+    ModelData md;
+    if (!loadForBench(modelPath, md) || md.matIndx.empty()) {
+        md = ModelData();
+        makeBenchMesh(1024, rng, md); }
+    printf("\n== Hit records: %zd triangles\n", md.matIndx.size());
+
+    std::vector<HitRecord> records;
+    double buildMs = timeMs([&]() { buildHitRecords(md.vertices, md.indices, md.matIndx, records); });
+    std::vector<glm::vec3> positions;
+    std::vector<CompactVertex> compact;
+    compactVertices(md.vertices, positions, compact);
+    if (md.materials.empty()) md.materials.resize(1);
+
+    const size_t nbHits = 1<<20;
+    std::vector<BenchHit> hits(nbHits);
+    std::uniform_int_distribution<uint32_t> pickTriangle(0, uint32_t(records.size()-1));
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    for (BenchHit& h : hits) {
+        float u = unit(rng), v = unit(rng);
+        if (u+v > 1.0f) { u = 1.0f-u;  v = 1.0f-v; }
+        h = {pickTriangle(rng), glm::vec3(1.0f-u-v, u, v)}; }
+
+    // Bytes and lines per hit, for the reads of each path.  Buffers:
+    // 0 ObjDesc, 1 indices, 2 matIndx, 3 materials, 4 vertices, 5 records.
+    enum Path { FullVertex, Compact, Records };
+    const char* pathNames[] = {"Vertex", "CompactVertex", "HitRecord"};
+    double bytes[3] = {0}, lines[3] = {0};
+    const size_t sampled = 1<<16;
+    for (size_t k=0;  k<sampled;  k++) {
+        const BenchHit& h = hits[k];
+        const uint32_t* ind = &md.indices[3*size_t(h.primitive)];
+        for (int path : {FullVertex, Compact, Records}) {
+            CacheLineCounter c;
+            c.read(0, 0, sizeof(ObjDesc));
+            int matIdx = md.matIndx[h.primitive];
+            if (path == Records)
+                c.read(5, sizeof(HitRecord)*h.primitive, sizeof(HitRecord));
+            else {
+                size_t vertexSize = path == FullVertex ? sizeof(Vertex) : sizeof(CompactVertex);
+                c.read(1, 3*sizeof(uint32_t)*h.primitive, 3*sizeof(uint32_t));
+                c.read(2, sizeof(int32_t)*h.primitive, sizeof(int32_t));
+                for (int i=0;  i<3;  i++)
+                    c.read(4, vertexSize*ind[i], vertexSize); }
+            c.read(3, sizeof(Material)*matIdx, sizeof(Material));
+            bytes[path] += c.bytes;
+            lines[path] += c.lines.size(); } }
+
+    // The shading data each path decodes, as the shader would.
+    auto viaCompact = [&](const BenchHit& h, glm::vec3& nrm, glm::vec2& uv) {
+        const uint32_t* ind = &md.indices[3*size_t(h.primitive)];
+        Material mat = md.materials[md.matIndx[h.primitive]];
+        CompactVertex v0 = compact[ind[0]], v1 = compact[ind[1]], v2 = compact[ind[2]];
+        nrm = h.bc.x*octDecodeNormal(v0.nrm) + h.bc.y*octDecodeNormal(v1.nrm) + h.bc.z*octDecodeNormal(v2.nrm);
+        uv = h.bc.x*decodeTexCoord(v0.texCoord) + h.bc.y*decodeTexCoord(v1.texCoord)
+           + h.bc.z*decodeTexCoord(v2.texCoord);
+        return mat.textureId; };
+    auto viaVertex = [&](const BenchHit& h, glm::vec3& nrm, glm::vec2& uv) {
+        const uint32_t* ind = &md.indices[3*size_t(h.primitive)];
+        Material mat = md.materials[md.matIndx[h.primitive]];
+        const Vertex& v0 = md.vertices[ind[0]];
+        const Vertex& v1 = md.vertices[ind[1]];
+        const Vertex& v2 = md.vertices[ind[2]];
+        nrm = h.bc.x*v0.nrm + h.bc.y*v1.nrm + h.bc.z*v2.nrm;
+        uv = h.bc.x*v0.texCoord + h.bc.y*v1.texCoord + h.bc.z*v2.texCoord;
+        return mat.textureId; };
+    auto viaRecord = [&](const BenchHit& h, glm::vec3& nrm, glm::vec2& uv) {
+        HitRecord rec = records[h.primitive];
+        Material mat = md.materials[rec.matIndex];
+        nrm = h.bc.x*octDecodeNormal(rec.nrm[0]) + h.bc.y*octDecodeNormal(rec.nrm[1])
+            + h.bc.z*octDecodeNormal(rec.nrm[2]);
+        uv = h.bc.x*decodeTexCoord(rec.texCoord[0]) + h.bc.y*decodeTexCoord(rec.texCoord[1])
+           + h.bc.z*decodeTexCoord(rec.texCoord[2]);
+        return mat.textureId; };
+
+    double ns[3];
+    volatile float sink = 0.0f;  // Keeps the fetches from being optimized away
+    const std::function<int(const BenchHit&, glm::vec3&, glm::vec2&)> fetches[3] = {viaVertex, viaCompact, viaRecord};
+    for (int path : {FullVertex, Compact, Records}) {
+        double ms = timeMs([&]() {
+            float sum = 0.0f;
+            for (const BenchHit& h : hits) {
+                glm::vec3 nrm;
+                glm::vec2 uv;
+                sum += float(fetches[path](h, nrm, uv)) + nrm.x + uv.y; }
+            sink = sum; });
+        ns[path] = 1e6*ms/nbHits; }
+
+    size_t mismatches = 0;
+    for (const BenchHit& h : hits) {
+        glm::vec3 n0, n1;
+        glm::vec2 uv0, uv1;
+        viaCompact(h, n0, uv0);
+        viaRecord(h, n1, uv1);
+        if (n0 != n1 || uv0 != uv1 || md.matIndx[h.primitive] != records[h.primitive].matIndex)
+            mismatches++; }
+
+    double geomErr = 0.0;
+    for (size_t t=0;  t<records.size();  t++) {
+        glm::dvec3 a(md.vertices[md.indices[3*t]].pos), b(md.vertices[md.indices[3*t+1]].pos),
+                   c(md.vertices[md.indices[3*t+2]].pos);
+        glm::dvec3 n = glm::cross(b-a, c-a);
+        if (glm::length(n) > 0.0)
+            geomErr = std::max(geomErr, angleBetween(glm::dvec3(octDecodeNormal(records[t].geomNormal)), n)); }
+
+    bool ok = mismatches == 0 && geomErr <= octNormalMaxError + 1e-6;
+    printf("  records built in %.1f ms; %zd bytes per triangle (%.1f MB)\n", buildMs,
+           sizeof(HitRecord), sizeof(HitRecord)*records.size()/(1024.0*1024.0));
+    printf("  %-14s %12s %12s %10s\n", "per hit", "bytes read", "cache lines", "ns (CPU)");
+    for (int path : {FullVertex, Compact, Records})
+        printf("  %-14s %12.1f %12.2f %10.1f\n", pathNames[path],
+               bytes[path]/sampled, lines[path]/sampled, ns[path]);
+    printf("  (each includes the %zd byte ObjDesc and %zd byte Material)\n", sizeof(ObjDesc), sizeof(Material));
+    printf("  same shading data as CompactVertex: %s (%zd mismatches)\n",
+           mismatches == 0 ? "yes" : "NO", mismatches);
+    printf("  max geometric normal error: %.3g deg  (bound %.3g)\n",
+           glm::degrees(geomErr), glm::degrees(octNormalMaxError));
+    return ok;
+}
+
+// ModelData::dedupMaterials on one model, and the packed material
+// indices it allows.  Every triangle must keep a byte-identical
+// material, no two materials may remain identical, and the packed
+// indices must unpack to the same values.  Returns false if not.
+static bool checkMaterialTable(const char* name, ModelData& md)
+{
+    ModelData before;
+    before.materials = md.materials;
+    before.matIndx = md.matIndx;
+    double ms = timeMs([&]() { md.dedupMaterials(); });
+
+    size_t changed = 0, duplicates = 0;
+    for (size_t t=0;  t<md.matIndx.size();  t++)
+        if (memcmp(&before.materials[before.matIndx[t]], &md.materials[md.matIndx[t]], sizeof(Material)) != 0)
+            changed++;
+    for (size_t a=0;  a<md.materials.size();  a++)
+        for (size_t b=a+1;  b<md.materials.size();  b++)
+            if (memcmp(&md.materials[a], &md.materials[b], sizeof(Material)) == 0)
+                duplicates++;
+
+    uint32_t bits = materialIndexBits(md.materials.size());
+    std::vector<uint32_t> packed = packMaterialIndices(md.matIndx.data(), md.matIndx.size(), bits);
+    size_t unpackErrors = 0;
+    for (size_t t=0;  t<md.matIndx.size();  t++)
+        if (unpackMaterialIndex(packed.data(), t, bits) != md.matIndx[t])
+            unpackErrors++;
+
+    auto kb = [](size_t bytes) { return bytes/1024.0; };
+    printf("  %s: %zd triangles, merged in %.1f ms\n", name, md.matIndx.size(), ms);
+    printf("    materials:       %8zd -> %8zd   (%.1f KB -> %.1f KB)\n",
+           before.materials.size(), md.materials.size(),
+           kb(sizeof(Material)*before.materials.size()), kb(sizeof(Material)*md.materials.size()));
+    printf("    material index:  %8d -> %8u bits (%.1f KB -> %.1f KB)\n", 32, bits,
+           kb(sizeof(int32_t)*before.matIndx.size()), kb(sizeof(uint32_t)*packed.size()));
+    bool ok = changed == 0 && duplicates == 0 && unpackErrors == 0;
+    printf("    same material per triangle, no duplicates left, indices unpack: %s\n", ok ? "yes" : "NO");
+    return ok;
+}
+
+static bool benchMaterialTable(const std::string& modelPath)
+{
+    printf("\n== Material table\n");
+    bool ok = true;
+
+    ModelData md;
+    if (md.readObjFile(modelPath, glm::mat4(1.0)) || md.readAssimpFile(modelPath, glm::mat4(1.0)))
+        ok &= checkMaterialTable(modelPath.c_str(), md);
+
+    // 1000 materials, copies of 40 distinct ones, 100 of them unused.
+    std::mt19937 rng(99);
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    std::vector<Material> distinct(40);
+    for (Material& m : distinct)
+        m = {glm::vec3(unit(rng), unit(rng), unit(rng)), glm::vec3(0.04f), glm::vec3(0.0f),
+             unit(rng)*100.0f, int(rng()%3) - 1};
+    ModelData synthetic;
+    for (int i=0;  i<1000;  i++)
+        synthetic.materials.push_back(distinct[rng() % distinct.size()]);
+    for (int t=0;  t<1000000;  t++)
+        synthetic.matIndx.push_back(int32_t(rng() % 900));
+    ok &= checkMaterialTable("synthetic", synthetic);
+    return ok;
+}
+
+// Surface area of the model as placed, counting each instanced mesh
+// once per instance.
+static double placedArea(const ModelData& md)
+{
+    std::vector<uint32_t> starts = md.instanceStarts();
+    double area = 0.0;
+    for (size_t k=0;  k<md.meshRanges.size();  k++) {
+        const MeshRange& r = md.meshRanges[k];
+        for (uint32_t n=0;  n<std::max(r.nbInstances, 1u);  n++) {
+            glm::mat4 M = r.nbInstances ? md.meshInstances[starts[k]+n].transform : glm::mat4(1.0);
+            for (uint32_t i=r.firstIndex;  i<r.firstIndex+r.indexCount;  i += 3) {
+                glm::vec3 a = glm::vec3(M * glm::vec4(md.vertices[md.indices[i+0]].pos, 1.0f));
+                glm::vec3 b = glm::vec3(M * glm::vec4(md.vertices[md.indices[i+1]].pos, 1.0f));
+                glm::vec3 c = glm::vec3(M * glm::vec4(md.vertices[md.indices[i+2]].pos, 1.0f));
+                area += 0.5 * glm::length(glm::cross(b-a, c-a)); } } }
+    return area;
+}
+
+// The model read from Assimp with and without instanceMeshes.  Both
+// must place the same surface and lights.  Returns false if not.
+static bool benchInstancing(const std::string& modelPath)
+{
+    printf("\n== Mesh instancing\n");
+
+    ModelData baked, instanced;
+    instanced.instanceMeshes = true;
+    bool ok = true;
+    double bakedMs = timeMs([&]() {
+        ok &= baked.readAssimpFile(modelPath, glm::mat4(1.0));
+        baked.optimizeMeshes();
+        baked.gatherEmitters(); });
+    double instancedMs = timeMs([&]() {
+        ok &= instanced.readAssimpFile(modelPath, glm::mat4(1.0));
+        instanced.optimizeMeshes();
+        instanced.gatherEmitters(); });
+    if (!ok) return true;
+
+    size_t nbShared = 0;
+    for (const auto& r : instanced.meshRanges)
+        if (r.nbInstances) nbShared++;
+    auto bytes = [](const ModelData& md) {
+        return sizeof(Vertex)*md.vertices.size() + sizeof(uint32_t)*md.indices.size()
+            + sizeof(int32_t)*md.matIndx.size(); };
+
+    double bakedArea = placedArea(baked), instancedArea = placedArea(instanced);
+    bool same = baked.emitters.size() == instanced.emitters.size()
+        && fabs(bakedArea - instancedArea) <= 1e-4*std::max(bakedArea, 1.0);
+
+    printf("  %zd meshes shared by %zd instances\n", nbShared, instanced.meshInstances.size());
+    printf("  %-10s %10s %10s %10s %10s\n", "", "vertices", "triangles", "MB", "load ms");
+    printf("  %-10s %10zd %10zd %10.2f %10.1f\n", "baked", baked.vertices.size(),
+           baked.matIndx.size(), bytes(baked)/(1024.0*1024.0), bakedMs);
+    printf("  %-10s %10zd %10zd %10.2f %10.1f\n", "instanced", instanced.vertices.size(),
+           instanced.matIndx.size(), bytes(instanced)/(1024.0*1024.0), instancedMs);
+    printf("  same surface and lights: %s\n", same ? "yes" : "NO");
+    return same;
+}
+
+// Writes an OBJ of a bumpy n by n grid of quads with no normals,
+// 2(n-1)^2 triangles.
+static bool writeGridObj(const std::string& path, int n)
+{
+    FILE* f = fopen(path.c_str(), "wb");
+    if (!f) return false;
+    fprintf(f, "# %d x %d grid\no grid\n", n, n);
+    for (int y=0;  y<n;  y++)
+        for (int x=0;  x<n;  x++)
+            fprintf(f, "v %.6f %.6f %.6f\n", x*0.01f, y*0.01f, 0.002f*sinf(0.37f*x)*cosf(0.23f*y));
+    for (int y=0;  y<n-1;  y++)
+        for (int x=0;  x<n-1;  x++) {
+            int a = y*n + x + 1;
+            fprintf(f, "f %d %d %d %d\n", a, a+1, a+n+1, a+n); }
+    return fclose(f) == 0;
+}
+
+// The OBJ reader against Assimp on one file.  Returns false if they
+// disagree on the triangles, surface area or materials.
+static bool compareObjReaders(const std::string& path)
+{
+    ModelData native, assimp;
+    bool nativeOk = false, assimpOk = false;
+    double nativeMs = timeMs([&]() { nativeOk = native.readObjFile(path, glm::mat4(1.0)); });
+    double assimpMs = timeMs([&]() { assimpOk = assimp.readAssimpFile(path, glm::mat4(1.0)); });
+    if (!nativeOk || !assimpOk) {
+        printf("  %s could not be read (OBJ reader %s, Assimp %s)\n", path.c_str(),
+               nativeOk ? "ok" : "failed", assimpOk ? "ok" : "failed");
+        return !assimpOk; }
+
+    double nativeArea = placedArea(native), assimpArea = placedArea(assimp);
+    bool same = native.matIndx.size() == assimp.matIndx.size()
+        && native.materials.size() == assimp.materials.size()
+        && native.textures.size() == assimp.textures.size()
+        && fabs(nativeArea - assimpArea) <= 1e-4*std::max(assimpArea, 1.0);
+
+    printf("  %-10s %10s %10s %10s\n", "", "vertices", "triangles", "ms");
+    printf("  %-10s %10zd %10zd %10.1f\n", "Assimp", assimp.vertices.size(), assimp.matIndx.size(), assimpMs);
+    printf("  %-10s %10zd %10zd %10.1f   %.1fx faster\n", "OBJ reader", native.vertices.size(),
+           native.matIndx.size(), nativeMs, assimpMs/nativeMs);
+    printf("  same triangles, area and materials: %s\n", same ? "yes" : "NO");
+    return same;
+}
+
+static bool benchObjReader(const std::string& modelPath)
+{
+    bool ok = true;
+    std::string extension = fs::path(modelPath).extension().string();
+    if (extension == ".obj" || extension == ".OBJ") {
+        printf("\n== OBJ reader: %s\n", modelPath.c_str());
+        ok &= compareObjReaders(modelPath); }
+
+    std::string gridPath = (fs::temp_directory_path() / "rtrt_bench_grid.obj").string();
+    printf("\n== OBJ reader: synthetic 10M triangles\n");
+    double writeMs = timeMs([&]() { ok &= writeGridObj(gridPath, 2237); });
+    printf("  written to %s in %.1f ms\n", gridPath.c_str(), writeMs);
+    ok &= compareObjReaders(gridPath);
+    std::error_code ec;
+    fs::remove(gridPath, ec);
+    return ok;
+}
+
+// The batch vertex transform at each SIMD level against a per-vertex
+// glm loop, on random vertices and tangents perpendicular to their
+// normals, under a rotated, translated and non-uniformly scaled
+// transform and its mirror image.  Each level is timed on separate
+// xyz arrays (as Assimp gives them) and on interleaved Vertex records
+// (as the OBJ reader transforms them, in place).  Every level must
+// match the scalar path exactly, in place too, and a double precision
+// inverse-transpose closely, and must keep tangents perpendicular to
+// normals.  Returns false if not.
+static bool benchVertexTransform()
+{
+    printf("\n== Vertex transform\n");
+
+    const size_t count = 1000000;
+    std::mt19937 rng(4321);
+    std::normal_distribution<float> gauss;
+    std::uniform_real_distribution<float> uniform(-100.0f, 100.0f);
+    std::vector<glm::vec3> positions(count), normals(count), tangents(count);
+    for (size_t i=0;  i<count;  i++) {
+        positions[i] = glm::vec3(uniform(rng), uniform(rng), uniform(rng));
+        normals[i]   = glm::normalize(glm::vec3(gauss(rng), gauss(rng), gauss(rng)));
+        tangents[i]  = glm::normalize(glm::cross(normals[i], glm::vec3(gauss(rng), gauss(rng), gauss(rng)))); }
+    VertexSource source{&positions[0].x, &normals[0].x, &tangents[0].x, 3};
+    std::vector<Vertex> interleaved(count);
+    for (size_t i=0;  i<count;  i++) {
+        interleaved[i].pos = positions[i];
+        interleaved[i].nrm = normals[i];
+        interleaved[i].texCoord = glm::vec2(float(i), 0.5f); }
+    const size_t stride = sizeof(Vertex)/sizeof(float);
+
+    float c = cosf(0.5f), s = sinf(0.5f);
+    glm::mat3 Rz(c, s, 0,  -s, c, 0,  0, 0, 1);
+    glm::mat3 Rx(1, 0, 0,  0, c, s,  0, -s, c);
+    glm::mat4 M(Rx * Rz * glm::mat3(3.0f, 0, 0,  0, 0.5f, 0,  0, 0, 1.2f));
+    M[3] = glm::vec4(10.0f, -4.0f, 7.5f, 1.0f);
+    glm::mat4 mirror(1.0f);
+    mirror[0][0] = -1.0f;
+
+    SimdLevel best = bestSimdLevel();
+    std::vector<SimdLevel> levels = {SimdLevel::Scalar};
+    if (best >= SimdLevel::SSE)  levels.push_back(SimdLevel::SSE);
+    if (best >= SimdLevel::AVX2) levels.push_back(SimdLevel::AVX2);
+
+    // Nanoseconds per vertex, best of several runs, for a batch that
+    // stays in cache and for all the vertices (bound by memory).
+    const size_t cached = 16384;
+    struct Rate { double cached, all; };
+    auto rate = [&](const std::function<void(size_t)>& f) {
+        Rate best{1e30, 1e30};
+        for (int r=0;  r<50;  r++)
+            best.cached = std::min(best.cached, 1e6*timeMs([&]() { f(cached); })/cached);
+        for (int r=0;  r<5;  r++)
+            best.all = std::min(best.all, 1e6*timeMs([&]() { f(count); })/count);
+        return best; };
+
+    bool ok = true;
+    for (const glm::mat4& tr : {M, mirror*M}) {
+        printf("  %s transform, ns per vertex\n", glm::determinant(tr) < 0.0f ? "mirrored" : "plain");
+        printf("    %-18s %8zd %8zd\n", "", cached, count);
+
+        // The per-vertex loop the loader used before, with the upper
+        // 3x3 (not the inverse-transpose) applied to normals, here
+        // renormalized to do the same work as the batch.
+        std::vector<Vertex> naive(count);
+        glm::mat3 upper(tr);
+        Rate naiveRate = rate([&](size_t n) {
+            for (size_t i=0;  i<n;  i++) {
+                naive[i].pos = glm::vec3(tr * glm::vec4(positions[i], 1.0f));
+                naive[i].nrm = glm::normalize(upper * normals[i]); } });
+        printf("    %-18s %8.2f %8.2f\n", "per-vertex glm", naiveRate.cached, naiveRate.all);
+
+        VertexTransform vt(tr);
+        std::vector<Vertex> scalar(count);
+        std::vector<glm::vec3> scalarTangents(count);
+        for (SimdLevel level : levels) {
+            std::vector<Vertex> out(count);
+            std::vector<glm::vec3> outTangents(count);
+            // Timed as the loader calls it, without tangents.
+            Rate r = rate([&](size_t n) { transformVertices(vt, {source.positions, source.normals, nullptr, 3},
+                                                            n, out.data(), nullptr, level); });
+            Rate ri = rate([&](size_t n) { transformVertices(vt, {&interleaved[0].pos.x, &interleaved[0].nrm.x,
+                                                                  nullptr, stride}, n, out.data(), nullptr, level); });
+            std::vector<Vertex> inPlace = interleaved;
+            transformVertices(vt, {&inPlace[0].pos.x, &inPlace[0].nrm.x, nullptr, stride}, count,
+                              inPlace.data(), nullptr, level);
+            transformVertices(vt, source, count, out.data(), outTangents.data(), level);
+            bool same = true;
+            if (level == SimdLevel::Scalar) {
+                scalar = out;
+                scalarTangents = outTangents; }
+            else
+                for (size_t i=0;  i<count && same;  i++)
+                    same = out[i].pos == scalar[i].pos && out[i].nrm == scalar[i].nrm
+                        && outTangents[i] == scalarTangents[i];
+            for (size_t i=0;  i<count && same;  i++)
+                same = inPlace[i].pos == scalar[i].pos && inPlace[i].nrm == scalar[i].nrm
+                    && inPlace[i].texCoord == interleaved[i].texCoord;
+            printf("    %-18s %8.2f %8.2f   %.1fx, %.1fx%s\n", simdLevelName(level), r.cached, r.all,
+                   naiveRate.cached/r.cached, naiveRate.all/r.all, same ? "" : "  DIFFERS FROM SCALAR");
+            printf("    %-18s %8.2f %8.2f   %.1fx, %.1fx\n", "  interleaved", ri.cached, ri.all,
+                   naiveRate.cached/ri.cached, naiveRate.all/ri.all);
+            ok &= same; }
+
+        // Errors of the scalar results against double precision.
+        glm::dmat4 dtr(tr);
+        glm::dmat3 normalTr = glm::transpose(glm::inverse(glm::dmat3(dtr)));
+        double posErr = 0.0, nrmErr = 0.0, tanErr = 0.0, perp = 0.0, naivePerp = 0.0;
+        for (size_t i=0;  i<count;  i++) {
+            glm::dvec3 p = glm::dvec3(dtr * glm::dvec4(glm::dvec3(positions[i]), 1.0));
+            glm::dvec3 n = normalTr * glm::dvec3(normals[i]);
+            glm::dvec3 t = glm::dmat3(dtr) * glm::dvec3(tangents[i]);
+            double scale = glm::length(glm::dvec3(dtr[3])) + 3.0*glm::length(glm::dvec3(positions[i])) + 1.0;
+            posErr = std::max(posErr, glm::length(glm::dvec3(scalar[i].pos) - p)/scale);
+            nrmErr = std::max(nrmErr, angleBetween(glm::dvec3(scalar[i].nrm), n));
+            tanErr = std::max(tanErr, angleBetween(glm::dvec3(scalarTangents[i]), t));
+            perp = std::max(perp, fabs(glm::dot(glm::dvec3(scalar[i].nrm), glm::dvec3(scalarTangents[i]))));
+            glm::dvec3 nn = glm::normalize(glm::dvec3(naive[i].nrm));
+            naivePerp = std::max(naivePerp, fabs(glm::dot(nn, glm::normalize(t)))); }
+        bool accurate = posErr <= 1e-6 && nrmErr <= 1e-5 && tanErr <= 1e-5 && perp <= 1e-5;
+        printf("    max position error:   %.3g rel\n", posErr);
+        printf("    max normal error:     %.3g deg\n", glm::degrees(nrmErr));
+        printf("    max tangent error:    %.3g deg\n", glm::degrees(tanErr));
+        printf("    max |dot(nrm, tan)|:  %.3g  (%.3g with the upper 3x3)\n", perp, naivePerp);
+        printf("    within bounds:        %s\n", accurate ? "yes" : "NO");
+        ok &= accurate; }
+    return ok;
+}
+
+// Largest difference between each emitter's pdf and the probability
+// the alias table actually gives it, relative to the pdf (or to 1/n
+// for powerless emitters), and how far the pdfs' sum is from 1.
+static double aliasTableError(const std::vector<LightAlias>& table)
+{
+    size_t n = table.size();
+    std::vector<double> given(n, 0.0);
+    double sum = 0.0;
+    for (size_t i=0;  i<n;  i++) {
+        given[i] += table[i].prob/n;
+        given[table[i].alias] += (1.0 - table[i].prob)/n;
+        sum += table[i].pdf; }
+    double err = fabs(sum - 1.0);
+    for (size_t i=0;  i<n;  i++)
+        err = std::max(err, fabs(given[i] - table[i].pdf)/std::max(double(table[i].pdf), 1.0/n));
+    return err;
+}
+
+// Picks an emitter index (or -1 for none) and its probability.
+typedef std::function<int(std::mt19937& rng, float& pdf)> LightPicker;
+
+// A picker that does what raytrace.rgen does with the alias table (or
+// uniformly if table is null).
+static LightPicker aliasPicker(const LightAlias* table, size_t n)
+{
+    return [=](std::mt19937& rng, float& pdf) {
+        std::uniform_real_distribution<float> rnd(0.0f, 1.0f);
+        size_t bin = std::min(size_t(rnd(rng)*n), n-1);
+        size_t i = bin;
+        if (table && rnd(rng) >= table[bin].prob) i = table[bin].alias;
+        pdf = table ? table[i].pdf : 1.0f/n;
+        return int(i); };
+}
+
+// Next event estimation as raytrace.rgen does it, for the unoccluded
+// irradiance at point P with normal N: picks an emitter, a point on
+// it, and weighs the light by the pdf.  Returns the estimator's mean
+// and variance.
+static void estimateIrradiance(const std::vector<Emitter>& emitters, const LightPicker& pick,
+                               const glm::vec3& P, const glm::vec3& N, int samples,
+                               double& mean, double& variance)
+{
+    std::mt19937 rng(77);
+    std::uniform_real_distribution<float> rnd(0.0f, 1.0f);
+    double sum = 0.0, sum2 = 0.0;
+    for (int k=0;  k<samples;  k++) {
+        float selectPdf;
+        int i = pick(rng, selectPdf);
+        if (i < 0) continue;
+        const Emitter& e = emitters[i];
+        float a = rnd(rng), b = rnd(rng);
+        if (a + b > 1.0f) {
+            a = 1.0f - a;
+            b = 1.0f - b; }
+        glm::vec3 L = e.v0 + a*(e.v1 - e.v0) + b*(e.v2 - e.v0) - P;
+        double d2 = glm::dot(L, L);
+        glm::vec3 D = L/float(sqrt(d2));
+        double G = std::max(glm::dot(D, N), 0.0f) * fabs(glm::dot(D, e.normal)) / d2;
+        double x = emitterPower(e)/e.area * G * e.area/selectPdf;
+        sum += x;
+        sum2 += x*x; }
+    mean = sum/samples;
+    variance = sum2/samples - mean*mean;
+}
+
+// An emitter of a 2 triangle quad of side s at height h above the
+// origin, facing down.
+static void addQuadLight(std::vector<Emitter>& emitters, glm::vec2 center, float s, float h, float emission)
+{
+    glm::vec3 c(center, h), x(s/2, 0, 0), y(0, s/2, 0);
+    glm::vec3 corners[4] = {c-x-y, c+x-y, c+x+y, c-x+y};
+    for (int t=0;  t<2;  t++) {
+        Emitter e{};
+        e.index = uint(emitters.size());
+        e.v0 = corners[0];
+        e.v1 = corners[t+2];
+        e.v2 = corners[t+1];
+        e.emission = glm::vec3(emission);
+        e.normal = glm::vec3(0, 0, -1);
+        e.area = s*s/2;
+        emitters.push_back(e); }
+}
+
+// The light alias table: built over the model's emitters and a
+// synthetic scene of one big bright quad among many small dim ones.
+// Checks that the table gives each emitter its pdf, and compares the
+// variance of next event estimation against uniform selection.
+// Returns false if the table is wrong or does not reduce variance.
+static bool benchLightSampling(const std::string& modelPath)
+{
+    printf("\n== Light sampling\n");
+    const double maxError = 1e-5;
+    bool ok = true;
+
+    ModelData md;
+    if (loadForBench(modelPath, md) && !md.emitters.empty()) {
+        std::vector<LightAlias> table;
+        double ms = timeMs([&]() { table = buildLightAlias(md.emitters); });
+        double err = aliasTableError(table);
+        printf("  model: %zd emitters, table built in %.2f ms, max pdf error %.3g\n",
+               md.emitters.size(), ms, err);
+        ok &= err <= maxError; }
+
+    std::vector<Emitter> emitters;
+    std::mt19937 rng(99);
+    std::uniform_real_distribution<float> place(-20.0f, 20.0f);
+    for (int i=0;  i<5000;  i++)
+        addQuadLight(emitters, glm::vec2(place(rng), place(rng)), 0.05f, 3.0f, 2.0f);
+    addQuadLight(emitters, glm::vec2(0.0f), 4.0f, 5.0f, 10.0f);
+
+    std::vector<LightAlias> table;
+    double ms = timeMs([&]() { table = buildLightAlias(emitters); });
+    double err = aliasTableError(table);
+    printf("  synthetic: %zd emitters, table built in %.2f ms, max pdf error %.3g\n",
+           emitters.size(), ms, err);
+    ok &= err <= maxError;
+
+    const int samples = 1000000;
+    double uniformMean, uniformVar, powerMean, powerVar;
+    glm::vec3 P(0.0f), up(0.0f, 0.0f, 1.0f);
+    estimateIrradiance(emitters, aliasPicker(nullptr, emitters.size()), P, up, samples, uniformMean, uniformVar);
+    estimateIrradiance(emitters, aliasPicker(table.data(), emitters.size()), P, up, samples, powerMean, powerVar);
+    double stdErr = sqrt((uniformVar + powerVar)/samples);
+    printf("  irradiance, %d samples:  uniform %.4f (variance %.4g)   by power %.4f (variance %.4g)\n",
+           samples, uniformMean, uniformVar, powerMean, powerVar);
+    printf("  variance reduction:      %.1fx\n", uniformVar/powerVar);
+    bool agree = fabs(uniformMean - powerMean) <= 5.0*stdErr;
+    printf("  estimates agree:         %s\n", agree ? "yes" : "NO");
+    ok &= agree && powerVar < uniformVar;
+    return ok;
+}
+
+// An emitter of one triangle of side s centered at c, facing n.
+static void addTriangleLight(std::vector<Emitter>& emitters, glm::vec3 c, glm::vec3 n, float s, float emission)
+{
+    glm::vec3 t = glm::normalize(glm::cross(n, fabsf(n.x) < 0.9f ? glm::vec3(1,0,0) : glm::vec3(0,1,0)));
+    glm::vec3 b = glm::cross(n, t);
+    Emitter e{};
+    e.index = uint(emitters.size());
+    e.v0 = c + s*t;
+    e.v1 = c + s*(-0.5f*t + 0.866f*b);
+    e.v2 = c + s*(-0.5f*t - 0.866f*b);
+    e.normal = glm::normalize(glm::cross(e.v1 - e.v0, e.v2 - e.v0));
+    e.area = 0.5f*glm::length(glm::cross(e.v1 - e.v0, e.v2 - e.v0));
+    e.emission = glm::vec3(emission);
+    emitters.push_back(e);
+}
+
+// A large interior: a grid of ceiling lamps over a 40x40 floor, and
+// small dim emitters of random orientation scattered through it.
+static std::vector<Emitter> interiorLights(int nbScattered)
+{
+    std::vector<Emitter> emitters;
+    for (int i=0;  i<8;  i++)
+        for (int j=0;  j<8;  j++)
+            addQuadLight(emitters, glm::vec2(-17.5f + 5.0f*i, -17.5f + 5.0f*j), 0.6f, 3.0f, 20.0f);
+    std::mt19937 rng(5);
+    std::uniform_real_distribution<float> place(-20.0f, 20.0f), height(0.2f, 2.8f);
+    std::normal_distribution<float> gauss;
+    for (int i=0;  i<nbScattered;  i++) {
+        glm::vec3 n = glm::normalize(glm::vec3(gauss(rng), gauss(rng), gauss(rng)));
+        addTriangleLight(emitters, glm::vec3(place(rng), place(rng), height(rng)), n, 0.05f, 5.0f); }
+    return emitters;
+}
+
+// The light BVH against brute force: at random shading points, the
+// pdf lightBvhPdf gives each emitter must be exactly that of walking
+// every path down the tree, and with the chance of failing on the way
+// add up to 1.  Every emitter that may light the point must have a
+// nonzero pdf, and the traversal's own pdf must be lightBvhPdf's.  For a small
+// scene, sampled frequencies are also compared with the pdfs.  Then
+// next event estimation in the interior is compared with the alias
+// table.  Returns false on any failure.
+static bool benchLightBvh()
+{
+    printf("\n== Light BVH\n");
+    bool ok = true;
+    std::mt19937 rng(321);
+    std::uniform_real_distribution<float> rnd(0.0f, 1.0f), place(-20.0f, 20.0f);
+    std::normal_distribution<float> gauss;
+    auto rndFn = [&]() { return rnd(rng); };
+
+    for (int nbScattered : {136, 20000}) {
+        std::vector<Emitter> emitters = interiorLights(nbScattered);
+        LightBvh bvh;
+        double ms = timeMs([&]() { bvh = buildLightBvh(emitters); });
+        printf("  %zd emitters: %zd nodes built in %.1f ms\n", emitters.size(), bvh.nodes.size(), ms);
+
+        double maxSumError = 0.0, maxFreqError = 0.0;
+        size_t missed = 0, mismatched = 0;
+        for (int t=0;  t<20;  t++) {
+            glm::vec3 P(place(rng), place(rng), 3.0f*rnd(rng));
+            glm::vec3 N = glm::normalize(glm::vec3(gauss(rng), gauss(rng), gauss(rng)));
+            // Brute force: every path down the tree, with the
+            // probability of ending at a leaf or failing on the way.
+            std::vector<float> brute(emitters.size(), 0.0f);
+            double fail = 0.0;
+            std::vector<std::pair<uint32_t, float>> stack = {{0u, 1.0f}};
+            while (!stack.empty()) {
+                auto [k, p] = stack.back();
+                stack.pop_back();
+                const LightBvhNode& node = bvh.nodes[k];
+                if (node.emitter >= 0) {
+                    brute[node.emitter] = p;
+                    continue; }
+                float i0 = lightBvhImportance(bvh.nodes[node.child0], P, N);
+                float i1 = lightBvhImportance(bvh.nodes[node.child1], P, N);
+                if (!(i0 + i1 > 0.0f)) {
+                    fail += p;
+                    continue; }
+                float p0 = i0/(i0 + i1);
+                stack.push_back({node.child0, p*p0});
+                stack.push_back({node.child1, p*(1.0f - p0)}); }
+
+            std::vector<double> pdf(emitters.size());
+            double sum = fail;
+            for (size_t i=0;  i<emitters.size();  i++) {
+                pdf[i] = lightBvhPdf(bvh, P, N, uint32_t(i));
+                if (float(pdf[i]) != brute[i]) mismatched++;
+                sum += pdf[i];
+                // Can any part of the emitter be above P's horizon?
+                const Emitter& e = emitters[i];
+                bool visible = false;
+                for (glm::vec3 y : {e.v0, e.v1, e.v2, (e.v0+e.v1+e.v2)/3.0f})
+                    visible |= glm::dot(N, y - P) > 1e-3f*glm::length(y - P);
+                if (visible && !(pdf[i] > 0.0)) missed++; }
+            maxSumError = std::max(maxSumError, fabs(sum - 1.0));
+
+            int samples = emitters.size() < 1000 ? 200000 : 2000;
+            std::vector<double> freq(emitters.size(), 0.0);
+            for (int k=0;  k<samples;  k++) {
+                float p;
+                int i = sampleLightBvh(bvh, P, N, rndFn, p);
+                if (i < 0) continue;
+                if (p != float(pdf[i])) mismatched++;
+                freq[i] += 1.0/samples; }
+            if (emitters.size() < 1000) {
+                double tv = 0.0;
+                for (size_t i=0;  i<emitters.size();  i++) tv += fabs(freq[i] - pdf[i]);
+                maxFreqError = std::max(maxFreqError, tv/2.0); } }
+
+        bool good = maxSumError <= 1e-4 && missed == 0 && mismatched == 0
+            && (emitters.size() >= 1000 || maxFreqError <= 0.02);
+        printf("    max |sum of pdfs and failures - 1|: %.3g\n", maxSumError);
+        printf("    lights missed: %zd, pdfs differing from brute force or traversal: %zd\n", missed, mismatched);
+        if (emitters.size() < 1000)
+            printf("    max distance of sampled frequencies from pdfs: %.3g\n", maxFreqError);
+        printf("    correct: %s\n", good ? "yes" : "NO");
+        ok &= good;
+
+        if (emitters.size() < 1000) continue;
+        // Points on the floor facing up, and on the walls facing in.
+        std::vector<LightAlias> table = buildLightAlias(emitters);
+        LightPicker aliasPick = aliasPicker(table.data(), emitters.size());
+        const int samples = 100000, nbPoints = 16;
+        double logRatio = 0.0;
+        bool agree = true;
+        for (int t=0;  t<nbPoints;  t++) {
+            glm::vec3 P(place(rng), place(rng), 0.0f), N(0.0f, 0.0f, 1.0f);
+            if (t%4 == 3) {
+                P = glm::vec3(-20.0f, place(rng), 3.0f*rnd(rng));
+                N = glm::vec3(1.0f, 0.0f, 0.0f); }
+            LightPicker bvhPick = [&](std::mt19937& r, float& pdf) {
+                return sampleLightBvh(bvh, P, N, [&]() { return std::uniform_real_distribution<float>()(r); }, pdf); };
+            double aliasMean, aliasVar, bvhMean, bvhVar;
+            estimateIrradiance(emitters, aliasPick, P, N, samples, aliasMean, aliasVar);
+            estimateIrradiance(emitters, bvhPick, P, N, samples, bvhMean, bvhVar);
+            agree &= fabs(aliasMean - bvhMean) <= 5.0*sqrt((aliasVar + bvhVar)/samples) + 1e-6;
+            logRatio += log(aliasVar/std::max(bvhVar, 1e-30)); }
+        double reduction = exp(logRatio/nbPoints);
+        printf("    irradiance at %d points, %d samples each: variance %.1fx lower than the alias table"
+               " (geometric mean)\n", nbPoints, samples, reduction);
+        printf("    estimates agree:  %s\n", agree ? "yes" : "NO");
+        ok &= agree && reduction > 1.0; }
+    return ok;
+}
+
+// Total area of the triangles given by indices.
+static double triangleArea(const std::vector<Vertex>& vertices, const uint32_t* indices, size_t nbIndices)
+{
+    double area = 0.0;
+    for (size_t t=0;  t+2<nbIndices;  t+=3) {
+        glm::dvec3 a(vertices[indices[t]].pos), b(vertices[indices[t+1]].pos), c(vertices[indices[t+2]].pos);
+        area += 0.5*glm::length(glm::cross(b - a, c - a)); }
+    return area;
+}
+
+// ModelData::buildLods' levels of md: each must index only its own
+// range's vertices, have no degenerate triangles or invalid
+// materials, and have fewer triangles and no smaller error than the
+// level before.  Prints triangles, error and area per level.  Returns
+// false on any failure.
+static bool checkLods(const char* name, const ModelData& md, double& ms)
+{
+    glm::vec3 lo(INFINITY), hi(-INFINITY);
+    for (const Vertex& v : md.vertices) {
+        lo = glm::min(lo, v.pos);
+        hi = glm::max(hi, v.pos); }
+    double diagonal = glm::length(hi - lo);
+
+    std::vector<size_t> triangles(md.lodLevels, 0);
+    std::vector<double> area(md.lodLevels, 0.0);
+    std::vector<float> maxError(md.lodLevels, 0.0f);
+    size_t bad = 0;
+    for (const MeshRange& r : md.meshRanges) {
+        triangles[0] += r.indexCount/3;
+        area[0] += triangleArea(md.vertices, &md.indices[r.firstIndex], r.indexCount);
+        size_t previous = r.indexCount/3;
+        float previousError = 0.0f;
+        for (uint32_t l=1;  l<md.lodLevels;  l++) {
+            if (r.nbLods == 0) {  // Drawn at full detail
+                triangles[l] += r.indexCount/3;
+                area[l] += triangleArea(md.vertices, &md.indices[r.firstIndex], r.indexCount);
+                continue; }
+            const MeshLod& lod = md.meshLods[r.firstLod + std::min(l, r.nbLods) - 1];
+            const uint32_t* idx = &md.lodIndices[lod.firstIndex];
+            triangles[l] += lod.indexCount/3;
+            area[l] += triangleArea(md.vertices, idx, lod.indexCount);
+            maxError[l] = std::max(maxError[l], lod.error);
+            if (l > r.nbLods) continue;
+            if (lod.indexCount/3 >= previous || lod.error < previousError) bad++;
+            previous = lod.indexCount/3;
+            previousError = lod.error;
+            for (uint32_t t=0;  t<lod.indexCount;  t+=3) {
+                for (int i=0;  i<3;  i++)
+                    if (idx[t+i] < r.firstVertex || idx[t+i] >= r.firstVertex + r.vertexCount) bad++;
+                if (idx[t] == idx[t+1] || idx[t+1] == idx[t+2] || idx[t+2] == idx[t]) bad++;
+                int32_t m = md.lodMatIndx[(lod.firstIndex + t)/3];
+                if (m < 0 || size_t(m) >= md.materials.size()) bad++; } } }
+
+    printf("  %s: %zd meshes simplified in %.1f ms\n", name, md.meshRanges.size(), ms);
+    printf("    %5s %10s %12s %10s\n", "level", "triangles", "max error", "area");
+    for (uint32_t l=0;  l<md.lodLevels;  l++)
+        printf("    %5u %10zd %11.3g%% %9.2f%%\n", l, triangles[l], 100.0*maxError[l]/diagonal,
+               100.0*area[l]/area[0]);
+    printf("    (max error as a percentage of the bounding box diagonal; area of level 0's)\n");
+    printf("    invalid levels or triangles: %zd\n", bad);
+    return bad == 0;
+}
+
+// ModelData::buildLods on a bumpy grid, where each level should come
+// close to its target triangle count with little change of area, and
+// on the model.  Returns false on any failure.
+static bool benchLods(const std::string& modelPath)
+{
+    printf("\n== Mesh LODs\n");
+    bool ok = true;
+
+    std::mt19937 rng(99);
+    ModelData grid;
+    makeBenchMesh(129, rng, grid);
+    grid.meshRanges.push_back({0, uint32_t(grid.vertices.size()), 0, uint32_t(grid.indices.size()),
+                               ~0u, glm::mat4(1.0)});
+    grid.lodLevels = 4;
+    double ms = timeMs([&]() { grid.buildLods(); });
+    ok &= checkLods("bumpy grid", grid, ms);
+    const MeshRange& r = grid.meshRanges[0];
+    bool close = r.nbLods == grid.lodLevels-1;
+    for (uint32_t l=0;  close && l<r.nbLods;  l++) {
+        const MeshLod& lod = grid.meshLods[r.firstLod + l];
+        close = lod.indexCount/3 <= 1.05*(r.indexCount/3)/(2u << l)
+             && triangleArea(grid.vertices, &grid.lodIndices[lod.firstIndex], lod.indexCount)
+                >= 0.98*triangleArea(grid.vertices, grid.indices.data(), grid.indices.size()); }
+    printf("    levels reach their targets with area kept: %s\n", close ? "yes" : "NO");
+    ok &= close;
+
+    ModelData md;
+    if (!loadForBench(modelPath, md)) return ok;
+    md.lodLevels = 4;
+    ms = timeMs([&]() { md.buildLods(); });
+    ok &= checkLods(modelPath.c_str(), md, ms);
+    return ok;
+}
+
+// Triangle order statistics over consecutive groups of 16 triangles
+// of each mesh, as a BLAS builder's leaves or a warp's hits might
+// see them: the mean surface area of a group's bounding box, and the
+// mean number of 64 byte lines of vertex data its vertices cover.
+static void triangleGroupStats(const ModelData& md, double& boxArea, double& vertexLines)
+{
+    const size_t groupSize = 16;
+    double area = 0.0, lines = 0.0;
+    size_t groups = 0;
+    std::vector<uint64_t> touched;
+    for (const MeshRange& r : md.meshRanges)
+        for (size_t first=r.firstIndex/3;  first<(r.firstIndex + r.indexCount)/3;  first+=groupSize) {
+            size_t last = std::min<size_t>(first + groupSize, (r.firstIndex + r.indexCount)/3);
+            glm::vec3 lo(INFINITY), hi(-INFINITY);
+            touched.clear();
+            for (size_t i=3*first;  i<3*last;  i++) {
+                lo = glm::min(lo, md.vertices[md.indices[i]].pos);
+                hi = glm::max(hi, md.vertices[md.indices[i]].pos);
+                touched.push_back(uint64_t(md.indices[i])*sizeof(Vertex)/64); }
+            glm::dvec3 d = glm::dvec3(hi - lo);
+            area += 2.0*(d.x*d.y + d.y*d.z + d.z*d.x);
+            std::sort(touched.begin(), touched.end());
+            lines += std::unique(touched.begin(), touched.end()) - touched.begin();
+            groups++; }
+    boxArea = groups ? area/groups : 0.0;
+    vertexLines = groups ? lines/groups : 0.0;
+}
+
+// Each mesh's triangles (their vertices' bytes and material), as
+// sorted hashes: equal for two orders of the same triangles.
+static std::vector<uint64_t> triangleHashes(const ModelData& md)
+{
+    std::vector<uint64_t> hashes;
+    for (size_t k=0;  k<md.meshRanges.size();  k++) {
+        const MeshRange& r = md.meshRanges[k];
+        size_t first = hashes.size();
+        for (uint32_t t=r.firstIndex/3;  t<(r.firstIndex + r.indexCount)/3;  t++) {
+            uint64_t h = 0x9E3779B97F4A7C15ull ^ k;
+            for (int c=0;  c<3;  c++) {
+                uint32_t w[sizeof(Vertex)/4];
+                memcpy(w, &md.vertices[md.indices[3*t+c]], sizeof(Vertex));
+                for (uint32_t x : w) h = (h ^ x) * 0xff51afd7ed558ccdull, h ^= h >> 32; }
+            hashes.push_back((h ^ uint32_t(md.matIndx[t])) * 0xc4ceb9fe1a85ec53ull); }
+        std::sort(hashes.begin() + first, hashes.end()); }
+    return hashes;
+}
+
+// The radix sort against std::stable_sort, Morton codes of both
+// widths against each other, and ModelData::sortTriangles on the
+// model: its time, and the spatial coherence of triangle groups before
+// and after.  Each mesh must keep exactly its triangles.  (The BLAS
+// sizes and build times, and the trace time, are printed by the
+// renderer itself: compare runs with and without MORTON_SORT.)
+// Returns false on any failure.
+static bool benchMortonSort(const std::string& modelPath)
+{
+    printf("\n== Morton sort\n");
+    bool ok = true;
+
+    std::mt19937_64 rng(5);
+    const size_t n = 1u << 21;
+    std::vector<uint64_t> keys(n);
+    std::vector<uint32_t> values(n);
+    for (size_t i=0;  i<n;  i++) {
+        keys[i] = rng() >> 1;
+        values[i] = uint32_t(i); }
+    std::vector<std::pair<uint64_t, uint32_t>> pairs(n);
+    for (size_t i=0;  i<n;  i++) pairs[i] = {keys[i] & 0xFFFFFFFFFFFull, values[i]};
+    double radixMs = timeMs([&]() { radixSort(keys, values, 44); });
+    double stdMs = timeMs([&]() {
+        std::stable_sort(pairs.begin(), pairs.end(), [](const auto& a, const auto& b) {
+            return a.first < b.first; }); });
+    bool sorted = true;
+    for (size_t i=0;  i<n;  i++)
+        sorted &= (keys[i] & 0xFFFFFFFFFFFull) == pairs[i].first && values[i] == pairs[i].second;
+    printf("  radix sort of %zd 44 bit keys: %.1f ms (std::stable_sort %.1f ms); matches: %s\n",
+           n, radixMs, stdMs, sorted ? "yes" : "NO");
+    ok &= sorted;
+
+    std::uniform_real_distribution<float> unit(0.0f, 1.0f);
+    bool codesAgree = true;
+    for (int i=0;  i<100000;  i++) {
+        glm::vec3 p(unit(rng), unit(rng), unit(rng));
+        codesAgree &= mortonCode63(p) >> 33 == mortonCode30(p); }
+    codesAgree &= mortonCode30(glm::vec3(1.0f)) == (1u << 30) - 1
+               && mortonCode63(glm::vec3(1.0f)) == (1ull << 63) - 1;
+    printf("  30 bit codes are the top bits of 63 bit codes: %s\n", codesAgree ? "yes" : "NO");
+    ok &= codesAgree;
+
+    ModelData original;
+    if (!loadForBench(modelPath, original)) return ok;
+    std::vector<uint64_t> before = triangleHashes(original);
+    double area0, lines0;
+    triangleGroupStats(original, area0, lines0);
+    printf("  %s: %zd triangles in %zd meshes\n", modelPath.c_str(), original.indices.size()/3,
+           original.meshRanges.size());
+    printf("    %-10s %9s %14s %14s %8s\n", "order", "ms", "group box area", "vertex lines", "ACMR");
+    auto acmr = [](const ModelData& md) {
+        double misses = 0.0;
+        for (const MeshRange& r : md.meshRanges)
+            misses += cacheMissRatio(&md.indices[r.firstIndex], r.indexCount) * (r.indexCount/3);
+        return md.indices.empty() ? 0.0 : misses/(md.indices.size()/3); };
+    printf("    %-10s %9s %13.1f%% %14.2f %8.3f\n", "loaded", "", 100.0, lines0, acmr(original));
+    for (uint32_t bits : {30u, 63u}) {
+        ModelData md = original;
+        md.mortonBits = bits;
+        double ms = timeMs([&]() { md.sortTriangles(); });
+        double area, lines;
+        triangleGroupStats(md, area, lines);
+        bool same = triangleHashes(md) == before;
+        printf("    %2u bit     %9.1f %13.1f%% %14.2f %8.3f   triangles kept: %s\n", bits, ms,
+               100.0*area/area0, lines, acmr(md), same ? "yes" : "NO");
+        ok &= same; }
+    return ok;
+}
+
+// The model's textures decoded one after another, as the loader used
+// to, against loadTextures on the thread pool, then against the
+// texture cache: a first run (which writes any missing cache files)
+// and a run from the cache.  The cached run's time includes reading
+// every mapped byte, as the upload would.  All must give the same top
+// level pixels.  Returns false on any failure.
+static bool benchTextureDecode(const std::string& modelPath)
+{
+    printf("\n== Texture decode\n");
+    ModelData md;
+    if (!md.readObjFile(modelPath, glm::mat4(1.0)) && !md.readAssimpFile(modelPath, glm::mat4(1.0))) {
+        printf("  cannot read %s\n", modelPath.c_str());
+        return false; }
+    if (md.textures.empty()) {
+        printf("  %s has no textures\n", modelPath.c_str());
+        return true; }
+
+    // Same size and top level as the reference, and every mip level.
+    auto sameTopLevel = [](const DecodedTexture& a, const DecodedTexture& b) {
+        return a.width == b.width && a.height == b.height && !b.levels.empty()
+            && memcmp(a.data(), b.data() + b.levels[0].offset, a.levels[0].size()) == 0; };
+    auto allLevels = [](const DecodedTexture& t) {
+        return t.levels.size() == fullMipLevels(t.width, t.height); };
+
+    try {
+        std::vector<DecodedTexture> serial;
+        double serialMs = timeMs([&]() {
+            for (const std::string& texName : md.textures)
+                serial.push_back(decodeTexture(texName, 0)); });
+        std::vector<DecodedTexture> parallel, firstRun, cached;
+        TextureOptions decodeOnly, withCache;
+        withCache.useCache = true;
+        double parallelMs = timeMs([&]() { parallel = loadTextures(md.textures, 0, decodeOnly); });
+        double firstRunMs = timeMs([&]() { firstRun = loadTextures(md.textures, 0, withCache); });
+        uint64_t hash = 0;
+        double cachedMs = timeMs([&]() {
+            cached = loadTextures(md.textures, 0, withCache);
+            for (const DecodedTexture& t : cached)
+                for (const TextureLevel& level : t.levels)
+                    hash = hashBytes(t.data() + level.offset, level.size(), hash); });
+
+        bool same = true, complete = true;
+        size_t nbCached = 0, texels = 0;
+        for (size_t t=0;  t<serial.size();  t++) {
+            same &= sameTopLevel(serial[t], parallel[t]) && sameTopLevel(serial[t], firstRun[t])
+                 && sameTopLevel(serial[t], cached[t]);
+            complete &= allLevels(firstRun[t]) && allLevels(cached[t]);
+            nbCached += cached[t].fromCache;
+            texels += size_t(serial[t].width)*serial[t].height; }
+        printf("  %zd textures, %.1f M texels at the top level\n", md.textures.size(), texels/1e6);
+        printf("    %-28s %10.1f ms\n", "decoded one after another", serialMs);
+        printf("    %-28s %10.1f ms  (%.2fx)\n", "decoded in parallel", parallelMs,
+               serialMs/std::max(parallelMs, 1e-3));
+        printf("    %-28s %10.1f ms\n", "texture cache, first run", firstRunMs);
+        printf("    %-28s %10.1f ms  (%.2fx; %zd from the cache)\n", "texture cache, later runs",
+               cachedMs, serialMs/std::max(cachedMs, 1e-3), nbCached);
+        printf("  same pixels: %s; cache has every mip level: %s\n",
+               same ? "yes" : "NO", complete ? "yes" : "NO");
+        printf("  (The cached runs also skip the GPU's mip blits; see \"Texture upload\" in a normal run.)\n");
+        return same && complete && nbCached == serial.size(); }
+    catch (const std::exception& e) {
+        printf("  %s\n", e.what());
+        return false; }
+}
+
+// Checks a mip chain made by buildMipChain against its definition:
+// with the box filter, each texel of each level must be (within one
+// code) the average, in linear color, of the area of the level above
+// it covers.  The reference chain is computed in double, separately
+// from the mip builder's code.  Returns the largest difference, in
+// codes.
+static int mipChainError(const DecodedTexture& texture)
+{
+    const TextureLevel& top = texture.levels[0];
+    const uint8_t* p = texture.data();
+    std::vector<double> above;
+    for (size_t i=0;  i<top.size();  i++)
+        above.push_back(i%4 < 3 ? srgbToLinear(p[i]) : p[i]/255.0);
+
+    int worst = 0;
+    for (size_t l=1;  l<texture.levels.size();  l++) {
+        const TextureLevel& from = texture.levels[l-1];
+        const TextureLevel& level = texture.levels[l];
+        double sx = double(from.width)/level.width, sy = double(from.height)/level.height;
+        std::vector<double> ref(level.size());
+        for (int y=0;  y<level.height;  y++)
+            for (int x=0;  x<level.width;  x++) {
+                double* sum = &ref[4*(size_t(y)*level.width + x)];
+                for (int j=int(y*sy);  j<from.height && j<(y+1)*sy;  j++)
+                    for (int i=int(x*sx);  i<from.width && i<(x+1)*sx;  i++) {
+                        double w = (std::min(i+1.0, (x+1)*sx) - std::max(double(i), x*sx))
+                                 * (std::min(j+1.0, (y+1)*sy) - std::max(double(j), y*sy));
+                        for (int c=0;  c<4;  c++)
+                            sum[c] += w*above[4*(size_t(j)*from.width + i) + c]/(sx*sy); }
+                const uint8_t* got = p + level.offset + 4*(size_t(y)*level.width + x);
+                for (int c=0;  c<4;  c++) {
+                    int want = c < 3 ? linearToSrgb(float(sum[c])) : int(sum[c]*255.0 + 0.5);
+                    worst = std::max(worst, abs(int(got[c]) - want)); } }
+        above.swap(ref); }
+    return worst;
+}
+
+// A random RGBA image, as decodeTexture would give it.
+static DecodedTexture randomTexture(int width, int height, unsigned seed)
+{
+    std::mt19937 rng(seed);
+    DecodedTexture texture;
+    texture.width = width;
+    texture.height = height;
+    texture.pixels.resize(size_t(width)*height*4);
+    for (uint8_t& v : texture.pixels) v = uint8_t(rng());
+    texture.levels.push_back({width, height, 0});
+    return texture;
+}
+
+// The CPU mip builder: its box filter against a direct computation on
+// odd sizes, flat images through both filters, gamma correct
+// averaging, and identical results from the SSE and scalar code.  Then
+// its speed on the model's textures.  Returns false on any failure.
+static bool benchMipBuilder(const std::string& modelPath)
+{
+    printf("\n== Mip builder\n");
+    bool ok = true;
+
+    int worst = 0;
+    for (int size : {1, 2, 3, 5, 7, 13, 37, 64, 100})
+        for (int other : {1, 6, 11}) {
+            DecodedTexture t = randomTexture(size, other, size*31 + other);
+            buildMipChain(t, MipFilter::Box);
+            worst = std::max(worst, mipChainError(t)); }
+    printf("  box filter on odd sizes, largest error: %d codes (at most 1: %s)\n",
+           worst, worst <= 1 ? "yes" : "NO");
+    ok &= worst <= 1;
+
+    for (MipFilter filter : {MipFilter::Box, MipFilter::Kaiser}) {
+        DecodedTexture flat;
+        flat.width = 37;
+        flat.height = 23;
+        for (int i=0;  i<37*23;  i++)
+            flat.pixels.insert(flat.pixels.end(), {200, 100, 30, 128});
+        flat.levels.push_back({37, 23, 0});
+        buildMipChain(flat, filter);
+        bool same = true;
+        for (size_t i=0;  i<flat.pixels.size();  i++)
+            same &= flat.pixels[i] == flat.pixels[i%4];
+        printf("  %-6s filter keeps a flat image flat: %s\n", mipFilterName(filter), same ? "yes" : "NO");
+        ok &= same; }
+
+    // Black and white texels average to half the light, not half the code.
+    DecodedTexture checker;
+    checker.width = checker.height = 2;
+    checker.pixels = {0,0,0,255, 255,255,255,255, 255,255,255,255, 0,0,0,255};
+    checker.levels.push_back({2, 2, 0});
+    buildMipChain(checker, MipFilter::Box);
+    printf("  black and white average to %d (linear 0.5; an sRGB space average is 128)\n",
+           checker.pixels[16]);
+    ok &= checker.pixels[16] == linearToSrgb(0.5f);
+
+    // The mip builder's vector code is SSE (4 channels of a texel).
+    const SimdLevel simdLevel = bestSimdLevel() == SimdLevel::Scalar ? SimdLevel::Scalar : SimdLevel::SSE;
+    bool identical = true;
+    for (MipFilter filter : {MipFilter::Box, MipFilter::Kaiser}) {
+        DecodedTexture a = randomTexture(301, 77, 5), b = a;
+        buildMipChain(a, filter, simdLevel);
+        buildMipChain(b, filter, SimdLevel::Scalar);
+        identical &= a.pixels == b.pixels; }
+    printf("  %s and scalar results identical: %s\n", simdLevelName(simdLevel),
+           identical ? "yes" : "NO");
+    ok &= identical;
+
+    ModelData md;
+    if (!md.readObjFile(modelPath, glm::mat4(1.0)) && !md.readAssimpFile(modelPath, glm::mat4(1.0)))
+        return ok;
+    try {
+        std::vector<DecodedTexture> textures;
+        size_t texels = 0;
+        for (const std::string& texName : md.textures) {
+            textures.push_back(decodeTexture(texName, 0));
+            texels += size_t(textures.back().width)*textures.back().height; }
+        printf("  %zd textures, %.1f M texels at the top level\n", textures.size(), texels/1e6);
+        for (MipFilter filter : {MipFilter::Box, MipFilter::Kaiser})
+            for (SimdLevel simd : {SimdLevel::Scalar, simdLevel}) {
+                double ms = 0.0;
+                for (const DecodedTexture& texture : textures) {
+                    DecodedTexture t = texture;
+                    ms += timeMs([&]() { buildMipChain(t, filter, simd); }); }
+                printf("    %-6s %-6s %10.1f ms  %8.1f M texels/s\n", mipFilterName(filter),
+                       simdLevelName(simd), ms, texels/1e3/std::max(ms, 1e-3)); } }
+    catch (const std::exception& e) {
+        printf("  %s\n", e.what());
+        return false; }
+    return ok;
+}
+
+// A smooth image (gradients and soft spots of color) with a little
+// noise, and alpha varying too unless opaque: closer to a real texture
+// than randomTexture's noise.
+static DecodedTexture smoothTexture(int width, int height, unsigned seed, bool opaque)
+{
+    std::mt19937 rng(seed);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    double fx[4], fy[4], phase[4];
+    for (int c=0;  c<4;  c++) {
+        fx[c] = 2.0 + 10.0*u(rng);
+        fy[c] = 2.0 + 10.0*u(rng);
+        phase[c] = 6.3*u(rng); }
+    DecodedTexture texture;
+    texture.width = width;
+    texture.height = height;
+    for (int y=0;  y<height;  y++)
+        for (int x=0;  x<width;  x++)
+            for (int c=0;  c<4;  c++) {
+                double v = 127.5 + 110.0*sin(fx[c]*x/width + phase[c])*cos(fy[c]*y/height) + 8.0*(u(rng) - 0.5);
+                texture.pixels.push_back(c == 3 && opaque ? 255 : uint8_t(std::min(std::max(v, 0.0), 255.0))); }
+    texture.levels.push_back({width, height, 0});
+    return texture;
+}
+
+// Block compression: the BC7 partition tables, exact flat blocks,
+// the quality of each format on smooth images, decoding against the
+// encoder's own measure, and identical results from the SSE and scalar
+// code.  Then its speed and quality on the model's textures.  Returns
+// false on any failure.
+static bool benchBlockCompress(const std::string& modelPath)
+{
+    printf("\n== Block compression\n");
+    bool ok = true;
+
+    bool anchorsOk = true;
+    for (int p=0;  p<64;  p++)
+        anchorsOk &= (bc7PartitionMask(p) & 1) == 0 && ((bc7PartitionMask(p) >> bc7Anchor(p)) & 1) == 1;
+    printf("  BC7 anchors in subset 1 of their partitions: %s\n", anchorsOk ? "yes" : "NO");
+    ok &= anchorsOk;
+
+    // A flat RGBA block is within a code in BC7 (7 bit endpoints and a
+    // p-bit shared by the channels).
+    std::mt19937 rng(7);
+    int flatError = 0;
+    for (int k=0;  k<1000;  k++) {
+        uint8_t texels[64], block[16], decoded[64];
+        uint32_t color = rng();
+        for (int i=0;  i<16;  i++) memcpy(&texels[4*i], &color, 4);
+        encodeBC7Block(texels, block, SimdLevel::Scalar);
+        decodeBC7Block(block, decoded);
+        for (int i=0;  i<64;  i++) flatError = std::max(flatError, abs(int(texels[i]) - decoded[i])); }
+    printf("  flat blocks in BC7, largest error: %d codes (at most 1: %s)\n", flatError,
+           flatError <= 1 ? "yes" : "NO");
+    ok &= flatError <= 1;
+
+    // PSNR of each format on smooth images, and the encoder's PSNR
+    // against one computed here from the decoded level.
+    const SimdLevel simdLevel = bestSimdLevel() == SimdLevel::Scalar ? SimdLevel::Scalar : SimdLevel::SSE;
+    struct Case { TextureFormat format; bool opaque; double minPsnr; };
+    for (const Case& c : {Case{TextureFormat::BC1, true, 32.0}, Case{TextureFormat::BC7, true, 40.0},
+                          Case{TextureFormat::BC7, false, 38.0}}) {
+        DecodedTexture original = smoothTexture(258, 130, 11, c.opaque), a = original, b = original;
+        buildMipChain(a, MipFilter::Box);
+        buildMipChain(b, MipFilter::Box);
+        const TextureFormat chosen = chooseBlockFormat(a);
+        compressTexture(a, c.format, simdLevel);
+        compressTexture(b, c.format, SimdLevel::Scalar);
+        std::vector<uint8_t> decoded = decompressLevel(a, 0);
+        const int nbChannels = c.format == TextureFormat::BC1 ? 3 : 4;
+        double sum = 0.0;
+        for (size_t i=0;  i<decoded.size();  i++)
+            if (int(i%4) < nbChannels) {
+                double d = double(decoded[i]) - original.pixels[i];
+                sum += d*d; }
+        double psnr = 10.0*log10(255.0*255.0/(sum/(decoded.size()/4*nbChannels)));
+        bool good = psnr >= c.minPsnr && fabs(psnr - a.psnr) < 0.01 && a.pixels == b.pixels
+                    && (chosen == TextureFormat::BC1) == c.opaque;
+        printf("  %s, %-11s %5.1f dB (at least %.0f), %.1f bits/texel, %s and scalar identical: %s\n",
+               textureFormatName(c.format), c.opaque ? "opaque:" : "with alpha:", psnr, c.minPsnr,
+               8.0*a.levels[0].size()/(258.0*130.0), simdLevelName(simdLevel),
+               good ? "yes" : "NO");
+        ok &= good; }
+
+    ModelData md;
+    if (!md.readObjFile(modelPath, glm::mat4(1.0)) && !md.readAssimpFile(modelPath, glm::mat4(1.0)))
+        return ok;
+    try {
+        std::vector<DecodedTexture> textures;
+        size_t texels = 0;
+        for (const std::string& texName : md.textures) {
+            textures.push_back(decodeTexture(texName, 0));
+            texels += size_t(textures.back().width)*textures.back().height; }
+        size_t nbBC1 = 0;
+        for (const DecodedTexture& texture : textures)
+            nbBC1 += chooseBlockFormat(texture) == TextureFormat::BC1;
+        printf("  %zd textures (%zd opaque, for BC1), %.1f M texels at the top level\n",
+               textures.size(), nbBC1, texels/1e6);
+
+        // Every texture in each format, to time both (top levels only).
+        for (TextureFormat format : {TextureFormat::BC1, TextureFormat::BC7})
+            for (SimdLevel simd : {SimdLevel::Scalar, simdLevel}) {
+                double ms = 0.0, worst = 99.0, sum = 0.0;
+                for (const DecodedTexture& texture : textures) {
+                    DecodedTexture t = texture;
+                    ms += timeMs([&]() { compressTexture(t, format, simd); });
+                    worst = std::min(worst, double(t.psnr));
+                    sum += t.psnr; }
+                printf("    %s %-6s %10.1f ms  %6.2f M texels/s  PSNR mean %.1f dB, lowest %.1f dB\n",
+                       textureFormatName(format), simdLevelName(simd), ms, texels/1e3/std::max(ms, 1e-3),
+                       sum/std::max<size_t>(textures.size(), 1), worst); } }
+    catch (const std::exception& e) {
+        printf("  %s\n", e.what());
+        return false; }
+    return ok;
+}
+
+// The texture registry on the model's textures: each file is new
+// once, a second model with the same files shares all of them by path,
+// a copy under another name is found by its contents and a file of
+// the same size but other contents is not, and releasing keeps the
+// textures still referenced, renumbered.  Returns false on any failure.
+static bool benchTextureRegistry(const std::string& modelPath)
+{
+    printf("\n== Texture registry\n");
+    ModelData md;
+    if (!md.readObjFile(modelPath, glm::mat4(1.0)) && !md.readAssimpFile(modelPath, glm::mat4(1.0)))
+        return true;
+    if (md.textures.empty()) {
+        printf("  The model has no textures\n");
+        return true; }
+    bool ok = true;
+
+    TextureRegistry registry;
+    TextureRegistry::Resolved first, second;
+    double ms = timeMs([&]() { first = registry.acquire(md.textures); });
+    std::vector<std::string> distinct;
+    for (const std::string& texName : md.textures)
+        distinct.push_back(canonicalPath(texName));
+    std::sort(distinct.begin(), distinct.end());
+    distinct.erase(std::unique(distinct.begin(), distinct.end()), distinct.end());
+    printf("  %zd references, %zd files: %zd new (%zd by content) in %.2f ms\n", md.textures.size(),
+           distinct.size(), first.newFiles.size(), first.byContent, ms);
+    ok &= first.newFiles.size() + first.byContent == distinct.size();
+    registry.uploaded(first, std::vector<size_t>(first.newFiles.size(), 1000));
+
+    second = registry.acquire(md.textures);
+    bool shared = second.newFiles.empty() && second.byPath == md.textures.size() && second.slots == first.slots;
+    printf("  second model: all shared by path: %s\n", shared ? "yes" : "NO");
+    ok &= shared;
+    registry.uploaded(second, {});
+    ok &= registry.decodesAvoided() == md.textures.size() - first.newFiles.size() + md.textures.size();
+
+    // A copy of the first texture, and a file of its size with other
+    // contents.
+    fs::path dir = fs::temp_directory_path() / "rtrt_registry_bench";
+    fs::create_directories(dir);
+    const std::string copyName = (dir / "copy.img").string(), otherName = (dir / "other.img").string();
+    std::error_code ec;
+    fs::copy_file(md.textures[0], copyName, fs::copy_options::overwrite_existing, ec);
+    std::vector<char> bytes(fs::file_size(md.textures[0], ec));
+    for (size_t i=0;  i<bytes.size();  i++) bytes[i] = char(i*7 + 1);
+    if (FILE* f = fopen(otherName.c_str(), "wb")) {
+        fwrite(bytes.data(), 1, bytes.size(), f);
+        fclose(f); }
+    TextureRegistry::Resolved copies = registry.acquire({copyName, otherName});
+    bool byContent = copies.byContent == 1 && copies.slots[0] == first.slots[0]
+                     && copies.newFiles.size() == 1 && copies.newFiles[0] == otherName;
+    printf("  copy found by content, same-size file new: %s\n", byContent ? "yes" : "NO");
+    ok &= byContent;
+    registry.uploaded(copies, {1000});
+
+    // Releasing the first model frees nothing; the second and the
+    // copies' model free all but the other file, now slot 0.
+    std::vector<int32_t> renumber = registry.release(first.slots);
+    bool kept = registry.size() == first.newFiles.size() + 1;
+    for (size_t s=0;  s<renumber.size();  s++) kept &= renumber[s] == int32_t(s);
+    renumber = registry.release(second.slots);
+    kept &= registry.size() == 2 && renumber[copies.slots[0]] == 0 && renumber[copies.slots[1]] == 1;
+    std::vector<int32_t> last = registry.release({0});
+    kept &= registry.size() == 1 && last[1] == 0;
+    printf("  released textures freed only when unused, the rest renumbered: %s\n", kept ? "yes" : "NO");
+    ok &= kept;
+    fs::remove_all(dir, ec);
+    return ok;
+}
+
+// Bilinear filtering of an RGBA8 image at (u,v), with REPEAT addressing.
+static void bilinearRepeat(const std::vector<uint8_t>& image, int width, int height,
+                           float u, float v, float rgba[4])
+{
+    float x = (u - floorf(u))*width - 0.5f, y = (v - floorf(v))*height - 0.5f;
+    int x0 = int(floorf(x)), y0 = int(floorf(y));
+    float fx = x - x0, fy = y - y0;
+    auto at = [&](int x, int y, int c) {
+        x = ((x % width) + width) % width;
+        y = ((y % height) + height) % height;
+        return float(image[4*(size_t(y)*width + x) + c]); };
+    for (int c=0;  c<4;  c++)
+        rgba[c] = ((at(x0, y0, c)*(1-fx) + at(x0+1, y0, c)*fx)*(1-fy)
+                   + (at(x0, y0+1, c)*(1-fx) + at(x0+1, y0+1, c)*fx)*fy)/255.0f;
+}
+
+// Virtual texturing, simulated on the CPU: the shaders' lookups
+// (VirtualTextures::sample) set feedback bits, and each frame the bits
+// go to feedback, the streaming thread loads the tiles, and update's
+// tiles are copied into a CPU copy of the cache.  A still view must
+// converge to every sample at its wanted level, filtered exactly as
+// from the texture itself (so the tile borders are right, for RGBA8
+// and BC1 sources); a view panning across a texture larger than the
+// cache must keep the cache consistent, evicting as it goes; and
+// removing a texture must leave the others working.  Returns false on
+// any failure.
+static bool benchVirtualTextures()
+{
+    printf("\n== Virtual textures\n");
+    bool ok = true;
+
+    // An RGBA8 texture larger than the cache at its top level, a BC1
+    // one, and one of a single tile.
+    std::vector<DecodedTexture> textures = {smoothTexture(1500, 900, 21, true),
+                                            smoothTexture(700, 300, 22, true),
+                                            smoothTexture(100, 60, 23, false)};
+    for (DecodedTexture& texture : textures)
+        buildMipChain(texture, MipFilter::Box);
+    compressTexture(textures[1], TextureFormat::BC1);
+    std::vector<std::vector<std::vector<uint8_t>>> reference(textures.size());
+    for (size_t t=0;  t<textures.size();  t++)
+        for (size_t l=0;  l<textures[t].levels.size();  l++)
+            reference[t].push_back(decompressLevel(textures[t], l));
+    std::vector<std::vector<TextureLevel>> levels;
+    for (const DecodedTexture& texture : textures)
+        levels.push_back(texture.levels);
+    std::vector<size_t> source = {0, 1, 2};  // Of each virtual texture
+
+    const uint32_t cacheSide = 5;
+    VirtualTextures vt(cacheSide);
+    vt.add(std::move(textures));
+    std::vector<uint8_t> cache;
+    vt.applyUpdate(VtUpdate(), cache);
+    printf("  %zd textures, %zd pages, a cache of %u tiles\n", vt.size(), vt.pageTable().size(),
+           cacheSide*cacheSide);
+
+    // A view: samples on a grid over a part of a texture, at one lod.
+    struct View { uint32_t texture; float u0, v0, u1, v1, lod; };
+    const int grid = 48;
+    auto sampleViews = [&](const std::vector<View>& views, std::vector<uint32_t>& bits,
+                           size_t& hits, size_t& misses, size_t& wrong) {
+        bits.assign(vt.feedbackWords(), 0);
+        hits = misses = wrong = 0;
+        for (const View& view : views)
+            for (int j=0;  j<grid;  j++)
+                for (int i=0;  i<grid;  i++) {
+                    float u = view.u0 + (view.u1 - view.u0)*(i + 0.5f)/grid;
+                    float v = view.v0 + (view.v1 - view.v0)*(j + 0.5f)/grid;
+                    float rgba[4], expected[4];
+                    uint32_t page = 0;
+                    int level = -1;
+                    bool found = vt.sample(view.texture, u, v, view.lod, cache, rgba, page, level);
+                    bits[page/32] |= 1u << (page%32);
+                    const int want = std::min(int(floorf(view.lod + 0.5f)),
+                                              int(vt.textureTable()[view.texture].nbLevels) - 1);
+                    if (!found || level != want) {
+                        misses++;
+                        continue; }
+                    hits++;
+                    const size_t t = source[view.texture];
+                    const TextureLevel& l = levels[t][level];
+                    bilinearRepeat(reference[t][level], l.width, l.height, u, v, expected);
+                    for (int c=0;  c<4;  c++)
+                        if (fabsf(rgba[c] - expected[c]) > 1e-3f) {
+                            wrong++;
+                            break; } } };
+    auto frame = [&](const std::vector<View>& views, size_t& hits, size_t& misses, size_t& wrong) {
+        std::vector<uint32_t> bits;
+        sampleViews(views, bits, hits, misses, wrong);
+        vt.feedback(bits.data(), bits.size());
+        vt.waitIdle();
+        vt.applyUpdate(vt.update(8), cache); };
+
+    // The cache's page table entries each have a slot of their own.
+    auto consistent = [&]() {
+        std::vector<bool> used(cacheSide*cacheSide, false);
+        size_t resident = 0;
+        for (uint32_t entry : vt.pageTable())
+            if (entry != 0) {
+                uint32_t x = entry & 0xfff, y = (entry >> 12) & 0xfff;
+                if (!(entry & VT_RESIDENT) || x >= cacheSide || y >= cacheSide || used[y*cacheSide + x])
+                    return false;
+                used[y*cacheSide + x] = true;
+                resident++; }
+        return resident == vt.stats().resident && resident <= cacheSide*cacheSide; };
+
+    // A still view of two textures converges.
+    const std::vector<View> still = {{0, 0.1f, 0.2f, 0.3f, 0.45f, 0.0f}, {1, -0.5f, 0.0f, 0.5f, 1.0f, 1.2f},
+                                     {2, 0.0f, 0.0f, 2.0f, 2.0f, 0.0f}};
+    size_t hits, misses, wrong, wrongSum = 0, fallbacks = 0;
+    int frames = 0;
+    auto start = std::chrono::steady_clock::now();
+    for (frames=1;  frames<=40;  frames++) {
+        frame(still, hits, misses, wrong);
+        wrongSum += wrong;
+        fallbacks += misses;
+        if (misses == 0) break; }
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    VtStats stats = vt.stats();
+    bool converged = misses == 0 && wrongSum == 0 && consistent();
+    printf("  still view: all %zd samples at their level after %d frames (%zd fell back before),"
+           " all filtered exactly: %s\n", hits, frames, fallbacks, converged ? "yes" : "NO");
+    printf("    %zd tiles streamed in %.2f ms of the streaming thread (%.3f ms each); %.1f ms in all\n",
+           stats.streamed, stats.streamMs, stats.streamMs/std::max<size_t>(stats.streamed, 1), ms);
+    ok &= converged;
+
+    // A view panning across the large texture, at its top level,
+    // wants more tiles over time than the cache holds.
+    bool panOk = true;
+    for (int f=0;  f<60;  f++) {
+        float u = 0.02f*f;
+        frame({{0, u, 0.3f, u + 0.15f, 0.5f, 0.0f}}, hits, misses, wrong);
+        panOk &= wrong == 0 && consistent(); }
+    for (frames=1;  frames<=40;  frames++) {
+        frame({{0, 1.2f, 0.3f, 1.35f, 0.5f, 0.0f}}, hits, misses, wrong);
+        if (misses == 0) break; }
+    stats = vt.stats();
+    panOk &= misses == 0 && wrong == 0 && stats.evicted > 0 && stats.pinned == 3;
+    printf("  panning view: %zd tiles streamed, %zd evicted, %zd resident (%zd pinned),"
+           " settled in %d frames, cache consistent: %s\n", stats.streamed, stats.evicted,
+           stats.resident, stats.pinned, frames, panOk ? "yes" : "NO");
+    ok &= panOk;
+
+    // Without the first texture, the other two (renumbered) still work.
+    vt.remove({-1, 0, 1});
+    source = {1, 2};
+    vt.applyUpdate(VtUpdate(), cache);
+    for (frames=1;  frames<=40;  frames++) {
+        frame({{0, 0.0f, 0.0f, 1.0f, 1.0f, 1.0f}, {1, 0.25f, 0.25f, 0.75f, 0.75f, 0.0f}}, hits, misses, wrong);
+        if (misses == 0) break; }
+    bool removedOk = vt.size() == 2 && misses == 0 && wrong == 0 && consistent();
+    printf("  after removing a texture: %zd pages, the others converge in %d frames: %s\n",
+           vt.pageTable().size(), frames, removedOk ? "yes" : "NO");
+    ok &= removedOk;
+    return ok;
+}
+
+// A texture of one color.
+static DecodedTexture flatTexture(int width, int height, const uint8_t rgba[4])
+{
+    DecodedTexture texture;
+    texture.width = width;
+    texture.height = height;
+    for (size_t i=0;  i<size_t(width)*height;  i++)
+        texture.pixels.insert(texture.pixels.end(), rgba, rgba + 4);
+    texture.levels.push_back({width, height, 0});
+    return texture;
+}
+
+// The largest difference, over a grid of texture coordinates (past
+// both edges, to cover wrapping), between bilinear samples of a
+// texture's texels and of level l of its atlas page through its
+// AtlasRect, as the shaders do.
+static float atlasSampleError(const std::vector<uint8_t>& texels, int width, int height,
+                              const TextureAtlas& atlas, size_t t, size_t l)
+{
+    const DecodedTexture& page = atlas.pages[atlas.page[t]];
+    const TextureLevel& level = page.levels[l];
+    std::vector<uint8_t> pageTexels = decompressLevel(page, l);
+    const AtlasRect& rect = atlas.rects[t];
+    float worst = 0.0f;
+    const int n = 37;
+    for (int i=0;  i<=n;  i++)
+        for (int j=0;  j<=n;  j++) {
+            float u = -0.25f + 1.5f*i/n, v = -0.25f + 1.5f*j/n;
+            float want[4], got[4];
+            bilinearRepeat(texels, width, height, u, v, want);
+            bilinearRepeat(pageTexels, level.width, level.height,
+                           rect.offset.x + (u - floorf(u))*rect.scale.x,
+                           rect.offset.y + (v - floorf(v))*rect.scale.y, got);
+            for (int c=0;  c<4;  c++)
+                worst = std::max(worst, fabsf(want[c] - got[c])); }
+    return worst;
+}
+
+// Atlas packing: which textures are packed, that a packed texture
+// samples as it would alone at the top level (the gutter wrapping it),
+// that flat textures stay exactly their color down to the last level
+// sampled (so the gutters hold at every level), and that a page of
+// compressed textures is compressed.  Returns false on any failure.
+static bool benchTextureAtlas()
+{
+    printf("\n== Texture atlas\n");
+    bool ok = true;
+    std::mt19937 rng(31);
+    auto side = [&]() { return 4 + int(rng() % 237); };
+
+    // Small textures of assorted sizes, and one too large to pack.
+    std::vector<DecodedTexture> textures;
+    for (int t=0;  t<60;  t++)
+        textures.push_back(smoothTexture(side(), side(), 100 + t, t % 3 != 0));
+    textures.push_back(smoothTexture(600, 400, 99, true));
+    TextureAtlas atlas;
+    double ms = timeMs([&]() { atlas = packTextureAtlas(textures, 256, MipFilter::Box); });
+    bool packedOk = atlas.nbPacked == textures.size() - 1 && atlas.page.back() == -1;
+    for (const DecodedTexture& page : atlas.pages)
+        packedOk &= page.width <= ATLAS_PAGE_SIZE && page.height <= ATLAS_PAGE_SIZE
+                    && page.width % ATLAS_GUTTER == 0 && page.height % ATLAS_GUTTER == 0
+                    && page.levels.size() == fullMipLevels(page.width, page.height);
+    printf("  %zd textures -> %zd images (%zd pages) in %.1f ms, only the large one left alone: %s\n",
+           textures.size(), textures.size() - atlas.nbPacked + atlas.pages.size(),
+           atlas.pages.size(), ms, packedOk ? "yes" : "NO");
+    ok &= packedOk;
+
+    float worst = 0.0f;
+    for (size_t t=0;  t<textures.size();  t++)
+        if (atlas.page[t] >= 0)
+            worst = std::max(worst, atlasSampleError(textures[t].pixels, textures[t].width,
+                                                     textures[t].height, atlas, t, 0));
+    bool exactOk = worst < 1.0f/255;
+    printf("  top level samples as each texture alone, wrapping included: %s (largest difference %.4f)\n",
+           exactOk ? "yes" : "NO", worst);
+    ok &= exactOk;
+
+    // Flat textures: any texel of a neighbour (or of the empty page)
+    // reaching a sample shows as a change of color.
+    std::vector<DecodedTexture> flats;
+    for (int t=0;  t<40;  t++) {
+        uint8_t rgba[4] = {uint8_t(rng()), uint8_t(rng()), uint8_t(rng()), 255};
+        flats.push_back(flatTexture(side(), side(), rgba)); }
+    TextureAtlas flatAtlas = packTextureAtlas(flats, 256, MipFilter::Box);
+    float worstLevel[ATLAS_LEVELS] = {0.0f};
+    for (size_t t=0;  t<flats.size();  t++)
+        for (size_t l=0;  l<ATLAS_LEVELS;  l++)
+            worstLevel[l] = std::max(worstLevel[l], atlasSampleError(flats[t].pixels, flats[t].width,
+                                                                     flats[t].height, flatAtlas, t, l));
+    bool gutterOk = flatAtlas.nbPacked == flats.size();
+    printf("  flat textures keep their color at levels");
+    for (size_t l=0;  l<ATLAS_LEVELS;  l++) {
+        gutterOk &= worstLevel[l] < 1.0f/255;
+        printf(" %zd (%.4f)", l, worstLevel[l]); }
+    printf(": %s\n", gutterOk ? "yes" : "NO");
+    ok &= gutterOk;
+
+    // Compressed textures give a compressed page.
+    std::vector<DecodedTexture> blocks = {smoothTexture(64, 48, 41, true), smoothTexture(100, 30, 42, true)};
+    for (DecodedTexture& texture : blocks) {
+        buildMipChain(texture, MipFilter::Box);
+        compressTexture(texture, TextureFormat::BC1); }
+    TextureAtlas blockAtlas = packTextureAtlas(blocks, 256, MipFilter::Box);
+    float blockError = 0.0f;
+    for (size_t t=0;  t<blocks.size() && blockAtlas.nbPacked == blocks.size();  t++)
+        blockError = std::max(blockError, atlasSampleError(decompressLevel(blocks[t], 0), blocks[t].width,
+                                                           blocks[t].height, blockAtlas, t, 0));
+    bool blockOk = blockAtlas.pages.size() == 1 && blockAtlas.pages[0].format() == TextureFormat::BC1
+                   && blockError < 24.0f/255;
+    printf("  BC1 textures packed into a BC1 page: %s (largest difference %.4f)\n",
+           blockOk ? "yes" : "NO", blockError);
+    ok &= blockOk;
+    return ok;
+}
+
+int runLoaderBenchmarks(const std::string& modelPath)
+{
+    bool ok = true;
+    ok &= benchSceneCache(modelPath);
+    ok &= benchSceneCacheKey();
+    ok &= benchCompactVertices(modelPath);
+    ok &= benchHitRecords(modelPath);
+    ok &= benchMaterialTable(modelPath);
+    ok &= benchInstancing(modelPath);
+    ok &= benchObjReader(modelPath);
+    ok &= benchVertexTransform();
+    ok &= benchLightSampling(modelPath);
+    ok &= benchLightBvh();
+    ok &= benchLods(modelPath);
+    ok &= benchMortonSort(modelPath);
+    ok &= benchTextureDecode(modelPath);
+    ok &= benchMipBuilder(modelPath);
+    ok &= benchBlockCompress(modelPath);
+    ok &= benchTextureRegistry(modelPath);
+    ok &= benchVirtualTextures();
+    ok &= benchTextureAtlas();
+    return ok ? 0 : 1;
+}
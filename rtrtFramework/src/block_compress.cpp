@@ -0,0 +1,796 @@
+//////////////////////////////////////////////////////////////////////
+// BC1 and BC7 block compression; see block_compress.h.
+//
+// A BC1 block is two 565 colors and a 2 bit index a texel choosing
+// one of them or a third of the way between.  Its endpoints start at
+// the ends of the block's principal axis (inset a little, as the
+// extremes are rarely worth a palette entry), then are refit by least
+// squares to the indices chosen, keeping the best of a few rounds.
+//
+// Of BC7's eight modes, this uses two: mode 6 (one subset, RGBA, 7 bit
+// endpoints each with a p-bit, 4 bit indices) for every block, and for
+// opaque blocks also mode 1 (two subsets, RGB, 6 bit endpoints with a
+// p-bit shared by the subset, 3 bit indices).  Mode 1 is tried in the
+// few partitions whose subsets lie closest to a line each; each
+// subset's endpoints are fit as BC1's are.  The block keeps whichever
+// encoding has the least error.
+//
+// Choosing indices is the inner loop: each texel against each palette
+// entry, four texels at a time with SSE.  Every value is a whole
+// number in float, so the SSE and scalar versions choose the same
+// indices and make identical blocks.
+////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <string.h>
+#include <algorithm>
+#include <utility>
+
+#include "block_compress.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define BLOCK_COMPRESS_X86
+#include <immintrin.h>
+#endif
+
+// Mode 1 partitions fully encoded per opaque block, the best estimates.
+static const int bc7PartitionsTried = 2;
+
+// Refitting rounds of a subset's endpoints.
+static const int fitRounds = 3;
+
+// Mean squared error, per channel, of a mode 6 encoding that is not
+// worth trying to better with mode 1.
+static const float goodEnough = 0.5f;
+
+// BC7's 64 two subset partitions (bit i: texel i is in subset 1), and
+// the anchor texel of subset 1 in each.
+static const uint16_t bc7Partitions[64] = {
+    0xcccc, 0x8888, 0xeeee, 0xecc8, 0xc880, 0xfeec, 0xfec8, 0xec80,
+    0xc800, 0xffec, 0xfe80, 0xe800, 0xffe8, 0xff00, 0xfff0, 0xf000,
+    0xf710, 0x008e, 0x7100, 0x08ce, 0x008c, 0x7310, 0x3100, 0x8cce,
+    0x088c, 0x3110, 0x6666, 0x366c, 0x17e8, 0x0ff0, 0x718e, 0x399c,
+    0xaaaa, 0xf0f0, 0x5a5a, 0x33cc, 0x3c3c, 0x55aa, 0x9696, 0xa55a,
+    0x73ce, 0x13c8, 0x324c, 0x3bdc, 0x6996, 0xc33c, 0x9966, 0x0660,
+    0x0272, 0x04e4, 0x4e40, 0x2720, 0xc936, 0x936c, 0x39c6, 0x639c,
+    0x9336, 0x9cc6, 0x817e, 0xe718, 0xccf0, 0x0fcc, 0x7744, 0xee22,
+};
+static const uint8_t bc7Anchors[64] = {
+    15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15, 15,
+    15,  2,  8,  2,  2,  8,  8, 15,  2,  8,  2,  2,  8,  8,  2,  2,
+    15, 15,  6,  8,  2,  8, 15, 15,  2,  8,  2,  2,  2, 15, 15,  6,
+     6,  2,  6,  8, 15, 15,  2,  2, 15, 15, 15, 15, 15,  2,  2, 15,
+};
+
+// Interpolation weights, out of 64, of 3 and 4 bit indices.
+static const int bc7Weights3[8] = {0, 9, 18, 27, 37, 46, 55, 64};
+static const int bc7Weights4[16] = {0, 4, 9, 13, 17, 21, 26, 30, 34, 38, 43, 47, 51, 55, 60, 64};
+
+uint16_t bc7PartitionMask(int partition) { return bc7Partitions[partition]; }
+int bc7Anchor(int partition) { return bc7Anchors[partition]; }
+
+const char* textureFormatName(TextureFormat format)
+{
+    switch (format) {
+    case TextureFormat::RGBA8: return "RGBA8";
+    case TextureFormat::BC1:   return "BC1";
+    case TextureFormat::BC7:   return "BC7"; }
+    return "?";
+}
+
+////////////////////////////////////////////////////////////////////////
+// Fitting endpoints
+
+// A block's texels, by channel.
+struct BlockTexels
+{
+    float c[4][16];
+};
+
+static void loadBlock(const uint8_t texels[64], BlockTexels& b)
+{
+    for (int i=0;  i<16;  i++)
+        for (int c=0;  c<4;  c++)
+            b.c[c][i] = texels[4*i+c];
+}
+
+static bool inMask(uint16_t mask, int i) { return (mask >> i) & 1; }
+
+// The line that best fits the texels in mask (in their first
+// nbChannels channels): their mean and principal axis.  Returns the
+// texels' squared distance from the line.
+static float principalAxis(const BlockTexels& b, uint16_t mask, int nbChannels,
+                           float mean[4], float axis[4])
+{
+    int n = 0;
+    std::fill(mean, mean+4, 0.0f);
+    std::fill(axis, axis+4, 0.0f);
+    for (int i=0;  i<16;  i++)
+        if (inMask(mask, i)) {
+            n++;
+            for (int c=0;  c<nbChannels;  c++) mean[c] += b.c[c][i]; }
+    if (n == 0) return 0.0f;
+    for (int c=0;  c<nbChannels;  c++) mean[c] /= n;
+
+    float cov[4][4] = {};
+    for (int i=0;  i<16;  i++)
+        if (inMask(mask, i))
+            for (int j=0;  j<nbChannels;  j++)
+                for (int k=0;  k<nbChannels;  k++)
+                    cov[j][k] += (b.c[j][i] - mean[j])*(b.c[k][i] - mean[k]);
+
+    // Power iteration, from the column of the channel varying most.
+    int widest = 0;
+    float trace = 0.0f;
+    for (int c=0;  c<nbChannels;  c++) {
+        trace += cov[c][c];
+        if (cov[c][c] > cov[widest][widest]) widest = c; }
+    if (trace <= 0.0f) return 0.0f;
+    float v[4] = {};
+    for (int c=0;  c<nbChannels;  c++) v[c] = cov[c][widest];
+    for (int iter=0;  iter<8;  iter++) {
+        float w[4] = {}, big = 0.0f;
+        for (int j=0;  j<nbChannels;  j++) {
+            for (int k=0;  k<nbChannels;  k++) w[j] += cov[j][k]*v[k];
+            big = std::max(big, fabsf(w[j])); }
+        if (big == 0.0f) break;
+        for (int c=0;  c<nbChannels;  c++) v[c] = w[c]/big; }
+
+    float length = 0.0f;
+    for (int c=0;  c<nbChannels;  c++) length += v[c]*v[c];
+    if (length == 0.0f) return trace;
+    length = sqrtf(length);
+    float along = 0.0f;
+    for (int j=0;  j<nbChannels;  j++) {
+        axis[j] = v[j]/length;
+        for (int k=0;  k<nbChannels;  k++) along += axis[j]*cov[j][k]*v[k]/length; }
+    return std::max(trace - along, 0.0f);
+}
+
+// The ends of the texels' span along the axis.
+static void axisEndpoints(const BlockTexels& b, uint16_t mask, int nbChannels,
+                          const float mean[4], const float axis[4], float e0[4], float e1[4])
+{
+    float lo = INFINITY, hi = -INFINITY;
+    for (int i=0;  i<16;  i++)
+        if (inMask(mask, i)) {
+            float t = 0.0f;
+            for (int c=0;  c<nbChannels;  c++) t += (b.c[c][i] - mean[c])*axis[c];
+            lo = std::min(lo, t);
+            hi = std::max(hi, t); }
+    if (lo > hi) lo = hi = 0.0f;
+    for (int c=0;  c<4;  c++) {
+        e0[c] = std::min(std::max(mean[c] + lo*axis[c], 0.0f), 255.0f);
+        e1[c] = std::min(std::max(mean[c] + hi*axis[c], 0.0f), 255.0f); }
+}
+
+// The endpoints that minimize the squared error of the texels in mask,
+// given each one's index and each index's weight toward e1.  False
+// (leaving them as they are) if every texel has the same weight.
+static bool fitEndpoints(const BlockTexels& b, uint16_t mask, int nbChannels, const uint8_t idx[16],
+                         const float* weightOf, float e0[4], float e1[4])
+{
+    float aa = 0.0f, ab = 0.0f, bb = 0.0f, xa[4] = {}, xb[4] = {};
+    for (int i=0;  i<16;  i++)
+        if (inMask(mask, i)) {
+            float w = weightOf[idx[i]], a = 1.0f - w;
+            aa += a*a;
+            ab += a*w;
+            bb += w*w;
+            for (int c=0;  c<nbChannels;  c++) {
+                xa[c] += a*b.c[c][i];
+                xb[c] += w*b.c[c][i]; } }
+    float det = aa*bb - ab*ab;
+    if (fabsf(det) < 1e-6f) return false;
+    for (int c=0;  c<nbChannels;  c++) {
+        e0[c] = std::min(std::max((bb*xa[c] - ab*xb[c])/det, 0.0f), 255.0f);
+        e1[c] = std::min(std::max((aa*xb[c] - ab*xa[c])/det, 0.0f), 255.0f); }
+    return true;
+}
+
+// Sums of texels' RGB and its products (rr, gg, bb, rg, rb, gb), from
+// which a set of texels' distance from their best line follows without
+// revisiting them: the trace of their covariance less its largest
+// eigenvalue.
+struct Moments
+{
+    float m[9]{};
+    int n{0};
+    void add(const Moments& o)
+    {
+        for (int k=0;  k<9;  k++) m[k] += o.m[k];
+        n += o.n;
+    }
+    void sub(const Moments& o)
+    {
+        for (int k=0;  k<9;  k++) m[k] -= o.m[k];
+        n -= o.n;
+    }
+};
+
+static Moments texelMoments(const BlockTexels& b, int i)
+{
+    const float r = b.c[0][i], g = b.c[1][i], bl = b.c[2][i];
+    Moments t;
+    t.m[0] = r;    t.m[1] = g;    t.m[2] = bl;
+    t.m[3] = r*r;  t.m[4] = g*g;  t.m[5] = bl*bl;
+    t.m[6] = r*g;  t.m[7] = r*bl; t.m[8] = g*bl;
+    t.n = 1;
+    return t;
+}
+
+static float lineResidual(const Moments& t)
+{
+    if (t.n < 2) return 0.0f;
+    const float* m = t.m;
+    const float inv = 1.0f/t.n;
+    const float cov[3][3] = {
+        {m[3] - m[0]*m[0]*inv, m[6] - m[0]*m[1]*inv, m[7] - m[0]*m[2]*inv},
+        {m[6] - m[0]*m[1]*inv, m[4] - m[1]*m[1]*inv, m[8] - m[1]*m[2]*inv},
+        {m[7] - m[0]*m[2]*inv, m[8] - m[1]*m[2]*inv, m[5] - m[2]*m[2]*inv}};
+    const float trace = cov[0][0] + cov[1][1] + cov[2][2];
+    if (trace <= 0.0f) return 0.0f;
+    int widest = 0;
+    for (int c=1;  c<3;  c++)
+        if (cov[c][c] > cov[widest][widest]) widest = c;
+    float v[3] = {cov[0][widest], cov[1][widest], cov[2][widest]};
+    for (int iter=0;  iter<4;  iter++) {
+        float w[3], big = 0.0f;
+        for (int j=0;  j<3;  j++) {
+            w[j] = cov[j][0]*v[0] + cov[j][1]*v[1] + cov[j][2]*v[2];
+            big = std::max(big, fabsf(w[j])); }
+        if (big == 0.0f) return trace;
+        for (int j=0;  j<3;  j++) v[j] = w[j]/big; }
+    float vv = v[0]*v[0] + v[1]*v[1] + v[2]*v[2], vcv = 0.0f;
+    for (int j=0;  j<3;  j++)
+        vcv += v[j]*(cov[j][0]*v[0] + cov[j][1]*v[1] + cov[j][2]*v[2]);
+    return std::max(trace - vcv/vv, 0.0f);
+}
+
+////////////////////////////////////////////////////////////////////////
+// Choosing indices
+
+struct Palette
+{
+    float c[16][4];
+    int n{0};
+};
+
+// Sets idx to the palette entry nearest each texel in mask (by its
+// first nbChannels channels), and returns their total squared error.
+template <bool Sse>
+static float chooseIndices(const BlockTexels& b, const Palette& p, int nbChannels, uint16_t mask,
+                           uint8_t idx[16])
+{
+    float err = 0.0f;
+#ifdef BLOCK_COMPRESS_X86
+    if constexpr (Sse) {
+        for (int g=0;  g<16;  g+=4) {
+            if (((mask >> g) & 15) == 0) continue;
+            __m128 texel[4];
+            for (int c=0;  c<nbChannels;  c++) texel[c] = _mm_loadu_ps(&b.c[c][g]);
+            __m128 best = _mm_set1_ps(INFINITY), bestIndex = _mm_setzero_ps();
+            for (int k=0;  k<p.n;  k++) {
+                __m128 d = _mm_setzero_ps();
+                for (int c=0;  c<nbChannels;  c++) {
+                    __m128 diff = _mm_sub_ps(texel[c], _mm_set1_ps(p.c[k][c]));
+                    d = _mm_add_ps(d, _mm_mul_ps(diff, diff)); }
+                __m128 nearer = _mm_cmplt_ps(d, best);
+                best = _mm_min_ps(d, best);
+                bestIndex = _mm_or_ps(_mm_and_ps(nearer, _mm_set1_ps(float(k))),
+                                      _mm_andnot_ps(nearer, bestIndex)); }
+            float dist[4], index[4];
+            _mm_storeu_ps(dist, best);
+            _mm_storeu_ps(index, bestIndex);
+            for (int i=0;  i<4;  i++)
+                if (inMask(mask, g+i)) {
+                    idx[g+i] = uint8_t(index[i]);
+                    err += dist[i]; } }
+        return err; }
+#endif
+    for (int i=0;  i<16;  i++) {
+        if (!inMask(mask, i)) continue;
+        float best = INFINITY;
+        for (int k=0;  k<p.n;  k++) {
+            float d = 0.0f;
+            for (int c=0;  c<nbChannels;  c++) {
+                float diff = b.c[c][i] - p.c[k][c];
+                d = d + diff*diff; }
+            if (d < best) {
+                best = d;
+                idx[i] = uint8_t(k); } }
+        err += best; }
+    return err;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Bits of a block, least significant first
+
+struct BitWriter
+{
+    uint8_t* out;
+    int pos{0};
+    void put(uint32_t v, int n)
+    {
+        for (int i=0;  i<n;  i++, pos++)
+            if ((v >> i) & 1) out[pos >> 3] |= uint8_t(1 << (pos & 7));
+    }
+};
+
+struct BitReader
+{
+    const uint8_t* in;
+    int pos{0};
+    uint32_t get(int n)
+    {
+        uint32_t v = 0;
+        for (int i=0;  i<n;  i++, pos++)
+            v |= uint32_t((in[pos >> 3] >> (pos & 7)) & 1) << i;
+        return v;
+    }
+};
+
+////////////////////////////////////////////////////////////////////////
+// BC1
+
+static uint16_t pack565(const float e[4])
+{
+    int r = std::min(int(e[0]*31.0f/255.0f + 0.5f), 31);
+    int g = std::min(int(e[1]*63.0f/255.0f + 0.5f), 63);
+    int b = std::min(int(e[2]*31.0f/255.0f + 0.5f), 31);
+    return uint16_t((r << 11) | (g << 5) | b);
+}
+
+static void unpack565(uint16_t v, int e[3])
+{
+    int r = (v >> 11) & 31, g = (v >> 5) & 63, b = v & 31;
+    e[0] = (r << 3) | (r >> 2);
+    e[1] = (g << 2) | (g >> 4);
+    e[2] = (b << 3) | (b >> 2);
+}
+
+// The four colors of a block in its 4 color mode.
+static Palette bc1Palette(uint16_t c0, uint16_t c1)
+{
+    int a[3], b[3];
+    unpack565(c0, a);
+    unpack565(c1, b);
+    Palette p;
+    p.n = 4;
+    for (int c=0;  c<3;  c++) {
+        p.c[0][c] = float(a[c]);
+        p.c[1][c] = float(b[c]);
+        p.c[2][c] = float((2*a[c] + b[c] + 1)/3);
+        p.c[3][c] = float((a[c] + 2*b[c] + 1)/3); }
+    for (int k=0;  k<4;  k++) p.c[k][3] = 255.0f;
+    return p;
+}
+
+template <bool Sse>
+static void encodeBC1(const BlockTexels& b, uint8_t out[8])
+{
+    static const float weightOf[4] = {0.0f, 1.0f, 1.0f/3.0f, 2.0f/3.0f};
+    float mean[4], axis[4], e0[4], e1[4];
+    principalAxis(b, 0xffff, 3, mean, axis);
+    axisEndpoints(b, 0xffff, 3, mean, axis, e0, e1);
+    for (int c=0;  c<3;  c++) {
+        float inset = (e1[c] - e0[c])/16.0f;
+        e0[c] += inset;
+        e1[c] -= inset; }
+
+    uint16_t best0 = 0, best1 = 0;
+    uint8_t bestIdx[16] = {};
+    float bestErr = INFINITY;
+    for (int round=0;  round<fitRounds;  round++) {
+        uint16_t c0 = pack565(e0), c1 = pack565(e1);
+        uint8_t idx[16] = {};
+        float err = chooseIndices<Sse>(b, bc1Palette(c0, c1), 3, 0xffff, idx);
+        if (err < bestErr) {
+            bestErr = err;
+            best0 = c0;
+            best1 = c1;
+            std::copy(idx, idx+16, bestIdx); }
+        if (err == 0.0f || !fitEndpoints(b, 0xffff, 3, idx, weightOf, e0, e1)) break; }
+
+    // The 4 color mode needs c0 > c1.  Swapping the endpoints swaps
+    // indices 0 and 1, and 2 and 3; equal endpoints need index 0 only.
+    if (best0 < best1) {
+        std::swap(best0, best1);
+        for (uint8_t& i : bestIdx) i ^= 1; }
+    if (best0 == best1)
+        std::fill(bestIdx, bestIdx+16, uint8_t(0));
+
+    memset(out, 0, 8);
+    BitWriter w{out};
+    w.put(best0, 16);
+    w.put(best1, 16);
+    for (int i=0;  i<16;  i++) w.put(bestIdx[i], 2);
+}
+
+void decodeBC1Block(const uint8_t block[8], uint8_t texels[64])
+{
+    BitReader r{block};
+    uint16_t c0 = uint16_t(r.get(16)), c1 = uint16_t(r.get(16));
+    Palette p = bc1Palette(c0, c1);
+    if (c0 <= c1) {
+        // 3 colors and transparent black.
+        int a[3], b[3];
+        unpack565(c0, a);
+        unpack565(c1, b);
+        for (int c=0;  c<3;  c++) {
+            p.c[2][c] = float((a[c] + b[c] + 1)/2);
+            p.c[3][c] = 0.0f; }
+        p.c[3][3] = 0.0f; }
+    for (int i=0;  i<16;  i++) {
+        int k = int(r.get(2));
+        for (int c=0;  c<4;  c++) texels[4*i+c] = uint8_t(p.c[k][c]); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// BC7
+
+// A mode's endpoint and index precision.
+struct Bc7Mode
+{
+    int endpointBits;   // Without the p-bit
+    bool sharedPBit;    // One p-bit for both endpoints of a subset
+    int indexBits;
+    int nbChannels;     // 3: RGB, with alpha 255
+};
+static const Bc7Mode bc7Mode1{6, true, 3, 3};
+static const Bc7Mode bc7Mode6{7, false, 4, 4};
+
+// One subset's encoding.
+struct SubsetFit
+{
+    int q[2][4]{};      // Endpoints at the mode's precision
+    int p[2]{};         // Their p-bits
+    uint8_t idx[16]{};  // Of the texels in the subset
+    float err{INFINITY};
+};
+
+// An endpoint channel with its p-bit, expanded to 8 bits.
+static int bc7Unquantize(int q, int p, int endpointBits)
+{
+    int v = (q << 1) | p, n = endpointBits + 1;
+    return (v << (8-n)) | (v >> (2*n-8));
+}
+
+// Rounds endpoint e to the mode's precision with p-bit p, returning
+// its squared error.
+static float quantizeEndpoint(const float e[4], int p, const Bc7Mode& m, int q[4])
+{
+    const int top = (1 << m.endpointBits) - 1;
+    float err = 0.0f;
+    for (int c=0;  c<m.nbChannels;  c++) {
+        int guess = int((e[c]*(2*top+1)/255.0f - p)/2.0f + 0.5f);
+        float best = INFINITY;
+        for (int k=guess-1;  k<=guess+1;  k++) {
+            int qk = std::min(std::max(k, 0), top);
+            float d = bc7Unquantize(qk, p, m.endpointBits) - e[c];
+            if (d*d < best) {
+                best = d*d;
+                q[c] = qk; } }
+        err += best; }
+    return err;
+}
+
+// Both endpoints of a subset, with the p-bits that fit them best.
+static void quantizeEndpoints(const float e[2][4], const Bc7Mode& m, SubsetFit& f)
+{
+    if (m.sharedPBit) {
+        float best = INFINITY;
+        for (int p=0;  p<2;  p++) {
+            int q0[4] = {}, q1[4] = {};
+            float err = quantizeEndpoint(e[0], p, m, q0) + quantizeEndpoint(e[1], p, m, q1);
+            if (err < best) {
+                best = err;
+                f.p[0] = f.p[1] = p;
+                std::copy(q0, q0+4, f.q[0]);
+                std::copy(q1, q1+4, f.q[1]); } }
+        return; }
+    for (int end=0;  end<2;  end++) {
+        float best = INFINITY;
+        for (int p=0;  p<2;  p++) {
+            int q[4] = {};
+            float err = quantizeEndpoint(e[end], p, m, q);
+            if (err < best) {
+                best = err;
+                f.p[end] = p;
+                std::copy(q, q+4, f.q[end]); } } }
+}
+
+static void bc7Endpoints(const SubsetFit& f, const Bc7Mode& m, int e[2][4])
+{
+    for (int end=0;  end<2;  end++)
+        for (int c=0;  c<4;  c++)
+            e[end][c] = c < m.nbChannels ? bc7Unquantize(f.q[end][c], f.p[end], m.endpointBits) : 255;
+}
+
+static Palette bc7Palette(const int e[2][4], int indexBits)
+{
+    const int* weights = indexBits == 3 ? bc7Weights3 : bc7Weights4;
+    Palette p;
+    p.n = 1 << indexBits;
+    for (int k=0;  k<p.n;  k++)
+        for (int c=0;  c<4;  c++)
+            p.c[k][c] = float(((64 - weights[k])*e[0][c] + weights[k]*e[1][c] + 32) >> 6);
+    return p;
+}
+
+template <bool Sse>
+static SubsetFit fitSubset(const BlockTexels& b, uint16_t mask, const Bc7Mode& m)
+{
+    const int* weights = m.indexBits == 3 ? bc7Weights3 : bc7Weights4;
+    float weightOf[16];
+    for (int k=0;  k<(1 << m.indexBits);  k++) weightOf[k] = weights[k]/64.0f;
+
+    float mean[4], axis[4], e[2][4];
+    principalAxis(b, mask, m.nbChannels, mean, axis);
+    axisEndpoints(b, mask, m.nbChannels, mean, axis, e[0], e[1]);
+
+    SubsetFit best;
+    for (int round=0;  round<fitRounds;  round++) {
+        SubsetFit fit;
+        quantizeEndpoints(e, m, fit);
+        int ends[2][4];
+        bc7Endpoints(fit, m, ends);
+        fit.err = chooseIndices<Sse>(b, bc7Palette(ends, m.indexBits), m.nbChannels, mask, fit.idx);
+        if (fit.err < best.err) best = fit;
+        if (fit.err == 0.0f || !fitEndpoints(b, mask, m.nbChannels, fit.idx, weightOf, e[0], e[1]))
+            break; }
+    return best;
+}
+
+// The anchor texel's index is written without its top bit, which must
+// be 0: if not, swap the subset's endpoints and invert its indices.
+// (The weights are symmetric, so the texels' colors are unchanged.)
+static void fixAnchor(SubsetFit& f, uint16_t mask, int anchor, int indexBits)
+{
+    const int top = (1 << indexBits) - 1;
+    if (f.idx[anchor] <= top/2) return;
+    std::swap(f.q[0], f.q[1]);
+    std::swap(f.p[0], f.p[1]);
+    for (int i=0;  i<16;  i++)
+        if (inMask(mask, i)) f.idx[i] = uint8_t(top - f.idx[i]);
+}
+
+static void writeMode6(SubsetFit f, uint8_t out[16])
+{
+    fixAnchor(f, 0xffff, 0, 4);
+    memset(out, 0, 16);
+    BitWriter w{out};
+    w.put(1 << 6, 7);
+    for (int c=0;  c<4;  c++)
+        for (int end=0;  end<2;  end++) w.put(f.q[end][c], 7);
+    w.put(f.p[0], 1);
+    w.put(f.p[1], 1);
+    for (int i=0;  i<16;  i++) w.put(f.idx[i], i == 0 ? 3 : 4);
+}
+
+static void writeMode1(int partition, SubsetFit s[2], uint8_t out[16])
+{
+    const uint16_t mask = bc7Partitions[partition];
+    const int anchor = bc7Anchors[partition];
+    fixAnchor(s[0], uint16_t(~mask), 0, 3);
+    fixAnchor(s[1], mask, anchor, 3);
+    memset(out, 0, 16);
+    BitWriter w{out};
+    w.put(1 << 1, 2);
+    w.put(partition, 6);
+    for (int c=0;  c<3;  c++)
+        for (int k=0;  k<2;  k++)
+            for (int end=0;  end<2;  end++) w.put(s[k].q[end][c], 6);
+    w.put(s[0].p[0], 1);
+    w.put(s[1].p[0], 1);
+    for (int i=0;  i<16;  i++)
+        w.put(s[inMask(mask, i)].idx[i], i == 0 || i == anchor ? 2 : 3);
+}
+
+template <bool Sse>
+static void encodeBC7(const BlockTexels& b, uint8_t out[16])
+{
+    bool opaque = true;
+    for (int i=0;  i<16;  i++) opaque &= b.c[3][i] == 255.0f;
+
+    SubsetFit single = fitSubset<Sse>(b, 0xffff, bc7Mode6);
+    int bestPartition = -1;
+    float bestErr = single.err;
+    SubsetFit pair[2];
+    if (opaque && single.err > 16.0f*3*goodEnough) {
+        // The partitions whose subsets are each nearest a line.
+        Moments texel[16], all;
+        for (int i=0;  i<16;  i++) {
+            texel[i] = texelMoments(b, i);
+            all.add(texel[i]); }
+        std::pair<float, int> estimates[64];
+        for (int p=0;  p<64;  p++) {
+            Moments one, zero = all;
+            for (int i=0;  i<16;  i++)
+                if (inMask(bc7Partitions[p], i)) one.add(texel[i]);
+            zero.sub(one);
+            estimates[p] = {lineResidual(zero) + lineResidual(one), p}; }
+        std::partial_sort(estimates, estimates + bc7PartitionsTried, estimates + 64);
+        for (int k=0;  k<bc7PartitionsTried;  k++) {
+            const int p = estimates[k].second;
+            SubsetFit s[2] = {fitSubset<Sse>(b, uint16_t(~bc7Partitions[p]), bc7Mode1),
+                              fitSubset<Sse>(b, bc7Partitions[p], bc7Mode1)};
+            if (s[0].err + s[1].err < bestErr) {
+                bestErr = s[0].err + s[1].err;
+                bestPartition = p;
+                pair[0] = s[0];
+                pair[1] = s[1]; } } }
+
+    if (bestPartition < 0)
+        writeMode6(single, out);
+    else
+        writeMode1(bestPartition, pair, out);
+}
+
+void decodeBC7Block(const uint8_t block[16], uint8_t texels[64])
+{
+    BitReader r{block};
+    int mode = 0;
+    while (mode < 8 && r.get(1) == 0) mode++;
+
+    SubsetFit s[2];
+    uint16_t mask = 0;
+    const Bc7Mode* m = nullptr;
+    if (mode == 6) {
+        m = &bc7Mode6;
+        for (int c=0;  c<4;  c++)
+            for (int end=0;  end<2;  end++) s[0].q[end][c] = int(r.get(7));
+        s[0].p[0] = int(r.get(1));
+        s[0].p[1] = int(r.get(1));
+        for (int i=0;  i<16;  i++) s[0].idx[i] = uint8_t(r.get(i == 0 ? 3 : 4)); }
+    else if (mode == 1) {
+        m = &bc7Mode1;
+        int partition = int(r.get(6));
+        mask = bc7Partitions[partition];
+        for (int c=0;  c<3;  c++)
+            for (int k=0;  k<2;  k++)
+                for (int end=0;  end<2;  end++) s[k].q[end][c] = int(r.get(6));
+        for (int k=0;  k<2;  k++) s[k].p[0] = s[k].p[1] = int(r.get(1));
+        for (int i=0;  i<16;  i++) {
+            uint8_t index = uint8_t(r.get(i == 0 || i == bc7Anchors[partition] ? 2 : 3));
+            s[inMask(mask, i)].idx[i] = index; } }
+    else {
+        // Not written by this encoder: transparent black, as a
+        // reserved mode decodes.
+        memset(texels, 0, 64);
+        return; }
+
+    Palette p[2];
+    for (int k=0;  k<2;  k++) {
+        int e[2][4];
+        bc7Endpoints(s[k], *m, e);
+        p[k] = bc7Palette(e, m->indexBits); }
+    for (int i=0;  i<16;  i++) {
+        int k = inMask(mask, i);
+        for (int c=0;  c<4;  c++) texels[4*i+c] = uint8_t(p[k].c[s[k].idx[i]][c]); }
+}
+
+////////////////////////////////////////////////////////////////////////
+// Blocks and textures
+
+void encodeBC1Block(const uint8_t texels[64], uint8_t block[8], SimdLevel simd)
+{
+    BlockTexels b;
+    loadBlock(texels, b);
+#ifdef BLOCK_COMPRESS_X86
+    if (simd != SimdLevel::Scalar) {
+        encodeBC1<true>(b, block);
+        return; }
+#endif
+    encodeBC1<false>(b, block);
+}
+
+void encodeBC7Block(const uint8_t texels[64], uint8_t block[16], SimdLevel simd)
+{
+    BlockTexels b;
+    loadBlock(texels, b);
+#ifdef BLOCK_COMPRESS_X86
+    if (simd != SimdLevel::Scalar) {
+        encodeBC7<true>(b, block);
+        return; }
+#endif
+    encodeBC7<false>(b, block);
+}
+
+TextureFormat chooseBlockFormat(const DecodedTexture& texture)
+{
+    const TextureLevel& top = texture.levels[0];
+    const uint8_t* texels = texture.data() + top.offset;
+    for (size_t i=3;  i<top.size();  i+=4)
+        if (texels[i] != 255) return TextureFormat::BC7;
+    return TextureFormat::BC1;
+}
+
+// The 4x4 texels of block (bx,by) of an RGBA8 image, repeating the
+// last column and row past its edges.
+static void gatherBlock(const uint8_t* image, int width, int height, int bx, int by, uint8_t texels[64])
+{
+    for (int y=0;  y<4;  y++)
+        for (int x=0;  x<4;  x++) {
+            int sx = std::min(4*bx + x, width-1), sy = std::min(4*by + y, height-1);
+            memcpy(&texels[4*(4*y+x)], image + 4*(size_t(sy)*width + sx), 4); }
+}
+
+void compressTexture(DecodedTexture& texture, TextureFormat format, SimdLevel simd)
+{
+    if (texture.format() != TextureFormat::RGBA8 || format == TextureFormat::RGBA8) return;
+    ThreadPool& pool = ThreadPool::global();
+    const size_t blockBytes = format == TextureFormat::BC1 ? 8 : 16;
+    const int nbChannels = format == TextureFormat::BC1 ? 3 : 4;
+
+    std::vector<TextureLevel> levels = texture.levels;
+    size_t bytes = 0;
+    for (TextureLevel& level : levels) {
+        level.format = format;
+        level.offset = bytes;
+        bytes += level.size(); }
+    std::vector<uint8_t> blocks(bytes);
+
+    // The top level's error is measured as it is encoded, a sum per
+    // row of blocks.
+    std::vector<double> rowError;
+    for (size_t l=0;  l<levels.size();  l++) {
+        const TextureLevel& from = texture.levels[l];
+        const uint8_t* image = texture.data() + from.offset;
+        const int bw = (from.width+3)/4, bh = (from.height+3)/4;
+        if (l == 0) rowError.assign(bh, 0.0);
+        pool.parallelFor(bh, [&](size_t by) {
+            uint8_t texels[64], decoded[64];
+            for (int bx=0;  bx<bw;  bx++) {
+                gatherBlock(image, from.width, from.height, bx, int(by), texels);
+                uint8_t* block = &blocks[levels[l].offset + (by*bw + bx)*blockBytes];
+                if (format == TextureFormat::BC1) {
+                    encodeBC1Block(texels, block, simd);
+                    if (l == 0) decodeBC1Block(block, decoded); }
+                else {
+                    encodeBC7Block(texels, block, simd);
+                    if (l == 0) decodeBC7Block(block, decoded); }
+                if (l != 0) continue;
+                for (int y=0;  y<4 && 4*int(by)+y<from.height;  y++)
+                    for (int x=0;  x<4 && 4*bx+x<from.width;  x++)
+                        for (int c=0;  c<nbChannels;  c++) {
+                            double d = double(texels[4*(4*y+x)+c]) - decoded[4*(4*y+x)+c];
+                            rowError[by] += d*d; } } }); }
+
+    double sum = 0.0;
+    for (double e : rowError) sum += e;
+    double mse = sum/(double(texture.width)*texture.height*nbChannels);
+    texture.psnr = mse > 0.0 ? float(10.0*log10(255.0*255.0/mse)) : 99.0f;
+    texture.pixels.swap(blocks);
+    texture.file.reset();
+    texture.levels = levels;
+}
+
+void compressTexture(DecodedTexture& texture, TextureFormat format)
+{
+    compressTexture(texture, format, bestSimdLevel());
+}
+
+std::vector<uint8_t> decompressLevel(const DecodedTexture& texture, size_t l)
+{
+    const TextureLevel& level = texture.levels[l];
+    const uint8_t* data = texture.data() + level.offset;
+    std::vector<uint8_t> image(size_t(level.width)*level.height*4);
+    if (level.format == TextureFormat::RGBA8) {
+        memcpy(image.data(), data, image.size());
+        return image; }
+
+    const size_t blockBytes = level.format == TextureFormat::BC1 ? 8 : 16;
+    const int bw = (level.width+3)/4, bh = (level.height+3)/4;
+    for (int by=0;  by<bh;  by++)
+        for (int bx=0;  bx<bw;  bx++) {
+            uint8_t texels[64];
+            const uint8_t* block = data + (size_t(by)*bw + bx)*blockBytes;
+            if (level.format == TextureFormat::BC1) decodeBC1Block(block, texels);
+            else decodeBC7Block(block, texels);
+            for (int y=0;  y<4 && 4*by+y<level.height;  y++)
+                for (int x=0;  x<4 && 4*bx+x<level.width;  x++)
+                    memcpy(&image[4*(size_t(4*by+y)*level.width + 4*bx+x)], &texels[4*(4*y+x)], 4); }
+    return image;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "texture_decode.h"
+#include "vertex_transform.h"  // SimdLevel
+
+// BC1 and BC7 block compression of a texture's mip levels, done once
+// when the texture cache is written (or with each load, without the
+// cache).  An opaque texture becomes BC1, 8 bytes a 4x4 block (an
+// eighth of RGBA8); one with any alpha becomes BC7, 16 bytes a block,
+// which also keeps opaque color better.  The blocks are split across
+// the global thread pool, and every block is encoded the same way
+// whatever the thread count or SIMD level.
+
+const char* textureFormatName(TextureFormat format);
+
+// BC1 if every texel of the top level is opaque, else BC7.
+TextureFormat chooseBlockFormat(const DecodedTexture& texture);
+
+// Replaces every RGBA8 level of a texture by its blocks in format (BC1
+// or BC7), and sets its psnr to that of its top level.
+void compressTexture(DecodedTexture& texture, TextureFormat format);
+void compressTexture(DecodedTexture& texture, TextureFormat format, SimdLevel level);
+
+// The RGBA8 texels of one level of a compressed texture, for devices
+// without the formats (and for measuring).
+std::vector<uint8_t> decompressLevel(const DecodedTexture& texture, size_t level);
+
+// One block of 4x4 RGBA8 texels, row by row, to and from its encoding.
+// The BC7 decoder knows only the modes the encoder writes, 1 and 6.
+void encodeBC1Block(const uint8_t texels[64], uint8_t block[8], SimdLevel level);
+void encodeBC7Block(const uint8_t texels[64], uint8_t block[16], SimdLevel level);
+void decodeBC1Block(const uint8_t block[8], uint8_t texels[64]);
+void decodeBC7Block(const uint8_t block[16], uint8_t texels[64]);
+
+// BC7's two subset partitions: bit i is set if texel i is in subset 1,
+// whose anchor (the texel with an implied index bit) is bc7Anchor.
+uint16_t bc7PartitionMask(int partition);
+int bc7Anchor(int partition);
@@ -2,7 +2,7 @@
 #include "vkapp.h"
 
 void VkApp::initBufferWrap(BufferWrap& wrap, VkDeviceSize size, VkBufferUsageFlags usage,
-                           VkMemoryPropertyFlags properties)
+                           VkMemoryPropertyFlags properties, MemCategory category)
 {
     VkBufferCreateInfo bufferInfo{VK_STRUCTURE_TYPE_BUFFER_CREATE_INFO};
     bufferInfo.size = size;
@@ -26,6 +26,10 @@ void VkApp::initBufferWrap(BufferWrap& wrap, VkDeviceSize size, VkBufferUsageFla
     vkBindBufferMemory(m_device, wrap.buffer, wrap.memory, 0);
 
     // @@ Verify success of vkAllocateMemory and vkBindBufferMemory.
+
+    wrap.allocSize = memRequirements.size;
+    wrap.category = category;
+    MemoryStats::global().allocate(category, wrap.allocSize);
 }
 
 
@@ -39,7 +43,8 @@ void VkApp::initImageWrap(ImageWrap& wrap,
                           VkMemoryPropertyFlags properties,
                           VkImageAspectFlagBits aspect,
                           VkImageLayout layout,
-                          uint mipLevels)
+                          uint mipLevels,
+                          MemCategory category)
 {
     // Create the VkImage
     VkImageCreateInfo imageInfo{VK_STRUCTURE_TYPE_IMAGE_CREATE_INFO};
@@ -71,6 +76,10 @@ void VkApp::initImageWrap(ImageWrap& wrap,
     
     vkBindImageMemory(m_device, wrap.image, wrap.memory, 0);
 
+    wrap.allocSize = memRequirements.size;
+    wrap.category = category;
+    MemoryStats::global().allocate(category, wrap.allocSize);
+
     // Create the associated VkImageView
     VkImageViewCreateInfo viewInfo{VK_STRUCTURE_TYPE_IMAGE_VIEW_CREATE_INFO};
     viewInfo.image = wrap.image;
@@ -107,18 +116,15 @@ void VkApp::initImageWrap(ImageWrap& wrap,
         VkPipelineStageFlags sourceStage = VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT;
         VkPipelineStageFlags destinationStage = VK_PIPELINE_STAGE_TRANSFER_BIT;
 
-        VkCommandBuffer commandBuffer = createTempCmdBuffer();
-
-        vkCmdPipelineBarrier(commandBuffer, sourceStage, destinationStage, 0,
+        // Recorded with the uploads, which are submitted before any use of the image.
+        vkCmdPipelineBarrier(uploadCommandBuffer(), sourceStage, destinationStage, 0,
                              0, nullptr,    0, nullptr,    1, &barrier);
-        
-        submitTempCmdBuffer(commandBuffer);
     }
 
     // @@ Verify success for vkCreateImage,  vkAllocateMemory, vkCreateImageView
 }
 
-void VkApp::initTextureSampler(ImageWrap& wrap)
+void VkApp::initTextureSampler(ImageWrap& wrap, float maxLod)
 {
     VkPhysicalDeviceProperties properties{};
     vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
@@ -136,6 +142,7 @@ void VkApp::initTextureSampler(ImageWrap& wrap)
     samplerInfo.compareEnable = VK_FALSE;
     samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
     samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_LINEAR;
+    samplerInfo.maxLod = maxLod;
 
     vkCreateSampler(m_device, &samplerInfo, nullptr, &wrap.sampler);
     
@@ -144,38 +151,24 @@ void VkApp::initTextureSampler(ImageWrap& wrap)
 
 
 void VkApp::initBufferWrapFromData(BufferWrap& wrap,
-                                   const VkCommandBuffer& cmdBuf,
                                    const VkDeviceSize&    size,
                                    const void*            data,
-                                   VkBufferUsageFlags     usage)
+                                   VkBufferUsageFlags     usage,
+                                   MemCategory            category)
 {
-    BufferWrap staging;
-    initBufferWrap(staging, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
-
-    void* dest;
-    vkMapMemory(m_device, staging.memory, 0, size, 0, &dest);
-    memcpy(dest, data, size);
-    vkUnmapMemory(m_device, staging.memory);
-
-    
     initBufferWrap(wrap, size, VK_BUFFER_USAGE_TRANSFER_DST_BIT | usage,
-                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    copyBuffer(staging.buffer, wrap.buffer, size);
-
-    staging.destroy(m_device);
+                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, category);
+    updateBufferWrap(wrap, size, data);
 }
 
-void VkApp::copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size)
+void VkApp::updateBufferWrap(BufferWrap& wrap, VkDeviceSize size, const void* data)
 {
-    VkCommandBuffer commandBuffer =  createTempCmdBuffer();
-
+    assert(size <= wrap.allocSize);
+    if (size == 0) return;
     VkBufferCopy copyRegion{};
+    VkBuffer staging = stageUpload(data, size, copyRegion.srcOffset);
     copyRegion.size = size;
-    vkCmdCopyBuffer(commandBuffer, srcBuffer, dstBuffer, 1, &copyRegion);
-
-    submitTempCmdBuffer(commandBuffer);
+    vkCmdCopyBuffer(uploadCommandBuffer(), staging, wrap.buffer, 1, &copyRegion);
 }
 
 // Gets a list of memory types supported by the GPU, and search
@@ -3,20 +3,30 @@
 #include <vulkan/vulkan_core.h>
 #include <iostream>
 
+#include "memory_stats.h"
+
 class VkApp;
 
 struct BufferWrap
 {
     VkBuffer buffer;
     VkDeviceMemory memory;
+    VkDeviceSize allocSize;     // Size of memory, as counted by MemoryStats
+    MemCategory category;
 
-    BufferWrap() : buffer(VK_NULL_HANDLE),  memory(VK_NULL_HANDLE)
+    BufferWrap() : buffer(VK_NULL_HANDLE),  memory(VK_NULL_HANDLE),
+                   allocSize(0), category(MemCategory::Other)
     {};
     
     void destroy(VkDevice& device)
     {
         vkDestroyBuffer(device, buffer, nullptr);
         vkFreeMemory(device, memory, nullptr);
+        if (allocSize != 0)
+            MemoryStats::global().release(category, allocSize);
+        allocSize = 0;
+        buffer = VK_NULL_HANDLE;  // Destroying twice is harmless
+        memory = VK_NULL_HANDLE;
     }
 };
 
@@ -26,6 +36,8 @@ struct ImageWrap
     VkDeviceMemory   memory{};
     VkImageView      imageView{};
     VkSampler        sampler{};
+    VkDeviceSize     allocSize{0};  // Size of memory, as counted by MemoryStats
+    MemCategory      category{MemCategory::Other};
     
     ImageWrap() : image(VK_NULL_HANDLE),  memory(VK_NULL_HANDLE),
                   imageView(VK_NULL_HANDLE), sampler(VK_NULL_HANDLE)
@@ -37,6 +49,13 @@ struct ImageWrap
         vkFreeMemory(device, memory, nullptr);
         vkDestroyImageView(device, imageView, nullptr);
         vkDestroySampler(device, sampler, nullptr);
+        if (allocSize != 0)
+            MemoryStats::global().release(category, allocSize);
+        allocSize = 0;
+        image = VK_NULL_HANDLE;
+        memory = VK_NULL_HANDLE;
+        imageView = VK_NULL_HANDLE;
+        sampler = VK_NULL_HANDLE;
     }
     
     VkDescriptorImageInfo Descriptor(VkImageLayout layout=VK_IMAGE_LAYOUT_GENERAL) const 
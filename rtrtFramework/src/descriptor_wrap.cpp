@@ -21,6 +21,7 @@ void DescriptorWrap::setBindings(const VkDevice device, std::vector<VkDescriptor
     std::vector<VkDescriptorPoolSize> poolSizes;
     
     for (auto it = bindingTable.cbegin(); it != bindingTable.cend(); ++it)  {
+        if (it->descriptorCount == 0) continue;  // (e.g. the textures of a model with none)
         bool found = false;
         for (auto itpool = poolSizes.begin(); itpool != poolSizes.end(); ++itpool) {
             if(itpool->type == it->descriptorType) {
@@ -113,6 +114,7 @@ void DescriptorWrap::write(VkDevice& device, uint index, const std::vector<Image
     std::vector<VkDescriptorImageInfo> des;
     for(auto& texture : textures)
         des.emplace_back(texture.Descriptor(VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL));
+    if (des.empty()) return;
 
     VkWriteDescriptorSet writeSet{VK_STRUCTURE_TYPE_WRITE_DESCRIPTOR_SET};
     writeSet.dstSet          = descSet;
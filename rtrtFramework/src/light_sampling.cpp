@@ -0,0 +1,340 @@
+//////////////////////////////////////////////////////////////////////
+// Power weighted emitter selection.  Picking emitters uniformly
+// wastes most shadow rays on small, dim lights when a scene also has
+// a few large bright ones.  The alias table lets the shader pick an
+// emitter with probability proportional to its power using one
+// random bin and one coin flip.
+//
+// The table is built with Vose's variant of Walker's method from:
+//   Vose, "A Linear Algorithm for Generating Random Numbers with a
+//   Given Distribution", IEEE Trans. Software Eng., 1991.
+////////////////////////////////////////////////////////////////////////
+
+#include <float.h>
+#include <math.h>
+#include <algorithm>
+
+#include "light_sampling.h"
+
+float emitterPower(const Emitter& emitter)
+{
+    const glm::vec3& e = emitter.emission;
+    return emitter.area * (0.2126f*e.r + 0.7152f*e.g + 0.0722f*e.b);
+}
+
+std::vector<LightAlias> buildLightAlias(const std::vector<Emitter>& emitters)
+{
+    size_t n = emitters.size();
+    std::vector<LightAlias> table(n);
+    if (n == 0) return table;
+
+    // Weights in double, so the bins' probabilities add up closely
+    // even with millions of emitters.
+    std::vector<double> weight(n);
+    double total = 0.0;
+    for (size_t i=0;  i<n;  i++) {
+        weight[i] = std::max(double(emitterPower(emitters[i])), 0.0);
+        total += weight[i]; }
+    if (!(total > 0.0)) {
+        std::fill(weight.begin(), weight.end(), 1.0);
+        total = double(n); }
+
+    // Scale so the average bin holds 1, then split the bins into
+    // those under and over that.
+    std::vector<double> scaled(n);
+    std::vector<uint32_t> small, large;
+    for (size_t i=0;  i<n;  i++) {
+        table[i].pdf = float(weight[i]/total);
+        scaled[i] = weight[i]*n/total;
+        if (scaled[i] < 1.0) small.push_back(uint32_t(i));
+        else large.push_back(uint32_t(i)); }
+
+    // Each small bin is topped up from a large one, which shrinks
+    // and may itself become small.
+    while (!small.empty() && !large.empty()) {
+        uint32_t s = small.back();  small.pop_back();
+        uint32_t l = large.back();
+        table[s].prob  = float(scaled[s]);
+        table[s].alias = l;
+        scaled[l] = (scaled[l] + scaled[s]) - 1.0;
+        if (scaled[l] < 1.0) {
+            large.pop_back();
+            small.push_back(l); } }
+
+    // What is left is 1 up to rounding.
+    for (uint32_t i : large) table[i] = {1.0f, i, table[i].pdf};
+    for (uint32_t i : small) table[i] = {1.0f, i, table[i].pdf};
+    return table;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Light BVH.  The importance measure and the build's cost function
+// follow:
+//   Conty Estevez, Kulla, "Importance Sampling of Many Lights with
+//   Adaptive Tree Splitting", HPG 2018,
+// as simplified in pbrt-v4's BVHLightSampler.  All emitters are
+// diffuse, so light falls off to nothing at 90 degrees from the
+// normal, and two sided.
+////////////////////////////////////////////////////////////////////////
+
+static const float PI = 3.14159265358979f;
+
+// A cone of directions: those within acos(cosTheta) of w.
+struct DirectionCone
+{
+    glm::vec3 w{0.0f, 0.0f, 1.0f};
+    float cosTheta{1.0f};
+    bool  empty{true};
+
+    static DirectionCone entireSphere() { return {glm::vec3(0,0,1), -1.0f, false}; }
+};
+
+static float safeAcos(float c) { return acosf(glm::clamp(c, -1.0f, 1.0f)); }
+
+// The smallest cone containing both a and b (or a slightly larger
+// one).
+static DirectionCone coneUnion(const DirectionCone& a, const DirectionCone& b)
+{
+    if (a.empty) return b;
+    if (b.empty) return a;
+    if (a.cosTheta == -1.0f) return a;
+    if (b.cosTheta == -1.0f) return b;
+    // Most unions add one emitter's normal, often already inside.
+    if (b.cosTheta == 1.0f && glm::dot(a.w, b.w) >= a.cosTheta) return a;
+    if (a.cosTheta == 1.0f && glm::dot(a.w, b.w) >= b.cosTheta) return b;
+
+    float thetaA = safeAcos(a.cosTheta), thetaB = safeAcos(b.cosTheta);
+    float thetaD = safeAcos(glm::dot(a.w, b.w));
+    if (std::min(thetaD + thetaB, PI) <= thetaA) return a;
+    if (std::min(thetaD + thetaA, PI) <= thetaB) return b;
+
+    float thetaO = (thetaA + thetaD + thetaB)/2.0f;
+    if (thetaO >= PI) return DirectionCone::entireSphere();
+
+    // Rotate a's axis toward b's by thetaO - thetaA.
+    glm::vec3 wr = glm::cross(a.w, b.w);
+    if (glm::dot(wr, wr) == 0.0f) return DirectionCone::entireSphere();
+    wr = glm::normalize(wr);
+    float r = thetaO - thetaA;
+    glm::vec3 w = a.w*cosf(r) + glm::cross(wr, a.w)*sinf(r) + wr*glm::dot(wr, a.w)*(1.0f - cosf(r));
+    return {glm::normalize(w), cosf(thetaO), false};
+}
+
+// The solid angle measure of a cone of normals widened by the 90
+// degree falloff of diffuse emission.
+static float orientationCost(const DirectionCone& c)
+{
+    if (c.cosTheta == 1.0f) return PI;          // One direction
+    if (c.cosTheta == -1.0f) return 4.0f*PI;    // The whole sphere
+    float thetaO = safeAcos(c.cosTheta);
+    float thetaW = std::min(thetaO + PI/2.0f, PI);
+    float sinO = sinf(thetaO);
+    return 2.0f*PI*(1.0f - c.cosTheta)
+        + PI/2.0f*(2.0f*thetaW*sinO - cosf(thetaO - 2.0f*thetaW) - 2.0f*thetaO*sinO + c.cosTheta);
+}
+
+// The bounds, power and normal cone of a set of emitters.
+struct LightBounds
+{
+    glm::vec3 lo{FLT_MAX}, hi{-FLT_MAX};
+    double    power{0.0};
+    DirectionCone cone;
+
+    void add(const LightBounds& b)
+    {
+        lo = glm::min(lo, b.lo);
+        hi = glm::max(hi, b.hi);
+        power += b.power;
+        cone = coneUnion(cone, b.cone);
+    }
+
+    float surfaceArea() const
+    {
+        glm::vec3 d = hi - lo;
+        return 2.0f*(d.x*d.y + d.y*d.z + d.z*d.x);
+    }
+};
+
+float lightBvhImportance(const LightBvhNode& node, const glm::vec3& P, const glm::vec3& N)
+{
+    if (!(node.power > 0.0f)) return 0.0f;
+
+    // The bounds are treated as their bounding sphere.  Inside it,
+    // light may come from any direction.
+    glm::vec3 center = (node.boundsMin + node.boundsMax)*0.5f;
+    glm::vec3 halfDiag = (node.boundsMax - node.boundsMin)*0.5f;
+    float radius2 = glm::dot(halfDiag, halfDiag);
+    glm::vec3 D = P - center;
+    float dist2 = glm::dot(D, D);
+    if (dist2 <= radius2) return node.power/std::max(radius2, 1e-12f);
+
+    glm::vec3 wi = D/sqrtf(dist2);  // From the emitters to P
+    float sin2B = radius2/dist2;
+    float cosB = sqrtf(std::max(0.0f, 1.0f - sin2B));
+    float sinB = sqrtf(std::min(1.0f, sin2B));
+
+    // The smallest angle between P's direction and any normal in the
+    // cone, reduced by the angle the bounds subtend: cos(max(0,
+    // thetaW - thetaO - thetaB)).
+    float cosW = fabsf(glm::dot(node.axis, wi));
+    float sinW = sqrtf(std::max(0.0f, 1.0f - cosW*cosW));
+    float cosO = node.cosSpread;
+    float sinO = sqrtf(std::max(0.0f, 1.0f - cosO*cosO));
+    float cosP = 1.0f;
+    if (cosW < cosO) {
+        float cosWO = cosW*cosO + sinW*sinO;
+        float sinWO = sinW*cosO - cosW*sinO;
+        if (cosWO < cosB) cosP = cosWO*cosB + sinWO*sinB; }
+    if (cosP <= 0.0f) return 0.0f;
+
+    // Likewise for the angle between N and the direction to the
+    // emitters: none can light P from below its horizon.
+    float cosI = -glm::dot(N, wi);
+    float sinI = sqrtf(std::max(0.0f, 1.0f - cosI*cosI));
+    float cosN = cosI < cosB ? cosI*cosB + sinI*sinB : 1.0f;
+    if (cosN <= 0.0f) return 0.0f;
+
+    return node.power*cosP*cosN/dist2;
+}
+
+LightBvh buildLightBvh(const std::vector<Emitter>& emitters)
+{
+    LightBvh bvh;
+    size_t n = emitters.size();
+    bvh.leafOf.resize(n);
+    if (n == 0) return bvh;
+
+    std::vector<LightBounds> bounds(n);
+    std::vector<glm::vec3> centroid(n);
+    std::vector<uint32_t> order(n);
+    for (size_t i=0;  i<n;  i++) {
+        const Emitter& e = emitters[i];
+        LightBounds& b = bounds[i];
+        b.lo = glm::min(e.v0, glm::min(e.v1, e.v2));
+        b.hi = glm::max(e.v0, glm::max(e.v1, e.v2));
+        b.power = std::max(emitterPower(e), 0.0f);
+        bool finite = glm::dot(e.normal, e.normal) > 0.5f;  // Not NaN from a degenerate triangle
+        b.cone = finite ? DirectionCone{e.normal, 1.0f, false} : DirectionCone::entireSphere();
+        centroid[i] = (e.v0 + e.v1 + e.v2)/3.0f;
+        order[i] = uint32_t(i); }
+
+    // Nodes are split top down, each into two adjacent new nodes.
+    struct Task { size_t begin, end;  uint32_t node; };
+    std::vector<Task> stack = {{0, n, 0}};
+    bvh.nodes.reserve(2*n - 1);
+    bvh.nodes.resize(1);
+    bvh.nodes[0].parent = ~0u;
+    const int nbBuckets = 12;
+    while (!stack.empty()) {
+        Task task = stack.back();
+        stack.pop_back();
+
+        LightBounds all;
+        glm::vec3 clo(FLT_MAX), chi(-FLT_MAX);
+        for (size_t k=task.begin;  k<task.end;  k++) {
+            all.add(bounds[order[k]]);
+            clo = glm::min(clo, centroid[order[k]]);
+            chi = glm::max(chi, centroid[order[k]]); }
+
+        LightBvhNode& node = bvh.nodes[task.node];
+        node.boundsMin = all.lo;
+        node.boundsMax = all.hi;
+        node.power     = float(all.power);
+        node.cosSpread = all.cone.cosTheta;
+        node.axis      = all.cone.w;
+        node.emitter   = -1;
+        node.child0 = node.child1 = ~0u;
+        if (task.end - task.begin == 1) {
+            node.emitter = int(order[task.begin]);
+            bvh.leafOf[order[task.begin]] = task.node;
+            continue; }
+
+        // Choose the bucket boundary, over all three axes, with the
+        // least surface area orientation heuristic cost.
+        glm::vec3 extent = all.hi - all.lo;
+        float maxExtent = std::max(extent.x, std::max(extent.y, extent.z));
+        float bestCost = FLT_MAX;
+        int bestAxis = -1, bestSplit = 0;
+        for (int axis=0;  axis<3;  axis++) {
+            float width = chi[axis] - clo[axis];
+            if (!(width > 0.0f)) continue;
+            LightBounds bucket[nbBuckets];
+            for (size_t k=task.begin;  k<task.end;  k++) {
+                int b = std::min(int(nbBuckets*(centroid[order[k]][axis] - clo[axis])/width), nbBuckets-1);
+                bucket[b].add(bounds[order[k]]); }
+            LightBounds above[nbBuckets];  // Of buckets b and up
+            above[nbBuckets-1] = bucket[nbBuckets-1];
+            for (int b=nbBuckets-2;  b>0;  b--) {
+                above[b] = above[b+1];
+                above[b].add(bucket[b]); }
+            float Kr = extent[axis] > 0.0f ? maxExtent/extent[axis] : 1.0f;
+            LightBounds below;
+            for (int split=1;  split<nbBuckets;  split++) {
+                below.add(bucket[split-1]);
+                if (below.cone.empty || above[split].cone.empty) continue;
+                float cost = Kr*float(below.power*orientationCost(below.cone)*below.surfaceArea()
+                                      + above[split].power*orientationCost(above[split].cone)*above[split].surfaceArea());
+                if (cost < bestCost) {
+                    bestCost = cost;
+                    bestAxis = axis;
+                    bestSplit = split; } } }
+
+        size_t mid;
+        if (bestAxis < 0)  // All centroids coincide: split by count.
+            mid = (task.begin + task.end)/2;
+        else {
+            float lo = clo[bestAxis], width = chi[bestAxis] - lo;
+            auto below = [&](uint32_t i) {
+                return std::min(int(nbBuckets*(centroid[i][bestAxis] - lo)/width), nbBuckets-1) < bestSplit; };
+            mid = std::partition(order.begin()+task.begin, order.begin()+task.end, below) - order.begin(); }
+
+        uint32_t child0 = uint32_t(bvh.nodes.size());
+        node.child0 = child0;
+        node.child1 = child0 + 1;
+        bvh.nodes.resize(bvh.nodes.size() + 2);
+        bvh.nodes[child0].parent = bvh.nodes[child0+1].parent = task.node;
+        stack.push_back({task.begin, mid, child0});
+        stack.push_back({mid, task.end, child0 + 1}); }
+    return bvh;
+}
+
+int sampleLightBvh(const LightBvh& bvh, const glm::vec3& P, const glm::vec3& N,
+                   const std::function<float()>& rnd, float& pdf)
+{
+    pdf = 0.0f;
+    if (bvh.nodes.empty()) return -1;
+    float p = 1.0f;
+    uint32_t k = 0;
+    while (bvh.nodes[k].emitter < 0) {
+        const LightBvhNode& node = bvh.nodes[k];
+        float i0 = lightBvhImportance(bvh.nodes[node.child0], P, N);
+        float i1 = lightBvhImportance(bvh.nodes[node.child1], P, N);
+        if (!(i0 + i1 > 0.0f)) return -1;
+        float p0 = i0/(i0 + i1);
+        if (rnd() < p0) {
+            k = node.child0;
+            p *= p0; }
+        else {
+            k = node.child1;
+            p *= 1.0f - p0; } }
+    pdf = p;
+    return bvh.nodes[k].emitter;
+}
+
+float lightBvhPdf(const LightBvh& bvh, const glm::vec3& P, const glm::vec3& N, uint32_t emitter)
+{
+    // The path from the root, walked down with the same expressions
+    // as sampleLightBvh so the result is exactly the same.
+    std::vector<uint32_t> path;
+    for (uint32_t k = bvh.leafOf[emitter];  k != ~0u;  k = bvh.nodes[k].parent)
+        path.push_back(k);
+    float p = 1.0f;
+    for (size_t d=path.size()-1;  d>0;  d--) {
+        const LightBvhNode& node = bvh.nodes[path[d]];
+        float i0 = lightBvhImportance(bvh.nodes[node.child0], P, N);
+        float i1 = lightBvhImportance(bvh.nodes[node.child1], P, N);
+        if (!(i0 + i1 > 0.0f)) return 0.0f;
+        float p0 = i0/(i0 + i1);
+        p *= path[d-1] == node.child0 ? p0 : 1.0f - p0; }
+    return p;
+}
@@ -0,0 +1,45 @@
+#pragma once
+
+#include <vector>
+#include <functional>
+
+#include "model_data.h"
+
+// Emitter selection for next event estimation in raytrace.rgen.
+
+// An emitter's share of the scene's light: its area times the
+// luminance of its emission.
+float emitterPower(const Emitter& emitter);
+
+// Builds the Walker alias table over emitters, weighted by
+// emitterPower, for the shader to pick an emitter in constant time.
+// If no emitter has any power, all are equally likely.
+std::vector<LightAlias> buildLightAlias(const std::vector<Emitter>& emitters);
+
+// The light BVH, used instead of the alias table when LIGHT_BVH is
+// defined.  nodes[0] is the root.  leafOf maps each emitter to its
+// leaf, for computing the pdf of a given emitter.
+struct LightBvh
+{
+    std::vector<LightBvhNode> nodes;
+    std::vector<uint32_t>     leafOf;
+};
+
+LightBvh buildLightBvh(const std::vector<Emitter>& emitters);
+
+// How much a node's emitters may light a point P with normal N, up
+// to a common scale.  Zero only if none of them can reach P's upper
+// hemisphere.  shaders/light_bvh.glsl must compute the same.
+float lightBvhImportance(const LightBvhNode& node, const glm::vec3& P, const glm::vec3& N);
+
+// CPU versions of the shader's traversal.  sampleLightBvh descends
+// from the root, choosing a child in proportion to its importance
+// with one rnd() per level, and returns the emitter and its
+// probability in pdf.  It returns -1 if it reaches a node neither of
+// whose children can light P; their emitters have pdf 0, and the
+// pdfs then add up to less than 1.  lightBvhPdf gives the probability
+// of that traversal selecting emitter, exactly as sampleLightBvh
+// computes it.
+int   sampleLightBvh(const LightBvh& bvh, const glm::vec3& P, const glm::vec3& N,
+                     const std::function<float()>& rnd, float& pdf);
+float lightBvhPdf(const LightBvh& bvh, const glm::vec3& P, const glm::vec3& N, uint32_t emitter);
@@ -0,0 +1,80 @@
+//////////////////////////////////////////////////////////////////////
+// Material table compaction.  Model files often repeat a material
+// under several names (one per aiMaterial, one per MTL entry), and
+// some materials are used by no triangle.  Byte-identical materials
+// are merged and unused ones dropped, and each object's material
+// indices are then uploaded in 8 or 16 bits when the table is small
+// enough.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <unordered_map>
+
+#include "material_table.h"
+
+static uint64_t hashMaterial(const Material& m)
+{
+    uint32_t w[sizeof(Material)/4];
+    memcpy(w, &m, sizeof(Material));
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    for (uint32_t x : w) {
+        h = (h ^ x) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32; }
+    return h;
+}
+
+// Materials are kept in the order of their first use.
+void ModelData::dedupMaterials()
+{
+    if (matIndx.empty()) return;
+    std::unordered_multimap<uint64_t, int32_t> byHash;
+    std::vector<Material> kept;
+    std::vector<int32_t> remap(materials.size(), -1);
+
+    for (int32_t& m : matIndx) {
+        if (m < 0 || size_t(m) >= materials.size()) continue;
+        if (remap[m] < 0) {
+            const Material& mat = materials[m];
+            uint64_t h = hashMaterial(mat);
+            auto range = byHash.equal_range(h);
+            for (auto it = range.first;  it != range.second;  ++it)
+                if (memcmp(&kept[it->second], &mat, sizeof(Material)) == 0) {
+                    remap[m] = it->second;
+                    break; }
+            if (remap[m] < 0) {
+                remap[m] = int32_t(kept.size());
+                byHash.emplace(h, remap[m]);
+                kept.push_back(mat); } }
+        m = remap[m]; }
+
+    if (kept.size() != materials.size())
+        printf("Materials: %zd -> %zd after merging duplicates and dropping unused ones\n",
+               materials.size(), kept.size());
+    materials.swap(kept);
+}
+
+uint32_t materialIndexBits(size_t nbMaterials)
+{
+    if (nbMaterials <= (1u<<8))  return 8;
+    if (nbMaterials <= (1u<<16)) return 16;
+    return 32;
+}
+
+std::vector<uint32_t> packMaterialIndices(const int32_t* matIndx, size_t count, uint32_t bits)
+{
+    const uint32_t perWord = 32/bits;
+    std::vector<uint32_t> packed((count + perWord-1) / perWord, 0u);
+    const uint32_t mask = bits == 32 ? ~0u : (1u<<bits) - 1;
+    for (size_t i=0;  i<count;  i++)
+        packed[i/perWord] |= (uint32_t(matIndx[i]) & mask) << ((i%perWord)*bits);
+    return packed;
+}
+
+int32_t unpackMaterialIndex(const uint32_t* packed, size_t i, uint32_t bits)
+{
+    const uint32_t perWord = 32/bits;
+    uint32_t word = packed[i/perWord];
+    if (bits == 32) return int32_t(word);
+    return int32_t((word >> ((i%perWord)*bits)) & ((1u<<bits) - 1));
+}
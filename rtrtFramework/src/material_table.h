@@ -0,0 +1,22 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "model_data.h"
+
+// Compaction of a model's materials, run by the loader after reading
+// (see ModelData::dedupMaterials), and the narrow material index
+// buffers uploaded for each object.
+
+// Width in bits of each material index on the GPU: 8, 16 or 32,
+// whichever is the narrowest that can hold nbMaterials-1.
+uint32_t materialIndexBits(size_t nbMaterials);
+
+// Packs count material indices, bits wide each, into 32 bit words,
+// lowest bits first.  Index i is in word i*bits/32.  Must match
+// LoadMaterialIndex in shaders/material_index.glsl.
+std::vector<uint32_t> packMaterialIndices(const int32_t* matIndx, size_t count, uint32_t bits);
+
+// Index i of an array packed as above.
+int32_t unpackMaterialIndex(const uint32_t* packed, size_t i, uint32_t bits);
@@ -0,0 +1,84 @@
+//////////////////////////////////////////////////////////////////////
+// GPU memory accounting.  Every buffer and image made through
+// VkApp::initBufferWrap or VkApp::initImageWrap is tagged with a
+// MemCategory; the sizes counted are those of the device memory
+// actually allocated (from vkGet*MemoryRequirements), so alignment
+// padding is included.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "memory_stats.h"
+
+static const char* categoryNames[] = {
+    "vertices", "indices", "materials", "hit records", "lights", "textures",
+    "accel structs", "build scratch", "render targets", "other", "staging" };
+static_assert(sizeof(categoryNames)/sizeof(categoryNames[0]) == int(MemCategory::Count),
+              "A MemCategory has no name");
+
+const char* memCategoryName(MemCategory category)
+{
+    return categoryNames[int(category)];
+}
+
+MemoryStats& MemoryStats::global()
+{
+    static MemoryStats stats;
+    return stats;
+}
+
+void MemoryStats::setBudget(uint64_t bytes, bool strict)
+{
+    m_budget = bytes;
+    m_strict = strict;
+}
+
+uint64_t MemoryStats::total() const
+{
+    uint64_t sum = 0;
+    for (int c=0;  c<int(MemCategory::Count);  c++)
+        if (c != int(MemCategory::Staging))
+            sum += m_bytes[c];
+    return sum;
+}
+
+void MemoryStats::allocate(MemCategory category, uint64_t bytes)
+{
+    m_bytes[int(category)] += bytes;
+    m_count[int(category)]++;
+    if (category == MemCategory::Staging) return;
+
+    uint64_t now = total();
+    uint64_t peak = m_peak;
+    while (now > peak && !m_peak.compare_exchange_weak(peak, now)) {}
+
+    if (m_budget != 0 && now > m_budget) {
+        if (m_strict) {
+            printf("GPU memory budget of %.1f MB exceeded by a %.1f MB allocation of %s\n",
+                   m_budget/(1024.0*1024.0), bytes/(1024.0*1024.0), memCategoryName(category));
+            print("GPU memory");
+            exit(-1); }
+        if (!m_warned.exchange(true))
+            printf("Warning: GPU memory budget of %.1f MB exceeded (%.1f MB allocated)\n",
+                   m_budget/(1024.0*1024.0), now/(1024.0*1024.0)); }
+}
+
+void MemoryStats::release(MemCategory category, uint64_t bytes)
+{
+    m_bytes[int(category)] -= bytes;
+    m_count[int(category)]--;
+}
+
+void MemoryStats::print(const char* title) const
+{
+    printf("%s:\n", title);
+    for (int c=0;  c<int(MemCategory::Count);  c++)
+        if (m_count[c] != 0)
+            printf("  %-15s %5u allocations %10.2f MB\n", categoryNames[c],
+                   uint32_t(m_count[c]), m_bytes[c]/(1024.0*1024.0));
+    printf("  %-15s %29.2f MB (peak %.2f MB", "total", total()/(1024.0*1024.0), m_peak/(1024.0*1024.0));
+    if (m_budget != 0)
+        printf(", budget %.2f MB", m_budget/(1024.0*1024.0));
+    printf(")\n");
+}
@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stdint.h>
+#include <atomic>
+
+// Accounting of the GPU memory allocated by VkApp::initBufferWrap
+// and VkApp::initImageWrap, by what it holds, against an optional
+// budget (set with the -budget command line argument).
+
+enum class MemCategory
+{
+    Vertices,        // vertexBuffer, positionBuffer
+    Indices,         // indexBuffer
+    Materials,       // matColorBuffer, matIndexBuffer
+    HitRecords,      // hitRecordBuffer
+    Lights,          // Emitters and the alias table or light BVH
+    Textures,
+    AccelStructures, // BLAS's and TLAS
+    Scratch,         // Acceleration structure build scratch
+    RenderTargets,   // Ray tracing, denoising, scanline and depth images
+    Other,           // Uniforms, ObjDesc's, instance transforms, SBT
+    Staging,         // Host visible upload buffers; not counted in the total
+    Count
+};
+
+const char* memCategoryName(MemCategory category);
+
+class MemoryStats
+{
+public:
+    static MemoryStats& global();
+
+    // A budget of 0 means none.  Exceeding a strict budget exits;
+    // otherwise it is reported once.
+    void setBudget(uint64_t bytes, bool strict);
+    uint64_t budget() const { return m_budget; }
+    bool strict() const { return m_strict; }
+
+    // Called for each allocation and its release.
+    void allocate(MemCategory category, uint64_t bytes);
+    void release(MemCategory category, uint64_t bytes);
+
+    uint64_t bytes(MemCategory category) const { return m_bytes[int(category)]; }
+    uint32_t count(MemCategory category) const { return m_count[int(category)]; }
+    uint64_t total() const;  // Over all categories but Staging
+    uint64_t peak() const { return m_peak; }
+
+    // Whether extra more bytes would still be within the budget.
+    bool fits(uint64_t extra) const { return m_budget == 0 || total() + extra <= m_budget; }
+
+    void print(const char* title) const;
+
+private:
+    std::atomic<uint64_t> m_bytes[int(MemCategory::Count)]{};
+    std::atomic<uint32_t> m_count[int(MemCategory::Count)]{};
+    std::atomic<uint64_t> m_peak{0};
+    std::atomic<bool>     m_warned{false};
+    uint64_t m_budget{0};
+    bool     m_strict{false};
+};
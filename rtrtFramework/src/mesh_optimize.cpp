@@ -0,0 +1,237 @@
+//////////////////////////////////////////////////////////////////////
+// Loader stage that welds duplicate vertices and reorders each mesh
+// for the GPU's post-transform vertex cache and for vertex fetch.
+// Assimp only triangulates and generates normals, so without this
+// both vkCmdDrawIndexed and the BLAS builds get duplicated vertices
+// and triangles in file order.
+//
+// Triangle reordering is Tipsify from:
+//   Sander, Nehab, Barczak, "Fast Triangle Reordering for Vertex
+//   Locality and Reduced Overdraw", SIGGRAPH 2007.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "mesh_optimize.h"
+#include "thread_pool.h"
+
+static uint64_t hashVertex(const Vertex& v)
+{
+    uint32_t w[sizeof(Vertex)/4];
+    memcpy(w, &v, sizeof(Vertex));
+    uint64_t h = 0x9E3779B97F4A7C15ull;
+    for (uint32_t x : w) {
+        h = (h ^ x) * 0xff51afd7ed558ccdull;
+        h ^= h >> 32; }
+    return h;
+}
+
+void weldVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    // Open addressing hash table of indices into the welded vertex array.
+    size_t tableSize = 1;
+    while (tableSize < 2*vertices.size()) tableSize *= 2;
+    std::vector<uint32_t> table(tableSize, UINT32_MAX);
+
+    std::vector<uint32_t> remap(vertices.size());
+    std::vector<Vertex> welded;
+    welded.reserve(vertices.size());
+
+    for (size_t i=0;  i<vertices.size();  i++) {
+        size_t slot = hashVertex(vertices[i]) & (tableSize-1);
+        while (table[slot] != UINT32_MAX
+               && memcmp(&welded[table[slot]], &vertices[i], sizeof(Vertex)) != 0)
+            slot = (slot+1) & (tableSize-1);
+        if (table[slot] == UINT32_MAX) {
+            table[slot] = uint32_t(welded.size());
+            welded.push_back(vertices[i]); }
+        remap[i] = table[slot]; }
+
+    for (auto& i : indices)
+        i = remap[i];
+    vertices.swap(welded);
+}
+
+std::vector<uint32_t> tipsifyTriangles(std::vector<uint32_t>& indices, size_t vertexCount,
+                                       int cacheSize)
+{
+    size_t nbTriangles = indices.size()/3;
+    std::vector<uint32_t> order;
+    order.reserve(nbTriangles);
+    if (nbTriangles == 0) return order;
+
+    // Vertex-triangle adjacency: the triangles using vertex v are
+    // adjacent[adjStart[v] ... adjStart[v+1]-1].
+    std::vector<uint32_t> adjStart(vertexCount+1, 0);
+    for (uint32_t v : indices) adjStart[v+1]++;
+    for (size_t v=0;  v<vertexCount;  v++) adjStart[v+1] += adjStart[v];
+    std::vector<uint32_t> adjacent(indices.size());
+    std::vector<uint32_t> fill(adjStart.begin(), adjStart.end()-1);
+    for (size_t i=0;  i<indices.size();  i++)
+        adjacent[fill[indices[i]]++] = uint32_t(i/3);
+
+    std::vector<uint32_t> live(vertexCount);         // Triangles not yet emitted, per vertex
+    for (size_t v=0;  v<vertexCount;  v++) live[v] = adjStart[v+1] - adjStart[v];
+    std::vector<int64_t> cacheTime(vertexCount, -(int64_t)cacheSize-1);  // When v entered the cache
+    std::vector<uint32_t> deadEnd;                  // Recently used vertices
+    std::vector<char> emitted(nbTriangles, 0);
+    std::vector<uint32_t> candidates;
+
+    int64_t time = cacheSize+1;
+    size_t cursor = 0;
+    int64_t fan = 0;
+    while (fan >= 0) {
+        // Emit all of the fanning vertex's remaining triangles.
+        candidates.clear();
+        for (uint32_t a=adjStart[fan];  a<adjStart[fan+1];  a++) {
+            uint32_t t = adjacent[a];
+            if (emitted[t]) continue;
+            for (int k=0;  k<3;  k++) {
+                uint32_t v = indices[3*t+k];
+                deadEnd.push_back(v);
+                candidates.push_back(v);
+                live[v]--;
+                if (time - cacheTime[v] > cacheSize) {
+                    cacheTime[v] = time;
+                    time++; } }
+            emitted[t] = 1;
+            order.push_back(t); }
+
+        // Next fanning vertex: the candidate still in the cache after
+        // its remaining triangles are emitted, that entered it earliest.
+        fan = -1;
+        int64_t best = -1;
+        for (uint32_t v : candidates) {
+            if (live[v] == 0) continue;
+            int64_t priority = 0;
+            if (time - cacheTime[v] + 2*int64_t(live[v]) <= cacheSize)
+                priority = time - cacheTime[v];
+            if (priority > best) {
+                best = priority;
+                fan = v; } }
+
+        // None: back up through recently used vertices, then scan on.
+        while (fan < 0 && !deadEnd.empty()) {
+            uint32_t v = deadEnd.back();
+            deadEnd.pop_back();
+            if (live[v] > 0) fan = v; }
+        while (fan < 0 && cursor < vertexCount) {
+            if (live[cursor] > 0) fan = int64_t(cursor);
+            else cursor++; }
+    }
+
+    std::vector<uint32_t> reordered(indices.size());
+    for (size_t k=0;  k<order.size();  k++)
+        for (int c=0;  c<3;  c++)
+            reordered[3*k+c] = indices[3*order[k]+c];
+    indices.swap(reordered);
+    return order;
+}
+
+void reorderVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices)
+{
+    std::vector<uint32_t> remap(vertices.size(), UINT32_MAX);
+    std::vector<Vertex> reordered;
+    reordered.reserve(vertices.size());
+    for (auto& i : indices) {
+        if (remap[i] == UINT32_MAX) {
+            remap[i] = uint32_t(reordered.size());
+            reordered.push_back(vertices[i]); }
+        i = remap[i]; }
+    vertices.swap(reordered);
+}
+
+double cacheMissRatio(const uint32_t* indices, size_t indexCount, int cacheSize)
+{
+    if (indexCount < 3) return 0.0;
+    uint32_t lo = *std::min_element(indices, indices+indexCount);
+    uint32_t hi = *std::max_element(indices, indices+indexCount);
+
+    // With a FIFO cache, a vertex is still cached if fewer than
+    // cacheSize misses happened since it was loaded.
+    std::vector<int64_t> loadedAt(size_t(hi-lo)+1, -(int64_t)cacheSize-1);
+    int64_t misses = 0;
+    for (size_t i=0;  i<indexCount;  i++) {
+        int64_t& at = loadedAt[indices[i]-lo];
+        if (misses - at >= cacheSize) {
+            at = misses;
+            misses++; } }
+    return double(misses) / double(indexCount/3);
+}
+
+// ACMR of the whole model, weighting each range by its triangles.
+static double modelCacheMissRatio(const ModelData& md)
+{
+    double misses = 0;
+    for (const auto& r : md.meshRanges)
+        misses += cacheMissRatio(&md.indices[r.firstIndex], r.indexCount) * (r.indexCount/3);
+    return md.indices.empty() ? 0.0 : misses / double(md.indices.size()/3);
+}
+
+void ModelData::optimizeMeshes()
+{
+    // The ranges must tile the arrays exactly, in order.
+    size_t v = 0, i = 0;
+    for (const auto& r : meshRanges) {
+        if (r.firstVertex != v || r.firstIndex != i) break;
+        v += r.vertexCount;
+        i += r.indexCount; }
+    if (v != vertices.size() || i != indices.size()) {
+        printf("Mesh optimization skipped: mesh ranges do not cover the model\n");
+        return; }
+
+    auto start = std::chrono::steady_clock::now();
+    double acmrBefore = modelCacheMissRatio(*this);
+    size_t verticesBefore = vertices.size();
+
+    // Each range is optimized on its own, into its own arrays.
+    struct Optimized
+    {
+        std::vector<Vertex>   vertices;
+        std::vector<uint32_t> indices;
+        std::vector<int32_t>  matIndx;
+    };
+    std::vector<Optimized> result(meshRanges.size());
+
+    ThreadPool::global().parallelFor(meshRanges.size(), [&](size_t k) {
+        const MeshRange& r = meshRanges[k];
+        Optimized& out = result[k];
+        out.vertices.assign(vertices.begin()+r.firstVertex,
+                            vertices.begin()+r.firstVertex+r.vertexCount);
+        out.indices.assign(indices.begin()+r.firstIndex,
+                           indices.begin()+r.firstIndex+r.indexCount);
+        for (auto& i : out.indices) i -= r.firstVertex;
+
+        weldVertices(out.vertices, out.indices);
+        std::vector<uint32_t> order = tipsifyTriangles(out.indices, out.vertices.size());
+        reorderVertexFetch(out.vertices, out.indices);
+
+        // Triangles carry their material index with them.
+        out.matIndx.resize(order.size());
+        for (size_t t=0;  t<order.size();  t++)
+            out.matIndx[t] = matIndx[r.firstIndex/3 + order[t]]; });
+
+    // Gather the ranges back into the model's arrays.
+    size_t nbVertices = 0;
+    for (size_t k=0;  k<result.size();  k++) {
+        meshRanges[k].firstVertex = uint32_t(nbVertices);
+        meshRanges[k].vertexCount = uint32_t(result[k].vertices.size());
+        nbVertices += result[k].vertices.size(); }
+    vertices.resize(nbVertices);
+
+    ThreadPool::global().parallelFor(result.size(), [&](size_t k) {
+        const MeshRange& r = meshRanges[k];
+        std::copy(result[k].vertices.begin(), result[k].vertices.end(), vertices.begin()+r.firstVertex);
+        std::copy(result[k].matIndx.begin(), result[k].matIndx.end(), matIndx.begin()+r.firstIndex/3);
+        for (size_t i=0;  i<result[k].indices.size();  i++)
+            indices[r.firstIndex+i] = result[k].indices[i] + r.firstVertex; });
+
+    double acmrAfter = modelCacheMissRatio(*this);
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Mesh optimization: %.1f ms\n", ms);
+    printf("  vertices: %zd -> %zd (welded)\n", verticesBefore, vertices.size());
+    printf("  ACMR (%d entry FIFO): %.3f -> %.3f\n", vertexCacheSize, acmrBefore, acmrAfter);
+}
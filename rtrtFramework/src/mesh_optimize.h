@@ -0,0 +1,33 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "model_data.h"
+
+// Mesh optimizations run by ModelData::optimizeMeshes on each
+// MeshRange of a model.  Each works on one mesh's own arrays, with
+// indices relative to the mesh's first vertex.
+
+// Size of the post-transform vertex cache the optimizations aim at
+// (and that cacheMissRatio simulates).
+const int vertexCacheSize = 16;
+
+// Merges bit-identical vertices and rewrites the indices to match.
+void weldVertices(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Reorders triangles for the post-transform vertex cache with
+// Sander et al.'s Tipsify algorithm.  Returns the new triangle order:
+// the k'th triangle of the result was triangle order[k] before.
+std::vector<uint32_t> tipsifyTriangles(std::vector<uint32_t>& indices, size_t vertexCount,
+                                       int cacheSize=vertexCacheSize);
+
+// Renumbers vertices in the order the indices first use them, so
+// vertex fetches walk forward through memory.  Unused vertices are
+// dropped.
+void reorderVertexFetch(std::vector<Vertex>& vertices, std::vector<uint32_t>& indices);
+
+// Average cache miss ratio (ACMR): vertices transformed per triangle
+// with a FIFO cache of the given size.  Between 0.5 (ideal) and 3.
+double cacheMissRatio(const uint32_t* indices, size_t indexCount,
+                      int cacheSize=vertexCacheSize);
@@ -0,0 +1,293 @@
+//////////////////////////////////////////////////////////////////////
+// Loader stage that builds levels of detail for each mesh by quadric
+// error edge collapse, from:
+//   Garland, Heckbert, "Surface Simplification Using Quadric Error
+//   Metrics", SIGGRAPH 1997.
+//
+// Collapses are done in passes: each pass finds every vertex's
+// cheapest collapse, then applies them in order of cost, skipping any
+// that touch a vertex an earlier collapse of the same pass changed.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <unordered_map>
+
+#include "mesh_simplify.h"
+#include "thread_pool.h"
+
+namespace {
+
+// Sum of squared distances to a set of weighted planes, as the
+// symmetric 4x4 matrix of Garland and Heckbert.  weight is the sum of
+// the planes' weights, so error()/weight is a mean squared distance.
+struct Quadric
+{
+    double a2{0}, ab{0}, ac{0}, ad{0}, b2{0}, bc{0}, bd{0}, c2{0}, cd{0}, d2{0};
+    double weight{0};
+
+    void addPlane(const glm::dvec3& n, double d, double w)
+    {
+        a2 += w*n.x*n.x;  ab += w*n.x*n.y;  ac += w*n.x*n.z;  ad += w*n.x*d;
+        b2 += w*n.y*n.y;  bc += w*n.y*n.z;  bd += w*n.y*d;
+        c2 += w*n.z*n.z;  cd += w*n.z*d;
+        d2 += w*d*d;
+        weight += w;
+    }
+
+    void add(const Quadric& q)
+    {
+        a2 += q.a2;  ab += q.ab;  ac += q.ac;  ad += q.ad;  b2 += q.b2;
+        bc += q.bc;  bd += q.bd;  c2 += q.c2;  cd += q.cd;  d2 += q.d2;
+        weight += q.weight;
+    }
+
+    double error(const glm::dvec3& p) const
+    {
+        double e = a2*p.x*p.x + 2*ab*p.x*p.y + 2*ac*p.x*p.z + 2*ad*p.x
+                 + b2*p.y*p.y + 2*bc*p.y*p.z + 2*bd*p.y
+                 + c2*p.z*p.z + 2*cd*p.z
+                 + d2;
+        return std::max(e, 0.0);
+    }
+};
+
+enum class VertexKind : uint8_t { Interior, Border, Locked };
+
+struct Collapse
+{
+    float    cost;  // Distance the collapse moves the surface
+    uint32_t from;
+    uint32_t to;
+};
+
+uint64_t edgeKey(uint32_t a, uint32_t b)
+{
+    if (a > b) std::swap(a, b);
+    return (uint64_t(a) << 32) | b;
+}
+
+}  // namespace
+
+std::vector<SimplifiedLevel> simplifyMesh(const std::vector<Vertex>& vertices,
+                                          const std::vector<uint32_t>& inputIndices,
+                                          const std::vector<float>& ratios)
+{
+    const size_t nv = vertices.size();
+    const size_t nt = inputIndices.size()/3;
+    std::vector<uint32_t> indices = inputIndices;
+    std::vector<bool> alive(nt, true);
+    size_t aliveCount = nt;
+
+    // Vertices at one position (split by normals or texCoords) share
+    // a position id.
+    std::vector<uint32_t> byPosition(nv);
+    for (uint32_t v=0;  v<nv;  v++) byPosition[v] = v;
+    auto posLess = [&](uint32_t a, uint32_t b) {
+        return memcmp(&vertices[a].pos, &vertices[b].pos, sizeof(glm::vec3)) < 0; };
+    std::sort(byPosition.begin(), byPosition.end(), posLess);
+    std::vector<uint32_t> position(nv), positionUses(nv, 0);
+    for (size_t i=0;  i<nv;  i++) {
+        uint32_t v = byPosition[i];
+        position[v] = (i > 0 && !posLess(byPosition[i-1], v)) ? position[byPosition[i-1]] : v;
+        positionUses[position[v]]++; }
+
+    // Edges between positions used by one triangle are on a border;
+    // by more than two, non-manifold.
+    std::unordered_map<uint64_t, uint32_t> edgeUses;
+    edgeUses.reserve(3*nt);
+    for (size_t t=0;  t<nt;  t++)
+        for (int e=0;  e<3;  e++)
+            edgeUses[edgeKey(position[indices[3*t+e]], position[indices[3*t+(e+1)%3]])]++;
+
+    std::vector<VertexKind> kind(nv, VertexKind::Interior);
+    for (size_t t=0;  t<nt;  t++)
+        for (int e=0;  e<3;  e++) {
+            uint32_t a = indices[3*t+e], b = indices[3*t+(e+1)%3];
+            uint32_t uses = edgeUses[edgeKey(position[a], position[b])];
+            VertexKind k = uses == 1 ? VertexKind::Border
+                         : uses > 2  ? VertexKind::Locked : VertexKind::Interior;
+            for (uint32_t v : {a, b})
+                kind[v] = std::max(kind[v], k); }
+    for (uint32_t v=0;  v<nv;  v++)
+        if (positionUses[position[v]] > 1) kind[v] = VertexKind::Locked;  // A seam
+
+    // Each vertex's quadric: the planes of the triangles around its
+    // position, weighted by area, plus for border edges a plane
+    // through the edge perpendicular to its triangle, so borders keep
+    // their shape.
+    std::vector<Quadric> quadric(nv);
+    std::vector<Quadric> positionQuadric(nv);
+    for (size_t t=0;  t<nt;  t++) {
+        glm::dvec3 p[3];
+        for (int i=0;  i<3;  i++) p[i] = glm::dvec3(vertices[indices[3*t+i]].pos);
+        glm::dvec3 n = glm::cross(p[1]-p[0], p[2]-p[0]);
+        double area2 = glm::length(n);
+        if (area2 == 0.0) continue;
+        n /= area2;
+        for (int i=0;  i<3;  i++)
+            positionQuadric[position[indices[3*t+i]]].addPlane(n, -glm::dot(n, p[0]), 0.5*area2);
+        for (int e=0;  e<3;  e++) {
+            uint32_t a = indices[3*t+e], b = indices[3*t+(e+1)%3];
+            if (edgeUses[edgeKey(position[a], position[b])] != 1) continue;
+            glm::dvec3 edge = p[(e+1)%3] - p[e];
+            glm::dvec3 bn = glm::cross(edge, n);
+            double len = glm::length(bn);
+            if (len == 0.0) continue;
+            bn /= len;
+            const double borderWeight = 10.0;
+            double w = borderWeight * glm::dot(edge, edge);
+            positionQuadric[position[a]].addPlane(bn, -glm::dot(bn, p[e]), w);
+            positionQuadric[position[b]].addPlane(bn, -glm::dot(bn, p[e]), w); } }
+    for (uint32_t v=0;  v<nv;  v++)
+        quadric[v] = positionQuadric[position[v]];
+
+    // Collapsing from onto to may be done without moving a border or
+    // seam: interior vertices go anywhere; border vertices only along
+    // their border, onto another border (or locked) vertex.
+    auto allowed = [&](uint32_t from, uint32_t to) {
+        if (kind[from] == VertexKind::Interior) return true;
+        if (kind[from] == VertexKind::Locked || kind[to] == VertexKind::Interior) return false;
+        return edgeUses[edgeKey(position[from], position[to])] == 1; };
+
+    auto faceNormal = [&](uint32_t a, uint32_t b, uint32_t c) {
+        return glm::cross(vertices[b].pos - vertices[a].pos, vertices[c].pos - vertices[a].pos); };
+
+    std::vector<SimplifiedLevel> levels;
+    float maxError = 0.0f;
+    std::vector<uint32_t> adjStart(nv+1), adjacent;
+    std::vector<Collapse> best(nv);
+    std::vector<bool> touched(nv);
+
+    for (float ratio : ratios) {
+        size_t target = size_t(ratio * nt);
+        while (aliveCount > target) {
+            // The triangles around each vertex.
+            std::fill(adjStart.begin(), adjStart.end(), 0);
+            for (size_t t=0;  t<nt;  t++)
+                if (alive[t])
+                    for (int i=0;  i<3;  i++) adjStart[indices[3*t+i]+1]++;
+            for (size_t v=0;  v<nv;  v++) adjStart[v+1] += adjStart[v];
+            adjacent.resize(adjStart[nv]);
+            std::vector<uint32_t> fill(adjStart.begin(), adjStart.end()-1);
+            for (size_t t=0;  t<nt;  t++)
+                if (alive[t])
+                    for (int i=0;  i<3;  i++) adjacent[fill[indices[3*t+i]]++] = uint32_t(t);
+
+            // Each vertex's cheapest allowed collapse.
+            for (uint32_t v=0;  v<nv;  v++) best[v] = {INFINITY, v, v};
+            for (size_t t=0;  t<nt;  t++) {
+                if (!alive[t]) continue;
+                for (int e=0;  e<3;  e++) {
+                    uint32_t a = indices[3*t+e], b = indices[3*t+(e+1)%3];
+                    for (int dir=0;  dir<2;  dir++, std::swap(a, b)) {
+                        if (!allowed(a, b)) continue;
+                        const Quadric& q = quadric[a];
+                        float cost = float(sqrt(q.error(glm::dvec3(vertices[b].pos))
+                                                / std::max(q.weight, 1e-30)));
+                        if (cost < best[a].cost) best[a] = {cost, a, b}; } } }
+
+            std::vector<Collapse> order;
+            for (uint32_t v=0;  v<nv;  v++)
+                if (best[v].from != best[v].to) order.push_back(best[v]);
+            std::sort(order.begin(), order.end(), [](const Collapse& x, const Collapse& y) {
+                return x.cost < y.cost; });
+
+            std::fill(touched.begin(), touched.end(), false);
+            size_t collapsed = 0;
+            for (const Collapse& c : order) {
+                if (aliveCount <= target) break;
+                if (touched[c.from] || touched[c.to]) continue;
+
+                // Reject a collapse that would flip a triangle over.
+                bool flips = false;
+                for (uint32_t k=adjStart[c.from];  k<adjStart[c.from+1] && !flips;  k++) {
+                    const uint32_t* tri = &indices[3*adjacent[k]];
+                    if (tri[0] == c.to || tri[1] == c.to || tri[2] == c.to) continue;
+                    uint32_t moved[3];
+                    for (int i=0;  i<3;  i++) moved[i] = tri[i] == c.from ? c.to : tri[i];
+                    glm::vec3 before = faceNormal(tri[0], tri[1], tri[2]);
+                    glm::vec3 after  = faceNormal(moved[0], moved[1], moved[2]);
+                    flips = glm::dot(before, after) <= 0.0f; }
+                if (flips) continue;
+
+                for (uint32_t k=adjStart[c.from];  k<adjStart[c.from+1];  k++) {
+                    uint32_t t = adjacent[k];
+                    uint32_t* tri = &indices[3*t];
+                    for (int i=0;  i<3;  i++) {
+                        touched[tri[i]] = true;
+                        if (tri[i] == c.from) tri[i] = c.to; }
+                    if (tri[0] == tri[1] || tri[1] == tri[2] || tri[2] == tri[0]) {
+                        alive[t] = false;
+                        aliveCount--; } }
+                quadric[c.to].add(quadric[c.from]);
+                maxError = std::max(maxError, c.cost);
+                collapsed++; }
+            if (collapsed == 0) break; }
+
+        SimplifiedLevel level;
+        for (size_t t=0;  t<nt;  t++)
+            if (alive[t]) {
+                level.indices.insert(level.indices.end(), &indices[3*t], &indices[3*t+3]);
+                level.triangles.push_back(uint32_t(t)); }
+        level.error = maxError;
+        levels.push_back(std::move(level)); }
+    return levels;
+}
+
+void ModelData::buildLods()
+{
+    auto start = std::chrono::steady_clock::now();
+    lodIndices.clear();
+    lodMatIndx.clear();
+    meshLods.clear();
+
+    // Each level has half the triangles of the one before.  Small
+    // meshes, and levels that no longer shrink, are not kept.
+    const size_t minTriangles = 64;
+    std::vector<float> ratios;
+    for (uint32_t k=1;  k<lodLevels;  k++)
+        ratios.push_back(1.0f / float(1u << k));
+
+    std::vector<std::vector<SimplifiedLevel>> result(meshRanges.size());
+    ThreadPool::global().parallelFor(meshRanges.size(), [&](size_t k) {
+        const MeshRange& r = meshRanges[k];
+        if (r.indexCount/3 < minTriangles) return;
+        std::vector<Vertex> meshVertices(vertices.begin()+r.firstVertex,
+                                         vertices.begin()+r.firstVertex+r.vertexCount);
+        std::vector<uint32_t> meshIndices(indices.begin()+r.firstIndex,
+                                          indices.begin()+r.firstIndex+r.indexCount);
+        for (auto& i : meshIndices) i -= r.firstVertex;
+        result[k] = simplifyMesh(meshVertices, meshIndices, ratios); });
+
+    std::vector<size_t> levelTriangles(lodLevels, 0);
+    for (size_t k=0;  k<meshRanges.size();  k++) {
+        MeshRange& r = meshRanges[k];
+        r.firstLod = uint32_t(meshLods.size());
+        r.nbLods = 0;
+        levelTriangles[0] += r.indexCount/3;
+        size_t previous = r.indexCount/3;
+        for (const SimplifiedLevel& level : result[k]) {
+            size_t count = level.triangles.size();
+            if (count == 0 || count > previous*9/10) break;
+            previous = count;
+            meshLods.push_back({uint32_t(lodIndices.size()), uint32_t(level.indices.size()), level.error});
+            for (uint32_t i : level.indices)
+                lodIndices.push_back(i + r.firstVertex);
+            for (uint32_t t : level.triangles)
+                lodMatIndx.push_back(matIndx[r.firstIndex/3 + t]);
+            r.nbLods++;
+            levelTriangles[r.nbLods] += count; }
+        // Meshes with fewer levels are drawn at their coarsest.
+        for (uint32_t l=r.nbLods+1;  l<lodLevels;  l++)
+            levelTriangles[l] += r.nbLods ? meshLods[r.firstLod+r.nbLods-1].indexCount/3
+                                          : r.indexCount/3; }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Mesh LODs: %.1f ms\n", ms);
+    for (uint32_t l=0;  l<lodLevels;  l++)
+        printf("  level %u: %zd triangles\n", l, levelTriangles[l]);
+}
@@ -0,0 +1,31 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "model_data.h"
+
+// Quadric error mesh simplification, used by ModelData::buildLods to
+// make each MeshRange's chain of levels of detail.  Works on one
+// mesh's own arrays, with indices relative to its first vertex.
+//
+// Edges are collapsed onto one of their two vertices rather than onto
+// a new optimal position, so every level indexes the mesh's original
+// vertices: all levels share one vertex buffer, and only the index
+// (and material index) buffers grow.
+
+// One level of a mesh, as made by simplifyMesh.
+struct SimplifiedLevel
+{
+    std::vector<uint32_t> indices;    // 3 per triangle
+    std::vector<uint32_t> triangles;  // Each triangle's index in the input (for its material)
+    float error{0.0f};                // Largest distance any collapse so far moved the surface
+};
+
+// Simplifies a mesh through successively smaller triangle counts,
+// ratios[k] times the input's, each level continuing from the last.
+// A level stops early when no more edge can be collapsed; vertices on
+// borders, UV/normal seams and non-manifold edges stay put.
+std::vector<SimplifiedLevel> simplifyMesh(const std::vector<Vertex>& vertices,
+                                          const std::vector<uint32_t>& indices,
+                                          const std::vector<float>& ratios);
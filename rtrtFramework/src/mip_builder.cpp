@@ -0,0 +1,289 @@
+//////////////////////////////////////////////////////////////////////
+// CPU mip level filtering; see mip_builder.h.
+//
+// Each level is made from the one above by a separable filter.  The
+// work is split into bands of the new level's rows; a band filters the
+// rows above it that it needs horizontally into a buffer of its own,
+// then filters that buffer vertically.  The previous level is kept in
+// float, linear color, so the chain is only rounded to 8 bits once per
+// level, on output.
+////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <algorithm>
+#include <vector>
+
+#include "mip_builder.h"
+#include "thread_pool.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define MIP_BUILDER_X86
+#include <immintrin.h>
+#endif
+
+// The Kaiser filter's radius, in texels of the smaller level, and the
+// shape of its window.
+static const double kaiserRadius = 3.0;
+static const double kaiserAlpha = 4.0;
+
+// Rows of the smaller level per task.
+static const int bandRows = 16;
+
+const char* mipFilterName(MipFilter filter)
+{
+    switch (filter) {
+    case MipFilter::Box:    return "box";
+    case MipFilter::Kaiser: return "Kaiser"; }
+    return "?";
+}
+
+////////////////////////////////////////////////////////////////////////
+// sRGB
+
+static double srgbDecode(double s)
+{
+    return s <= 0.04045 ? s/12.92 : pow((s + 0.055)/1.055, 2.4);
+}
+
+// The linear value of each 8 bit code, and the linear values at which
+// rounding moves from one code to the next.  Encoding looks up the
+// code at the start of one of 4096 equal steps of [0,1], then checks
+// the one threshold that may lie within the step.  (The thresholds are
+// at least 1/3300 apart.)
+struct SrgbTables
+{
+    float   toLinear[256];
+    float   threshold[256];  // Linear value of code k+0.5; the last is past 1
+    uint8_t stepCode[4096];
+    SrgbTables()
+    {
+        for (int k=0;  k<256;  k++) toLinear[k] = float(srgbDecode(k/255.0));
+        for (int k=0;  k<255;  k++) threshold[k] = float(srgbDecode((k + 0.5)/255.0));
+        threshold[255] = 2.0f;
+        for (int i=0;  i<4096;  i++)
+            stepCode[i] = uint8_t(std::upper_bound(threshold, threshold + 255, i/4096.0f) - threshold);
+    }
+
+    // The nearest code (in sRGB) to a linear value in [0,1].
+    uint8_t encode(float v) const
+    {
+        uint8_t code = stepCode[std::min(int(v*4096.0f), 4095)];
+        return v >= threshold[code] ? code+1 : code;
+    }
+};
+
+static const SrgbTables& srgbTables()
+{
+    static const SrgbTables tables;
+    return tables;
+}
+
+float srgbToLinear(uint8_t v)
+{
+    return srgbTables().toLinear[v];
+}
+
+uint8_t linearToSrgb(float v)
+{
+    return srgbTables().encode(std::min(std::max(v, 0.0f), 1.0f));
+}
+
+////////////////////////////////////////////////////////////////////////
+// Filter weights
+
+static double sinc(double x)
+{
+    x *= 3.14159265358979323846;
+    return fabs(x) < 1e-9 ? 1.0 : sin(x)/x;
+}
+
+// Modified Bessel function of the first kind, order 0 (by its series).
+static double besselI0(double x)
+{
+    double sum = 1.0, term = 1.0;
+    for (int k=1;  k<50 && term > 1e-12*sum;  k++) {
+        term *= (x*x/4.0)/(double(k)*k);
+        sum += term; }
+    return sum;
+}
+
+static double kaiserWindow(double x)
+{
+    double t = x/kaiserRadius;
+    if (fabs(t) >= 1.0) return 0.0;
+    return besselI0(kaiserAlpha*sqrt(1.0 - t*t))/besselI0(kaiserAlpha);
+}
+
+// The taps of each texel of the smaller level along one axis: count
+// source texels (clamped to the edge) and their weights, from
+// offset in index and weight.
+struct AxisFilter
+{
+    struct Taps { size_t offset; int count; };
+    std::vector<Taps>  taps;
+    std::vector<int>   index;
+    std::vector<float> weight;
+};
+
+static AxisFilter makeAxisFilter(int srcSize, int dstSize, MipFilter filter)
+{
+    AxisFilter f;
+    const double scale = double(srcSize)/dstSize;  // Source texels per texel
+    const double radius = (filter == MipFilter::Box ? 0.5 : kaiserRadius)*scale;
+    for (int i=0;  i<dstSize;  i++) {
+        const double center = (i + 0.5)*scale;
+        std::vector<int> index;
+        std::vector<double> weight;
+        double sum = 0.0;
+        for (int j=int(floor(center - radius));  j<int(ceil(center + radius));  j++) {
+            double w;
+            if (filter == MipFilter::Box)  // The part of texel j the area covers
+                w = std::min(j + 1.0, center + radius) - std::max(double(j), center - radius);
+            else {
+                double x = (j + 0.5 - center)/scale;
+                w = sinc(x)*kaiserWindow(x); }
+            if (fabs(w) < 1e-7) continue;
+            index.push_back(std::min(std::max(j, 0), srcSize-1));
+            weight.push_back(w);
+            sum += w; }
+        f.taps.push_back({f.index.size(), int(index.size())});
+        for (size_t k=0;  k<index.size();  k++) {
+            f.index.push_back(index[k]);
+            f.weight.push_back(float(weight[k]/sum)); } }
+    return f;
+}
+
+////////////////////////////////////////////////////////////////////////
+// Filtering
+
+// out += w*in, for one RGBA texel.  Both versions do the same float
+// operations, so their results are identical.
+template <bool Sse>
+static inline void addWeighted(float* out, const float* in, float w)
+{
+#ifdef MIP_BUILDER_X86
+    if constexpr (Sse) {
+        _mm_storeu_ps(out, _mm_add_ps(_mm_loadu_ps(out), _mm_mul_ps(_mm_set1_ps(w), _mm_loadu_ps(in))));
+        return; }
+#endif
+    for (int c=0;  c<4;  c++)
+        out[c] = out[c] + w*in[c];
+}
+
+// One level's texels, in linear color, as floats.
+struct FloatImage
+{
+    int width{0}, height{0};
+    std::vector<float> texels;  // RGBA
+};
+
+// Filters src down to the size of dst, rows [y0,y1) of dst.
+// loadRow(y, row) gives row y of src as linear floats.
+template <bool Sse, typename LoadRow>
+static void filterBand(int srcWidth, const AxisFilter& fx, const AxisFilter& fy,
+                       FloatImage& dst, int y0, int y1, const LoadRow& loadRow)
+{
+    // The source rows these rows use, filtered horizontally.
+    int rowLo = INT32_MAX, rowHi = -1;
+    for (int y=y0;  y<y1;  y++) {
+        const AxisFilter::Taps& t = fy.taps[y];
+        for (int k=0;  k<t.count;  k++) {
+            rowLo = std::min(rowLo, fy.index[t.offset+k]);
+            rowHi = std::max(rowHi, fy.index[t.offset+k]); } }
+
+    const int w = dst.width;
+    std::vector<float> row(size_t(srcWidth)*4);
+    std::vector<float> band(size_t(rowHi - rowLo + 1)*w*4, 0.0f);
+    for (int r=rowLo;  r<=rowHi;  r++) {
+        loadRow(r, row.data());
+        float* out = &band[size_t(r - rowLo)*w*4];
+        for (int x=0;  x<w;  x++) {
+            const AxisFilter::Taps& t = fx.taps[x];
+            for (int k=0;  k<t.count;  k++)
+                addWeighted<Sse>(out + 4*x, &row[4*fx.index[t.offset+k]], fx.weight[t.offset+k]); } }
+
+    // Then vertically, clamped to [0,1] (the Kaiser filter overshoots).
+    for (int y=y0;  y<y1;  y++) {
+        float* out = &dst.texels[size_t(y)*w*4];
+        std::fill(out, out + size_t(w)*4, 0.0f);
+        const AxisFilter::Taps& t = fy.taps[y];
+        for (int k=0;  k<t.count;  k++) {
+            const float* in = &band[size_t(fy.index[t.offset+k] - rowLo)*w*4];
+            const float wk = fy.weight[t.offset+k];
+            for (int x=0;  x<w;  x++)
+                addWeighted<Sse>(out + 4*x, in + 4*x, wk); }
+        for (size_t i=0;  i<size_t(w)*4;  i++)
+            out[i] = std::min(std::max(out[i], 0.0f), 1.0f); }
+}
+
+template <bool Sse>
+static void buildChain(DecodedTexture& texture, MipFilter filter)
+{
+    ThreadPool& pool = ThreadPool::global();
+    const SrgbTables& srgb = srgbTables();
+    const uint32_t nbLevels = fullMipLevels(texture.width, texture.height);
+
+    size_t bytes = 0;
+    for (int w=texture.width, h=texture.height, l=0;  l<int(nbLevels);  l++) {
+        bytes += size_t(w)*h*4;
+        w = std::max(w/2, 1);
+        h = std::max(h/2, 1); }
+    texture.pixels.resize(bytes);
+
+    FloatImage above, level;
+    while (texture.levels.size() < nbLevels) {
+        const TextureLevel top = texture.levels.back();
+        TextureLevel next;
+        next.width = std::max(top.width/2, 1);
+        next.height = std::max(top.height/2, 1);
+        next.offset = top.offset + top.size();
+
+        const AxisFilter fx = makeAxisFilter(top.width, next.width, filter);
+        const AxisFilter fy = makeAxisFilter(top.height, next.height, filter);
+        level.width = next.width;
+        level.height = next.height;
+        level.texels.resize(size_t(next.width)*next.height*4);
+
+        // The top level is read from its 8 bit texels, later ones from
+        // the float copy of the level above.
+        const bool fromBytes = texture.levels.size() == 1;
+        const uint8_t* topBytes = &texture.pixels[top.offset];
+        auto loadRow = [&](int y, float* row) {
+            if (fromBytes) {
+                const uint8_t* in = topBytes + size_t(y)*top.width*4;
+                for (int x=0;  x<top.width;  x++) {
+                    for (int c=0;  c<3;  c++) row[4*x+c] = srgb.toLinear[in[4*x+c]];
+                    row[4*x+3] = in[4*x+3]/255.0f; } }
+            else
+                std::copy(&above.texels[size_t(y)*top.width*4],
+                          &above.texels[size_t(y+1)*top.width*4], row); };
+
+        const int nbBands = (next.height + bandRows-1)/bandRows;
+        pool.parallelFor(nbBands, [&](size_t b) {
+            int y0 = int(b)*bandRows, y1 = std::min(y0 + bandRows, next.height);
+            filterBand<Sse>(top.width, fx, fy, level, y0, y1, loadRow);
+
+            // This band's 8 bit texels.
+            uint8_t* out = &texture.pixels[next.offset];
+            for (size_t i=size_t(y0)*next.width;  i<size_t(y1)*next.width;  i++) {
+                for (int c=0;  c<3;  c++) out[4*i+c] = srgb.encode(level.texels[4*i+c]);
+                out[4*i+3] = uint8_t(level.texels[4*i+3]*255.0f + 0.5f); } });
+
+        texture.levels.push_back(next);
+        std::swap(above, level); }
+}
+
+void buildMipChain(DecodedTexture& texture, MipFilter filter, SimdLevel simd)
+{
+#ifdef MIP_BUILDER_X86
+    if (simd != SimdLevel::Scalar) {
+        buildChain<true>(texture, filter);
+        return; }
+#endif
+    buildChain<false>(texture, filter);
+}
+
+void buildMipChain(DecodedTexture& texture, MipFilter filter)
+{
+    buildMipChain(texture, filter, bestSimdLevel());
+}
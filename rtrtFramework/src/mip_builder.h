@@ -0,0 +1,27 @@
+#pragma once
+
+#include "texture_decode.h"
+#include "vertex_transform.h"  // SimdLevel
+
+// CPU filtering of a texture's mip levels, used for the texture cache
+// and (with CPU_MIPS) in place of generateMipmap's GPU blits.  The
+// color channels are sRGB encoded, so they are filtered in linear
+// color and re-encoded; alpha is filtered as it is.  Each level is
+// filtered from the one above at full float precision, with the
+// filter scaled to the exact ratio of the two sizes, so an odd size
+// (where a level is not half the one above) is handled correctly.
+//
+// The levels are split into bands of rows across the global thread
+// pool.  Every texel is computed the same way whatever the thread
+// count or SIMD level, so the results are identical on any machine.
+
+const char* mipFilterName(MipFilter filter);
+
+// Appends the rest of the mip chain, down to 1x1, to a texture that
+// has only its top level.
+void buildMipChain(DecodedTexture& texture, MipFilter filter);
+void buildMipChain(DecodedTexture& texture, MipFilter filter, SimdLevel level);
+
+// sRGB encoding of one 8 bit channel to and from linear color.
+float srgbToLinear(uint8_t v);
+uint8_t linearToSrgb(float v);
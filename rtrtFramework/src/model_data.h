@@ -0,0 +1,93 @@
+#pragma once
+
+#include <string>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shaders/shared_structs.h"
+
+// Where one aiMesh (as placed by one node of the model's node tree)
+// landed in the flattened ModelData arrays.
+struct MeshRange
+{
+    uint32_t firstVertex;
+    uint32_t vertexCount;
+    uint32_t firstIndex;        // Index of its first triangle's first index
+    uint32_t indexCount;        // 3 per triangle
+    uint32_t meshId;            // Assimp mesh number; shared by all placements of one mesh
+    glm::mat4 transform;        // The node transform that was applied to the mesh
+    uint32_t nbInstances{0};    // Instanced mesh: its placements (see MeshInstance);
+                                // 0: transform was baked into the vertices
+    uint32_t firstLod{0};       // Its simplified levels are
+    uint32_t nbLods{0};         // ModelData::meshLods[firstLod ... firstLod+nbLods-1]
+};
+
+// One simplified level of a MeshRange, made by ModelData::buildLods.
+// Its triangles index the range's own vertices.
+struct MeshLod
+{
+    uint32_t firstIndex;        // Into ModelData::lodIndices
+    uint32_t indexCount;        // 3 per triangle; its materials are at lodMatIndx[firstIndex/3]
+    float    error;             // Largest distance the simplification moved the surface
+};
+
+// With ModelData::instanceMeshes, an aiMesh placed by several nodes
+// is stored once, untransformed, in a MeshRange of its own.  Each
+// placement becomes one of these.
+struct MeshInstance
+{
+    uint32_t  range;            // Index of the mesh's MeshRange
+    glm::mat4 transform;        // The placing node's transform
+};
+
+// CPU side copy of a model as read from a file, before it is sent to
+// the GPU by VkApp::loadModel.
+struct ModelData
+{
+    std::vector<Vertex> vertices;
+    std::vector<uint32_t> indices;
+    std::vector<Material> materials;
+    std::vector<int32_t>     matIndx;
+    std::vector<std::string> textures;
+    std::vector<Emitter>     emitters;  // Triangles with emissive materials
+    std::vector<MeshRange>   meshRanges;
+    std::vector<MeshInstance> meshInstances;  // Grouped by range, in range order
+    std::vector<uint32_t> lodIndices;  // Triangles of every MeshLod
+    std::vector<int32_t>  lodMatIndx;  // Their materials
+    std::vector<MeshLod>  meshLods;
+
+    bool instanceMeshes{false};  // Set before reading to store repeated meshes once
+    uint32_t lodLevels{1};       // Set before reading: levels of detail per mesh, with the original
+    uint32_t mortonBits{0};      // Set before reading: 30 or 63 to sort triangles by Morton code
+    bool skyLight{false};        // Set before reading: add the sky light San Miguel lacks
+
+    // Reads a model (with readObjFile, else readAssimpFile) and does
+    // everything the options above ask for: the ModelData the scene
+    // cache stores.  If reader is given, it is set to the name of the
+    // one that read the file.
+    bool readModelFile(const std::string& path, const char** reader=nullptr);
+    bool readAssimpFile(const std::string& path, const glm::mat4& M);
+    bool readObjFile(const std::string& path, const glm::mat4& M);  // See obj_reader.cpp
+    void gatherEmitters();
+    void optimizeMeshes();  // Weld and reorder each MeshRange; see mesh_optimize.cpp
+    void dedupMaterials();  // Merge identical materials; see material_table.cpp
+    void buildLods();       // Simplify each MeshRange lodLevels-1 times; see mesh_simplify.cpp
+    void sortTriangles();   // Sort each MeshRange by mortonBits codes; see morton_sort.cpp
+
+    // The instances of meshRanges[r] are
+    // meshInstances[instanceStart[r] ... instanceStart[r]+nbInstances-1].
+    std::vector<uint32_t> instanceStarts() const;
+};
+
+// Binary cache of a fully loaded ModelData, stored next to the model
+// file (or in cacheFile, if given).  See scene_cache.cpp.
+bool readSceneCache(const std::string& modelPath, ModelData& meshdata,
+                    const std::string& cacheFile="");
+bool writeSceneCache(const std::string& modelPath, const ModelData& meshdata,
+                     const std::string& cacheFile="");
+
+// Loader timing runs, selected with the -bench command line argument.
+int runLoaderBenchmarks(const std::string& modelPath);
@@ -0,0 +1,207 @@
+//////////////////////////////////////////////////////////////////////
+// Loader stage that sorts each mesh's triangles into Morton order
+// (ModelData::mortonBits).  Triangles arrive in the order the file or
+// Assimp's node traversal produced; in Morton order, triangles near
+// each other in space are near each other in the index buffer, which
+// helps the BLAS builder and the closest hit's vertex and index
+// fetches.  The cost is some of the vertex cache order made by
+// optimizeMeshes, which only the rasterizer cares about.
+//
+// The codes are of triangle centroids, relative to the bounding cube of
+// each mesh.  One radix sort orders all the model's triangles by code,
+// and a second (stable) sort by mesh puts each mesh's back in its own
+// range.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <algorithm>
+#include <chrono>
+#include <numeric>
+
+#include "morton_sort.h"
+#include "mesh_optimize.h"
+#include "thread_pool.h"
+
+// Spreads the low 10 bits of v out to every third bit.
+static uint32_t expandBits10(uint32_t v)
+{
+    v = (v * 0x00010001u) & 0xFF0000FFu;
+    v = (v * 0x00000101u) & 0x0F00F00Fu;
+    v = (v * 0x00000011u) & 0xC30C30C3u;
+    v = (v * 0x00000005u) & 0x49249249u;
+    return v;
+}
+
+// Spreads the low 21 bits of v out to every third bit.
+static uint64_t expandBits21(uint64_t v)
+{
+    v &= 0x1fffff;
+    v = (v | v << 32) & 0x001f00000000ffffull;
+    v = (v | v << 16) & 0x001f0000ff0000ffull;
+    v = (v | v << 8)  & 0x100f00f00f00f00full;
+    v = (v | v << 4)  & 0x10c30c30c30c30c3ull;
+    v = (v | v << 2)  & 0x1249249249249249ull;
+    return v;
+}
+
+static uint32_t quantize(float x, uint32_t levels)
+{
+    x = std::min(std::max(x, 0.0f), 1.0f);
+    return std::min(uint32_t(x * levels), levels-1);
+}
+
+uint32_t mortonCode30(const glm::vec3& p)
+{
+    return (expandBits10(quantize(p.x, 1u<<10)) << 2)
+         | (expandBits10(quantize(p.y, 1u<<10)) << 1)
+         |  expandBits10(quantize(p.z, 1u<<10));
+}
+
+uint64_t mortonCode63(const glm::vec3& p)
+{
+    return (expandBits21(quantize(p.x, 1u<<21)) << 2)
+         | (expandBits21(quantize(p.y, 1u<<21)) << 1)
+         |  expandBits21(quantize(p.z, 1u<<21));
+}
+
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, unsigned keyBits)
+{
+    // The arrays are split into chunks, each with a histogram of its
+    // own per pass.  Scattering chunk by chunk in order keeps the sort
+    // stable.
+    const size_t n = keys.size();
+    ThreadPool& pool = ThreadPool::global();
+    const size_t chunks = std::min<size_t>(std::max<size_t>(n/16384, 1), 4*pool.size());
+    const size_t chunkSize = (n + chunks-1) / chunks;
+    std::vector<uint64_t> keysOut(n);
+    std::vector<uint32_t> valuesOut(n);
+    std::vector<size_t> offsets(chunks*256);
+
+    for (unsigned shift=0;  shift<keyBits;  shift+=8) {
+        const uint64_t mask = keyBits - shift >= 8 ? 255 : (1u << (keyBits - shift)) - 1;
+        std::fill(offsets.begin(), offsets.end(), 0);
+        pool.parallelFor(chunks, [&](size_t c) {
+            size_t* count = &offsets[c*256];
+            for (size_t i=c*chunkSize;  i<std::min(n, (c+1)*chunkSize);  i++)
+                count[(keys[i] >> shift) & mask]++; });
+
+        // Each (digit, chunk)'s first slot, digits in order and within
+        // a digit chunks in order.  A pass where every key has the
+        // same digit would change nothing.
+        size_t sum = 0;
+        bool allSame = false;
+        for (int d=0;  d<256;  d++) {
+            size_t digitCount = 0;
+            for (size_t c=0;  c<chunks;  c++) {
+                size_t count = offsets[c*256+d];
+                offsets[c*256+d] = sum;
+                sum += count;
+                digitCount += count; }
+            allSame |= digitCount == n; }
+        if (allSame) continue;
+
+        pool.parallelFor(chunks, [&](size_t c) {
+            size_t* next = &offsets[c*256];
+            for (size_t i=c*chunkSize;  i<std::min(n, (c+1)*chunkSize);  i++) {
+                size_t to = next[(keys[i] >> shift) & mask]++;
+                keysOut[to] = keys[i];
+                valuesOut[to] = values[i]; } });
+        keys.swap(keysOut);
+        values.swap(valuesOut); }
+}
+
+void ModelData::sortTriangles()
+{
+    // The ranges must tile the arrays exactly, in order.
+    size_t v = 0, i = 0;
+    for (const auto& r : meshRanges) {
+        if (r.firstVertex != v || r.firstIndex != i) break;
+        v += r.vertexCount;
+        i += r.indexCount; }
+    if (v != vertices.size() || i != indices.size()) {
+        printf("Morton sort skipped: mesh ranges do not cover the model\n");
+        return; }
+    if (mortonBits != 30 && mortonBits != 63) {
+        printf("Morton sort skipped: %u bit codes are not supported\n", mortonBits);
+        return; }
+
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool& pool = ThreadPool::global();
+    const size_t nbTriangles = indices.size()/3;
+
+    // Each triangle's range, and each range's bounding box.
+    std::vector<uint32_t> rangeOf(nbTriangles);
+    std::vector<glm::vec3> lo(meshRanges.size());
+    std::vector<float> scale(meshRanges.size());
+    pool.parallelFor(meshRanges.size(), [&](size_t k) {
+        const MeshRange& r = meshRanges[k];
+        std::fill(rangeOf.begin() + r.firstIndex/3, rangeOf.begin() + (r.firstIndex + r.indexCount)/3,
+                  uint32_t(k));
+        glm::vec3 boxLo(INFINITY), boxHi(-INFINITY);
+        for (uint32_t i=r.firstVertex;  i<r.firstVertex + r.vertexCount;  i++) {
+            boxLo = glm::min(boxLo, vertices[i].pos);
+            boxHi = glm::max(boxHi, vertices[i].pos); }
+        // The same scale on all axes, so a flat mesh is not ordered
+        // by its thinnest dimension.
+        glm::vec3 extent = boxHi - boxLo;
+        float size = std::max(extent.x, std::max(extent.y, extent.z));
+        lo[k] = boxLo;
+        scale[k] = size > 0.0f ? 1.0f/size : 0.0f; });
+
+    // Sort by code, then (stably) by range.
+    std::vector<uint64_t> keys(nbTriangles);
+    std::vector<uint32_t> order(nbTriangles);
+    std::iota(order.begin(), order.end(), 0u);
+    pool.parallelForRange(nbTriangles, 4096, [&](size_t b, size_t e) {
+        for (size_t t=b;  t<e;  t++) {
+            glm::vec3 centroid = (vertices[indices[3*t]].pos + vertices[indices[3*t+1]].pos
+                                  + vertices[indices[3*t+2]].pos) / 3.0f;
+            uint32_t k = rangeOf[t];
+            glm::vec3 p = (centroid - lo[k]) * scale[k];
+            keys[t] = mortonBits == 30 ? mortonCode30(p) : mortonCode63(p); } });
+    radixSort(keys, order, mortonBits);
+
+    unsigned rangeBits = 0;
+    while (rangeBits < 32 && (size_t(1) << rangeBits) < meshRanges.size()) rangeBits++;
+    for (size_t t=0;  t<nbTriangles;  t++)
+        keys[t] = rangeOf[order[t]];
+    radixSort(keys, order, rangeBits);
+
+    // Triangles carry their material index with them.
+    std::vector<uint32_t> sortedIndices(indices.size());
+    std::vector<int32_t> sortedMatIndx(matIndx.size());
+    pool.parallelForRange(nbTriangles, 4096, [&](size_t b, size_t e) {
+        for (size_t t=b;  t<e;  t++) {
+            for (int c=0;  c<3;  c++)
+                sortedIndices[3*t+c] = indices[3*order[t]+c];
+            sortedMatIndx[t] = matIndx[order[t]]; } });
+    double acmrBefore = 0.0, acmrAfter = 0.0;
+    for (const MeshRange& r : meshRanges) {
+        acmrBefore += cacheMissRatio(&indices[r.firstIndex], r.indexCount) * (r.indexCount/3);
+        acmrAfter  += cacheMissRatio(&sortedIndices[r.firstIndex], r.indexCount) * (r.indexCount/3); }
+    indices.swap(sortedIndices);
+    matIndx.swap(sortedMatIndx);
+
+    // Vertices in the order the sorted triangles first use them (any
+    // unused ones last, so each range keeps its size).
+    pool.parallelFor(meshRanges.size(), [&](size_t k) {
+        const MeshRange& r = meshRanges[k];
+        std::vector<uint32_t> remap(r.vertexCount, UINT32_MAX);
+        std::vector<Vertex> reordered;
+        reordered.reserve(r.vertexCount);
+        for (uint32_t i=r.firstIndex;  i<r.firstIndex + r.indexCount;  i++) {
+            uint32_t& to = remap[indices[i] - r.firstVertex];
+            if (to == UINT32_MAX) {
+                to = uint32_t(reordered.size());
+                reordered.push_back(vertices[indices[i]]); }
+            indices[i] = r.firstVertex + to; }
+        for (uint32_t i=0;  i<r.vertexCount;  i++)
+            if (remap[i] == UINT32_MAX) reordered.push_back(vertices[r.firstVertex + i]);
+        std::copy(reordered.begin(), reordered.end(), vertices.begin() + r.firstVertex); });
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Morton sort (%u bit codes): %zd triangles in %.1f ms\n", mortonBits, nbTriangles, ms);
+    if (nbTriangles != 0)
+        printf("  ACMR (%d entry FIFO): %.3f -> %.3f\n", vertexCacheSize,
+               acmrBefore/nbTriangles, acmrAfter/nbTriangles);
+}
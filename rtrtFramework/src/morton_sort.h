@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "model_data.h"
+
+// Morton (Z-order) codes and the parallel radix sort used by
+// ModelData::sortTriangles to put each mesh's triangles in spatial
+// order.
+
+// Interleaves the bits of a point's coordinates, each in [0,1],
+// quantized to 10 bits (a 30 bit code) or 21 bits (a 63 bit code).
+uint32_t mortonCode30(const glm::vec3& p);
+uint64_t mortonCode63(const glm::vec3& p);
+
+// Stable LSD radix sort of values by the low keyBits bits of keys, 8
+// bits per pass.  Each pass's histograms and scatter are split across
+// the global thread pool.  Both arrays come back permuted.
+void radixSort(std::vector<uint64_t>& keys, std::vector<uint32_t>& values, unsigned keyBits);
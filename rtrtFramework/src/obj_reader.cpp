@@ -0,0 +1,567 @@
+//////////////////////////////////////////////////////////////////////
+// A reader for Wavefront OBJ models and their MTL material files that
+// fills a ModelData directly, without Assimp.  The OBJ file is memory
+// mapped and cut into line aligned chunks that are parsed on all
+// cores, and the meshes are then assembled in parallel.
+//
+// The result matches what readAssimpFile makes of the same file:
+// faces are triangulated as fans, there is one mesh per group and
+// material, material 0 is Assimp's default material, and a vertex
+// without a normal gets the average normal of its mesh's triangles
+// around its position (as aiProcess_GenSmoothNormals does).
+//
+// Free-form geometry, malformed lines and out of range indices make
+// readObjFile fail, so the caller can fall back to readAssimpFile.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <map>
+
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "model_data.h"
+#include "mapped_file.h"
+#include "thread_pool.h"
+#include "vertex_transform.h"
+
+static const uint32_t noIndex = UINT32_MAX;
+
+static bool isDigit(char c) { return c >= '0' && c <= '9'; }
+static bool isSpace(char c) { return c == ' ' || c == '\t' || c == '\r'; }
+
+static const char* skipSpace(const char* p, const char* end)
+{
+    while (p < end && isSpace(*p)) p++;
+    return p;
+}
+
+// The rest of a line, without surrounding white space.
+static std::string restOfLine(const char* p, const char* end)
+{
+    p = skipSpace(p, end);
+    while (end > p && isSpace(end[-1])) end--;
+    return std::string(p, end);
+}
+
+// Powers of ten that are exact in a double.
+static const double pow10Table[] = {
+    1e0,  1e1,  1e2,  1e3,  1e4,  1e5,  1e6,  1e7,  1e8,  1e9,  1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22};
+
+// Parses a decimal number.  Up to 19 significant digits are gathered
+// in an integer which is then scaled once by a power of ten; that is
+// exact to far better than a float's precision.  Returns the position
+// after the number, or nullptr if there is none.
+static const char* parseFloat(const char* p, const char* end, float& out)
+{
+    p = skipSpace(p, end);
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+
+    uint64_t mantissa = 0;
+    int digits = 0, exponent = 0;
+    bool any = false;
+    for (;  p < end && isDigit(*p);  p++) {
+        any = true;
+        if (digits < 19) {
+            mantissa = mantissa*10 + (*p - '0');
+            if (mantissa) digits++; }
+        else exponent++; }
+    if (p < end && *p == '.')
+        for (p++;  p < end && isDigit(*p);  p++) {
+            any = true;
+            if (digits < 19) {
+                mantissa = mantissa*10 + (*p - '0');
+                if (mantissa) digits++;
+                exponent--; } }
+    if (!any) return nullptr;
+
+    if (p < end && (*p == 'e' || *p == 'E')) {
+        const char* q = p+1;
+        bool negExp = false;
+        if (q < end && (*q == '-' || *q == '+')) negExp = *q++ == '-';
+        if (q < end && isDigit(*q)) {
+            int e = 0;
+            for (;  q < end && isDigit(*q);  q++)
+                if (e < 10000) e = e*10 + (*q - '0');
+            exponent += negExp ? -e : e;
+            p = q; } }
+
+    double v = double(mantissa);
+    if (exponent < 0)
+        v = exponent >= -22 ? v / pow10Table[-exponent] : v * pow(10.0, exponent);
+    else if (exponent > 0)
+        v = exponent <= 22 ? v * pow10Table[exponent] : v * pow(10.0, exponent);
+    out = float(negative ? -v : v);
+    return p;
+}
+
+static const char* parseInt(const char* p, const char* end, int64_t& out)
+{
+    bool negative = false;
+    if (p < end && (*p == '-' || *p == '+')) negative = *p++ == '-';
+    if (p >= end || !isDigit(*p)) return nullptr;
+    int64_t v = 0;
+    for (;  p < end && isDigit(*p);  p++)
+        if (v < (int64_t(1) << 40)) v = v*10 + (*p - '0');
+    out = negative ? -v : v;
+    return p;
+}
+
+// One corner of a face: the 0 based indices of its position, texture
+// coordinate and normal (noIndex if it has none).
+struct ObjCorner
+{
+    uint32_t v, vt, vn;
+};
+
+// A statement that changes the state that following faces are read in.
+struct ObjStatement
+{
+    enum Kind { UseMtl, Group, MtlLib } kind;
+    uint32_t    face;       // Number of the chunk's faces before it
+    std::string name;
+};
+
+// What one chunk of the file holds.  A negative (relative) index in a
+// face can only be resolved once the number of positions, etc. in
+// earlier chunks is known; such corners are listed in relative.
+struct ObjChunk
+{
+    std::vector<glm::vec3> positions;
+    std::vector<glm::vec2> texCoords;
+    std::vector<glm::vec3> normals;
+    std::vector<ObjCorner> corners;
+    std::vector<uint32_t>  faceStart;   // First corner of each face
+    std::vector<ObjStatement> statements;
+    std::vector<std::pair<uint32_t, uint8_t>> relative;  // Corner, and which of v, vt, vn (bits 0,1,2)
+    std::string error;                  // Why the chunk could not be read
+};
+
+// Parses one face corner, "v", "v/vt", "v//vn" or "v/vt/vn".
+static const char* parseCorner(const char* p, const char* end, ObjChunk& chunk)
+{
+    ObjCorner corner{noIndex, noIndex, noIndex};
+    uint32_t* fields[3] = {&corner.v, &corner.vt, &corner.vn};
+    size_t counts[3] = {chunk.positions.size(), chunk.texCoords.size(), chunk.normals.size()};
+    uint8_t relative = 0;
+
+    for (int f=0;  f<3;  f++) {
+        if (f > 0) {
+            if (p >= end || *p != '/') break;
+            p++;
+            if (p < end && *p == '/') continue; }  // v//vn
+        int64_t k;
+        p = parseInt(p, end, k);
+        if (!p || k == 0 || k > int64_t(noIndex)) return nullptr;
+        if (k > 0) *fields[f] = uint32_t(k-1);
+        else {
+            *fields[f] = uint32_t(int64_t(counts[f]) + k);  // Rebased later
+            relative |= 1 << f; } }
+
+    if (relative) chunk.relative.push_back({uint32_t(chunk.corners.size()), relative});
+    chunk.corners.push_back(corner);
+    return p;
+}
+
+static void parseLine(const char* p, const char* end, ObjChunk& chunk)
+{
+    const char* key = p;
+    while (p < end && !isSpace(*p)) p++;
+    size_t keyLength = p - key;
+    auto is = [&](const char* k) { return keyLength == strlen(k) && memcmp(key, k, keyLength) == 0; };
+
+    bool ok = true;
+    if (keyLength == 0 || key[0] == '#') {}
+    else if (is("v")) {
+        glm::vec3 v;
+        ok = (p = parseFloat(p, end, v.x)) && (p = parseFloat(p, end, v.y)) && (p = parseFloat(p, end, v.z));
+        chunk.positions.push_back(v); }
+    else if (is("vt")) {
+        glm::vec2 t(0.0f);
+        ok = (p = parseFloat(p, end, t.x)) != nullptr;
+        if (ok) parseFloat(p, end, t.y);
+        chunk.texCoords.push_back(t); }
+    else if (is("vn")) {
+        glm::vec3 n;
+        ok = (p = parseFloat(p, end, n.x)) && (p = parseFloat(p, end, n.y)) && (p = parseFloat(p, end, n.z));
+        chunk.normals.push_back(n); }
+    else if (is("f")) {
+        size_t first = chunk.corners.size(), firstRelative = chunk.relative.size();
+        for (p = skipSpace(p, end);  p < end;  p = skipSpace(p, end)) {
+            p = parseCorner(p, end, chunk);
+            if (!p || (p < end && !isSpace(*p))) {
+                ok = false;
+                break; } }
+        // Points and lines make no triangles; Assimp drops them too.
+        if (chunk.corners.size() - first < 3) {
+            chunk.corners.resize(first);
+            chunk.relative.resize(firstRelative); }
+        else chunk.faceStart.push_back(uint32_t(first)); }
+    else if (is("usemtl"))
+        chunk.statements.push_back({ObjStatement::UseMtl, uint32_t(chunk.faceStart.size()), restOfLine(p, end)});
+    else if (is("g") || is("o"))
+        chunk.statements.push_back({ObjStatement::Group, uint32_t(chunk.faceStart.size()), restOfLine(p, end)});
+    else if (is("mtllib"))
+        chunk.statements.push_back({ObjStatement::MtlLib, uint32_t(chunk.faceStart.size()), restOfLine(p, end)});
+    else if (is("cstype") || is("curv") || is("curv2") || is("surf")) {
+        chunk.error = "free-form geometry is not supported";
+        return; }
+    // Anything else (s, l, p, mg, ...) does not affect the triangles.
+
+    if (!ok)
+        chunk.error = "cannot parse: " + std::string(key, std::min<size_t>(end - key, 60));
+}
+
+static void parseChunk(const char* p, const char* end, ObjChunk& chunk)
+{
+    while (p < end && chunk.error.empty()) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        parseLine(skipSpace(p, eol), eol, chunk);
+        p = eol + 1; }
+}
+
+// Material properties from an MTL file, with the defaults Assimp uses.
+struct ObjMaterial
+{
+    glm::vec3   Kd{0.6f}, Ks{0.0f}, Ke{0.0f};
+    float       Ns{0.0f};
+    std::string mapKd;
+};
+
+static void readMtlFile(const fs::path& path, std::vector<ObjMaterial>& materials,
+                        std::map<std::string, uint32_t>& byName)
+{
+    MappedFile file;
+    if (!file.open(path.string())) {
+        printf("Cannot read material library %s\n", path.string().c_str());
+        return; }
+
+    const char* p = (const char*)file.data();
+    const char* end = p + file.size();
+    ObjMaterial* mtl = nullptr;
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        const char* s = skipSpace(p, eol);
+        const char* key = s;
+        while (s < eol && !isSpace(*s)) s++;
+        std::string k(key, s);
+        p = eol + 1;
+
+        if (k == "newmtl") {
+            std::string name = restOfLine(s, eol);
+            if (byName.count(name)) {  // The first definition is kept
+                mtl = nullptr;
+                continue; }
+            byName[name] = uint32_t(materials.size());
+            materials.push_back(ObjMaterial());
+            mtl = &materials.back();
+            continue; }
+        if (!mtl) continue;
+
+        glm::vec3* color = k == "Kd" ? &mtl->Kd : k == "Ks" ? &mtl->Ks : k == "Ke" ? &mtl->Ke : nullptr;
+        if (color) {
+            // "Kd r" alone means grey; spectral and xyz forms are not handled.
+            float c[3];
+            int n = 0;
+            for (const char* q = s;  n < 3 && (q = parseFloat(q, eol, c[n]));  n++) {}
+            if (n == 1) *color = glm::vec3(c[0]);
+            else if (n == 3) *color = glm::vec3(c[0], c[1], c[2]); }
+        else if (k == "Ns")
+            parseFloat(s, eol, mtl->Ns);
+        else if (k == "map_Kd") {
+            // Options such as "-s 1 1 1" may precede the file name, which comes last.
+            std::string rest = restOfLine(s, eol);
+            size_t at = rest.find_last_of(" \t");
+            mtl->mapKd = at == std::string::npos ? rest : rest.substr(at+1); }
+    }
+}
+
+// The triangles of a run of faces of one mesh, with their corners
+// made into vertices (each distinct v/vt/vn triple just once).
+struct ObjPiece
+{
+    uint32_t mesh;
+    uint32_t chunk;
+    uint32_t faceBegin, faceEnd;
+
+    std::vector<ObjCorner> vertices;  // The distinct corners
+    std::vector<uint32_t>  indices;   // Into vertices
+    bool     missingNormals{false};
+    bool     badIndex{false};
+    uint32_t firstVertex{0};          // Position in the model's arrays
+    uint32_t firstIndex{0};
+};
+
+static const uint32_t pieceFaces = 1<<16;
+
+static uint64_t hashCorner(const ObjCorner& c)
+{
+    uint64_t h = (uint64_t(c.v) * 0x9E3779B97F4A7C15ull) ^ (uint64_t(c.vt) * 0xC2B2AE3D27D4EB4Full)
+        ^ (uint64_t(c.vn) * 0x165667B19E3779F9ull);
+    return h ^ (h >> 29);
+}
+
+static void buildPiece(ObjPiece& piece, const ObjChunk& chunk,
+                       size_t nbPositions, size_t nbTexCoords, size_t nbNormals)
+{
+    uint32_t cornerBegin = chunk.faceStart[piece.faceBegin];
+    uint32_t cornerEnd = piece.faceEnd < chunk.faceStart.size()
+        ? chunk.faceStart[piece.faceEnd] : uint32_t(chunk.corners.size());
+
+    // Open addressing hash table of indices into piece.vertices.
+    size_t tableSize = 1;
+    while (tableSize < 2*size_t(cornerEnd - cornerBegin)) tableSize *= 2;
+    std::vector<uint32_t> table(tableSize, noIndex);
+    std::vector<uint32_t> remap(cornerEnd - cornerBegin);
+
+    for (uint32_t c=cornerBegin;  c<cornerEnd;  c++) {
+        const ObjCorner& corner = chunk.corners[c];
+        if (corner.v >= nbPositions
+            || (corner.vt != noIndex && corner.vt >= nbTexCoords)
+            || (corner.vn != noIndex && corner.vn >= nbNormals)) {
+            piece.badIndex = true;
+            return; }
+        if (corner.vn == noIndex) piece.missingNormals = true;
+
+        size_t slot = hashCorner(corner) & (tableSize-1);
+        while (table[slot] != noIndex
+               && memcmp(&piece.vertices[table[slot]], &corner, sizeof(ObjCorner)) != 0)
+            slot = (slot+1) & (tableSize-1);
+        if (table[slot] == noIndex) {
+            table[slot] = uint32_t(piece.vertices.size());
+            piece.vertices.push_back(corner); }
+        remap[c - cornerBegin] = table[slot]; }
+
+    for (uint32_t f=piece.faceBegin;  f<piece.faceEnd;  f++) {
+        uint32_t b = chunk.faceStart[f] - cornerBegin;
+        uint32_t e = (f+1 < chunk.faceStart.size() ? chunk.faceStart[f+1] : uint32_t(chunk.corners.size()))
+            - cornerBegin;
+        for (uint32_t i=b+2;  i<e;  i++) {
+            piece.indices.push_back(remap[b]);
+            piece.indices.push_back(remap[i-1]);
+            piece.indices.push_back(remap[i]); } }
+}
+
+bool ModelData::readObjFile(const std::string& path, const glm::mat4& M)
+{
+    std::string extension = fs::path(path).extension().string();
+    std::transform(extension.begin(), extension.end(), extension.begin(), ::tolower);
+    if (extension != ".obj") return false;
+
+    MappedFile file;
+    if (!file.open(path)) return false;
+    printf("ReadObjFile File:  %s \n", path.c_str());
+    auto start = std::chrono::steady_clock::now();
+    ThreadPool& pool = ThreadPool::global();
+
+    // Cut the file into chunks at line ends; a few per thread so that
+    // chunks of differing difficulty even out.
+    const char* text = (const char*)file.data();
+    const char* textEnd = text + file.size();
+    size_t chunkSize = std::max<size_t>(file.size() / (4*pool.size()) + 1, 1<<20);
+    std::vector<const char*> cuts{text};
+    while (cuts.back() < textEnd) {
+        const char* p = cuts.back() + std::min<size_t>(chunkSize, textEnd - cuts.back());
+        while (p < textEnd && p[-1] != '\n') p++;
+        cuts.push_back(p); }
+
+    std::vector<ObjChunk> chunks(cuts.size()-1);
+    pool.parallelFor(chunks.size(), [&](size_t c) { parseChunk(cuts[c], cuts[c+1], chunks[c]); });
+    for (const auto& chunk : chunks)
+        if (!chunk.error.empty()) {
+            printf("OBJ reader: %s\n", chunk.error.c_str());
+            return false; }
+
+    // Each chunk's first position, etc., and the relative indices resolved.
+    std::vector<size_t> firstPosition(chunks.size()+1, 0), firstTexCoord(chunks.size()+1, 0),
+        firstNormal(chunks.size()+1, 0);
+    for (size_t c=0;  c<chunks.size();  c++) {
+        firstPosition[c+1] = firstPosition[c] + chunks[c].positions.size();
+        firstTexCoord[c+1] = firstTexCoord[c] + chunks[c].texCoords.size();
+        firstNormal[c+1]   = firstNormal[c]   + chunks[c].normals.size(); }
+    size_t nbPositions = firstPosition.back(), nbTexCoords = firstTexCoord.back(),
+        nbNormals = firstNormal.back();
+    pool.parallelFor(chunks.size(), [&](size_t c) {
+        for (const auto& rel : chunks[c].relative) {
+            ObjCorner& corner = chunks[c].corners[rel.first];
+            if (rel.second & 1) corner.v  += uint32_t(firstPosition[c]);
+            if (rel.second & 2) corner.vt += uint32_t(firstTexCoord[c]);
+            if (rel.second & 4) corner.vn += uint32_t(firstNormal[c]); } });
+
+    std::vector<glm::vec3> positions(nbPositions), normals(nbNormals);
+    std::vector<glm::vec2> texCoords(nbTexCoords);
+    pool.parallelFor(chunks.size(), [&](size_t c) {
+        std::copy(chunks[c].positions.begin(), chunks[c].positions.end(), positions.begin()+firstPosition[c]);
+        std::copy(chunks[c].texCoords.begin(), chunks[c].texCoords.end(), texCoords.begin()+firstTexCoord[c]);
+        std::copy(chunks[c].normals.begin(), chunks[c].normals.end(), normals.begin()+firstNormal[c]);
+        chunks[c].positions = {};
+        chunks[c].texCoords = {};
+        chunks[c].normals = {}; });
+
+    // Material libraries.  Material 0 is the default material, as in Assimp.
+    std::vector<ObjMaterial> objMaterials(1);
+    std::map<std::string, uint32_t> materialByName;
+    for (const auto& chunk : chunks)
+        for (const auto& s : chunk.statements)
+            if (s.kind == ObjStatement::MtlLib) {
+                fs::path mtlPath = path;
+                mtlPath.replace_filename(s.name);
+                readMtlFile(mtlPath, objMaterials, materialByName); }
+
+    // Walk the statements in file order, splitting the faces into
+    // pieces of the mesh for each (group, material) pair.
+    std::map<std::pair<std::string, uint32_t>, uint32_t> meshByKey;
+    std::vector<uint32_t> meshMaterial;
+    std::vector<ObjPiece> pieces;
+    std::string group;
+    uint32_t material = 0;
+    auto addFaces = [&](uint32_t c, uint32_t b, uint32_t e) {
+        if (b >= e) return;
+        auto key = std::make_pair(group, material);
+        auto it = meshByKey.find(key);
+        if (it == meshByKey.end()) {
+            it = meshByKey.insert({key, uint32_t(meshMaterial.size())}).first;
+            meshMaterial.push_back(material); }
+        for (uint32_t f=b;  f<e;  f += pieceFaces) {
+            ObjPiece piece;
+            piece.mesh = it->second;
+            piece.chunk = c;
+            piece.faceBegin = f;
+            piece.faceEnd = std::min(e, f + pieceFaces);
+            pieces.push_back(std::move(piece)); } };
+    for (uint32_t c=0;  c<chunks.size();  c++) {
+        uint32_t face = 0;
+        for (const auto& s : chunks[c].statements) {
+            addFaces(c, face, s.face);
+            face = s.face;
+            if (s.kind == ObjStatement::Group) group = s.name;
+            else if (s.kind == ObjStatement::UseMtl) {
+                auto it = materialByName.find(s.name);
+                material = it == materialByName.end() ? 0 : it->second; } }
+        addFaces(c, face, uint32_t(chunks[c].faceStart.size())); }
+
+    // Pieces are made in parallel, then grouped by mesh.
+    pool.parallelFor(pieces.size(), [&](size_t k) {
+        buildPiece(pieces[k], chunks[pieces[k].chunk], nbPositions, nbTexCoords, nbNormals); });
+    if (pieces.empty()) {
+        printf("OBJ reader: no faces\n");
+        return false; }
+    for (const auto& piece : pieces)
+        if (piece.badIndex) {
+            printf("OBJ reader: face index out of range\n");
+            return false; }
+    std::stable_sort(pieces.begin(), pieces.end(),
+                     [](const ObjPiece& a, const ObjPiece& b) { return a.mesh < b.mesh; });
+
+    ModelData md;
+    size_t nbVertices = 0, nbIndices = 0;
+    for (size_t k=0;  k<pieces.size();  k++) {
+        ObjPiece& piece = pieces[k];
+        if (k == 0 || pieces[k-1].mesh != piece.mesh)
+            md.meshRanges.push_back({uint32_t(nbVertices), 0, uint32_t(nbIndices), 0, piece.mesh, M});
+        piece.firstVertex = uint32_t(nbVertices);
+        piece.firstIndex  = uint32_t(nbIndices);
+        nbVertices += piece.vertices.size();
+        nbIndices  += piece.indices.size();
+        md.meshRanges.back().vertexCount += uint32_t(piece.vertices.size());
+        md.meshRanges.back().indexCount  += uint32_t(piece.indices.size());
+        if (nbVertices > UINT32_MAX || nbIndices > UINT32_MAX) {
+            printf("Model too large for 32 bit indices.\n");
+            return false; } }
+
+    md.vertices.resize(nbVertices);
+    md.indices.resize(nbIndices);
+    md.matIndx.resize(nbIndices/3);
+    std::vector<uint32_t> positionOf(nbVertices);  // Each vertex's index in positions
+    std::vector<char> meshNeedsNormals(meshMaterial.size(), 0);
+    pool.parallelFor(pieces.size(), [&](size_t k) {
+        const ObjPiece& piece = pieces[k];
+        for (size_t i=0;  i<piece.vertices.size();  i++) {
+            const ObjCorner& c = piece.vertices[i];
+            md.vertices[piece.firstVertex+i] = {
+                positions[c.v],
+                c.vn != noIndex ? normals[c.vn] : glm::vec3(0.0f),
+                c.vt != noIndex ? texCoords[c.vt] : glm::vec2(0.0f)};
+            positionOf[piece.firstVertex+i] = c.v; }
+        for (size_t i=0;  i<piece.indices.size();  i++)
+            md.indices[piece.firstIndex+i] = piece.indices[i] + piece.firstVertex;
+        std::fill(md.matIndx.begin() + piece.firstIndex/3,
+                  md.matIndx.begin() + (piece.firstIndex + piece.indices.size())/3,
+                  int32_t(meshMaterial[piece.mesh]));
+        if (piece.missingNormals) meshNeedsNormals[piece.mesh] = 1; });
+
+    // Smooth normals for the vertices that have none: the average of
+    // the (unit) normals of the mesh's triangles at the vertex's position.
+    pool.parallelFor(md.meshRanges.size(), [&](size_t m) {
+        const MeshRange& r = md.meshRanges[m];
+        if (!meshNeedsNormals[r.meshId]) return;
+        uint32_t lo = noIndex, hi = 0;
+        for (uint32_t v=r.firstVertex;  v<r.firstVertex+r.vertexCount;  v++) {
+            lo = std::min(lo, positionOf[v]);
+            hi = std::max(hi, positionOf[v]); }
+        std::vector<glm::vec3> sum(size_t(hi - lo) + 1, glm::vec3(0.0f));
+        for (uint32_t i=r.firstIndex;  i<r.firstIndex+r.indexCount;  i += 3) {
+            const uint32_t* t = &md.indices[i];
+            glm::vec3 n = glm::cross(md.vertices[t[1]].pos - md.vertices[t[0]].pos,
+                                     md.vertices[t[2]].pos - md.vertices[t[0]].pos);
+            float length = glm::length(n);
+            if (!(length > 0.0f)) continue;
+            for (int k=0;  k<3;  k++) sum[positionOf[t[k]] - lo] += n/length; }
+        for (uint32_t v=r.firstVertex;  v<r.firstVertex+r.vertexCount;  v++) {
+            Vertex& vertex = md.vertices[v];
+            if (vertex.nrm != glm::vec3(0.0f)) continue;
+            glm::vec3 s = sum[positionOf[v] - lo];
+            vertex.nrm = glm::length(s) > 0.0f ? glm::normalize(s) : glm::vec3(0,0,1); } });
+
+    if (M != glm::mat4(1.0)) {
+        VertexTransform tr(M);
+        const size_t stride = sizeof(Vertex)/sizeof(float);
+        pool.parallelForRange(md.vertices.size(), 1<<16, [&](size_t b, size_t e) {
+            Vertex* v = &md.vertices[b];
+            transformVertices(tr, {&v->pos.x, &v->nrm.x, nullptr, stride}, e - b, v); }); }
+
+    // Materials, converted as readAssimpFile does.
+    for (const ObjMaterial& om : objMaterials) {
+        Material newmat;
+        if (om.Ke != glm::vec3(0.0f)) {  // An emitter
+            newmat.diffuse = {1,1,1};
+            newmat.specular = {0,0,0};
+            newmat.shininess = 0.0;
+            newmat.emission = om.Ke;
+            newmat.textureId = -1; }
+        else {
+            newmat.diffuse = om.Kd;
+            newmat.specular = om.Ks;
+            newmat.shininess = om.Ns;
+            newmat.emission = {0,0,0};
+            newmat.textureId = -1; }
+
+        if (!om.mapKd.empty()) {
+            fs::path fullPath = path;
+            fullPath.replace_filename(om.mapKd);
+            printf("Texture: %s\n", fullPath.string().c_str());
+            newmat.textureId = int(md.textures.size());
+            md.textures.push_back(fullPath.u8string()); }
+        md.materials.push_back(newmat); }
+
+    md.instanceMeshes = instanceMeshes;
+    md.lodLevels = lodLevels;
+    md.mortonBits = mortonBits;
+    md.skyLight = skyLight;
+    *this = std::move(md);
+
+    printf("Parsed %zd chunks into %zd meshes in %.1f ms on %d threads\n", chunks.size(),
+           meshRanges.size(),
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count(),
+           pool.size());
+    return true;
+}
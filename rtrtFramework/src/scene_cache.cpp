@@ -0,0 +1,313 @@
+//////////////////////////////////////////////////////////////////////
+// A binary cache of a loaded ModelData.  Reading a large model with
+// Assimp takes many seconds; reading it back from this cache is a
+// memory map and a few memcpy's.
+//
+// The cache file is written next to the model as <model>.rtcache.  It
+// records the size, modification time and content hash of the model
+// file (and of the .mtl files an OBJ names), and is ignored when any
+// of those no longer match.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <ctype.h>
+#include <algorithm>
+#include <fstream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "model_data.h"
+#include "mapped_file.h"
+
+// Bump this whenever the layout of the file or of the cached structures
+// changes, or the loader computes different vertices.
+#define SCENE_CACHE_VERSION 10
+
+struct SceneCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t vertexSize;        // sizeof(Vertex), etc.  Catches struct changes
+    uint32_t materialSize;      // that forgot to bump the version.
+    uint32_t emitterSize;
+    uint32_t meshRangeSize;
+    uint32_t meshInstanceSize;
+    uint32_t meshLodSize;
+    uint32_t instanceMeshes;    // The ModelData options the cache was made with
+    uint32_t lodLevels;
+    uint32_t mortonBits;
+    uint32_t skyLight;
+
+    uint64_t sourceSize;        // Key: the model file(s) this cache was made from
+    int64_t  sourceTime;
+    uint64_t sourceHash;
+
+    uint64_t nbVertices;
+    uint64_t nbIndices;
+    uint64_t nbMaterials;
+    uint64_t nbMatIndx;
+    uint64_t nbEmitters;
+    uint64_t nbMeshRanges;
+    uint64_t nbMeshInstances;
+    uint64_t nbLodIndices;
+    uint64_t nbLodMatIndx;
+    uint64_t nbMeshLods;
+    uint64_t nbTextures;
+    uint64_t textureBytes;      // Size of the packed texture name block
+};
+
+static const char sceneCacheMagic[8] = {'R','T','S','C','E','N','E','\0'};
+
+// Each array in the file starts on a 16 byte boundary.
+static size_t alignUp16(size_t n) { return (n + 15) & ~size_t(15); }
+
+struct SourceKey
+{
+    uint64_t size{0};
+    int64_t  time{0};
+    uint64_t hash{0};
+};
+
+// Fold one file into the cache key.
+static bool addToKey(SourceKey& key, const fs::path& path)
+{
+    MappedFile file;
+    if (!file.open(path.string())) return false;
+
+    std::error_code ec;
+    auto mtime = fs::last_write_time(path, ec);
+    if (ec) return false;
+
+    key.size += file.size();
+    key.time ^= int64_t(mtime.time_since_epoch().count());
+    key.hash  = hashBytes(file.data(), file.size(), key.hash);
+    return true;
+}
+
+// The material libraries an OBJ file names in its mtllib statements,
+// resolved as the OBJ reader does: the rest of the line, next to the
+// model.
+static std::vector<fs::path> objMaterialLibraries(const std::string& modelPath)
+{
+    std::vector<fs::path> libs;
+    MappedFile file;
+    if (!file.open(modelPath)) return libs;
+    const char* p = (const char*)file.data();
+    const char* end = p + file.size();
+    while (p < end) {
+        const char* eol = (const char*)memchr(p, '\n', end - p);
+        if (!eol) eol = end;
+        while (p < eol && (*p == ' ' || *p == '\t')) p++;
+        if (eol - p > 6 && memcmp(p, "mtllib", 6) == 0 && (p[6] == ' ' || p[6] == '\t')) {
+            const char* b = p + 6;
+            const char* e = eol;
+            while (b < e && (*b == ' ' || *b == '\t')) b++;
+            while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) e--;
+            fs::path lib = modelPath;
+            lib.replace_filename(std::string(b, e));
+            if (std::find(libs.begin(), libs.end(), lib) == libs.end())
+                libs.push_back(lib); }
+        p = eol + 1; }
+    return libs;
+}
+
+static bool makeSourceKey(const std::string& modelPath, SourceKey& key)
+{
+    if (!addToKey(key, modelPath)) return false;
+
+    // An OBJ's materials live in separate files; their changes must
+    // also invalidate the cache.  Each name is in the key too, so a
+    // library that appears or disappears does as well.
+    std::string ext = fs::path(modelPath).extension().string();
+    for (char& c : ext) c = char(tolower(c));
+    if (ext == ".obj")
+        for (const fs::path& lib : objMaterialLibraries(modelPath)) {
+            std::string name = lib.string();
+            key.hash = hashBytes(name.data(), name.size(), key.hash);
+            if (fs::exists(lib))
+                addToKey(key, lib); }
+    return true;
+}
+
+static std::string cachePath(const std::string& modelPath)
+{
+    return modelPath + ".rtcache";
+}
+
+// Copies count objects of type T from the mapped file into v,
+// advancing offset past the (16 byte aligned) array.
+template <typename T>
+static bool readArray(const MappedFile& file, size_t& offset, uint64_t count, std::vector<T>& v)
+{
+    // (A corrupt count must not overflow the size computed from it.)
+    if (offset > file.size() || count > (file.size() - offset)/sizeof(T)) return false;
+    size_t bytes = size_t(count)*sizeof(T);
+    const T* src = reinterpret_cast<const T*>(file.data() + offset);
+    v.assign(src, src + count);
+    offset = alignUp16(offset + bytes);
+    return true;
+}
+
+template <typename T>
+static void writeArray(std::ofstream& out, const std::vector<T>& v)
+{
+    static const char zeros[16] = {0};
+    size_t bytes = v.size()*sizeof(T);
+    out.write(reinterpret_cast<const char*>(v.data()), bytes);
+    out.write(zeros, alignUp16(bytes) - bytes);
+}
+
+bool readSceneCache(const std::string& modelPath, ModelData& meshdata,
+                    const std::string& cacheFile)
+{
+    const std::string path = cacheFile.empty() ? cachePath(modelPath) : cacheFile;
+    MappedFile file;
+    if (!file.open(path)) return false;
+    if (file.size() < sizeof(SceneCacheHeader)) return false;
+
+    SceneCacheHeader header;
+    memcpy(&header, file.data(), sizeof(header));
+    if (memcmp(header.magic, sceneCacheMagic, sizeof(sceneCacheMagic)) != 0
+        || header.version != SCENE_CACHE_VERSION
+        || header.vertexSize != sizeof(Vertex)
+        || header.materialSize != sizeof(Material)
+        || header.emitterSize != sizeof(Emitter)
+        || header.meshRangeSize != sizeof(MeshRange)
+        || header.meshInstanceSize != sizeof(MeshInstance)
+        || header.meshLodSize != sizeof(MeshLod)) {
+        printf("Scene cache %s is out of date (format)\n", path.c_str());
+        return false; }
+    if (header.instanceMeshes != uint32_t(meshdata.instanceMeshes)) {
+        printf("Scene cache %s was made with instanceMeshes=%u\n", path.c_str(),
+               header.instanceMeshes);
+        return false; }
+    if (header.lodLevels != meshdata.lodLevels) {
+        printf("Scene cache %s was made with lodLevels=%u\n", path.c_str(),
+               header.lodLevels);
+        return false; }
+    if (header.mortonBits != meshdata.mortonBits) {
+        printf("Scene cache %s was made with mortonBits=%u\n", path.c_str(),
+               header.mortonBits);
+        return false; }
+    if (header.skyLight != uint32_t(meshdata.skyLight)) {
+        printf("Scene cache %s was made with skyLight=%u\n", path.c_str(),
+               header.skyLight);
+        return false; }
+
+    SourceKey key;
+    if (!makeSourceKey(modelPath, key)) return false;
+    if (key.size != header.sourceSize || key.time != header.sourceTime
+        || key.hash != header.sourceHash) {
+        printf("Scene cache %s is out of date (model changed)\n", path.c_str());
+        return false; }
+
+    size_t offset = alignUp16(sizeof(SceneCacheHeader));
+    ModelData md;
+    md.instanceMeshes = meshdata.instanceMeshes;
+    md.lodLevels = meshdata.lodLevels;
+    md.mortonBits = meshdata.mortonBits;
+    md.skyLight = meshdata.skyLight;
+    std::vector<char> names;
+    if (!readArray(file, offset, header.nbVertices,  md.vertices)
+        || !readArray(file, offset, header.nbIndices,   md.indices)
+        || !readArray(file, offset, header.nbMaterials, md.materials)
+        || !readArray(file, offset, header.nbMatIndx,   md.matIndx)
+        || !readArray(file, offset, header.nbEmitters,  md.emitters)
+        || !readArray(file, offset, header.nbMeshRanges, md.meshRanges)
+        || !readArray(file, offset, header.nbMeshInstances, md.meshInstances)
+        || !readArray(file, offset, header.nbLodIndices, md.lodIndices)
+        || !readArray(file, offset, header.nbLodMatIndx, md.lodMatIndx)
+        || !readArray(file, offset, header.nbMeshLods,   md.meshLods)
+        || !readArray(file, offset, header.textureBytes, names)) {
+        printf("Scene cache %s is truncated\n", path.c_str());
+        return false; }
+
+    // Texture names are stored back to back, each terminated by a '\0'.
+    if (!names.empty() && names.back() != '\0') return false;
+    for (size_t i=0;  i<names.size();  ) {
+        md.textures.push_back(std::string(&names[i]));
+        i += md.textures.back().size()+1; }
+    if (md.textures.size() != header.nbTextures) return false;
+
+    meshdata = std::move(md);
+    return true;
+}
+
+bool writeSceneCache(const std::string& modelPath, const ModelData& meshdata,
+                     const std::string& cacheFile)
+{
+    SourceKey key;
+    if (!makeSourceKey(modelPath, key)) return false;
+
+    std::vector<char> names;
+    for (const auto& t : meshdata.textures)
+        names.insert(names.end(), t.c_str(), t.c_str()+t.size()+1);
+
+    SceneCacheHeader header{};
+    memcpy(header.magic, sceneCacheMagic, sizeof(sceneCacheMagic));
+    header.version      = SCENE_CACHE_VERSION;
+    header.vertexSize   = sizeof(Vertex);
+    header.materialSize = sizeof(Material);
+    header.emitterSize  = sizeof(Emitter);
+    header.meshRangeSize = sizeof(MeshRange);
+    header.meshInstanceSize = sizeof(MeshInstance);
+    header.meshLodSize  = sizeof(MeshLod);
+    header.instanceMeshes = meshdata.instanceMeshes;
+    header.lodLevels    = meshdata.lodLevels;
+    header.mortonBits   = meshdata.mortonBits;
+    header.skyLight     = meshdata.skyLight;
+    header.sourceSize   = key.size;
+    header.sourceTime   = key.time;
+    header.sourceHash   = key.hash;
+    header.nbVertices   = meshdata.vertices.size();
+    header.nbIndices    = meshdata.indices.size();
+    header.nbMaterials  = meshdata.materials.size();
+    header.nbMatIndx    = meshdata.matIndx.size();
+    header.nbEmitters   = meshdata.emitters.size();
+    header.nbMeshRanges = meshdata.meshRanges.size();
+    header.nbMeshInstances = meshdata.meshInstances.size();
+    header.nbLodIndices = meshdata.lodIndices.size();
+    header.nbLodMatIndx = meshdata.lodMatIndx.size();
+    header.nbMeshLods   = meshdata.meshLods.size();
+    header.nbTextures   = meshdata.textures.size();
+    header.textureBytes = names.size();
+
+    // Write to a temporary name, then rename, so an interrupted write
+    // never leaves a valid-looking but partial cache behind.
+    std::string path = cacheFile.empty() ? cachePath(modelPath) : cacheFile;
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Cannot write scene cache %s\n", tmpPath.c_str());
+            return false; }
+
+        static const char zeros[16] = {0};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(zeros, alignUp16(sizeof(header)) - sizeof(header));
+        writeArray(out, meshdata.vertices);
+        writeArray(out, meshdata.indices);
+        writeArray(out, meshdata.materials);
+        writeArray(out, meshdata.matIndx);
+        writeArray(out, meshdata.emitters);
+        writeArray(out, meshdata.meshRanges);
+        writeArray(out, meshdata.meshInstances);
+        writeArray(out, meshdata.lodIndices);
+        writeArray(out, meshdata.lodMatIndx);
+        writeArray(out, meshdata.meshLods);
+        writeArray(out, names);
+        if (!out) {
+            printf("Failed writing scene cache %s\n", tmpPath.c_str());
+            return false; }
+    }
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    if (ec) {
+        fs::remove(tmpPath, ec);
+        return false; }
+
+    printf("Wrote scene cache %s\n", path.c_str());
+    return true;
+}
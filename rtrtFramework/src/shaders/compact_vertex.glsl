@@ -0,0 +1,20 @@
+// Decoding of the CompactVertex attributes (see shared_structs.h).
+// Must match the encoders in vertex_compress.cpp.
+
+// Octahedral normal: the unit sphere is projected onto the octahedron
+// |x|+|y|+|z|=1, whose lower half is folded over the upper, and the
+// resulting square is stored as two snorm16's.  See Cigolle et al.,
+// "A Survey of Efficient Representations for Independent Unit Vectors".
+vec3 octDecodeNormal(uint packed)
+{
+    vec2 e = unpackSnorm2x16(packed);
+    vec3 n = vec3(e.x, e.y, 1.0 - abs(e.x) - abs(e.y));
+    if (n.z < 0.0)
+        n.xy = (1.0 - abs(n.yx)) * vec2(n.x >= 0.0 ? 1.0 : -1.0, n.y >= 0.0 ? 1.0 : -1.0);
+    return normalize(n);
+}
+
+vec2 decodeTexCoord(uint packed)
+{
+    return unpackHalf2x16(packed);
+}
@@ -0,0 +1,41 @@
+// Importance of a light BVH node (see LightBvhNode in
+// shared_structs.h) for a point P with normal N.  Must match
+// lightBvhImportance in light_sampling.cpp.
+float lightBvhImportance(LightBvhNode node, vec3 P, vec3 N)
+{
+    if (!(node.power > 0.0)) return 0.0;
+
+    // The bounds are treated as their bounding sphere.  Inside it,
+    // light may come from any direction.
+    vec3 center = (node.boundsMin + node.boundsMax)*0.5;
+    vec3 halfDiag = (node.boundsMax - node.boundsMin)*0.5;
+    float radius2 = dot(halfDiag, halfDiag);
+    vec3 D = P - center;
+    float dist2 = dot(D, D);
+    if (dist2 <= radius2) return node.power/max(radius2, 1e-12);
+
+    vec3 wi = D/sqrt(dist2);  // From the emitters to P
+    float sin2B = radius2/dist2;
+    float cosB = sqrt(max(0.0, 1.0 - sin2B));
+    float sinB = sqrt(min(1.0, sin2B));
+
+    // cos(max(0, thetaW - thetaO - thetaB)) for the emitters' normals
+    float cosW = abs(dot(node.axis, wi));
+    float sinW = sqrt(max(0.0, 1.0 - cosW*cosW));
+    float cosO = node.cosSpread;
+    float sinO = sqrt(max(0.0, 1.0 - cosO*cosO));
+    float cosP = 1.0;
+    if (cosW < cosO) {
+        float cosWO = cosW*cosO + sinW*sinO;
+        float sinWO = sinW*cosO - cosW*sinO;
+        if (cosWO < cosB) cosP = cosWO*cosB + sinWO*sinB; }
+    if (cosP <= 0.0) return 0.0;
+
+    // and for P's normal
+    float cosI = -dot(N, wi);
+    float sinI = sqrt(max(0.0, 1.0 - cosI*cosI));
+    float cosN = cosI < cosB ? cosI*cosB + sinI*sinB : 1.0;
+    if (cosN <= 0.0) return 0.0;
+
+    return node.power*cosP*cosN/dist2;
+}
@@ -0,0 +1,14 @@
+// Each triangle's material index, packed 8, 16 or 32 bits wide into
+// 32 bit words (see ObjDesc::matIndexBits).  Must match
+// packMaterialIndices in material_table.cpp.
+
+layout(buffer_reference, scalar) buffer MatIndices {uint i[]; }; // Packed material ID for each triangle
+
+int LoadMaterialIndex(uint64_t address, uint bits, int primitive)
+{
+    MatIndices matIndices = MatIndices(address);
+    uint perWord = 32/bits;
+    uint word = matIndices.i[uint(primitive)/perWord];
+    if (bits == 32) return int(word);
+    return int((word >> ((uint(primitive)%perWord)*bits)) & ((1u<<bits) - 1u));
+}
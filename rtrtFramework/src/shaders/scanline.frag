@@ -9,6 +9,7 @@
 #extension GL_EXT_buffer_reference2 : require
 
 #include "shared_structs.h"
+#include "material_index.glsl"
 
 layout(push_constant) uniform _PushConstantRaster
 {
@@ -27,20 +28,28 @@ layout(location = 0) out vec4 fragColor;
 layout(buffer_reference, scalar) buffer Vertices {Vertex v[]; };    // Positions of an object
 layout(buffer_reference, scalar) buffer Indices {uint i[]; };       // Triangle indices
 layout(buffer_reference, scalar) buffer Materials {Material m[]; }; // Array of materials
-layout(buffer_reference, scalar) buffer MatIndices {int i[]; };     // Material ID for each triangle
 
 layout(binding=1, scalar) buffer ObjDesc_ { ObjDesc i[]; } objDesc;
 layout(binding=2) uniform sampler2D[] textureSamplers;
+#ifdef VIRTUAL_TEXTURES
+layout(binding=4, scalar) buffer VtTextures_ { VtTexture t[]; } vtTextures;
+layout(binding=5) buffer VtPages_ { uint p[]; } vtPages;
+layout(binding=6) buffer VtFeedback_ { uint bits[]; } vtFeedback;
+layout(binding=7) uniform sampler2D vtCache;
+#include "virtual_texture.glsl"
+#endif
+#ifdef TEXTURE_ATLAS
+layout(binding=4, scalar) buffer AtlasRects_ { AtlasRect r[]; } atlasRects;
+#endif
 
 float pi = 3.14159;
 void main()
 {
   // Material of the object
   ObjDesc    obj = objDesc.i[pcRaster.objIndex];
-  MatIndices matIndices  = MatIndices(obj.materialIndexAddress);
   Materials  materials   = Materials(obj.materialAddress);
   
-  int               matIndex = matIndices.i[gl_PrimitiveID];
+  int               matIndex = LoadMaterialIndex(obj.materialIndexAddress, obj.matIndexBits, gl_PrimitiveID);
   Material mat      = materials.m[matIndex];
   
   vec3 N = normalize(worldNrm);
@@ -59,7 +68,18 @@ void main()
   {
     int  txtOffset  = obj.txtOffset;
     uint txtId      = txtOffset + mat.textureId;
+#ifdef VIRTUAL_TEXTURES
+    vec4 color;
+    if (sampleVirtualTexture(txtId, texCoord, vtLod(txtId, dFdx(texCoord), dFdy(texCoord)), color))
+      Kd = color.xyz;
+#elif defined(TEXTURE_ATLAS)
+    // Wrapped here, so the gradients are those of the unwrapped coordinates.
+    AtlasRect rect = atlasRects.r[txtId];
+    Kd = textureGrad(textureSamplers[nonuniformEXT(rect.image)], rect.offset + fract(texCoord)*rect.scale,
+                     dFdx(texCoord)*rect.scale, dFdy(texCoord)*rect.scale).xyz;
+#else
     Kd = texture(textureSamplers[nonuniformEXT(txtId)], texCoord).xyz;
+#endif
   }
   
   // This very minimal lighting calculation should be replaced with a modern BRDF calculation. 
@@ -6,20 +6,29 @@
 #extension GL_EXT_shader_explicit_arithmetic_types_int64 : require
 
 #include "shared_structs.h"
+#include "compact_vertex.glsl"
 
 layout(binding = 0) uniform _MatrixUniforms
 {
   MatrixUniforms mats;
 };
 
+// Transforms of each instance, indexed by gl_InstanceIndex.
+layout(binding = 3, scalar) buffer InstanceTransforms_ { InstanceTransform m[]; } instanceTransforms;
+
 layout(push_constant) uniform _PushConstantRaster
 {
   PushConstantRaster pcRaster;
 };
 
 layout(location = 0) in vec3 inPosition;
+#ifdef COMPACT_VERTICES
+layout(location = 1) in uint inPackedNormal;
+layout(location = 2) in uint inPackedTexCoord;
+#else
 layout(location = 1) in vec3 inNormal;
 layout(location = 2) in vec2 inTexCoord;
+#endif
 
 
 layout(location = 1) out vec3 worldPos;
@@ -36,11 +45,18 @@ out gl_PerVertex
 void main()
 {
   vec3 eye = vec3(mats.viewInverse * vec4(0, 0, 0, 1));
+  mat4 modelMatrix = instanceTransforms.m[gl_InstanceIndex].transform;
+  mat3 normalMatrix = mat3(instanceTransforms.m[gl_InstanceIndex].normalMatrix);
 
-  worldPos = vec3(pcRaster.modelMatrix * vec4(inPosition, 1.0));
+  worldPos = vec3(modelMatrix * vec4(inPosition, 1.0));
   viewDir  = vec3(eye - worldPos);
+#ifdef COMPACT_VERTICES
+  texCoord = decodeTexCoord(inPackedTexCoord);
+  worldNrm = normalMatrix * octDecodeNormal(inPackedNormal);
+#else
   texCoord = inTexCoord;
-  worldNrm = mat3(pcRaster.modelMatrix) * inNormal;
+  worldNrm = normalMatrix * inNormal;
+#endif
 
   gl_Position = mats.viewProj * vec4(worldPos, 1.0);
 }
@@ -16,10 +16,12 @@ using uint = unsigned int;
 struct ObjDesc
 {
   int      txtOffset;             // Texture index offset in the array of textures
+  uint     matIndexBits;          // Width of each material index: 8, 16 or 32
   uint64_t vertexAddress;         // Address of the Vertex buffer
   uint64_t indexAddress;          // Address of the index buffer
   uint64_t materialAddress;       // Address of the material buffer
   uint64_t materialIndexAddress;  // Address of the triangle material index buffer
+  uint64_t hitRecordAddress;      // HIT_RECORDS only: address of the HitRecord buffer
 };
 
 // An emitter
@@ -35,6 +37,50 @@ struct Emitter
     vec3 point;
 };
 
+// One bin of the Walker alias table that picks emitters in proportion
+// to their power.  A uniformly chosen bin i gives emitter i with
+// probability prob, and emitter alias otherwise.  pdf is the
+// probability of picking emitter i by any bin.
+struct LightAlias
+{
+    float prob;
+    uint  alias;
+    float pdf;
+};
+
+// Define this to pick the emitter for each shading point by
+// traversing a light BVH (see light_sampling.h and light_bvh.glsl)
+// instead of by power alone through the LightAlias table.
+//#define LIGHT_BVH
+
+// A node of the light BVH.  Bounds, power and the cone of normals
+// (around axis, with half angle acos(cosSpread)) cover all the
+// node's emitters.  Interior nodes have emitter -1; leaves have one
+// emitter and no children.  Emitters are lit on both sides, as
+// GeometryFactor treats them.
+struct LightBvhNode
+{
+    vec3  boundsMin;
+    float power;
+    vec3  boundsMax;
+    float cosSpread;
+    vec3  axis;
+    int   emitter;          // Index in the emitter list, or -1
+    uint  child0;
+    uint  child1;
+    uint  parent;           // ~0u at the root
+};
+
+// An instance's entry in the instance buffer.  Normals go to world
+// space by the inverse-transpose of the transform's upper 3x3, not by
+// the 3x3 itself (they differ under non-uniform scale); it is computed
+// once per instance on the CPU.
+struct InstanceTransform
+{
+  mat4 transform;     // Object to world
+  mat4 normalMatrix;  // Upper 3x3: inverse-transpose of transform's, up to a positive scale
+};
+
 // Uniform buffer set at each frame
 struct MatrixUniforms
 {
@@ -104,6 +150,7 @@ struct PushConstantRay
     ALIGNAS(4) int frameSeed;
     ALIGNAS(4) float rr;
     ALIGNAS(4) int depth;
+    ALIGNAS(4) int nbEmitters;    // Lights to sample; with none, explicit mode does no light sampling
 };
 
 struct Vertex  // Created by readModel; used in shaders
@@ -113,6 +160,30 @@ struct Vertex  // Created by readModel; used in shaders
   vec2 texCoord;
 };
 
+// Define this to store each object's shading attributes as an 8 byte
+// CompactVertex, with the positions in a separate vec3 buffer (which
+// the BLAS is built from), instead of as 32 byte Vertex's.
+//#define COMPACT_VERTICES
+
+struct CompactVertex  // Created by loadModel from a Vertex; see vertex_compress.h
+{
+  uint nrm;       // Octahedral encoded normal, two snorm16's
+  uint texCoord;  // Two half floats
+};
+
+// Define this to give each triangle a 32 byte HitRecord holding all
+// GetHitObjectData needs from it, so a hit reads one record instead
+// of an index triple, three vertices and a material index.
+//#define HIT_RECORDS
+
+struct HitRecord  // Created by loadModel for each triangle; see vertex_compress.h
+{
+  uint nrm[3];       // The vertices' normals, encoded as in CompactVertex
+  uint texCoord[3];  // The vertices' texture coordinates, likewise
+  int  matIndex;     // The triangle's material
+  uint geomNormal;   // Its geometric normal, octahedral encoded
+};
+
 struct Material  // Created by readModel; used in shaders
 {
   vec3  diffuse;
@@ -122,6 +193,58 @@ struct Material  // Created by readModel; used in shaders
   int   textureId;
 };
 
+// Define this (as the side, in tiles, of the cache of resident tiles)
+// to sample textures through a page table into that cache instead of
+// keeping every texture resident at all its mip levels.  The shaders
+// record the tiles they want in a feedback buffer, and a streaming
+// thread loads the missing ones; see virtual_texture.h and
+// virtual_texture.glsl.
+//#define VIRTUAL_TEXTURES 32
+
+#define VT_TILE_SIZE   128   // Texels of a texture level a tile covers, on each side
+#define VT_TILE_BORDER 4     // Texels of its neighbours kept around a tile, for filtering
+#define VT_CACHE_TILE  (VT_TILE_SIZE + 2*VT_TILE_BORDER)  // A tile's side in the cache
+#define VT_RESIDENT    0x80000000u
+
+// A virtually textured texture.  Its page table entries, one per tile
+// of each level, level 0 first and row by row, start at firstPage.
+// Only the levels down to the first that is a single tile are paged;
+// that one's tile is always resident, and coarser levels are not
+// used.  A page table entry is 0, or VT_RESIDENT | x | y<<12 for a
+// tile at (x,y) in the cache.
+struct VtTexture
+{
+  uint firstPage;
+  int  width;       // Of level 0
+  int  height;
+  uint nbLevels;    // Paged levels
+};
+
+// Define this (as the largest side, in texels, of a texture packed) to
+// pack the small textures of each model into a few atlas pages, each
+// one image and one descriptor; see texture_atlas.h.  (Virtual
+// textures have no use for it.)
+//#define TEXTURE_ATLAS 256
+
+#if defined(TEXTURE_ATLAS) && defined(VIRTUAL_TEXTURES)
+#error TEXTURE_ATLAS and VIRTUAL_TEXTURES cannot both be defined
+#endif
+
+#define ATLAS_PAGE_SIZE 2048  // Largest side of a page
+#define ATLAS_GUTTER    8     // Texels around each packed texture, at level 0
+#define ATLAS_LEVELS    4     // Levels of a page sampled: each keeps a texel of gutter
+
+// Where texture slot i is (with TEXTURE_ATLAS): its texture
+// coordinates, wrapped to [0,1), are scaled by scale and offset by
+// offset into textureSamplers[image].  An unpacked texture has the
+// whole of its image.
+struct AtlasRect
+{
+  vec2 scale;
+  vec2 offset;
+  uint image;
+};
+
 
 // Push constant structure for the ray tracer
 struct PushConstantDenoise
@@ -135,7 +258,8 @@ struct RayPayload
 {
     bool hit;           // Does the ray intersect anything or not?
     vec3 hitPos;	    // The world coordinates of the hit point.      
-    int instanceIndex;  // Index of the object instance hit (we have only one, so =0)
+    int instanceIndex;  // Index of the object of the instance hit
+    int instanceId;     // Index of the instance hit (into the instance transforms)
     int primitiveIndex; // Index of the hit triangle primitive within object
     vec3 bc;            // Barycentric coordinates of the hit point within triangle
     uint seed;
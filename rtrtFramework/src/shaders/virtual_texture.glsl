@@ -0,0 +1,59 @@
+// Sampling a virtual texture (VIRTUAL_TEXTURES; see VtTexture in
+// shared_structs.h and virtual_texture.h).  The including shader
+// declares the buffers vtTextures (VtTexture t[]), vtPages (uint p[])
+// and vtFeedback (uint bits[]), and the cache image vtCache.  Must
+// match VirtualTextures::sample in virtual_texture.cpp.
+
+int vtTiles(int size) { return (size + VT_TILE_SIZE - 1)/VT_TILE_SIZE; }
+
+// Sets a page's feedback bit, unless another invocation already has.
+void vtWant(uint page)
+{
+    uint bit = 1u << (page & 31u);
+    if ((vtFeedback.bits[page >> 5] & bit) == 0u)
+        atomicOr(vtFeedback.bits[page >> 5], bit);
+}
+
+// The level of detail of a virtual texture at the screen derivatives
+// of its texture coordinates.
+float vtLod(uint id, vec2 dUVdx, vec2 dUVdy)
+{
+    vec2 size = vec2(vtTextures.t[id].width, vtTextures.t[id].height);
+    vec2 dx = dUVdx*size, dy = dUVdy*size;
+    return 0.5*log2(max(max(dot(dx, dx), dot(dy, dy)), 1e-12));
+}
+
+// Texture id's color at uv, bilinear filtered at the level nearest
+// lod, which is recorded as wanted; if that tile is not resident, at
+// the finest resident level above it.  False if none is (until the
+// texture's last paged tile is first placed).
+bool sampleVirtualTexture(uint id, vec2 uv, float lod, out vec4 color)
+{
+    VtTexture t = vtTextures.t[id];
+    uv = fract(uv);  // The REPEAT address mode
+    int want = clamp(int(floor(lod + 0.5)), 0, int(t.nbLevels) - 1);
+    uint first = t.firstPage;
+    int w = t.width, h = t.height;
+    for (int l = 0;  l < want;  l++) {
+        first += uint(vtTiles(w)*vtTiles(h));
+        w = max(w/2, 1);
+        h = max(h/2, 1); }
+
+    for (int l = want;  l < int(t.nbLevels);  l++) {
+        int tilesX = vtTiles(w), tilesY = vtTiles(h);
+        vec2 texel = uv*vec2(w, h);
+        ivec2 tile = min(ivec2(texel)/VT_TILE_SIZE, ivec2(tilesX - 1, tilesY - 1));
+        uint page = first + uint(tile.y*tilesX + tile.x);
+        if (l == want) vtWant(page);
+        uint entry = vtPages.p[page];
+        if (entry != 0u) {
+            vec2 cachePos = vec2(entry & 0xfffu, (entry >> 12) & 0xfffu)*float(VT_CACHE_TILE)
+                            + float(VT_TILE_BORDER) + texel - vec2(tile*VT_TILE_SIZE);
+            color = textureLod(vtCache, cachePos/vec2(textureSize(vtCache, 0)), 0.0);
+            return true; }
+        first += uint(tilesX*tilesY);
+        w = max(w/2, 1);
+        h = max(h/2, 1); }
+    color = vec4(0.0);
+    return false;
+}
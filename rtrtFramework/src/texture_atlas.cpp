@@ -0,0 +1,134 @@
+//////////////////////////////////////////////////////////////////////
+// Atlas pages of small textures; see texture_atlas.h.
+//
+// The packer is a shelf packer: the textures, tallest first, are laid
+// left to right in rows as tall as their first, and a row that does
+// not fit starts a new page.  Textures under a size threshold vary
+// little in height, so the rows waste little, and the result is the
+// same on every run.  Each page is then trimmed to the area used.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+
+#include "texture_atlas.h"
+#include "mip_builder.h"
+#include "block_compress.h"
+
+// A texture's place in a page, its gutter included.
+struct AtlasPlacement
+{
+    int texture;
+    int page;
+    int x, y;
+};
+
+// Up to a multiple of the gutter, the grid textures are placed on.
+static int alignToGrid(int n)
+{
+    return (n + ATLAS_GUTTER - 1)/ATLAS_GUTTER*ATLAS_GUTTER;
+}
+
+// The area a texture takes in a page.
+static int footprintWidth(const DecodedTexture& t)  { return alignToGrid(t.width + 2*ATLAS_GUTTER); }
+static int footprintHeight(const DecodedTexture& t) { return alignToGrid(t.height + 2*ATLAS_GUTTER); }
+
+TextureAtlas packTextureAtlas(const std::vector<DecodedTexture>& textures, int maxSide,
+                              MipFilter filter)
+{
+    auto start = std::chrono::steady_clock::now();
+    TextureAtlas atlas;
+    atlas.page.assign(textures.size(), -1);
+    atlas.rects.assign(textures.size(), AtlasRect{vec2(1.0f), vec2(0.0f), 0});
+
+    std::vector<int> small;
+    for (size_t t=0;  t<textures.size();  t++) {
+        const DecodedTexture& texture = textures[t];
+        if (!texture.levels.empty() && texture.width <= maxSide && texture.height <= maxSide
+            && footprintWidth(texture) <= ATLAS_PAGE_SIZE && footprintHeight(texture) <= ATLAS_PAGE_SIZE)
+            small.push_back(int(t)); }
+    if (small.size() < 2) return atlas;  // Nothing saved
+
+    // Tallest first, then widest; ties keep the textures' order.
+    std::stable_sort(small.begin(), small.end(), [&](int a, int b) {
+        int ha = footprintHeight(textures[a]), hb = footprintHeight(textures[b]);
+        if (ha != hb) return ha > hb;
+        return footprintWidth(textures[a]) > footprintWidth(textures[b]); });
+
+    std::vector<AtlasPlacement> placed;
+    std::vector<int> pageWidth, pageHeight;
+    int x = 0, y = 0, shelf = 0;
+    for (int t : small) {
+        int w = footprintWidth(textures[t]), h = footprintHeight(textures[t]);
+        if (x + w > ATLAS_PAGE_SIZE) {  // The next shelf
+            y += shelf;
+            x = 0;
+            shelf = 0; }
+        if (pageWidth.empty() || y + h > ATLAS_PAGE_SIZE) {  // The next page
+            pageWidth.push_back(0);
+            pageHeight.push_back(0);
+            x = y = shelf = 0; }
+        int page = int(pageWidth.size()) - 1;
+        placed.push_back({t, page, x, y});
+        pageWidth[page]  = std::max(pageWidth[page], x + w);
+        pageHeight[page] = std::max(pageHeight[page], y + h);
+        x += w;
+        shelf = std::max(shelf, h); }
+
+    // The pages' top levels: each texture, then its gutter repeating it.
+    std::vector<bool> compressed(pageWidth.size(), false);
+    for (size_t p=0;  p<pageWidth.size();  p++) {
+        DecodedTexture page;
+        page.width = pageWidth[p];
+        page.height = pageHeight[p];
+        // Unused texels opaque black, so a page of opaque textures is BC1.
+        for (size_t i=0;  i<size_t(page.width)*page.height;  i++)
+            page.pixels.insert(page.pixels.end(), {0, 0, 0, 255});
+        page.levels.push_back({page.width, page.height, 0});
+        atlas.pages.push_back(std::move(page)); }
+
+    size_t packedTexels = 0;
+    for (const AtlasPlacement& pl : placed) {
+        const DecodedTexture& texture = textures[pl.texture];
+        DecodedTexture& page = atlas.pages[pl.page];
+        std::vector<uint8_t> decoded;
+        const uint8_t* src = texture.data() + texture.levels[0].offset;
+        if (texture.format() != TextureFormat::RGBA8) {
+            decoded = decompressLevel(texture, 0);
+            src = decoded.data();
+            compressed[pl.page] = true; }
+
+        const int w = texture.width, h = texture.height;
+        const int left = pl.x + ATLAS_GUTTER, bottom = pl.y + ATLAS_GUTTER;
+        const int fw = footprintWidth(texture), fh = footprintHeight(texture);
+        for (int py = pl.y;  py < pl.y + fh;  py++) {
+            const int ty = ((py - bottom) % h + h) % h;
+            uint8_t* dst = page.pixels.data() + 4*(size_t(py)*page.width + pl.x);
+            for (int px = pl.x;  px < pl.x + fw;  px++, dst += 4) {
+                const int tx = ((px - left) % w + w) % w;
+                memcpy(dst, src + 4*(size_t(ty)*w + tx), 4); } }
+
+        AtlasRect& rect = atlas.rects[pl.texture];
+        rect.scale  = vec2(float(w)/page.width, float(h)/page.height);
+        rect.offset = vec2(float(left)/page.width, float(bottom)/page.height);
+        rect.image  = uint(pl.page);
+        atlas.page[pl.texture] = pl.page;
+        packedTexels += size_t(w)*h; }
+    atlas.nbPacked = placed.size();
+
+    size_t pageTexels = 0;
+    for (size_t p=0;  p<atlas.pages.size();  p++) {
+        DecodedTexture& page = atlas.pages[p];
+        pageTexels += size_t(page.width)*page.height;
+        buildMipChain(page, filter);
+        if (compressed[p])
+            compressTexture(page, chooseBlockFormat(page)); }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Texture atlas: %zd of %zd textures packed into %zd pages (%.0f%% filled) in %.1f ms\n",
+           atlas.nbPacked, textures.size(), atlas.pages.size(),
+           100.0*packedTexels/std::max(pageTexels, size_t(1)), ms);
+    return atlas;
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#include "texture_decode.h"
+#include "shaders/shared_structs.h"  // AtlasRect, ATLAS_PAGE_SIZE, ...
+
+// Packing of small textures into atlas pages (TEXTURE_ATLAS in
+// shared_structs.h).  A model with many tiny textures (photos, book
+// spines, labels) otherwise takes an image, a sampler and a slot of
+// textureSamplers[] for each; packed, a page of them is one of each,
+// and nearby texels of different textures share the texture cache.
+//
+// Each packed texture is surrounded by ATLAS_GUTTER texels that repeat
+// it (as the REPEAT address mode would), and placed on a grid of
+// ATLAS_GUTTER texels, so down to level ATLAS_LEVELS-1 of the page a
+// texture's texels never share a texel with another's, and bilinear
+// filtering at its edges reads its own wrapped texels.  The shaders
+// wrap the texture coordinates themselves and map them into the page
+// with the texture's AtlasRect.
+//
+// None of this touches Vulkan; VkApp uploads the pages as textures.
+
+struct TextureAtlas
+{
+    std::vector<DecodedTexture> pages;  // RGBA8, or BC1/BC7 if the textures were; all their levels
+    std::vector<int32_t> page;          // Of each texture, or -1 if not packed
+    std::vector<AtlasRect> rects;       // Of each texture; image is its page (0 if not packed)
+    size_t nbPacked{0};
+};
+
+// Packs the textures no larger than maxSide on either side (when there
+// are at least two) into as few pages, of at most ATLAS_PAGE_SIZE
+// texels square, as a shelf packer manages.  The pages' levels are
+// filtered with filter, and compressed when the textures are.
+TextureAtlas packTextureAtlas(const std::vector<DecodedTexture>& textures, int maxSide,
+                              MipFilter filter);
@@ -0,0 +1,187 @@
+//////////////////////////////////////////////////////////////////////
+// A cache of decoded textures with their full mip chains.  Decoding a
+// JPG or PNG and then blitting its mip levels on the GPU is most of
+// the start-up time of a texture-heavy model; reading the levels back
+// from this cache is a memory map, and they are uploaded from the
+// mapping as they are.
+//
+// The cache file is written next to the image as <image>.rtex.  It
+// records the size and modification time of the image file and is
+// ignored when either no longer matches.  (The images are not hashed
+// as the scene cache's models are: reading each one to hash it would
+// cost much of what the cache saves.)
+//
+// The layout: a header, a table of the levels, then each level's
+// texels (RGBA8, or BC1 or BC7 blocks; bottom row first) on a 16 byte
+// boundary.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <fstream>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "texture_decode.h"
+
+// Bump this whenever the layout of the file changes, or the mip levels
+// are filtered differently.
+#define TEXTURE_CACHE_VERSION 3
+
+struct TextureCacheHeader
+{
+    char     magic[8];
+    uint32_t version;
+    uint32_t texelSize;         // 4: RGBA8 (a texel's size before compression)
+    uint32_t format;            // TextureFormat of every level
+    float    psnr;              // Of a compressed level 0
+    uint32_t width;             // Of level 0
+    uint32_t height;
+    uint32_t nbLevels;
+    uint32_t mipFilter;         // MipFilter the levels were made with
+
+    uint64_t sourceSize;        // Key: the image file this cache was made from
+    int64_t  sourceTime;
+};
+
+struct TextureCacheLevel
+{
+    uint32_t width;
+    uint32_t height;
+    uint64_t offset;            // From the start of the file
+};
+
+static const char textureCacheMagic[8] = {'R','T','T','E','X','\0','\0','\0'};
+
+static size_t alignUp16(size_t n) { return (n + 15) & ~size_t(15); }
+
+static std::string cachePath(const std::string& fileName)
+{
+    return fileName + ".rtex";
+}
+
+static bool makeSourceKey(const std::string& fileName, uint64_t& size, int64_t& time)
+{
+    std::error_code ec;
+    size = fs::file_size(fileName, ec);
+    if (ec) return false;
+    auto mtime = fs::last_write_time(fileName, ec);
+    if (ec) return false;
+    time = int64_t(mtime.time_since_epoch().count());
+    return true;
+}
+
+bool readTextureCache(const std::string& fileName, uint32_t mipDrop,
+                      const TextureOptions& options, DecodedTexture& texture)
+{
+    auto file = std::make_shared<MappedFile>();
+    if (!file->open(cachePath(fileName))) return false;
+    if (file->size() < sizeof(TextureCacheHeader)) return false;
+
+    TextureCacheHeader header;
+    memcpy(&header, file->data(), sizeof(header));
+    if (memcmp(header.magic, textureCacheMagic, sizeof(textureCacheMagic)) != 0
+        || header.version != TEXTURE_CACHE_VERSION
+        || header.texelSize != 4
+        || header.format > uint32_t(TextureFormat::BC7)
+        || header.nbLevels != fullMipLevels(header.width, header.height)) {
+        printf("Texture cache %s is out of date (format)\n", cachePath(fileName).c_str());
+        return false; }
+    if (header.mipFilter != uint32_t(options.mipFilter)) {
+        printf("Texture cache %s was made with another mip filter\n", cachePath(fileName).c_str());
+        return false; }
+    if ((header.format != uint32_t(TextureFormat::RGBA8)) != options.compress) {
+        printf("Texture cache %s was made %s compression\n", cachePath(fileName).c_str(),
+               options.compress ? "without" : "with");
+        return false; }
+
+    uint64_t size;
+    int64_t time;
+    if (!makeSourceKey(fileName, size, time)) return false;
+    if (size != header.sourceSize || time != header.sourceTime) {
+        printf("Texture cache %s is out of date (image changed)\n", cachePath(fileName).c_str());
+        return false; }
+
+    size_t tableOffset = alignUp16(sizeof(TextureCacheHeader));
+    if (tableOffset + header.nbLevels*sizeof(TextureCacheLevel) > file->size()) return false;
+    std::vector<TextureCacheLevel> table(header.nbLevels);
+    memcpy(table.data(), file->data() + tableOffset, header.nbLevels*sizeof(TextureCacheLevel));
+
+    // Levels dropped for the memory budget are simply not uploaded.
+    DecodedTexture result;
+    for (uint32_t l=std::min(mipDrop, header.nbLevels-1);  l<header.nbLevels;  l++) {
+        TextureLevel level;
+        level.width = int(table[l].width);
+        level.height = int(table[l].height);
+        level.offset = size_t(table[l].offset);
+        level.format = TextureFormat(header.format);
+        if (level.offset + level.size() > file->size()) {
+            printf("Texture cache %s is truncated\n", cachePath(fileName).c_str());
+            return false; }
+        result.levels.push_back(level); }
+    result.width = result.levels[0].width;
+    result.height = result.levels[0].height;
+    result.psnr = header.psnr;
+    result.file = std::move(file);
+    texture = std::move(result);
+    return true;
+}
+
+bool writeTextureCache(const std::string& fileName, const DecodedTexture& texture,
+                       MipFilter filter)
+{
+    if (texture.levels.size() != fullMipLevels(texture.width, texture.height)) return false;
+    uint64_t size;
+    int64_t time;
+    if (!makeSourceKey(fileName, size, time)) return false;
+
+    TextureCacheHeader header{};
+    memcpy(header.magic, textureCacheMagic, sizeof(textureCacheMagic));
+    header.version    = TEXTURE_CACHE_VERSION;
+    header.texelSize  = 4;
+    header.format     = uint32_t(texture.format());
+    header.psnr       = texture.psnr;
+    header.width      = texture.width;
+    header.height     = texture.height;
+    header.nbLevels   = uint32_t(texture.levels.size());
+    header.mipFilter  = uint32_t(filter);
+    header.sourceSize = size;
+    header.sourceTime = time;
+
+    std::vector<TextureCacheLevel> table;
+    size_t offset = alignUp16(alignUp16(sizeof(header)) + texture.levels.size()*sizeof(TextureCacheLevel));
+    for (const TextureLevel& level : texture.levels) {
+        table.push_back({uint32_t(level.width), uint32_t(level.height), offset});
+        offset = alignUp16(offset + level.size()); }
+
+    // Write to a temporary name, then rename, so an interrupted write
+    // never leaves a valid-looking but partial cache behind.
+    std::string path = cachePath(fileName);
+    std::string tmpPath = path + ".tmp";
+    {
+        std::ofstream out(tmpPath, std::ios::binary | std::ios::trunc);
+        if (!out) {
+            printf("Cannot write texture cache %s\n", tmpPath.c_str());
+            return false; }
+
+        static const char zeros[16] = {0};
+        out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        out.write(zeros, alignUp16(sizeof(header)) - sizeof(header));
+        size_t tableBytes = table.size()*sizeof(TextureCacheLevel);
+        out.write(reinterpret_cast<const char*>(table.data()), tableBytes);
+        out.write(zeros, alignUp16(tableBytes) - tableBytes);
+        for (const TextureLevel& level : texture.levels) {
+            out.write(reinterpret_cast<const char*>(texture.data() + level.offset), level.size());
+            out.write(zeros, alignUp16(level.size()) - level.size()); }
+        if (!out) {
+            printf("Failed writing texture cache %s\n", tmpPath.c_str());
+            return false; }
+    }
+
+    std::error_code ec;
+    fs::rename(tmpPath, path, ec);
+    if (ec) {
+        fs::remove(tmpPath, ec);
+        return false; }
+    return true;
+}
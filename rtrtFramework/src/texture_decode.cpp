@@ -0,0 +1,176 @@
+//////////////////////////////////////////////////////////////////////
+// Texture decoding for the loader.  stb_image decodes a file on one
+// thread, so a texture-heavy model decodes its files side by side on
+// the thread pool; VkApp::uploadTextures then uploads the lot from
+// the calling thread.  With the texture cache, a file is decoded only
+// on the first run (when mip_builder.cpp filters its mip levels);
+// later runs map its cache file and upload the levels as they are.
+// With compression, the cache holds the levels as BC1 or BC7 blocks,
+// compressed by block_compress.cpp on that first run.
+//
+// stb_image 2.08 keeps its vertical flip setting in a global, so the
+// rows are flipped here instead.  (Its only other shared state, the
+// fixed Huffman tables, is filled lazily with the same constants by
+// whichever thread first needs them.)
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <stdexcept>
+
+#include "stb_image.h"
+
+#include "texture_decode.h"
+#include "mip_builder.h"
+#include "block_compress.h"
+#include "thread_pool.h"
+
+// Halves an RGBA8 image in each dimension with a box filter, from src
+// to dst, which may be the same.  (Each output pixel is written below
+// all later reads.)
+static void halveImage(const uint8_t* src, int width, int height, uint8_t* dst)
+{
+    int w = std::max(width/2, 1), h = std::max(height/2, 1);
+    for (int y=0;  y<h;  y++)
+        for (int x=0;  x<w;  x++) {
+            int x0 = std::min(2*x, width-1),  x1 = std::min(2*x+1, width-1);
+            int y0 = std::min(2*y, height-1), y1 = std::min(2*y+1, height-1);
+            for (int c=0;  c<4;  c++) {
+                int sum = src[4*(y0*width+x0)+c] + src[4*(y0*width+x1)+c]
+                        + src[4*(y1*width+x0)+c] + src[4*(y1*width+x1)+c];
+                dst[4*(y*w+x)+c] = uint8_t((sum + 2)/4); } }
+}
+
+uint32_t fullMipLevels(int width, int height)
+{
+    return uint32_t(std::floor(std::log2(std::max(std::max(width, height), 1)))) + 1;
+}
+
+// Removes a texture's top levels, keeping at least one.
+static void dropLevels(DecodedTexture& texture, uint32_t mipDrop)
+{
+    size_t drop = std::min<size_t>(mipDrop, texture.levels.size()-1);
+    if (drop == 0) return;
+    size_t bytes = texture.levels[drop].offset;
+    texture.levels.erase(texture.levels.begin(), texture.levels.begin() + drop);
+    for (TextureLevel& level : texture.levels)
+        level.offset -= bytes;
+    texture.pixels.erase(texture.pixels.begin(), texture.pixels.begin() + bytes);
+    texture.width = texture.levels[0].width;
+    texture.height = texture.levels[0].height;
+}
+
+DecodedTexture decodeTexture(std::string fileName, uint32_t mipDrop)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t i=0;  i<fileName.size();  i++)
+        if (fileName[i] == '\\') fileName[i] = '/';
+    
+    int texWidth, texHeight, texChannels;
+    stbi_uc* pixels = stbi_load(fileName.c_str(), &texWidth, &texHeight, &texChannels,
+                                STBI_rgb_alpha);
+
+    if (!pixels) {
+        throw std::runtime_error("failed to load texture image " + fileName);
+    }
+
+    // Bottom row first, as the shaders' texture coordinates expect.
+    DecodedTexture texture;
+    texture.pixels.resize(size_t(texWidth)*texHeight*4);
+    const size_t rowBytes = size_t(texWidth)*4;
+    for (int y=0;  y<texHeight;  y++)
+        memcpy(&texture.pixels[y*rowBytes], pixels + (texHeight-1-y)*rowBytes, rowBytes);
+    stbi_image_free(pixels);
+
+    // Mip levels dropped to meet the memory budget (see uploadModel),
+    // filtered as the texture cache's levels are.
+    for (uint32_t d=0;  d<mipDrop;  d++) {
+        halveImage(texture.pixels.data(), texWidth, texHeight, texture.pixels.data());
+        texWidth = std::max(texWidth/2, 1);
+        texHeight = std::max(texHeight/2, 1); }
+    texture.pixels.resize(size_t(texWidth)*texHeight*4);
+
+    texture.width = texWidth;
+    texture.height = texHeight;
+    texture.levels.push_back({texWidth, texHeight, 0});
+    texture.decodeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    return texture;
+}
+
+DecodedTexture loadTexture(const std::string& fileName, uint32_t mipDrop,
+                           const TextureOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::string path = fileName;
+    for (size_t i=0;  i<path.size();  i++)
+        if (path[i] == '\\') path[i] = '/';
+
+    DecodedTexture texture;
+    if (options.useCache && readTextureCache(path, mipDrop, options, texture))
+        texture.fromCache = true;
+    else if (options.useCache || options.cpuMips || options.compress) {
+        // The cache has every level; this run uses those below mipDrop.
+        texture = decodeTexture(path, 0);
+        buildMipChain(texture, options.mipFilter);
+        if (options.compress)
+            compressTexture(texture, chooseBlockFormat(texture));
+        if (options.useCache)
+            writeTextureCache(path, texture, options.mipFilter);
+        dropLevels(texture, mipDrop); }
+    else
+        texture = decodeTexture(path, mipDrop);  // The GPU makes the other levels
+
+    texture.decodeMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    return texture;
+}
+
+std::vector<DecodedTexture> loadTextures(const std::vector<std::string>& fileNames,
+                                         uint32_t mipDrop, const TextureOptions& options)
+{
+    auto start = std::chrono::steady_clock::now();
+    std::vector<DecodedTexture> textures(fileNames.size());
+    std::vector<std::string> errors(fileNames.size());
+
+    // An exception must not escape a worker thread; each is kept for
+    // the calling thread to throw.
+    ThreadPool::global().parallelFor(fileNames.size(), [&](size_t t) {
+        try {
+            textures[t] = loadTexture(fileNames[t], mipDrop, options); }
+        catch (const std::exception& e) {
+            errors[t] = e.what(); } });
+    for (const std::string& error : errors)
+        if (!error.empty()) throw std::runtime_error(error);
+
+    double wallMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - start).count();
+    double sumMs = 0.0;
+    size_t nbCached = 0, nbCompressed = 0;
+    size_t bytes = 0, rgbaBytes = 0;  // Of all levels, as stored and as RGBA8
+    for (size_t t=0;  t<textures.size();  t++) {
+        const DecodedTexture& texture = textures[t];
+        char psnr[32] = "";
+        if (texture.format() != TextureFormat::RGBA8) {
+            snprintf(psnr, sizeof(psnr), "%s %5.1f dB", textureFormatName(texture.format()), texture.psnr);
+            nbCompressed++; }
+        printf("  %8.1f ms  %5d x %-5d %-12s %s%s\n", texture.decodeMs,
+               texture.width, texture.height, psnr, fileNames[t].c_str(),
+               texture.fromCache ? " (cache)" : "");
+        sumMs += texture.decodeMs;
+        nbCached += texture.fromCache;
+        for (const TextureLevel& level : texture.levels) {
+            bytes += level.size();
+            rgbaBytes += size_t(level.width)*level.height*4; } }
+    printf("Texture load: %zd textures (%zd from the texture cache) in %.1f ms on %u threads"
+           " (%.1f ms one after another)\n",
+           textures.size(), nbCached, wallMs, ThreadPool::global().size(), sumMs);
+    if (nbCompressed != 0)
+        printf("Texture memory: %.1f MB, against %.1f MB as RGBA8 (%zd textures compressed, %.1f MB saved)\n",
+               bytes/(1024.0*1024.0), rgbaBytes/(1024.0*1024.0), nbCompressed,
+               (rgbaBytes - bytes)/(1024.0*1024.0));
+    return textures;
+}
@@ -0,0 +1,104 @@
+#pragma once
+
+#include <stdint.h>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "mapped_file.h"
+
+// Texture files decoded on the CPU, ready for VkApp::uploadTextures.
+// None of this touches Vulkan, so it may run on any thread.
+
+// How a TextureLevel's texels are stored.
+enum class TextureFormat
+{
+    RGBA8,  // 4 bytes a texel
+    BC1,    // 8 bytes a block of 4x4 texels: RGB, opaque
+    BC7,    // 16 bytes a block of 4x4 texels: RGBA
+};
+
+// One mip level of a DecodedTexture: width*height texels at offset in
+// its data().  Compressed levels are whole 4x4 blocks, row by row,
+// the last column and row of blocks padded by repeating the edge.
+struct TextureLevel
+{
+    int    width{0};
+    int    height{0};
+    size_t offset{0};
+    TextureFormat format{TextureFormat::RGBA8};
+    size_t size() const
+    {
+        if (format == TextureFormat::RGBA8) return size_t(width)*height*4;
+        size_t blocks = size_t((width+3)/4)*((height+3)/4);
+        return blocks*(format == TextureFormat::BC1 ? 8 : 16);
+    }
+};
+
+// A texture's pixels (reduced by any dropped mip levels), bottom row
+// first.  Decoded from the image file, it has its top level only and
+// the GPU makes the rest; read from a texture cache, it has every
+// level, in the memory mapped file.
+struct DecodedTexture
+{
+    int width{0};                     // Of levels[0]
+    int height{0};
+    std::vector<uint8_t> pixels;      // The levels' texels, unless in file
+    std::shared_ptr<MappedFile> file; // The texture cache file, if read from one
+    std::vector<TextureLevel> levels;
+    double decodeMs{0.0};             // Time taken by loadTexture
+    bool fromCache{false};
+    float psnr{0.0f};                 // Of a compressed level 0, in dB
+
+    const uint8_t* data() const { return file ? file->data() : pixels.data(); }
+    TextureFormat format() const { return levels.empty() ? TextureFormat::RGBA8 : levels[0].format; }
+};
+
+// The filters of the CPU mip builder (mip_builder.h).
+enum class MipFilter
+{
+    Box,     // Each texel the average of the area it covers
+    Kaiser,  // Kaiser windowed sinc: sharper, with some ringing
+};
+
+// How loadTexture makes a texture's mip levels.
+struct TextureOptions
+{
+    bool useCache{false};     // Read and write the texture cache
+    bool cpuMips{false};      // Filter the levels on the CPU even without the cache
+    bool compress{false};     // Then compress them to BC1 or BC7 (block_compress.h)
+    MipFilter mipFilter{MipFilter::Box};
+};
+
+// Number of mip levels of a full chain, down to 1x1.
+uint32_t fullMipLevels(int width, int height);
+
+// Reads and decodes one image file, then halves it mipDrop times (each
+// dropping its top mip level, for the memory budget).  Throws
+// std::runtime_error if the file cannot be read.
+DecodedTexture decodeTexture(std::string fileName, uint32_t mipDrop);
+
+// As decodeTexture, but with options.useCache reads the texture cache
+// of the file instead, if there is an up to date one.  If not, it
+// decodes the file, filters its full mip chain on the CPU, and writes
+// the cache for the next run.  With cpuMips (or compress) and no
+// cache, the chain is filtered all the same but not written.  With
+// compress, every level is then block compressed.
+DecodedTexture loadTexture(const std::string& fileName, uint32_t mipDrop,
+                           const TextureOptions& options);
+
+// Loads all the files at once with loadTexture, split across the global
+// thread pool, and prints each one's time, the total and the wall
+// time (and with compression, each one's PSNR and the memory saved).  The result is in the order of fileNames.  Throws (after all
+// are done) if any file cannot be read.
+std::vector<DecodedTexture> loadTextures(const std::vector<std::string>& fileNames,
+                                         uint32_t mipDrop, const TextureOptions& options);
+
+// The texture cache (texture_cache.cpp): a file next to each image,
+// <image>.rtex, with all its mip levels ready to upload.  A cache
+// made with another mip filter, or with(out) compression, is out of
+// date.
+bool readTextureCache(const std::string& fileName, uint32_t mipDrop,
+                      const TextureOptions& options, DecodedTexture& texture);
+bool writeTextureCache(const std::string& fileName, const DecodedTexture& texture,
+                       MipFilter filter);
@@ -0,0 +1,135 @@
+//////////////////////////////////////////////////////////////////////
+// The registry of the scene's textures; see texture_registry.h.
+//
+// Models that reuse an image are common: an OBJ's .mtl often gives the
+// same map to many materials (and readObjFile and readAssimpFile list
+// a texture per material), and models exported from one scene ship
+// their own copies of shared images.  Without the registry each
+// reference was decoded and uploaded, and took its own device memory.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <filesystem>
+namespace fs = std::filesystem;
+
+#include "texture_registry.h"
+#include "mapped_file.h"
+
+std::string canonicalPath(const std::string& fileName)
+{
+    std::string name = fileName;
+    for (size_t i=0;  i<name.size();  i++)
+        if (name[i] == '\\') name[i] = '/';
+    std::error_code ec;
+    fs::path path = fs::weakly_canonical(fs::path(name), ec);
+    if (ec) path = fs::absolute(fs::path(name), ec).lexically_normal();
+    return path.generic_string();
+}
+
+// Hashes an entry's file, once.  False if it cannot be read.
+bool TextureRegistry::hashEntry(Entry& e)
+{
+    if (e.hashed) return true;
+    MappedFile file;
+    if (!file.open(e.paths[0])) return false;
+    e.hash = hashBytes(file.data(), file.size());
+    e.hashed = true;
+    return true;
+}
+
+TextureRegistry::Resolved TextureRegistry::acquire(const std::vector<std::string>& fileNames)
+{
+    Resolved r;
+    r.firstNewSlot = uint32_t(m_entries.size());
+    for (const std::string& fileName : fileNames) {
+        std::string path = canonicalPath(fileName);
+        uint32_t slot = UINT32_MAX;
+        auto known = m_byPath.find(path);
+        if (known != m_byPath.end()) {
+            slot = known->second;
+            r.byPath++; }
+        else {
+            Entry e;
+            e.paths.push_back(path);
+            std::error_code ec;
+            e.fileSize = fs::file_size(path, ec);
+
+            // A copy of a registered image: same size, then same hash.
+            for (uint32_t s=0;  s<m_entries.size() && !ec;  s++)
+                if (m_entries[s].fileSize == e.fileSize && hashEntry(e) && hashEntry(m_entries[s])
+                    && m_entries[s].hash == e.hash) {
+                    slot = s;
+                    break; }
+            if (slot != UINT32_MAX) {
+                m_entries[slot].paths.push_back(path);
+                r.byContent++; }
+            else {
+                slot = uint32_t(m_entries.size());
+                m_entries.push_back(e);
+                r.newFiles.push_back(fileName); }
+            m_byPath[path] = slot; }
+
+        m_entries[slot].refs++;
+        r.slots.push_back(slot); }
+
+    // Every reference beyond the first of each new texture was saved
+    // a decode, as was every reference to an older one.
+    std::vector<bool> seen(m_entries.size(), false);
+    for (uint32_t slot : r.slots) {
+        if (slot >= r.firstNewSlot && !seen[slot]) seen[slot] = true;
+        else r.reused.push_back(slot); }
+    return r;
+}
+
+void TextureRegistry::uploaded(const Resolved& r, const std::vector<size_t>& newBytes)
+{
+    for (size_t i=0;  i<newBytes.size();  i++)
+        m_entries[r.firstNewSlot + i].bytes = newBytes[i];
+    size_t bytes = 0;
+    for (uint32_t slot : r.reused)
+        bytes += m_entries[slot].bytes;
+    m_decodesAvoided += r.reused.size();
+    m_bytesAvoided += bytes;
+    printf("Texture registry: %zd references, %zd new textures; %zd shared (%zd by path, %zd by content)"
+           " saved %.1f MB (%zd decodes and %.1f MB in all)\n",
+           r.slots.size(), r.newFiles.size(), r.reused.size(), r.byPath, r.byContent,
+           bytes/(1024.0*1024.0), m_decodesAvoided, m_bytesAvoided/(1024.0*1024.0));
+}
+
+std::vector<int32_t> TextureRegistry::release(const std::vector<uint32_t>& slots)
+{
+    for (uint32_t slot : slots)
+        m_entries[slot].refs--;
+
+    std::vector<int32_t> renumber(m_entries.size(), -1);
+    std::vector<Entry> kept;
+    for (size_t s=0;  s<m_entries.size();  s++)
+        if (m_entries[s].refs != 0) {
+            renumber[s] = int32_t(kept.size());
+            kept.push_back(std::move(m_entries[s])); }
+    m_entries.swap(kept);
+
+    m_byPath.clear();
+    for (uint32_t s=0;  s<m_entries.size();  s++)
+        for (const std::string& path : m_entries[s].paths)
+            m_byPath[path] = s;
+    return renumber;
+}
+
+std::vector<std::string> TextureRegistry::unregistered(const std::vector<std::string>& fileNames) const
+{
+    std::vector<std::string> result;
+    std::unordered_map<std::string, bool> listed;
+    for (const std::string& fileName : fileNames) {
+        std::string path = canonicalPath(fileName);
+        if (m_byPath.count(path) == 0 && !listed[path]) {
+            listed[path] = true;
+            result.push_back(fileName); } }
+    return result;
+}
+
+void TextureRegistry::clear()
+{
+    m_entries.clear();
+    m_byPath.clear();
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <stdint.h>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// The scene's textures by their image files, so an image used by
+// several materials, or by several models, is decoded and uploaded
+// once.  Each texture has a slot, its index in VkApp::m_objText, and
+// the materials refer to textures by slot.
+//
+// An image is known first by its canonical path.  A file at a new
+// path is also compared with the registered images of the same size,
+// by a hash of its contents, which finds copies of one image in
+// several models' folders; only files whose size matches another's
+// are ever read for this.  Textures are counted by reference, and
+// freed when the last model using them is removed.
+//
+// None of this touches Vulkan; VkApp uploads the new textures.
+class TextureRegistry
+{
+public:
+    // A model's textures, as resolved by acquire.
+    struct Resolved
+    {
+        std::vector<uint32_t> slots;        // Each of the model's textures' slot
+        std::vector<std::string> newFiles;  // To load and upload, to slots firstNewSlot on
+        uint32_t firstNewSlot{0};
+        std::vector<uint32_t> reused;       // The slot of each reference not loaded again
+        size_t byPath{0}, byContent{0};     // How those were found
+    };
+
+    // Takes a reference to each of a model's texture files, giving
+    // the ones not yet registered new slots at the end.
+    Resolved acquire(const std::vector<std::string>& fileNames);
+
+    // Records the device bytes of the textures just uploaded for r
+    // (in newFiles order), and prints what sharing saved.
+    void uploaded(const Resolved& r, const std::vector<size_t>& newBytes);
+
+    // Drops one reference to each of slots.  Textures left unused are
+    // removed and the others renumbered down to fill their slots; the
+    // result maps each old slot to its new one, or -1 if removed.
+    std::vector<int32_t> release(const std::vector<uint32_t>& slots);
+
+    // Those of fileNames whose paths are not registered, each once.
+    std::vector<std::string> unregistered(const std::vector<std::string>& fileNames) const;
+
+    size_t size() const { return m_entries.size(); }
+    void clear();
+
+    size_t decodesAvoided() const { return m_decodesAvoided; }
+    size_t bytesAvoided() const { return m_bytesAvoided; }
+
+private:
+    struct Entry
+    {
+        std::vector<std::string> paths;  // Canonical; several for copies
+        uint64_t fileSize{0};
+        uint64_t hash{0};
+        bool     hashed{false};
+        uint32_t refs{0};
+        size_t   bytes{0};               // On the device
+    };
+    bool hashEntry(Entry& e);
+
+    std::vector<Entry> m_entries;        // By slot
+    std::unordered_map<std::string, uint32_t> m_byPath;
+    size_t m_decodesAvoided{0};
+    size_t m_bytesAvoided{0};
+};
+
+// A file's path in one spelling: absolute, with '/' separators and
+// no "." or ".." parts, and symbolic links resolved.
+std::string canonicalPath(const std::string& fileName);
@@ -0,0 +1,92 @@
+#include <algorithm>
+
+#include "thread_pool.h"
+
+// Set while a thread is running loop iterations, so that a nested
+// parallelFor runs serially instead of deadlocking the pool.
+static thread_local bool insideLoop = false;
+
+ThreadPool::ThreadPool(unsigned threadCount)
+{
+    if (threadCount == 0)
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    for (unsigned i=1;  i<threadCount;  i++)
+        m_workers.emplace_back([this]() { workerLoop(); });
+}
+
+ThreadPool::~ThreadPool()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    for (auto& t : m_workers)
+        t.join();
+}
+
+ThreadPool& ThreadPool::global()
+{
+    static ThreadPool pool;
+    return pool;
+}
+
+// Grabs chunks of the current loop until none are left.
+void ThreadPool::runChunks()
+{
+    insideLoop = true;
+    for (;;) {
+        size_t begin = m_next.fetch_add(m_grain);
+        if (begin >= m_count) break;
+        (*m_body)(begin, std::min(begin + m_grain, m_count)); }
+    insideLoop = false;
+}
+
+void ThreadPool::workerLoop()
+{
+    uint64_t seen = 0;
+    for (;;) {
+        {
+            std::unique_lock<std::mutex> lock(m_mutex);
+            m_wake.wait(lock, [&]() { return m_stop || m_generation != seen; });
+            if (m_stop) return;
+            seen = m_generation;
+        }
+
+        runChunks();
+
+        std::lock_guard<std::mutex> lock(m_mutex);
+        if (--m_busy == 0) m_done.notify_one();
+    }
+}
+
+void ThreadPool::parallelForRange(size_t count, size_t grain,
+                                  const std::function<void(size_t, size_t)>& body)
+{
+    if (count == 0) return;
+    if (grain == 0) grain = 1;
+
+    // Not worth waking anybody up for, or already inside a loop.
+    if (m_workers.empty() || count <= grain || insideLoop) {
+        for (size_t b=0;  b<count;  b += grain)
+            body(b, std::min(b + grain, count));
+        return; }
+
+    std::lock_guard<std::mutex> submit(m_submitMutex);
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_body  = &body;
+        m_count = count;
+        m_grain = grain;
+        m_next  = 0;
+        m_busy  = unsigned(m_workers.size());
+        m_generation++;
+    }
+    m_wake.notify_all();
+
+    runChunks();
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_done.wait(lock, [&]() { return m_busy == 0; });
+    m_body = nullptr;
+}
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// A fixed set of worker threads that split loops between them.  The
+// calling thread also works on the loop, and parallelFor returns only
+// once every iteration is done.
+//
+// A parallelFor called from inside another parallelFor simply runs
+// serially on the calling thread.
+class ThreadPool
+{
+public:
+    explicit ThreadPool(unsigned threadCount=0);  // 0: one thread per core
+    ~ThreadPool();
+    ThreadPool(const ThreadPool&) = delete;
+    ThreadPool& operator=(const ThreadPool&) = delete;
+
+    // Number of threads working on a loop, including the caller.
+    unsigned size() const { return unsigned(m_workers.size()) + 1; }
+
+    // Calls body(begin, end) on consecutive sub-ranges of [0,count),
+    // each at most grain long.
+    void parallelForRange(size_t count, size_t grain,
+                          const std::function<void(size_t, size_t)>& body);
+
+    // Calls body(i) for each i in [0,count).
+    void parallelFor(size_t count, const std::function<void(size_t)>& body)
+    {
+        parallelForRange(count, 1, [&](size_t b, size_t e) {
+            for (size_t i=b;  i<e;  i++) body(i); });
+    }
+
+    // The pool shared by the loader and other CPU side processing.
+    static ThreadPool& global();
+
+private:
+    void workerLoop();
+    void runChunks();
+
+    std::vector<std::thread> m_workers;
+    std::mutex              m_submitMutex;   // One loop at a time
+    std::mutex              m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_done;
+    bool     m_stop{false};
+    uint64_t m_generation{0};
+    unsigned m_busy{0};
+
+    // The loop currently being run.
+    const std::function<void(size_t, size_t)>* m_body{nullptr};
+    size_t m_count{0};
+    size_t m_grain{1};
+    std::atomic<size_t> m_next{0};
+};
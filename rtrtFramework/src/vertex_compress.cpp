@@ -0,0 +1,150 @@
+//////////////////////////////////////////////////////////////////////
+// Compact vertex attributes: a 32 bit octahedral normal and two half
+// float texture coordinates, 8 bytes instead of the 20 bytes of
+// float nrm and texCoord in a Vertex.
+////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+#include <algorithm>
+
+#include "vertex_compress.h"
+#include "thread_pool.h"
+
+// Project onto the octahedron and fold the lower half over the upper.
+static glm::vec2 octWrap(const glm::vec3& n)
+{
+    float s = fabsf(n.x) + fabsf(n.y) + fabsf(n.z);
+    glm::vec2 p(n.x/s, n.y/s);
+    if (n.z < 0.0f)
+        p = glm::vec2((1.0f - fabsf(p.y)) * (p.x >= 0.0f ? 1.0f : -1.0f),
+                      (1.0f - fabsf(p.x)) * (p.y >= 0.0f ? 1.0f : -1.0f));
+    return p;
+}
+
+glm::vec3 octDecodeNormal(uint32_t packed)
+{
+    glm::vec2 e = glm::unpackSnorm2x16(packed);
+    glm::vec3 n(e.x, e.y, 1.0f - fabsf(e.x) - fabsf(e.y));
+    if (n.z < 0.0f) {
+        float x = n.x;
+        n.x = (1.0f - fabsf(n.y)) * (x   >= 0.0f ? 1.0f : -1.0f);
+        n.y = (1.0f - fabsf(x))   * (n.y >= 0.0f ? 1.0f : -1.0f); }
+    return glm::normalize(n);
+}
+
+// Rounding each coordinate to the nearest snorm16 is not always the
+// closest encoding; try all four neighbours and keep the best.
+uint32_t octEncodeNormal(const glm::vec3& n)
+{
+    float len = glm::length(n);
+    if (!(len > 0.0f)) return octEncodeNormal(glm::vec3(0,0,1));
+    glm::vec3 u = n/len;
+
+    glm::vec2 p = octWrap(u) * 32767.0f;
+    uint32_t best = 0;
+    float bestDot = -2.0f;
+    for (int i=0;  i<4;  i++) {
+        float x = (i&1) ? ceilf(p.x) : floorf(p.x);
+        float y = (i&2) ? ceilf(p.y) : floorf(p.y);
+        uint32_t code = glm::packSnorm2x16(glm::vec2(x, y) / 32767.0f);
+        float d = glm::dot(octDecodeNormal(code), u);
+        if (d > bestDot) {
+            bestDot = d;
+            best = code; } }
+    return best;
+}
+
+uint32_t encodeTexCoord(const glm::vec2& uv)
+{
+    return glm::packHalf2x16(glm::clamp(uv, glm::vec2(-65504.0f), glm::vec2(65504.0f)));
+}
+
+glm::vec2 decodeTexCoord(uint32_t packed)
+{
+    return glm::unpackHalf2x16(packed);
+}
+
+// Angle between two vectors; accurate for tiny angles, unlike acos(dot).
+static float angleBetween(const glm::vec3& a, const glm::vec3& b)
+{
+    glm::dvec3 da(a), db(b);
+    return float(atan2(glm::length(glm::cross(da, db)), glm::dot(da, db)));
+}
+
+// Encodes one vertex's normal and texture coordinate, noting the
+// encoding error in err.
+static void encodeAttributes(const Vertex& v, uint32_t& nrm, uint32_t& texCoord, CompactErrors& err)
+{
+    nrm = octEncodeNormal(v.nrm);
+    texCoord = encodeTexCoord(v.texCoord);
+
+    if (glm::length(v.nrm) > 0.0f)
+        err.normal = std::max(err.normal, angleBetween(octDecodeNormal(nrm), v.nrm));
+
+    glm::vec2 uv = v.texCoord;
+    if (fabsf(uv.x) > 65504.0f || fabsf(uv.y) > 65504.0f) {
+        err.texCoordClamped++;
+        return; }
+    glm::vec2 diff = glm::abs(decodeTexCoord(texCoord) - uv);
+    glm::vec2 rel = diff / glm::max(glm::abs(uv), glm::vec2(1.0f));
+    err.texCoord = std::max(err.texCoord, std::max(rel.x, rel.y));
+}
+
+static CompactErrors mergeErrors(const std::vector<CompactErrors>& chunkErrors)
+{
+    CompactErrors total;
+    for (const auto& e : chunkErrors) {
+        total.normal = std::max(total.normal, e.normal);
+        total.texCoord = std::max(total.texCoord, e.texCoord);
+        total.texCoordClamped += e.texCoordClamped; }
+    return total;
+}
+
+CompactErrors compactVertices(const std::vector<Vertex>& vertices,
+                              std::vector<glm::vec3>&      positions,
+                              std::vector<CompactVertex>&  attributes)
+{
+    positions.resize(vertices.size());
+    attributes.resize(vertices.size());
+
+    const size_t grain = 1<<16;
+    std::vector<CompactErrors> chunkErrors((vertices.size() + grain-1) / grain);
+    ThreadPool::global().parallelForRange(vertices.size(), grain, [&](size_t b, size_t e) {
+        CompactErrors& err = chunkErrors[b/grain];
+        for (size_t i=b;  i<e;  i++) {
+            positions[i] = vertices[i].pos;
+            encodeAttributes(vertices[i], attributes[i].nrm, attributes[i].texCoord, err); } });
+
+    return mergeErrors(chunkErrors);
+}
+
+// The vertices are encoded once each, then gathered per triangle.
+CompactErrors buildHitRecords(const std::vector<Vertex>&   vertices,
+                              const std::vector<uint32_t>& indices,
+                              const std::vector<int32_t>&  matIndx,
+                              std::vector<HitRecord>&      records)
+{
+    std::vector<CompactVertex> attributes(vertices.size());
+    const size_t grain = 1<<16;
+    std::vector<CompactErrors> chunkErrors((vertices.size() + grain-1) / grain);
+    ThreadPool::global().parallelForRange(vertices.size(), grain, [&](size_t b, size_t e) {
+        for (size_t i=b;  i<e;  i++)
+            encodeAttributes(vertices[i], attributes[i].nrm, attributes[i].texCoord, chunkErrors[b/grain]); });
+
+    size_t nbTriangles = indices.size() / 3;
+    records.resize(nbTriangles);
+    ThreadPool::global().parallelForRange(nbTriangles, grain, [&](size_t b, size_t e) {
+        for (size_t t=b;  t<e;  t++) {
+            HitRecord& rec = records[t];
+            for (int k=0;  k<3;  k++) {
+                const CompactVertex& a = attributes[indices[3*t+k]];
+                rec.nrm[k] = a.nrm;
+                rec.texCoord[k] = a.texCoord; }
+            rec.matIndex = t < matIndx.size() ? matIndx[t] : 0;
+            // A degenerate triangle's normal encodes as (0,0,1).
+            const glm::vec3& p0 = vertices[indices[3*t]].pos;
+            rec.geomNormal = octEncodeNormal(glm::cross(vertices[indices[3*t+1]].pos - p0,
+                                                        vertices[indices[3*t+2]].pos - p0)); } });
+
+    return mergeErrors(chunkErrors);
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <stdint.h>
+#include <vector>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shaders/shared_structs.h"
+
+// CPU encoders and decoders for the CompactVertex layout used when
+// COMPACT_VERTICES is defined.  The shaders' decoders are in
+// shaders/compact_vertex.glsl and must match these.
+
+uint32_t  octEncodeNormal(const glm::vec3& n);
+glm::vec3 octDecodeNormal(uint32_t packed);
+uint32_t  encodeTexCoord(const glm::vec2& uv);
+glm::vec2 decodeTexCoord(uint32_t packed);
+
+// Error bounds of a round trip through the encoders:
+//   The angle between a unit normal and its decoded version.
+const float octNormalMaxError = 1.5e-4f;  // radians (under 0.01 degrees)
+//   The difference between a texture coordinate and its decoded
+//   version, relative to max(|uv|, 1).  Coordinates beyond the half
+//   float range (65504) are clamped and do not meet this.
+const float texCoordMaxRelError = 1.0f/2048.0f;
+
+// Largest errors seen when compacting a model's vertices.
+struct CompactErrors
+{
+    float    normal{0};          // radians
+    float    texCoord{0};        // relative, as above
+    size_t   texCoordClamped{0}; // Coordinates beyond the half float range
+};
+
+// Builds the HitRecord of each triangle, from vertices indexed by
+// indices (three per triangle) and the triangles' material indices.
+// The errors are those of the vertices' encoding, as above.
+CompactErrors buildHitRecords(const std::vector<Vertex>&   vertices,
+                              const std::vector<uint32_t>& indices,
+                              const std::vector<int32_t>&  matIndx,
+                              std::vector<HitRecord>&      records);
+
+// Splits vertices into a stream of positions (for the BLAS and the
+// rasterizer) and a stream of compact shading attributes.
+CompactErrors compactVertices(const std::vector<Vertex>& vertices,
+                              std::vector<glm::vec3>&      positions,
+                              std::vector<CompactVertex>&  attributes);
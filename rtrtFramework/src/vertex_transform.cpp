@@ -0,0 +1,291 @@
+//////////////////////////////////////////////////////////////////////
+// Batch vertex transformation for the loader; see vertex_transform.h.
+//
+// At scene sizes this is bound by memory traffic (a plain copy of the
+// vertices costs over half the time of the per-vertex loop), so the
+// SIMD kernels go straight from the interleaved source to out: four
+// (SSE) or eight (AVX2) vertices are loaded, transposed, transformed
+// and stored back from registers, with no intermediate arrays.  The
+// AVX2 path is compiled for that instruction set on its own and only
+// called when the CPU reports it, so no compiler flags are needed.
+// FMA is deliberately not used: every path multiplies and adds in the
+// same order, giving bit-identical results.
+////////////////////////////////////////////////////////////////////////
+
+#include <math.h>
+
+#include "vertex_transform.h"
+
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define VERTEX_TRANSFORM_X86
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define TARGET_AVX2
+#else
+#define TARGET_AVX2 __attribute__((target("avx2")))
+#endif
+#endif
+
+VertexTransform::VertexTransform(const glm::mat4& M)
+    : position(M), tangent(glm::mat3(M))
+{
+    // The cofactor matrix is det(A) times the inverse-transpose; its
+    // columns are cross products of A's columns.  Unlike the inverse
+    // it exists for any A, and a positive scale does not matter as
+    // normals are renormalized.  A mirroring A has det<0, and the sign
+    // must be flipped back to keep normals pointing outward.
+    const glm::mat3& A = tangent;
+    normal = glm::mat3(glm::cross(A[1], A[2]), glm::cross(A[2], A[0]), glm::cross(A[0], A[1]));
+    if (glm::determinant(A) < 0.0f) normal = -normal;
+}
+
+// Matrix entries, row by row: 3x4 for points, 3x3 for directions.
+struct Rows
+{
+    float m[12];
+};
+
+static Rows pointRows(const glm::mat4& M)
+{
+    return {{M[0][0], M[1][0], M[2][0], M[3][0],
+             M[0][1], M[1][1], M[2][1], M[3][1],
+             M[0][2], M[1][2], M[2][2], M[3][2]}};
+}
+
+static Rows directionRows(const glm::mat3& A)
+{
+    return {{A[0][0], A[1][0], A[2][0], 0.0f,
+             A[0][1], A[1][1], A[2][1], 0.0f,
+             A[0][2], A[1][2], A[2][2], 0.0f}};
+}
+
+// Points add the translation; directions are renormalized instead.
+
+static inline glm::vec3 pointScalar(const Rows& r, const float* p)
+{
+    const float* m = r.m;
+    return glm::vec3(((m[0]*p[0] + m[1]*p[1]) + m[2]*p[2]) + m[3],
+                     ((m[4]*p[0] + m[5]*p[1]) + m[6]*p[2]) + m[7],
+                     ((m[8]*p[0] + m[9]*p[1]) + m[10]*p[2]) + m[11]);
+}
+
+static inline glm::vec3 directionScalar(const Rows& r, const float* p)
+{
+    const float* m = r.m;
+    float dx = (m[0]*p[0] + m[1]*p[1]) + m[2]*p[2];
+    float dy = (m[4]*p[0] + m[5]*p[1]) + m[6]*p[2];
+    float dz = (m[8]*p[0] + m[9]*p[1]) + m[10]*p[2];
+    float len = sqrtf((dx*dx + dy*dy) + dz*dz);
+    if (len > 0.0f) {
+        float inv = 1.0f/len;
+        dx = dx*inv;
+        dy = dy*inv;
+        dz = dz*inv; }
+    return glm::vec3(dx, dy, dz);
+}
+
+// Vertices [i, count), one at a time.  Each vertex is read before it
+// is written, as the source may be out itself.
+static void transformScalar(const Rows& positionRows, const Rows& normalRows, const VertexSource& source,
+                            size_t i, size_t count, Vertex* out)
+{
+    for (;  i<count;  i++) {
+        glm::vec3 pos = pointScalar(positionRows, source.positions + i*source.stride);
+        glm::vec3 nrm = source.normals ? directionScalar(normalRows, source.normals + i*source.stride)
+                                       : glm::vec3(0.0f, 0.0f, 1.0f);
+        out[i].pos = pos;
+        out[i].nrm = nrm; }
+}
+
+#ifdef VERTEX_TRANSFORM_X86
+// The SIMD kernels handle whole groups of 4 or 8 vertices from i on
+// and return where they stopped; transformScalar does the rest.  A group is read
+// entirely before it is written.
+
+// How many of count vertices the groups may cover.  Unless the source
+// is tightly packed, each vector is loaded with a fourth float after
+// it, which is only known to be readable if another vertex follows.
+static size_t groupable(const VertexSource& source, size_t count)
+{
+    if (source.stride == 3 || count == 0) return count;
+    return count - 1;
+}
+
+// Loads the xyz vectors of four vertices, one coordinate per register.
+static inline void load4(const float* src, size_t stride, __m128& x, __m128& y, __m128& z)
+{
+    if (stride == 3) {
+        __m128 a = _mm_loadu_ps(src);    // x0 y0 z0 x1
+        __m128 b = _mm_loadu_ps(src+4);  // y1 z1 x2 y2
+        __m128 c = _mm_loadu_ps(src+8);  // z2 x3 y3 z3
+        __m128 t = _mm_shuffle_ps(b, c, _MM_SHUFFLE(2,1,3,2));  // x2 y2 x3 y3
+        __m128 u = _mm_shuffle_ps(a, b, _MM_SHUFFLE(1,0,2,1));  // y0 z0 y1 z1
+        x = _mm_shuffle_ps(a, t, _MM_SHUFFLE(2,0,3,0));
+        y = _mm_shuffle_ps(u, t, _MM_SHUFFLE(3,1,2,0));
+        z = _mm_shuffle_ps(u, c, _MM_SHUFFLE(3,0,3,1)); }
+    else {
+        __m128 a = _mm_loadu_ps(src), b = _mm_loadu_ps(src+stride);
+        __m128 c = _mm_loadu_ps(src+2*stride), d = _mm_loadu_ps(src+3*stride);
+        _MM_TRANSPOSE4_PS(a, b, c, d);  // d is the unused fourth floats
+        x = a;
+        y = b;
+        z = c; }
+}
+
+// Writes four vertices' pos and nrm, leaving texCoord alone.
+static inline void store4(Vertex* v, __m128 px, __m128 py, __m128 pz, __m128 nx, __m128 ny, __m128 nz)
+{
+    _MM_TRANSPOSE4_PS(px, py, pz, nx);  // Row k is pos and nrm.x of vertex k
+    __m128 yz01 = _mm_unpacklo_ps(ny, nz);
+    __m128 yz23 = _mm_unpackhi_ps(ny, nz);
+    _mm_storeu_ps(&v[0].pos.x, px);
+    _mm_storeu_ps(&v[1].pos.x, py);
+    _mm_storeu_ps(&v[2].pos.x, pz);
+    _mm_storeu_ps(&v[3].pos.x, nx);
+    _mm_storel_pi((__m64*)&v[0].nrm.y, yz01);
+    _mm_storeh_pi((__m64*)&v[1].nrm.y, yz01);
+    _mm_storel_pi((__m64*)&v[2].nrm.y, yz23);
+    _mm_storeh_pi((__m64*)&v[3].nrm.y, yz23);
+}
+
+static size_t transformSse(const Rows& positionRows, const Rows& normalRows, const VertexSource& source,
+                           size_t i, size_t count, Vertex* out)
+{
+    __m128 p[12], n[12];
+    for (int k=0;  k<12;  k++) {
+        p[k] = _mm_set1_ps(positionRows.m[k]);
+        n[k] = _mm_set1_ps(normalRows.m[k]); }
+    const __m128 zero = _mm_setzero_ps();
+    const __m128 one = _mm_set1_ps(1.0f);
+    size_t stride = source.stride, end = groupable(source, count);
+    for (;  i+4<=end;  i += 4) {
+        __m128 x, y, z, dx = zero, dy = zero, dz = one;
+        load4(source.positions + i*stride, stride, x, y, z);
+        if (source.normals) {
+            __m128 u, v, w;
+            load4(source.normals + i*stride, stride, u, v, w);
+            dx = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[0], u), _mm_mul_ps(n[1], v)), _mm_mul_ps(n[2], w));
+            dy = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[4], u), _mm_mul_ps(n[5], v)), _mm_mul_ps(n[6], w));
+            dz = _mm_add_ps(_mm_add_ps(_mm_mul_ps(n[8], u), _mm_mul_ps(n[9], v)), _mm_mul_ps(n[10], w));
+            __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy)),
+                                                _mm_mul_ps(dz, dz)));
+            // Where len is 0, leave the (zero) vector as it is.
+            __m128 nonzero = _mm_cmpgt_ps(len, zero);
+            __m128 inv = _mm_or_ps(_mm_and_ps(nonzero, _mm_div_ps(one, len)), _mm_andnot_ps(nonzero, one));
+            dx = _mm_mul_ps(dx, inv);
+            dy = _mm_mul_ps(dy, inv);
+            dz = _mm_mul_ps(dz, inv); }
+        __m128 ox = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p[0], x), _mm_mul_ps(p[1], y)),
+                                          _mm_mul_ps(p[2], z)), p[3]);
+        __m128 oy = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p[4], x), _mm_mul_ps(p[5], y)),
+                                          _mm_mul_ps(p[6], z)), p[7]);
+        __m128 oz = _mm_add_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(p[8], x), _mm_mul_ps(p[9], y)),
+                                          _mm_mul_ps(p[10], z)), p[11]);
+        store4(out + i, ox, oy, oz, dx, dy, dz); }
+    return i;
+}
+
+// Two groups of four, loaded and stored with SSE and transformed as one.
+TARGET_AVX2 static size_t transformAvx2(const Rows& positionRows, const Rows& normalRows,
+                                        const VertexSource& source, size_t i, size_t count, Vertex* out)
+{
+    __m256 p[12], n[12];
+    for (int k=0;  k<12;  k++) {
+        p[k] = _mm256_set1_ps(positionRows.m[k]);
+        n[k] = _mm256_set1_ps(normalRows.m[k]); }
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 one = _mm256_set1_ps(1.0f);
+    size_t stride = source.stride, end = groupable(source, count);
+    for (;  i+8<=end;  i += 8) {
+        __m128 x0, y0, z0, x1, y1, z1;
+        load4(source.positions + i*stride, stride, x0, y0, z0);
+        load4(source.positions + (i+4)*stride, stride, x1, y1, z1);
+        __m256 x = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+        __m256 y = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+        __m256 z = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+        __m256 dx = zero, dy = zero, dz = one;
+        if (source.normals) {
+            load4(source.normals + i*stride, stride, x0, y0, z0);
+            load4(source.normals + (i+4)*stride, stride, x1, y1, z1);
+            __m256 u = _mm256_insertf128_ps(_mm256_castps128_ps256(x0), x1, 1);
+            __m256 v = _mm256_insertf128_ps(_mm256_castps128_ps256(y0), y1, 1);
+            __m256 w = _mm256_insertf128_ps(_mm256_castps128_ps256(z0), z1, 1);
+            dx = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[0], u), _mm256_mul_ps(n[1], v)), _mm256_mul_ps(n[2], w));
+            dy = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[4], u), _mm256_mul_ps(n[5], v)), _mm256_mul_ps(n[6], w));
+            dz = _mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(n[8], u), _mm256_mul_ps(n[9], v)), _mm256_mul_ps(n[10], w));
+            __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy)),
+                                                      _mm256_mul_ps(dz, dz)));
+            __m256 inv = _mm256_blendv_ps(one, _mm256_div_ps(one, len), _mm256_cmp_ps(len, zero, _CMP_GT_OQ));
+            dx = _mm256_mul_ps(dx, inv);
+            dy = _mm256_mul_ps(dy, inv);
+            dz = _mm256_mul_ps(dz, inv); }
+        __m256 ox = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p[0], x), _mm256_mul_ps(p[1], y)),
+                                                _mm256_mul_ps(p[2], z)), p[3]);
+        __m256 oy = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p[4], x), _mm256_mul_ps(p[5], y)),
+                                                _mm256_mul_ps(p[6], z)), p[7]);
+        __m256 oz = _mm256_add_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(p[8], x), _mm256_mul_ps(p[9], y)),
+                                                _mm256_mul_ps(p[10], z)), p[11]);
+        store4(out + i, _mm256_castps256_ps128(ox), _mm256_castps256_ps128(oy), _mm256_castps256_ps128(oz),
+               _mm256_castps256_ps128(dx), _mm256_castps256_ps128(dy), _mm256_castps256_ps128(dz));
+        store4(out + i + 4, _mm256_extractf128_ps(ox, 1), _mm256_extractf128_ps(oy, 1),
+               _mm256_extractf128_ps(oz, 1), _mm256_extractf128_ps(dx, 1), _mm256_extractf128_ps(dy, 1),
+               _mm256_extractf128_ps(dz, 1)); }
+    return i;
+}
+#endif
+
+SimdLevel bestSimdLevel()
+{
+#ifdef VERTEX_TRANSFORM_X86
+#ifdef _MSC_VER
+    int info[4];
+    __cpuid(info, 0);
+    if (info[0] >= 7) {
+        __cpuidex(info, 7, 0);
+        bool avx2 = (info[1] & (1<<5)) != 0;
+        __cpuid(info, 1);
+        bool osxsave = (info[2] & (1<<27)) != 0 && (info[2] & (1<<28)) != 0;
+        if (avx2 && osxsave && (_xgetbv(0) & 6) == 6) return SimdLevel::AVX2; }
+#else
+    if (__builtin_cpu_supports("avx2")) return SimdLevel::AVX2;
+#endif
+    return SimdLevel::SSE;  // Part of every x86-64 CPU
+#else
+    return SimdLevel::Scalar;
+#endif
+}
+
+const char* simdLevelName(SimdLevel level)
+{
+    switch (level) {
+    case SimdLevel::AVX2: return "AVX2";
+    case SimdLevel::SSE:  return "SSE";
+    default:              return "scalar"; }
+}
+
+void transformVertices(const VertexTransform& tr, const VertexSource& source, size_t count,
+                       Vertex* out, glm::vec3* tangentsOut)
+{
+    static const SimdLevel best = bestSimdLevel();
+    transformVertices(tr, source, count, out, tangentsOut, best);
+}
+
+void transformVertices(const VertexTransform& tr, const VertexSource& source, size_t count,
+                       Vertex* out, glm::vec3* tangentsOut, SimdLevel level)
+{
+    Rows positionRows = pointRows(tr.position);
+    Rows normalRows   = directionRows(tr.normal);
+    size_t done = 0;
+#ifdef VERTEX_TRANSFORM_X86
+    if (level == SimdLevel::AVX2) done = transformAvx2(positionRows, normalRows, source, done, count, out);
+    if (level != SimdLevel::Scalar) done = transformSse(positionRows, normalRows, source, done, count, out);
+#endif
+    transformScalar(positionRows, normalRows, source, done, count, out);
+
+    // The loader has no tangents; they take the scalar path.
+    if (source.tangents && tangentsOut) {
+        Rows tangentRows = directionRows(tr.tangent);
+        for (size_t i=0;  i<count;  i++)
+            tangentsOut[i] = directionScalar(tangentRows, source.tangents + i*source.stride); }
+}
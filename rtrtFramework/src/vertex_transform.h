@@ -0,0 +1,52 @@
+#pragma once
+
+#include <stddef.h>
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+
+#include "shaders/shared_structs.h"
+
+// Batch transformation of a mesh's vertex attributes by a model
+// transform, as done by the loader for each placed mesh.  Groups of
+// vertices are transposed in registers and transformed with SSE or
+// AVX2 when the CPU has them, one vertex at a time otherwise.  All
+// paths compute the same operations in the same order, so their
+// results are identical.
+
+// The matrices one transform applies to each kind of attribute.
+struct VertexTransform
+{
+    glm::mat4 position;  // The model transform
+    glm::mat3 normal;    // Its inverse-transpose (up to a positive scale)
+    glm::mat3 tangent;   // Its upper 3x3
+
+    explicit VertexTransform(const glm::mat4& M);
+};
+
+// A mesh's attributes, each an array of xyz floats with consecutive
+// vectors stride floats apart.  normals and tangents may be null.
+struct VertexSource
+{
+    const float* positions;
+    const float* normals;
+    const float* tangents;
+    size_t       stride{3};
+};
+
+enum class SimdLevel { Scalar, SSE, AVX2 };
+
+// The best level this CPU supports.
+SimdLevel bestSimdLevel();
+const char* simdLevelName(SimdLevel level);
+
+// Writes the transformed positions and normals of count vertices
+// into out[i].pos and out[i].nrm (leaving texCoord alone).  Normals
+// and tangents are renormalized; a vertex without a normal gets
+// (0,0,1).  Tangents are written to tangentsOut if both it and
+// source.tangents are given.  The source may be out itself.
+void transformVertices(const VertexTransform& tr, const VertexSource& source, size_t count,
+                       Vertex* out, glm::vec3* tangentsOut=nullptr);
+void transformVertices(const VertexTransform& tr, const VertexSource& source, size_t count,
+                       Vertex* out, glm::vec3* tangentsOut, SimdLevel level);
@@ -0,0 +1,435 @@
+//////////////////////////////////////////////////////////////////////
+// Virtual texturing, the CPU half: the page table, the cache's
+// residency, and the streaming thread; see virtual_texture.h.
+//
+// Only the main thread touches the page table and the page states.
+// The streaming thread sees only its queue of requests (each with its
+// own reference to the texture's data) and the list of tiles it has
+// streamed.  A page is Queued from its request until its tile is
+// placed or dropped; requests still waiting when the next frame's
+// feedback comes are replaced by that frame's.
+////////////////////////////////////////////////////////////////////////
+
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <stdexcept>
+
+#include "virtual_texture.h"
+#include "block_compress.h"
+#include "thread_pool.h"
+
+// Streamed tiles waiting for update, at most: the streaming thread
+// stops there, rather than run far ahead of the frames.
+static const size_t maxStreamed = 64;
+
+static const size_t tileBytes = size_t(VT_CACHE_TILE)*VT_CACHE_TILE*4;
+
+static int tilesOf(int size) { return (size + VT_TILE_SIZE - 1)/VT_TILE_SIZE; }
+
+static int wrapTexel(int i, int n)
+{
+    i %= n;
+    return i < 0 ? i + n : i;
+}
+
+void loadVirtualTile(const DecodedTexture& texture, int l, int tileX, int tileY, uint8_t* texels)
+{
+    const TextureLevel& level = texture.levels[l];
+    const uint8_t* data = texture.data() + level.offset;
+    const int x0 = tileX*VT_TILE_SIZE - VT_TILE_BORDER, y0 = tileY*VT_TILE_SIZE - VT_TILE_BORDER;
+
+    if (level.format == TextureFormat::RGBA8) {
+        // Each row in runs that do not wrap.
+        for (int y=0;  y<VT_CACHE_TILE;  y++) {
+            const uint8_t* row = data + size_t(wrapTexel(y0 + y, level.height))*level.width*4;
+            uint8_t* out = texels + size_t(y)*VT_CACHE_TILE*4;
+            for (int x=0;  x<VT_CACHE_TILE;  ) {
+                int sx = wrapTexel(x0 + x, level.width);
+                int run = std::min(VT_CACHE_TILE - x, level.width - sx);
+                memcpy(out + 4*x, row + 4*sx, 4*run);
+                x += run; } }
+        return; }
+
+    // Blocks are decoded as they are met, 4x4 texels at a time.  The
+    // tile's texels start on a block boundary, so unless the level
+    // wraps within a block, each group of 4x4 is one whole block.
+    const size_t blockBytes = level.format == TextureFormat::BC1 ? 8 : 16;
+    const int blocksX = (level.width + 3)/4;
+    int decodedBlock = -1;
+    uint8_t block[64];
+    for (int gy=0;  gy<VT_CACHE_TILE;  gy+=4)
+        for (int gx=0;  gx<VT_CACHE_TILE;  gx+=4)
+            for (int y=gy;  y<gy+4;  y++) {
+                int sy = wrapTexel(y0 + y, level.height);
+                for (int x=gx;  x<gx+4;  x++) {
+                    int sx = wrapTexel(x0 + x, level.width);
+                    int b = (sy/4)*blocksX + sx/4;
+                    if (b != decodedBlock) {
+                        const uint8_t* encoded = data + size_t(b)*blockBytes;
+                        if (level.format == TextureFormat::BC1) decodeBC1Block(encoded, block);
+                        else decodeBC7Block(encoded, block);
+                        decodedBlock = b; }
+                    memcpy(texels + 4*(size_t(y)*VT_CACHE_TILE + x), &block[4*(4*(sy%4) + sx%4)], 4); } }
+}
+
+VirtualTextures::VirtualTextures(uint32_t cacheSide)
+    : m_cacheSide(cacheSide), m_slots(size_t(cacheSide)*cacheSide)
+{
+    m_thread = std::thread([this]() { streamLoop(); });
+}
+
+VirtualTextures::~VirtualTextures()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_stop = true;
+    }
+    m_wake.notify_all();
+    m_thread.join();
+}
+
+void VirtualTextures::streamLoop()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    for (;;) {
+        m_wake.wait(lock, [this]() {
+            return m_stop || (!m_queue.empty() && m_streamed.size() < maxStreamed); });
+        if (m_stop) return;
+        Request r = std::move(m_queue.front());
+        m_queue.pop_front();
+        m_busy++;
+        lock.unlock();
+
+        auto start = std::chrono::steady_clock::now();
+        Tile tile{r.page, r.generation, std::vector<uint8_t>(tileBytes)};
+        loadVirtualTile(*r.data, r.level, r.tileX, r.tileY, tile.texels.data());
+        double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+
+        lock.lock();
+        m_busy--;
+        m_streamedCount++;
+        m_streamMs += ms;
+        if (r.generation == m_generation)
+            m_streamed.push_back(std::move(tile));
+        m_idle.notify_all(); }
+}
+
+void VirtualTextures::waitIdle()
+{
+    std::unique_lock<std::mutex> lock(m_mutex);
+    m_idle.wait(lock, [this]() {
+        return m_busy == 0 && (m_queue.empty() || m_streamed.size() >= maxStreamed); });
+}
+
+// The page table's layout: each texture's levels down to the first
+// that is a single tile, one after the other.
+void VirtualTextures::layOutPages()
+{
+    m_table.clear();
+    uint32_t page = 0;
+    for (Texture& t : m_textures) {
+        const DecodedTexture& data = *t.data;
+        VtTexture vt{page, data.width, data.height, 0};
+        t.levelPage.clear();
+        t.tilesX.clear();
+        for (const TextureLevel& level : data.levels) {
+            t.levelPage.push_back(page - vt.firstPage);
+            t.tilesX.push_back(uint32_t(tilesOf(level.width)));
+            page += uint32_t(tilesOf(level.width)*tilesOf(level.height));
+            vt.nbLevels++;
+            if (level.width <= VT_TILE_SIZE && level.height <= VT_TILE_SIZE) break; }
+        t.levelPage.push_back(page - vt.firstPage);
+        m_table.push_back(vt); }
+
+    // Pages already laid out keep their place (add only appends).
+    m_pages.resize(page, 0);
+    m_state.resize(page, Absent);
+    m_pageSlot.resize(page, UINT32_MAX);
+}
+
+void VirtualTextures::locatePage(uint32_t page, uint32_t& texture, int& level,
+                                 int& tileX, int& tileY) const
+{
+    auto after = std::upper_bound(m_table.begin(), m_table.end(), page,
+                                  [](uint32_t p, const VtTexture& t) { return p < t.firstPage; });
+    texture = uint32_t(after - m_table.begin()) - 1;
+    const Texture& t = m_textures[texture];
+    uint32_t inTexture = page - m_table[texture].firstPage;
+    level = int(std::upper_bound(t.levelPage.begin(), t.levelPage.end(), inTexture)
+                - t.levelPage.begin()) - 1;
+    uint32_t inLevel = inTexture - t.levelPage[level];
+    tileX = int(inLevel % t.tilesX[level]);
+    tileY = int(inLevel / t.tilesX[level]);
+}
+
+// The page of the tile covering the same texels one level down, or
+// UINT32_MAX at the last paged level.
+uint32_t VirtualTextures::parentPage(uint32_t page) const
+{
+    uint32_t texture;
+    int level, tileX, tileY;
+    locatePage(page, texture, level, tileX, tileY);
+    const Texture& t = m_textures[texture];
+    if (uint32_t(level + 1) >= m_table[texture].nbLevels) return UINT32_MAX;
+    const TextureLevel& parent = t.data->levels[level + 1];
+    int x = std::min(tileX/2, tilesOf(parent.width) - 1);
+    int y = std::min(tileY/2, tilesOf(parent.height) - 1);
+    return m_table[texture].firstPage + t.levelPage[level + 1] + uint32_t(y)*t.tilesX[level + 1] + x;
+}
+
+VirtualTextures::Request VirtualTextures::makeRequest(uint32_t page) const
+{
+    Request r;
+    r.page = page;
+    r.generation = m_generation;
+    uint32_t texture;
+    locatePage(page, texture, r.level, r.tileX, r.tileY);
+    r.data = m_textures[texture].data;
+    return r;
+}
+
+uint32_t VirtualTextures::add(std::vector<DecodedTexture>&& textures)
+{
+    std::vector<std::shared_ptr<const DecodedTexture>> data;
+    for (DecodedTexture& texture : textures) {
+        if (texture.levels.size() != fullMipLevels(texture.width, texture.height))
+            throw std::runtime_error("virtual texture without its full mip chain");
+        data.push_back(std::make_shared<const DecodedTexture>(std::move(texture))); }
+    return add(data);
+}
+
+uint32_t VirtualTextures::add(const std::vector<std::shared_ptr<const DecodedTexture>>& data)
+{
+    const uint32_t first = uint32_t(m_textures.size());
+    for (const auto& texture : data)
+        m_textures.push_back({texture, {}, {}});
+    layOutPages();
+
+    // The new textures' last paged tiles, placed by the next update.
+    std::vector<Tile> pinned(m_textures.size() - first);
+    ThreadPool::global().parallelFor(pinned.size(), [&](size_t i) {
+        const uint32_t t = first + uint32_t(i);
+        const uint32_t page = m_table[t].firstPage + m_textures[t].levelPage[m_table[t].nbLevels - 1];
+        Request r = makeRequest(page);
+        pinned[i] = {page, m_generation, std::vector<uint8_t>(tileBytes)};
+        loadVirtualTile(*r.data, r.level, r.tileX, r.tileY, pinned[i].texels.data()); });
+    for (Tile& tile : pinned) {
+        m_state[tile.page] = Queued;
+        m_pinnedTiles.push_back(std::move(tile)); }
+
+    if (m_textures.size() > m_slots.size()/2 && !m_warnedFull) {
+        printf("Virtual textures: %zd textures pin a tile each, of the %zd in the cache;"
+               " define VIRTUAL_TEXTURES larger\n", m_textures.size(), m_slots.size());
+        m_warnedFull = true; }
+    return first;
+}
+
+void VirtualTextures::remove(const std::vector<int32_t>& renumber)
+{
+    std::vector<std::shared_ptr<const DecodedTexture>> kept;
+    for (size_t t=0;  t<m_textures.size();  t++)
+        if (t < renumber.size() && renumber[t] >= 0) {
+            if (kept.size() <= size_t(renumber[t])) kept.resize(renumber[t] + 1);
+            kept[renumber[t]] = m_textures[t].data; }
+    clear();
+    add(kept);
+}
+
+void VirtualTextures::clear()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_generation++;
+        m_queue.clear();
+        m_streamed.clear();
+    }
+    m_textures.clear();
+    m_table.clear();
+    m_pages.clear();
+    m_state.clear();
+    m_pageSlot.clear();
+    m_pinnedTiles.clear();
+    std::fill(m_slots.begin(), m_slots.end(), Slot());
+}
+
+void VirtualTextures::feedback(const uint32_t* bits, size_t nbWords)
+{
+    m_frame++;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    for (const Request& r : m_queue)
+        m_state[r.page] = Absent;
+    m_queue.clear();
+
+    // Each wanted page, and the resident pages above it that the
+    // shaders fall back on, are kept in the cache this frame.
+    std::vector<std::pair<int, uint32_t>> wanted;  // (-level, page)
+    nbWords = std::min(nbWords, feedbackWords());
+    for (size_t w=0;  w<nbWords;  w++)
+        for (uint32_t b=0;  b<32 && (bits[w] >> b) != 0;  b++) {
+            const uint32_t page = uint32_t(32*w) + b;
+            if (!((bits[w] >> b) & 1) || page >= m_pages.size()) continue;
+            for (uint32_t p = page;  p != UINT32_MAX;  p = parentPage(p))
+                if (m_state[p] == Resident) m_slots[m_pageSlot[p]].lastWanted = m_frame;
+            if (m_state[page] == Absent) {
+                uint32_t texture;
+                int level, tileX, tileY;
+                locatePage(page, texture, level, tileX, tileY);
+                wanted.push_back({-level, page}); } }
+
+    // Coarsest first: those improve the most texels soonest.
+    std::sort(wanted.begin(), wanted.end());
+    for (const auto& w : wanted) {
+        m_state[w.second] = Queued;
+        m_queue.push_back(makeRequest(w.second)); }
+    if (!m_queue.empty()) m_wake.notify_one();
+}
+
+// Puts a tile in a free slot of the cache, or else in place of the
+// least recently wanted one that was not wanted this frame (a pinned
+// tile takes any slot but another pinned one's).  False if there is
+// none.
+bool VirtualTextures::placeTile(Tile& tile, bool pinned, VtUpdate& result,
+                                std::vector<uint32_t>& dirty)
+{
+    size_t best = SIZE_MAX;
+    for (size_t s=0;  s<m_slots.size();  s++) {
+        const Slot& slot = m_slots[s];
+        if (slot.page == UINT32_MAX) {
+            best = s;
+            break; }
+        if (!slot.pinned && (pinned || slot.lastWanted < m_frame)
+            && (best == SIZE_MAX || slot.lastWanted < m_slots[best].lastWanted))
+            best = s; }
+    if (best == SIZE_MAX) return false;
+
+    Slot& slot = m_slots[best];
+    if (slot.page != UINT32_MAX) {
+        m_pages[slot.page] = 0;
+        m_state[slot.page] = Absent;
+        m_pageSlot[slot.page] = UINT32_MAX;
+        dirty.push_back(slot.page);
+        m_evicted++; }
+
+    const uint32_t x = uint32_t(best % m_cacheSide), y = uint32_t(best / m_cacheSide);
+    slot = {tile.page, m_frame, pinned};
+    m_pages[tile.page] = VT_RESIDENT | x | (y << 12);
+    m_state[tile.page] = Resident;
+    m_pageSlot[tile.page] = uint32_t(best);
+    dirty.push_back(tile.page);
+
+    result.tiles.push_back({x, y, result.texels.size()});
+    result.texels.insert(result.texels.end(), tile.texels.begin(), tile.texels.end());
+    return true;
+}
+
+VtUpdate VirtualTextures::update(size_t maxTiles)
+{
+    VtUpdate result;
+    std::vector<uint32_t> dirty;
+    for (Tile& tile : m_pinnedTiles)
+        if (!placeTile(tile, true, result, dirty)) {
+            m_state[tile.page] = Absent;
+            m_dropped++; }
+    m_pinnedTiles.clear();
+
+    std::vector<Tile> tiles;
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        size_t n = std::min(maxTiles, m_streamed.size());
+        std::move(m_streamed.begin(), m_streamed.begin() + n, std::back_inserter(tiles));
+        m_streamed.erase(m_streamed.begin(), m_streamed.begin() + n);
+    }
+    m_wake.notify_one();  // There is room for more
+
+    for (Tile& tile : tiles) {
+        if (tile.generation != m_generation) continue;  // Laid out again since
+        if (!placeTile(tile, false, result, dirty)) {
+            m_state[tile.page] = Absent;  // Asked for again by a later frame
+            m_dropped++; } }
+
+    // The changed entries, in runs.
+    std::sort(dirty.begin(), dirty.end());
+    dirty.erase(std::unique(dirty.begin(), dirty.end()), dirty.end());
+    for (size_t i=0;  i<dirty.size();  ) {
+        size_t j = i + 1;
+        while (j < dirty.size() && dirty[j] == dirty[j-1] + 1) j++;
+        result.pageRanges.push_back({dirty[i], dirty[j-1] + 1});
+        i = j; }
+    return result;
+}
+
+VtStats VirtualTextures::stats() const
+{
+    VtStats s;
+    s.pages = m_pages.size();
+    for (const Slot& slot : m_slots)
+        if (slot.page != UINT32_MAX) {
+            s.resident++;
+            s.pinned += slot.pinned; }
+    for (PageState state : m_state)
+        s.queued += state == Queued;
+    s.evicted = m_evicted;
+    s.dropped = m_dropped;
+    std::lock_guard<std::mutex> lock(m_mutex);
+    s.streamed = m_streamedCount;
+    s.streamMs = m_streamMs;
+    return s;
+}
+
+bool VirtualTextures::sample(uint32_t texture, float u, float v, float lod,
+                             const std::vector<uint8_t>& cache, float rgba[4],
+                             uint32_t& wantedPage, int& level) const
+{
+    const VtTexture& t = m_table[texture];
+    u -= floorf(u);
+    v -= floorf(v);
+    const int want = std::min(std::max(int(floorf(lod + 0.5f)), 0), int(t.nbLevels) - 1);
+    uint32_t first = t.firstPage;
+    int w = t.width, h = t.height;
+    for (int l=0;  l<want;  l++) {
+        first += uint32_t(tilesOf(w)*tilesOf(h));
+        w = std::max(w/2, 1);
+        h = std::max(h/2, 1); }
+
+    const int cachePixels = int(m_cacheSide)*VT_CACHE_TILE;
+    for (int l=want;  l<int(t.nbLevels);  l++) {
+        const int tilesX = tilesOf(w), tilesY = tilesOf(h);
+        const float tx = u*w, ty = v*h;
+        const int cx = std::min(int(tx)/VT_TILE_SIZE, tilesX - 1);
+        const int cy = std::min(int(ty)/VT_TILE_SIZE, tilesY - 1);
+        const uint32_t page = first + uint32_t(cy*tilesX + cx);
+        if (l == want) wantedPage = page;
+        const uint32_t entry = m_pages[page];
+        if (entry != 0) {
+            // Bilinear filtering in the cache, as the sampler does.
+            float px = float(entry & 0xfff)*VT_CACHE_TILE + VT_TILE_BORDER + tx - float(cx*VT_TILE_SIZE) - 0.5f;
+            float py = float((entry >> 12) & 0xfff)*VT_CACHE_TILE + VT_TILE_BORDER + ty - float(cy*VT_TILE_SIZE) - 0.5f;
+            int x0 = int(floorf(px)), y0 = int(floorf(py));
+            float fx = px - x0, fy = py - y0;
+            for (int c=0;  c<4;  c++) {
+                auto at = [&](int x, int y) {
+                    x = std::min(std::max(x, 0), cachePixels - 1);
+                    y = std::min(std::max(y, 0), cachePixels - 1);
+                    return float(cache[4*(size_t(y)*cachePixels + x) + c]); };
+                rgba[c] = ((at(x0, y0)*(1-fx) + at(x0+1, y0)*fx)*(1-fy)
+                           + (at(x0, y0+1)*(1-fx) + at(x0+1, y0+1)*fx)*fy)/255.0f; }
+            level = l;
+            return true; }
+        first += uint32_t(tilesX*tilesY);
+        w = std::max(w/2, 1);
+        h = std::max(h/2, 1); }
+    return false;
+}
+
+void VirtualTextures::applyUpdate(const VtUpdate& update, std::vector<uint8_t>& cache) const
+{
+    const size_t cachePixels = size_t(m_cacheSide)*VT_CACHE_TILE;
+    cache.resize(cachePixels*cachePixels*4);
+    for (const VtUpdate::Tile& tile : update.tiles)
+        for (int y=0;  y<VT_CACHE_TILE;  y++)
+            memcpy(&cache[4*((size_t(tile.y)*VT_CACHE_TILE + y)*cachePixels + size_t(tile.x)*VT_CACHE_TILE)],
+                   &update.texels[tile.offset + size_t(y)*VT_CACHE_TILE*4], VT_CACHE_TILE*4);
+}
@@ -0,0 +1,184 @@
+#pragma once
+
+#include <stdint.h>
+#include <condition_variable>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "texture_decode.h"
+#include "shaders/shared_structs.h"  // VtTexture, VT_TILE_SIZE, ...
+
+// Virtual texturing (VIRTUAL_TEXTURES in shared_structs.h), the CPU
+// half.  Each texture's mip levels are cut into tiles of VT_TILE_SIZE
+// texels, and only the tiles the shaders have asked for are resident,
+// in a cache of cacheSide x cacheSide tiles (one RGBA8 image, each tile
+// with a border of its neighbours' texels so bilinear filtering never
+// reads another tile).  A page table, one entry per tile of every
+// texture, says where each resident tile is.
+//
+// The loop, once a frame:
+//  - the shaders look up the tile they want (at the level their mip
+//    selection asks for), set its bit in a feedback buffer, and sample
+//    it or, if it is not resident, the finest resident tile above it;
+//  - feedback takes those bits.  Wanted tiles not resident are queued,
+//    coarsest level first, for the streaming thread, which copies
+//    their texels (decoding BC1 and BC7 blocks) from the textures'
+//    full mip chains, usually the memory mapped texture cache files;
+//  - update places the tiles streamed so far in the cache, evicting
+//    those least recently wanted (never one wanted this frame, nor a
+//    texture's last paged tile), and lists the cache copies and the
+//    page table entries that changed.
+//
+// None of this touches Vulkan; VkApp (vkapp_virtualTexture.cpp) copies
+// the tiles to the cache image and the entries to the page table
+// buffer.
+
+// The tiles placed by an update.  Each tile is VT_CACHE_TILE texels
+// square, RGBA8, its rows in the order of the texture's.
+struct VtUpdate
+{
+    struct Tile
+    {
+        uint32_t x, y;   // Its place in the cache, in tiles
+        size_t offset;   // Of its texels, in bytes
+    };
+    std::vector<uint8_t> texels;
+    std::vector<Tile> tiles;
+    std::vector<std::pair<uint32_t, uint32_t>> pageRanges;  // [first,end) of the page table to copy
+
+    bool empty() const { return tiles.empty() && pageRanges.empty(); }
+};
+
+struct VtStats
+{
+    size_t pages{0};       // Page table entries
+    size_t resident{0};    // Tiles in the cache
+    size_t pinned{0};      // Of those, textures' last paged tiles
+    size_t queued{0};      // Wanted, waiting for or being streamed
+    size_t streamed{0};    // In all
+    size_t evicted{0};
+    size_t dropped{0};     // Streamed tiles with no room in the cache
+    double streamMs{0.0};  // Time the streaming thread spent on them
+};
+
+class VirtualTextures
+{
+public:
+    explicit VirtualTextures(uint32_t cacheSide);
+    ~VirtualTextures();
+    VirtualTextures(const VirtualTextures&) = delete;
+    VirtualTextures& operator=(const VirtualTextures&) = delete;
+
+    // Appends textures, which must have their full mip chains (RGBA8,
+    // BC1 or BC7), and loads their last paged tiles at once.  Returns
+    // the index of the first.
+    uint32_t add(std::vector<DecodedTexture>&& textures);
+
+    // Removes the textures that renumber (as from TextureRegistry::
+    // release) maps to -1, and renumbers the rest.  The page table is
+    // laid out again, and every tile must be streamed again.
+    void remove(const std::vector<int32_t>& renumber);
+    void clear();
+    size_t size() const { return m_textures.size(); }
+
+    // What the shaders read: the textures, and the page table.
+    const std::vector<VtTexture>& textureTable() const { return m_table; }
+    const std::vector<uint32_t>& pageTable() const { return m_pages; }
+    size_t feedbackWords() const { return (m_pages.size() + 31)/32; }
+    uint32_t cacheSide() const { return m_cacheSide; }
+
+    // Takes the feedback bits (one per page, 32 to a word) of the frame
+    // just drawn, and starts a new frame.
+    void feedback(const uint32_t* bits, size_t nbWords);
+
+    // Places up to maxTiles of the tiles streamed so far, and any of
+    // the textures' last paged tiles, in the cache.
+    VtUpdate update(size_t maxTiles);
+
+    // Waits until the streaming thread has nothing left to do.
+    void waitIdle();
+
+    VtStats stats() const;
+
+    // The shaders' sampleVirtualTexture on the CPU, for testing: the
+    // bilinear filtered color of texture at (u,v) at level lod, with
+    // cache the contents of the cache image.  Sets wantedPage to the
+    // page whose feedback bit the shader sets, and level to the level
+    // it sampled; false if no tile was resident.  Must match
+    // virtual_texture.glsl.
+    bool sample(uint32_t texture, float u, float v, float lod, const std::vector<uint8_t>& cache,
+                float rgba[4], uint32_t& wantedPage, int& level) const;
+
+    // Copies an update's tiles into cache, as the GPU does.
+    void applyUpdate(const VtUpdate& update, std::vector<uint8_t>& cache) const;
+
+private:
+    struct Texture
+    {
+        std::shared_ptr<const DecodedTexture> data;
+        std::vector<uint32_t> levelPage;  // First page of each paged level, from firstPage
+        std::vector<uint32_t> tilesX;     // Each paged level's tiles
+    };
+    enum PageState : uint8_t { Absent, Queued, Resident };
+    struct Request
+    {
+        uint32_t page;
+        uint64_t generation;
+        std::shared_ptr<const DecodedTexture> data;
+        int level, tileX, tileY;
+    };
+    struct Tile
+    {
+        uint32_t page;
+        uint64_t generation;
+        std::vector<uint8_t> texels;
+    };
+    struct Slot
+    {
+        uint32_t page{UINT32_MAX};  // UINT32_MAX: free
+        uint64_t lastWanted{0};     // Frame
+        bool     pinned{false};
+    };
+
+    uint32_t add(const std::vector<std::shared_ptr<const DecodedTexture>>& data);
+    void layOutPages();
+    void locatePage(uint32_t page, uint32_t& texture, int& level, int& tileX, int& tileY) const;
+    uint32_t parentPage(uint32_t page) const;
+    Request makeRequest(uint32_t page) const;
+    bool placeTile(Tile& tile, bool pinned, VtUpdate& result, std::vector<uint32_t>& dirty);
+    void streamLoop();
+
+    uint32_t m_cacheSide;
+    std::vector<Texture>   m_textures;
+    std::vector<VtTexture> m_table;
+    std::vector<uint32_t>  m_pages;
+    std::vector<PageState> m_state;
+    std::vector<uint32_t>  m_pageSlot;   // Of each resident page
+    std::vector<Slot>      m_slots;      // The cache, row by row
+    std::vector<Tile>      m_pinnedTiles;  // Loaded by add, for the next update
+    uint64_t m_frame{1};
+    size_t   m_evicted{0}, m_dropped{0};
+    bool     m_warnedFull{false};
+
+    // Shared with the streaming thread.
+    mutable std::mutex      m_mutex;
+    std::condition_variable m_wake;
+    std::condition_variable m_idle;
+    std::deque<Request>     m_queue;
+    std::vector<Tile>       m_streamed;
+    uint64_t m_generation{0};    // Bumped when the page table is laid out again
+    unsigned m_busy{0};
+    size_t   m_streamedCount{0};
+    double   m_streamMs{0.0};
+    bool     m_stop{false};
+    std::thread m_thread;
+};
+
+// The texels of one tile as the cache holds it: VT_CACHE_TILE square,
+// RGBA8, from level of texture, with its border repeating the level
+// (as the REPEAT address mode does).
+void loadVirtualTile(const DecodedTexture& texture, int level, int tileX, int tileY, uint8_t* texels);
@@ -22,6 +22,9 @@
 
 VkApp::VkApp(App* _app) : app(_app)
 {
+    m_startTime = std::chrono::steady_clock::now();
+    MemoryStats::global().setBudget(uint64_t(app->memoryBudgetMB*1024.0*1024.0), app->strictBudget);
+
     uint32_t version;
     vkEnumerateInstanceVersion(&version);
     printf("SDK Version: %d.%d.%d\n", VK_API_VERSION_MAJOR(version),
@@ -34,6 +37,7 @@ VkApp::VkApp(App* _app) : app(_app)
     createDevice();			        // -> m_device
     getCommandQueue();	            // -> m_queue
     createCommandPool();		    // -> m_cmdPool
+    createUploadRing();		        // -> m_uploadRing
     loadExtensions();		        // Auto generated; loads namespace of all known extensions
     getSurface();			        // -> m_surface
     
@@ -51,6 +55,12 @@ VkApp::VkApp(App* _app) : app(_app)
     #endif
     
     // Load model and create related entities
+    #ifdef VIRTUAL_TEXTURES
+    createVirtualTextureCache();    // -> m_vtCache, ...
+    #endif
+    #ifdef TEXTURE_ATLAS
+    createTextureRectBuffer();      // -> m_textureRectBuff
+    #endif
     loadModel();
     createMatrixBuffer();
     createObjDescriptionBuffer();
@@ -72,10 +82,17 @@ VkApp::VkApp(App* _app) : app(_app)
     createDenoiseBuffer();
     createDenoiseDescriptorSet();
     createDenoiseCompPipeline();
+
+    MemoryStats::global().print("GPU memory");
+    printUploadStats();
 }
 
 void VkApp::drawFrame()
 {
+    pollModelLoad();  // Swap in any part of the model loaded since the last frame
+    if (m_loadStage == LoadStage::Done && !app->addModels.empty()) {
+        addModel(app->addModels.front(), glm::mat4(1.0));  // One per frame
+        app->addModels.erase(app->addModels.begin()); }
 
     prepareFrame();
     
@@ -85,6 +102,9 @@ void VkApp::drawFrame()
     
     {   // Extra indent for code clarity
         updateCameraBuffer();
+        #ifdef VIRTUAL_TEXTURES
+        updateVirtualTextures();  // Tiles asked for by the last frame
+        #endif
         
         // Draw scene
         if (useRaytracer) {
@@ -95,10 +115,17 @@ void VkApp::drawFrame()
         rasterize();
         
         postProcess(); //  tone mapper and output to swapchain image.
+        #ifdef VIRTUAL_TEXTURES
+        finishVirtualTextureFrame();
+        #endif
     }   // Done recording;  Execute!
     
     vkEndCommandBuffer(m_commandBuffer);
     submitFrame();  // Submit for display
+
+    if (m_firstFrameMs == 0.0) {
+        m_firstFrameMs = msSinceStart();
+        printf("Time to first frame: %.1f ms\n", m_firstFrameMs); }
 }
 
 VkCommandBuffer VkApp::createTempCmdBuffer()
@@ -119,6 +146,7 @@ VkCommandBuffer VkApp::createTempCmdBuffer()
 void VkApp::submitTempCmdBuffer(VkCommandBuffer cmdBuffer)
 {
     vkEndCommandBuffer(cmdBuffer);
+    flushUploads();  // Ahead of anything that may use them
 
     VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
     submitInfo.commandBufferCount = 1;
@@ -161,6 +189,7 @@ void VkApp::submitFrame()
     submitInfo.pSignalSemaphores    = &m_writtenSemaphore; // signaled when execution finishes
     submitInfo.commandBufferCount = 1;
     submitInfo.pCommandBuffers = &m_commandBuffer;
+    flushUploads();  // Ahead of the frame, which may use them
     auto result = vkQueueSubmit(m_queue, 1, &submitInfo, m_waitFence);
     if (result != VK_SUCCESS) 
     {
@@ -2,6 +2,10 @@
 #pragma once
 
 #include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <thread>
 #include "vulkan/vulkan_core.h"
 //#include <vulkan/vulkan.hpp>  // A modern C++ API for Vulkan. Beware 14K lines of code
    
@@ -11,6 +15,43 @@
 #define GUI
 // Define this to read the San_Miguel model instead of the default living room model.
 //#define SAN_MIGUEL
+// Define this to load each mesh of a model as its own object (with
+// its own buffers, BLAS and instance) instead of one object per model.
+//#define SPLIT_MESHES
+// Define this to store a mesh placed by several nodes of a model just
+// once, as one object (and BLAS) with an instance per placement,
+// instead of baking each placement's transform into its own copy.
+//#define INSTANCE_MESHES
+// Define this to read the model on a loader thread while a placeholder
+// scene is drawn, instead of before the first frame.
+#define ASYNC_LOAD
+// Define this to simplify each mesh into levels of detail at load
+// time.  The rasterizer picks a level per instance by its size on the
+// screen; the ray tracer can trace secondary rays against a coarser
+// level.  Most useful with SPLIT_MESHES or INSTANCE_MESHES, as a level
+// is chosen per object.
+//#define MESH_LODS
+// Define this (as 30 or 63, the bits of each code) to sort each
+// mesh's triangles in Morton order of their centroids at load time,
+// for better BLAS's and more coherent closest hit memory reads.
+//#define MORTON_SORT 30
+// Define this to keep each texture, decoded and with all its mip
+// levels filtered, in a cache file next to the image (<image>.rtex).
+// Later runs map the cache and upload its levels as they are.  The
+// cache takes about 5.3 bytes of disk per texel.
+#define TEXTURE_CACHE
+// Define this to filter every texture's mip levels on the CPU, in
+// linear color, even without TEXTURE_CACHE.  (Without either, they are
+// blitted on the GPU, in sRGB space.)
+//#define CPU_MIPS
+// The filter (Box or Kaiser) of mip levels made on the CPU.
+#define MIP_FILTER Box
+// Define this to compress every texture's mip levels on the CPU, to
+// BC1 if it is opaque and BC7 if not, and upload the blocks: an eighth
+// or a quarter of the memory.  Best with TEXTURE_CACHE, as compressing
+// takes a while and the cache keeps the blocks.  (Ignored on a device
+// without BC textures.)
+//#define TEXTURE_COMPRESSION
 
 #ifdef GUI
 #include "backends/imgui_impl_glfw.h"
@@ -28,6 +69,11 @@
 #include "buffer_wrap.h"
 #include "descriptor_wrap.h"
 #include "acceleration_wrap.h"
+#include "model_data.h"
+#include "texture_decode.h"
+#include "texture_registry.h"
+#include "virtual_texture.h"
+#include "texture_atlas.h"
 
 //#include "raytracing_wrap.h"
 #define GLM_FORCE_CTOR_INIT  // May be needed by recent versions of GLM;
@@ -37,15 +83,58 @@
 #define GLM_SWIZZLE
 #include <glm/glm.hpp>
 
+// One coarser level of detail of an object (MESH_LODS).  Its
+// triangles follow the full detail ones in the object's buffers, each
+// level starting on a 16 byte boundary.
+struct ObjLod
+{
+    uint32_t firstIndex;     // Into ObjData::indexBuffer
+    uint32_t nbIndices;
+    uint32_t firstTriangle;  // Into ObjData::hitRecordBuffer
+    uint32_t firstMatWord;   // Into ObjData::matIndexBuffer
+    float    error;          // Largest distance (object space) the simplification moved the surface
+};
+
 // The OBJ model: Vulkan buffers of object data
 struct ObjData
 {
     uint32_t     nbIndices{0};
     uint32_t     nbVertices{0};
-    BufferWrap vertexBuffer;    // Buffer of vertices 
+    BufferWrap vertexBuffer;    // Buffer of vertices (CompactVertex's if COMPACT_VERTICES)
+    BufferWrap positionBuffer;  // COMPACT_VERTICES only: buffer of vertex positions
     BufferWrap indexBuffer;     // Buffer of triangle indices
     BufferWrap matColorBuffer;  // Buffer of materials
     BufferWrap matIndexBuffer;  // Buffer of each triangle's material index
+    BufferWrap hitRecordBuffer; // HIT_RECORDS only: buffer of each triangle's HitRecord
+    std::vector<ObjLod> lods;   // MESH_LODS only: levels 1, 2, ...
+    glm::vec4  bounds{0.0f};    // Bounding sphere: center, radius
+    uint32_t   lodDesc{0};      // Index of lods[0]'s ObjDesc; see VkApp::objectDescriptions
+};
+
+// One coarser level of an ObjGeometry; indexed as its full detail
+// triangles are.
+struct ObjGeometryLod
+{
+    std::vector<uint32_t>  indices;
+    std::vector<int32_t>   matIndx;
+    std::vector<HitRecord> hitRecords;  // HIT_RECORDS only
+    float                  error{0.0f};
+};
+
+// One object's worth of vertices and triangles to be uploaded by
+// VkApp::addObject; pointers into a loaded model's arrays.
+struct ObjGeometry
+{
+    const void*      vertices;     // Vertex's (or CompactVertex's if COMPACT_VERTICES)
+    const glm::vec3* positions;    // COMPACT_VERTICES only
+    uint32_t         nbVertices;
+    const uint32_t*  indices;      // Indexing from firstVertex onward
+    const int32_t*   matIndx;
+    uint32_t         matIndexBits; // Width of matIndx entries on the GPU; see material_table.h
+    const HitRecord* hitRecords;   // HIT_RECORDS only; one per triangle
+    uint32_t         nbIndices;
+    uint32_t         firstVertex;  // Subtracted from each index
+    std::vector<ObjGeometryLod> lods;  // MESH_LODS only
 };
 
 #define NAME(handle, objType, name)  { \
@@ -130,6 +219,32 @@ public:
     VkCommandBuffer m_commandBuffer{};
     void createCommandPool();
 
+    // Uploads are staged in a persistently mapped ring, recorded into
+    // one command buffer, and submitted with a fence before the next
+    // submit of anything else; see vkapp_upload.cpp.
+    struct UploadBatch
+    {
+        VkCommandBuffer cmdBuf{VK_NULL_HANDLE};
+        VkFence fence{VK_NULL_HANDLE};
+        VkDeviceSize ringBytes{0};        // Of m_uploadRing, freed when the fence signals
+        std::vector<BufferWrap> buffers;  // Staging too large for the ring
+    };
+    BufferWrap m_uploadRing{};
+    uint8_t* m_uploadRingData{nullptr};
+    VkDeviceSize m_uploadHead{0};
+    VkDeviceSize m_uploadUsed{0};
+    UploadBatch m_uploadBatch{};                // Being recorded
+    std::deque<UploadBatch> m_uploadsInFlight;  // Oldest first
+    struct { size_t batches{0}, ringWaits{0}, dedicated{0}, bytes{0}; } m_uploadStats;
+    void createUploadRing();
+    void destroyUploadRing();
+    VkBuffer stageUpload(const void* data, VkDeviceSize size, VkDeviceSize& offset);
+    VkCommandBuffer uploadCommandBuffer();
+    void flushUploads();
+    void finishUploads();
+    bool retireUpload(bool wait);
+    void printUploadStats();
+
     VkSwapchainKHR m_swapchain{VK_NULL_HANDLE};
     uint32_t       m_imageCount{0};
     std::vector<VkImage>     m_swapchainImages{};  // from vkGetSwapchainImagesKHR
@@ -193,13 +308,133 @@ public:
     std::vector<ObjData>  m_objData{};  // Obj data in Vulkan Buffers
     std::vector<ObjDesc>  m_objDesc{};  // Device-addresses of those buffers
     std::vector<ImageWrap>  m_objText{}; // All textures of the scene
+    TextureRegistry m_textureRegistry{}; // Their image files, each uploaded once
+    bool m_textureCompressionBC{false};  // The device samples BC1 and BC7 textures
+#ifdef VIRTUAL_TEXTURES
+    // The textures, paged into a cache of tiles instead of m_objText,
+    // which stays empty (vkapp_virtualTexture.cpp).
+    VirtualTextures m_virtualTextures{VIRTUAL_TEXTURES};
+    ImageWrap  m_vtCache{};            // VIRTUAL_TEXTURES tiles square
+    BufferWrap m_vtTextureBuff{};      // m_virtualTextures.textureTable()
+    BufferWrap m_vtPageBuff{};         // m_virtualTextures.pageTable()
+    BufferWrap m_vtFeedbackBuff{};     // Set by the shaders, read back a frame later
+    uint32_t*  m_vtFeedback{nullptr};  // Mapped m_vtFeedbackBuff
+    size_t     m_vtFeedbackWords{0};
+    BufferWrap m_vtStaging{};          // Mapped; a frame's tiles and page table entries
+    uint8_t*   m_vtStagingData{nullptr};
+    void createVirtualTextureCache();
+    void createVirtualTextureTables();
+    void writeVirtualTextureDescriptors();
+    void updateVirtualTextures();
+    void finishVirtualTextureFrame();
+    void destroyVirtualTextures();
+#endif
+#ifdef TEXTURE_ATLAS
+    // Each texture slot's place in m_objText, which holds the textures
+    // left unpacked and the atlas pages (texture_atlas.h).
+    std::vector<AtlasRect> m_textureRects{};
+    BufferWrap m_textureRectBuff{};    // Binding 4 of m_scDesc
+    void createTextureRectBuffer();
+#endif
     std::vector<ObjInst>  m_objInst{}; // Instances paring an object and a transform
     BufferWrap m_lightBuff{};          // Buffer of light list
+    BufferWrap m_lightSelectBuff{};    // Alias table (or light BVH) for choosing lights
+    std::vector<Emitter> m_emitters{}; // The scene's lights, as in m_lightBuff
+    void createLightBuffers();         // m_emitters -> m_lightBuff, m_lightSelectBuff
+
+    // Where each model loaded by uploadModel landed in the arrays
+    // above; removeModel takes these ranges out again.
+    struct SceneModel
+    {
+        std::string filename;
+        size_t   firstObject{0},   nbObjects{0};
+        size_t   firstInstance{0}, nbInstances{0};
+        size_t   firstEmitter{0},  nbEmitters{0};
+        std::vector<uint32_t> textureSlots;  // Each of its textures' slot in m_objText
+        std::vector<Material> materials;     // With its own texture indices
+        uint32_t textureMipDrop{0};          // Top mip levels dropped from its textures for the budget
+    };
+    std::vector<SceneModel> m_sceneModels{};
     void createBufferWrap(uint size, VkMemoryAllocateFlagBits flag);
     void loadModel();                  // Load the scene.
     bool loadModel(const std::string& filename, glm::mat4 transform);
+    // The two halves of loadModel: reading (no Vulkan calls, so
+    // safe on any thread) and creating the GPU objects.  uploadModel
+    // returns the index of the model's first object; untextured
+    // leaves the textures for a later attachTextures.
+    static bool readModel(const std::string& filename, ModelData& meshdata);
+    size_t uploadModel(const std::string& filename, const ModelData& meshdata,
+                       glm::mat4 transform, bool untextured=false);
+    void attachTextures(size_t firstObject, const TextureRegistry::Resolved& refs,
+                        const std::vector<DecodedTexture>& textures);
+    void addObject(const ObjGeometry& geom, const BufferWrap& materials,
+                   const std::vector<glm::mat4>& transforms);
+    static std::vector<Material> slotMaterials(const SceneModel& model);
+
+    // Levels of detail (MESH_LODS); see vkapp_lod.cpp.  The
+    // rasterizer draws each instance at the coarsest level whose error
+    // covers less than m_lodPixelError pixels (0: always full detail).
+    // The ray tracer's secondary rays see every object at level
+    // m_rtLod (0: full detail), through a second set of BLAS's.
+    float    m_lodPixelError{1.0f};
+    uint32_t m_rtLod{0};
+    uint32_t m_lodLevels{1};          // Most levels of any object, with full detail
+    uint64_t m_drawnTriangles{0};     // By the last rasterize()
+    RaytracingBuilderKHR m_lodBuilder{};  // BLAS's of the objects' level m_rtLod
+    std::vector<uint32_t> m_lodBlas{};    // Each object's index in m_lodBuilder, or ~0u
+    std::vector<ObjDesc> objectDescriptions();    // m_objDesc, then the levels' descriptions
+    std::vector<InstanceTransform> instanceTransforms() const;
+    uint32_t selectLod(const ObjData& object, const glm::mat4& modelView, float pixelsPerUnit) const;
+    void createLodBlas();
+    void setRtLod(uint32_t level);
+
+    // Background loading (ASYNC_LOAD); see vkapp_asyncLoad.cpp.  A
+    // loader thread reads the model and then decodes its textures;
+    // each result is swapped in between frames.
+    enum class LoadStage { Geometry, Textures, Done };
+    struct PendingModel
+    {
+        std::string filename;
+        ModelData meshdata;
+        TextureRegistry::Resolved textureRefs;  // Its textures, of which textures are the new ones
+        std::vector<DecodedTexture> textures;
+        size_t firstObject{0};
+        std::string error;      // Set by the loader thread on failure
+    };
+    PendingModel      m_pending;
+    LoadStage         m_loadStage{LoadStage::Done};
+    std::thread       m_loaderThread;
+    std::atomic<bool> m_loaderDone{false};  // The loader thread's current job is finished
+    std::chrono::steady_clock::time_point m_startTime;  // Of VkApp's construction
+    double m_firstFrameMs{0.0};  // Time to first frame
+    double m_fullSceneMs{0.0};   // Time until the whole model is shown (0 until then)
+    static ModelData placeholderModel();
+    void startModelLoad(const std::string& filename);
+    void pollModelLoad();        // Called before each frame
+    void destroySceneObjects();
+    void rebuildSceneResources(bool rebuildAccel);
+    double msSinceStart() const;
+
+    // Adding and removing models while the app runs; see
+    // vkapp_sceneEdit.cpp.  Only the new objects' BLAS's are built;
+    // the TLAS is rebuilt and the changed descriptors rewritten.
+    struct SceneEditTiming
+    {
+        double readMs{0}, uploadMs{0}, blasMs{0}, tlasMs{0}, descMs{0}, totalMs{0};
+    };
+    SceneEditTiming m_lastEdit{};
+    bool addModel(const std::string& filename, glm::mat4 transform);
+    void removeModel(size_t model);    // Index into m_sceneModels
+    bool updateObjDescriptionBuffer(); // True if the buffers were reallocated
+    void updateSceneDescriptors(bool buffersMoved);
+    void recreateScenePipelines();
+    uint32_t m_textureSlots{0};        // Binding 2 of m_scDesc; m_objText.size() rounded up
+    void writeTextureDescriptors();
 
     BufferWrap m_objDescriptionBuff{};  // Device buffer of the OBJ descriptions
+    BufferWrap m_instanceBuff{};        // Device buffer of each ObjInst's InstanceTransform
+    size_t m_objDescCapacity{0};        // Entries each of those two buffers can hold
+    size_t m_instanceCapacity{0};
     void createObjDescriptionBuffer();
 
     DescriptorWrap m_scDesc{};
@@ -225,11 +460,17 @@ public:
     BufferWrap m_scratch1;
     BufferWrap m_scratch2;
     RaytracingBuilderKHR m_rtBuilder{};
-    BlasInput objectToVkGeometryKHR(const ObjData& model);
-    void createBottomLevelAS();
+    BlasInput objectToVkGeometryKHR(const ObjData& model, uint32_t level=0);
+    double createBottomLevelAS(size_t firstObject);  // Returns its wall time in ms
     void createTopLevelAS();
     void createRtAccelerationStructure();
 
+    // GPU timing of the ray tracing pass
+    VkQueryPool m_traceQueryPool{VK_NULL_HANDLE};
+    float  m_timestampPeriod{1.0f};  // Nanoseconds per timestamp tick
+    bool   m_traceTimed{false};      // Timestamps were written by an earlier frame
+    double m_traceMs{0.0};
+
     // Raytrace descriptor set objects and functions
     DescriptorWrap m_rtDesc{};
     void createRtDescriptorSet();
@@ -271,6 +512,8 @@ public:
     void ResetRtAccumulation();
     
     glm::mat4 m_priorViewProj{};
+    glm::mat4 m_view{1.0f};           // This frame's, for selectLod
+    float     m_pixelsPerUnit{1.0f};  // Pixels covered by a unit at distance 1
     void updateCameraBuffer();
     void rasterize();
     void raytrace();
@@ -283,8 +526,6 @@ public:
     
     std::string loadFile(const std::string& filename);
     
-     void copyBuffer(VkBuffer srcBuffer, VkBuffer dstBuffer, VkDeviceSize size);
-    
     // Various ways to create ImageWrap and BufferWrap structures. 
     void initImageWrap(ImageWrap& wrap, VkExtent2D& size,
                        VkFormat format,
@@ -292,30 +533,46 @@ public:
                        VkMemoryPropertyFlags properties,
                        VkImageAspectFlagBits aspect,
                        VkImageLayout layout, 
-                       uint32_t mipLevels=1);
-    void initTextureSampler(ImageWrap& wrapper);
-
-    ImageWrap readTextureFile(std::string fileName);
-    void generateMipmap(VkImage image, VkFormat imageFormat,
+                       uint32_t mipLevels=1,
+                       MemCategory category=MemCategory::Other);
+    void initTextureSampler(ImageWrap& wrapper, float maxLod=0.0f);  // Samples levels 0 to maxLod
+
+    // Textures are loaded with loadTextures (texture_decode.h), then
+    // created on the GPU and appended to m_objText by uploadTextures.
+    // Only those new to m_textureRegistry are loaded (uploadNewTextures
+    // records them there).
+    TextureOptions textureOptions() const;
+    std::vector<DecodedTexture> loadModelTextures(const std::vector<std::string>& fileNames,
+                                                  uint32_t mipDrop) const;
+    void uploadTextures(const std::vector<const DecodedTexture*>& textures, float maxLod=0.0f);
+    void uploadNewTextures(const TextureRegistry::Resolved& refs,
+                           const std::vector<DecodedTexture>& textures);
+    void generateMipmap(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat,
                          int32_t texWidth, int32_t texHeight, uint32_t mipLevels);
     
+    // Allocations are counted in MemoryStats::global() under category.
     void initBufferWrap(BufferWrap& wrap, VkDeviceSize size, VkBufferUsageFlags usage,
-                        VkMemoryPropertyFlags properties);
+                        VkMemoryPropertyFlags properties,
+                        MemCategory category=MemCategory::Other);
 
     
+    // Overwrites the start of a buffer made by initBufferWrapFromData.
+    // Both record the copy with the uploads (see vkapp_upload.cpp).
+    void updateBufferWrap(BufferWrap& wrap, VkDeviceSize size, const void* data);
+
     void initBufferWrapFromData(BufferWrap& wrap,
-                                const VkCommandBuffer& cmdBuf,
                                 const VkDeviceSize&    size,
                                 const void*            data,
-                                VkBufferUsageFlags     usage);
+                                VkBufferUsageFlags     usage,
+                                MemCategory            category=MemCategory::Other);
     
     template <typename T>
     void initBufferWrapFromData(BufferWrap& wrap,
-                              const VkCommandBuffer& cmdBuf,
                               const std::vector<T>&  data,
-                              VkBufferUsageFlags     usage)
+                              VkBufferUsageFlags     usage,
+                              MemCategory            category=MemCategory::Other)
     {
-        initBufferWrapFromData(wrap, cmdBuf, sizeof(T)*data.size(), data.data(), usage);
+        initBufferWrapFromData(wrap, sizeof(T)*data.size(), data.data(), usage, category);
     }
     // For debug purpose
     std::string m_console_out;
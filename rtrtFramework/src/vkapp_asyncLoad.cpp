@@ -0,0 +1,190 @@
+//////////////////////////////////////////////////////////////////////
+// Background model loading (ASYNC_LOAD in vkapp.h).
+//
+// VkApp's constructor uploads a small placeholder scene and starts a
+// loader thread that reads the model file (or its scene cache).  The
+// render loop runs from the start, drawing the placeholder.  Before
+// each frame, pollModelLoad checks on the loader thread:
+//   Geometry: the model has been read.  Its geometry is uploaded
+//     with untextured materials, and the loader thread goes on to
+//     decode the textures.
+//   Textures: the textures have been decoded.  They are uploaded
+//     and the model's materials are switched to use them.
+// Each step replaces the scene's buffers, acceleration structure,
+// descriptor sets and pipelines between two frames.
+//
+// All Vulkan calls stay on the render thread; the app has a single
+// queue, and uploads are submitted on it ahead of any work that uses
+// them (vkapp_upload.cpp).
+////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+#include "app.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+double VkApp::msSinceStart() const
+{
+    return std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - m_startTime).count();
+}
+
+// A gray floor lit by a small area light; drawn while the model loads.
+ModelData VkApp::placeholderModel()
+{
+    ModelData model;
+    const vec3 up(0,1,0), down(0,-1,0);
+    const float F = 20.0f, L = 1.0f, H = 4.0f;
+    model.vertices = {
+        {vec3(-F,0,-F), up,   vec2(0,0)}, {vec3(-F,0, F), up,   vec2(0,1)},
+        {vec3( F,0,-F), up,   vec2(1,0)}, {vec3( F,0, F), up,   vec2(1,1)},
+        {vec3(-L,H,-L), down, vec2(0,0)}, {vec3( L,H,-L), down, vec2(1,0)},
+        {vec3(-L,H, L), down, vec2(0,1)}, {vec3( L,H, L), down, vec2(1,1)} };
+    model.indices = {0,1,2, 2,1,3,  4,5,6, 6,5,7};
+    model.materials = {
+        {vec3(0.5), vec3(0.0), vec3(0.0), 1.0, -1},  // Floor
+        {vec3(0.0), vec3(0.0), vec3(5.0), 0.0, -1}}; // Light
+    model.matIndx = {0, 0, 1, 1};
+    model.meshRanges.push_back({0, uint32_t(model.vertices.size()),
+                                0, uint32_t(model.indices.size()), ~0u, glm::mat4(1.0)});
+    model.gatherEmitters();
+    return model;
+}
+
+void VkApp::startModelLoad(const std::string& filename)
+{
+    uploadModel("placeholder", placeholderModel(), glm::mat4(1.0));
+
+    m_pending = PendingModel();
+    m_pending.filename = filename;
+    m_loadStage = LoadStage::Geometry;
+    m_loaderDone = false;
+    m_loaderThread = std::thread([this]() {
+        if (!readModel(m_pending.filename, m_pending.meshdata))
+            m_pending.error = "Cannot find model file";
+        m_loaderDone = true; });
+}
+
+void VkApp::pollModelLoad()
+{
+    if (m_loadStage == LoadStage::Done || !m_loaderDone) return;
+    m_loaderThread.join();
+
+    if (!m_pending.error.empty()) {
+        printf("\n\n%s %s\n\n", m_pending.error.c_str(), m_pending.filename.c_str());
+        exit(0); }
+
+    finishUploads();
+    vkDeviceWaitIdle(m_device);  // Nothing in flight may use what is replaced
+
+    if (m_loadStage == LoadStage::Geometry) {
+        const ModelData& meshdata = m_pending.meshdata;
+        bool textured = !meshdata.textures.empty();
+        destroySceneObjects();
+        m_pending.firstObject = uploadModel(m_pending.filename, meshdata, glm::mat4(1.0), textured);
+        rebuildSceneResources(true);
+        printf("Time to geometry: %.1f ms\n", msSinceStart());
+
+        if (textured) {
+            m_pending.textureRefs = m_textureRegistry.acquire(meshdata.textures);
+            m_loadStage = LoadStage::Textures;
+            m_loaderDone = false;
+            uint32_t mipDrop = m_sceneModels.back().textureMipDrop;  // As uploadModel chose for the budget
+            m_loaderThread = std::thread([this, mipDrop]() {
+                try {
+                    m_pending.textures = loadModelTextures(m_pending.textureRefs.newFiles, mipDrop); }
+                catch (const std::exception& e) {
+                    m_pending.error = e.what(); }
+                m_loaderDone = true; });
+            return; } }
+
+    else if (m_loadStage == LoadStage::Textures) {
+        attachTextures(m_pending.firstObject, m_pending.textureRefs, m_pending.textures);
+        rebuildSceneResources(false); }
+
+    m_loadStage = LoadStage::Done;
+    m_fullSceneMs = msSinceStart();
+    printf("Time to full scene: %.1f ms\n", m_fullSceneMs);
+    MemoryStats::global().print("GPU memory");
+    m_pending = PendingModel();  // Frees the CPU copy of the model
+}
+
+// Destroys the objects, textures and lights made by uploadModel.
+void VkApp::destroySceneObjects()
+{
+    VkBuffer lastMaterials = VK_NULL_HANDLE;
+    for (ObjData& ob : m_objData) {
+        ob.vertexBuffer.destroy(m_device);
+        ob.positionBuffer.destroy(m_device);
+        ob.indexBuffer.destroy(m_device);
+        ob.matIndexBuffer.destroy(m_device);
+        ob.hitRecordBuffer.destroy(m_device);
+        // One model's objects all share one buffer of materials.
+        if (ob.matColorBuffer.buffer != lastMaterials) {
+            lastMaterials = ob.matColorBuffer.buffer;
+            ob.matColorBuffer.destroy(m_device); } }
+    for (ImageWrap& texture : m_objText)
+        texture.destroy(m_device);
+    m_lightBuff.destroy(m_device);
+    m_lightSelectBuff.destroy(m_device);
+
+    m_objData.clear();
+    m_objDesc.clear();
+    m_objInst.clear();
+    m_objText.clear();
+    m_textureRegistry.clear();
+#ifdef VIRTUAL_TEXTURES
+    m_virtualTextures.clear();
+    createVirtualTextureTables();
+#endif
+#ifdef TEXTURE_ATLAS
+    m_textureRects.clear();
+    createTextureRectBuffer();
+#endif
+    m_emitters.clear();
+    m_sceneModels.clear();
+}
+
+// Recreates everything that refers to the scene's objects: the object
+// descriptions, the acceleration structure (if rebuildAccel), and the
+// descriptor sets, pipelines and shader binding table.  (Changing the
+// number of textures changes the descriptor set layout.)
+void VkApp::rebuildSceneResources(bool rebuildAccel)
+{
+    m_objDescriptionBuff.destroy(m_device);
+    m_instanceBuff.destroy(m_device);
+    createObjDescriptionBuffer();
+
+    if (rebuildAccel) {
+        m_rtBuilder.destroy();
+        createRtAccelerationStructure(); }
+
+    recreateScenePipelines();
+}
+
+// Recreates the descriptor sets, and with them the pipelines and the
+// shader binding table.
+void VkApp::recreateScenePipelines()
+{
+    vkDestroyPipeline(m_device, m_scPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_scPipelineLayout, nullptr);
+    m_scDesc.destroy(m_device);
+    createScDescriptorSet();
+    createScPipeline();
+
+    vkDestroyPipeline(m_device, m_rtPipeline, nullptr);
+    vkDestroyPipelineLayout(m_device, m_rtPipelineLayout, nullptr);
+    m_rtDesc.destroy(m_device);
+    m_shaderBindingTableBuff.destroy(m_device);
+    createRtDescriptorSet();
+    createRtPipeline();
+    createRtShaderBindingTable();
+
+    app->myCamera.modified = true;  // Restart the ray tracer's accumulation
+}
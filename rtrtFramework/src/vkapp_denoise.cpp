@@ -26,7 +26,8 @@ void VkApp::createDenoiseBuffer()
     VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
     VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
     
-    initImageWrap(m_denoiseBuffer, m_windowSize, format, flags, mem, aspect, layout);
+    initImageWrap(m_denoiseBuffer, m_windowSize, format, flags, mem, aspect, layout,
+                  1, MemCategory::RenderTargets);
     
     // @@ destroy m_denoiseBuffer
 }
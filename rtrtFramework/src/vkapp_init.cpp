@@ -23,7 +23,10 @@ void VkApp::destroyAllVulkanResources()
     // @@  Uncomment next 3 lines when directed to do so at the end of postProcess().
     vkWaitForFences(m_device, 1, &m_waitFence, VK_TRUE, UINT64_MAX);
     vkResetFences(m_device, 1, &m_waitFence);
+    finishUploads();
     vkDeviceWaitIdle(m_device);
+    if (m_loaderThread.joinable())
+        m_loaderThread.join();  // A model still loading at exit
     
     #ifdef GUI
     vkDestroyDescriptorPool(m_device, m_imguiDescPool, nullptr);
@@ -49,9 +52,15 @@ void VkApp::destroyAllVulkanResources()
     m_denoiseDesc.destroy(m_device);
     m_denoiseBuffer.destroy(m_device);
 
+    #ifdef VIRTUAL_TEXTURES
+    destroyVirtualTextures();
+    #endif
+
     vkDestroyPipelineLayout(m_device, m_denoiseCompPipelineLayout, nullptr);
     vkDestroyPipeline(m_device, m_denoisePipeline, nullptr);
 
+    destroyUploadRing();
+
     vkDestroyDevice(m_device, nullptr);
     vkDestroyInstance(m_instance, nullptr);
 }
@@ -354,6 +363,8 @@ void VkApp::createDevice()
     
     // Ask Vulkan to fill in all structures on the pNext chain
     vkGetPhysicalDeviceFeatures2(m_physicalDevice, &features2);
+    // Every supported feature is enabled by passing this chain on.
+    m_textureCompressionBC = features2.features.textureCompressionBC;
 
     float priority = 1.0;
     VkDeviceQueueCreateInfo queueInfo{VK_STRUCTURE_TYPE_DEVICE_QUEUE_CREATE_INFO};
@@ -8,6 +8,7 @@
 #include <string>
 #include <vector>
 #include <array>
+#include <chrono>
 #include <math.h>
 
 #include <filesystem>
@@ -31,24 +32,42 @@ using namespace glm;
 #include "app.h"
 #include "shaders/shared_structs.h"
 
-// Local objects and procedures defined and used here:
-struct ModelData
-{
-    std::vector<Vertex> vertices;
-    std::vector<uint32_t> indices;
-    std::vector<Material> materials;
-    std::vector<int32_t>     matIndx;
-    std::vector<std::string> textures;
+#include "model_data.h"
+#include "thread_pool.h"
+#include "vertex_compress.h"
+#include "material_table.h"
+#include "vertex_transform.h"
+#include "light_sampling.h"
 
-    bool readAssimpFile(const std::string& path, const glm::mat4& M);
+// One placement of an assimp mesh by a node of the model's node
+// tree, and where that copy of the mesh goes in the flat arrays.
+struct MeshPlacement
+{
+    unsigned int meshId;
+    aiMatrix4x4  transform;
+    size_t firstVertex{0};
+    size_t firstTriangle{0};
 };
 
-void recurseModelNodes(ModelData* meshdata,
+// Local procedures defined and used here:
+void recurseModelNodes(std::vector<MeshPlacement>& placements,
                        const  aiScene* aiscene,
                        const  aiNode* node,
                        const aiMatrix4x4& parentTr,
                        const int level=0);
+void flattenMeshes(ModelData* meshdata,
+                   const aiScene* aiscene,
+                   std::vector<MeshPlacement>& placements);
 
+// aiMatrix4x4 is row major; glm is column major.
+static glm::mat4 toGlm(const aiMatrix4x4& tr)
+{
+    glm::mat4 M;
+    for (int r=0;  r<4;  r++)
+        for (int c=0;  c<4;  c++)
+            M[c][r] = tr[r][c];
+    return M;
+}
 
 // Returns an address (as VkDeviceAddress=uint64_t) of a buffer on the GPU.
 VkDeviceAddress getBufferDeviceAddress(VkDevice device, VkBuffer buffer) {
@@ -75,186 +94,624 @@ void VkApp::loadModel()
     scLightPos = vec3(0.5f, 2.5f, 3.0f);
 #endif
     
+#ifdef ASYNC_LOAD
+    // The model is read on a loader thread; a placeholder is drawn
+    // until it is ready.
+    startModelLoad(modelFile);
+#else
     if (!loadModel(modelFile, glm::mat4(1.0))) {
         printf("\n\nCannot find model file %s\n\n", modelFile.c_str());
         exit(0); }
+    m_fullSceneMs = msSinceStart();
+#endif
 }
 
 bool VkApp::loadModel(const std::string& filename, glm::mat4 transform)
 {
     ModelData meshdata;
-    if (!meshdata.readAssimpFile(filename.c_str(), glm::mat4(1.0))) return false;
+    if (!readModel(filename, meshdata)) return false;
+    uploadModel(filename, meshdata, transform);
+    return true;
+}
 
-    printf("vertices: %zd\n", meshdata.vertices.size());
-    printf("indices: %zd (%zd)\n", meshdata.indices.size(), meshdata.indices.size()/3);
-    printf("materials: %zd\n", meshdata.materials.size());
-    printf("matIndx: %zd\n", meshdata.matIndx.size());
-    printf("textures: %zd\n", meshdata.textures.size());
-             
+bool VkApp::readModel(const std::string& filename, ModelData& meshdata)
+{
+#ifdef INSTANCE_MESHES
+    meshdata.instanceMeshes = true;
+#endif
+#ifdef MESH_LODS
+    meshdata.lodLevels = 4;
+#endif
+#ifdef MORTON_SORT
+    meshdata.mortonBits = MORTON_SORT;
+#endif
 #ifdef SAN_MIGUEL
-    // The San_Miguel model has no useful lights. This code adds one
-    // light to mimic a sky above the courtyard. That is, a rectangle
-    // consisting of 4 vertices, and two triangles with a new bright
-    // emissive Material.
-    
-    vec3 T0(0,0,1);
-    vec3 T1( 0.866, 0, -0.5);
-    vec3 T2(-0.866, 0, -0.5);
-    vec3 Z(0,0,0);
-    vec3 LC(21.50, 20.39, 2.29);
-    int Nv = meshdata.vertices.size();
-    int Nm = meshdata.materials.size();
-    
-    float s = 50;
-    vec3 Sky(5,5,5);
-    meshdata.vertices.push_back({vec3( 6.5,15, 0), vec3(0,1,0), vec2(0,0)});
-    meshdata.vertices.push_back({vec3( 6.5,15,13), vec3(0,1,0), vec2(0,0)});
-    meshdata.vertices.push_back({vec3(23.0,15, 0), vec3(0,1,0), vec2(0,0)});
-    meshdata.vertices.push_back({vec3(23.0,15,13), vec3(0,1,0), vec2(0,0)});
-    meshdata.indices.push_back(Nv+0);
-    meshdata.indices.push_back(Nv+1);
-    meshdata.indices.push_back(Nv+2);
-    meshdata.indices.push_back(Nv+2);
-    meshdata.indices.push_back(Nv+1);
-    meshdata.indices.push_back(Nv+3);
-    meshdata.materials.push_back({Z, Z, Sky, 0.0, -1});
-    meshdata.matIndx.push_back(Nm);                       
-    meshdata.matIndx.push_back(Nm);                             
+    meshdata.skyLight = true;
 #endif
+    auto loadStart = std::chrono::steady_clock::now();
+
+    // A binary cache written by an earlier run skips Assimp (and
+    // everything else readModelFile does that only depends on the
+    // model file).
+    const char* reader = "scene cache";
+    bool fromCache = readSceneCache(filename, meshdata);
+    if (!fromCache) {
+        if (!meshdata.readModelFile(filename, &reader)) return false;
+        writeSceneCache(filename, meshdata); }
+
+    double loadMs = std::chrono::duration<double, std::milli>(
+        std::chrono::steady_clock::now() - loadStart).count();
+    printf("Model %s loaded in %.1f ms (%s: %s)\n", filename.c_str(), loadMs,
+           fromCache ? "warm" : "cold", reader);
     
     printf("vertices: %zd\n", meshdata.vertices.size());
     printf("indices: %zd (%zd)\n", meshdata.indices.size(), meshdata.indices.size()/3);
     printf("materials: %zd\n", meshdata.materials.size());
     printf("matIndx: %zd\n", meshdata.matIndx.size());
     printf("textures: %zd\n", meshdata.textures.size());
-    
+    printf("emitters: %zd\n", meshdata.emitters.size());
+    if (!meshdata.meshLods.empty())
+        printf("LOD triangles: %zd in %zd levels\n", meshdata.lodIndices.size()/3,
+               meshdata.meshLods.size());
+    return true;
+}
+
+// A buffer cannot have size 0, so a scene without lights gets one
+// zeroed element in each light buffer.  pcRay.nbEmitters (0) keeps
+// the shader from reading it.
+template <typename T>
+static void atLeastOne(std::vector<T>& v)
+{
+    if (v.empty()) v.push_back(T{});
+}
+
+// Sends the scene's light list to the shader, with the alias table
+// (or light BVH) it samples lights by.  (Through the upload ring, as
+// vkCmdUpdateBuffer is limited to 64KB.)
+void VkApp::createLightBuffers()
+{
+    const std::vector<Emitter>& lightList = m_emitters;
+    double totalPower = 0.0, maxPower = 0.0;
+    for (const Emitter& e : lightList) {
+        totalPower += emitterPower(e);
+        maxPower = std::max(maxPower, double(emitterPower(e))); }
+    if (!lightList.empty())
+        printf("lights: brightest emitter has %.3g%% of the power (%.3g%% if uniform)\n",
+               100.0*maxPower/totalPower, 100.0/lightList.size());
+
+    if (m_lightBuff.buffer != VK_NULL_HANDLE)
+        finishUploads();  // None may be left copying to the old buffers
+    m_lightBuff.destroy(m_device);
+    m_lightSelectBuff.destroy(m_device);
+    std::vector<Emitter> noLights;
+    atLeastOne(noLights);
+    initBufferWrapFromData(m_lightBuff, lightList.empty() ? noLights : lightList,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemCategory::Lights);
+#ifdef LIGHT_BVH
+    auto bvhStart = std::chrono::steady_clock::now();
+    LightBvh lightBvh = buildLightBvh(lightList);
+    printf("light BVH: %zd nodes built in %.1f ms\n", lightBvh.nodes.size(),
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - bvhStart).count());
+    atLeastOne(lightBvh.nodes);
+    initBufferWrapFromData(m_lightSelectBuff, lightBvh.nodes, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                           MemCategory::Lights);
+#else
+    std::vector<LightAlias> lightAlias = buildLightAlias(lightList);
+    atLeastOne(lightAlias);
+    initBufferWrapFromData(m_lightSelectBuff, lightAlias, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                           MemCategory::Lights);
+#endif
+}
 
-    std::vector<Emitter> lightList; 
-    // @@ The raytracer will eventually need a list of lights.  By
-    // "light" I mean a triangle in the triangle list such that the
-    // triangle's associated material type has a non-zero emission.
-    // Create such a list into the above lightList vector,
-    //
-    // Hints:
-    // 1: Loop through the indices of the model's triangles with
-    //      for (uint i=0;  i<meshdata.matIndx.size();  i++)
-    // 2: Get the material type of triangle i with
-    //      Material& mat = meshdata.materials[meshdata.matIndx[i]];
-    //      where Material type is defined in shaders/shared_structs.h
-    // 3: Check if the material specifies a non-zero emission, perhaps with
-    //      if (glm::dot(mat.emission,mat.emission) > 0.0f)
-    // 4: The triangle at index i has
-    //    vertices:
-    //      v0 = meshdata.vertices[meshdata.indices[3*i+0]].pos;
-    //      v1 = meshdata.vertices[meshdata.indices[3*i+1]].pos;
-    //      v2 = meshdata.vertices[meshdata.indices[3*i+2]].pos;
-    //    emission:  Use 4*mat.emission to get a scene of reasonable brightness
-    // 5: Create an instance of Emitter with those values and push_back onto lightList
-    //      Class Emitter is defined in shaders/shared_structs.h
+// An emitting triangle as placed in the scene by transform.
+static Emitter transformEmitter(const Emitter& e, const glm::mat4& M)
+{
+    Emitter out = e;
+    out.v0 = vec3(M * vec4(e.v0, 1.0f));
+    out.v1 = vec3(M * vec4(e.v1, 1.0f));
+    out.v2 = vec3(M * vec4(e.v2, 1.0f));
+    vec3 cross = glm::cross(out.v1 - out.v0, out.v2 - out.v0);
+    out.normal = glm::normalize(cross);
+    out.area = glm::length(cross) / 2.0f;
+    return out;
+}
+
+size_t VkApp::uploadModel(const std::string& filename, const ModelData& meshdata,
+                          glm::mat4 transform, bool untextured)
+{
+    SceneModel model;
+    model.filename = filename;
+    model.firstObject = m_objData.size();
+    model.firstInstance = m_objInst.size();
+    model.firstEmitter = m_emitters.size();
+    model.nbEmitters = meshdata.emitters.size();
+    for (const Emitter& e : meshdata.emitters)
+        m_emitters.push_back(transformEmitter(e, transform));
+    createLightBuffers();
+
+#ifdef COMPACT_VERTICES
+    // Positions go to their own buffer for the BLAS and the
+    // rasterizer; the shading attributes are compacted.
+    std::vector<glm::vec3> positions;
+    std::vector<CompactVertex> attributes;
+    CompactErrors err = compactVertices(meshdata.vertices, positions, attributes);
+    printf("Compact vertices: %zd bytes -> %zd bytes; max normal error %.3g deg, max texCoord error %.3g\n",
+           sizeof(Vertex)*meshdata.vertices.size(),
+           (sizeof(glm::vec3) + sizeof(CompactVertex))*meshdata.vertices.size(),
+           glm::degrees(err.normal), err.texCoord);
+    if (err.texCoordClamped)
+        printf("  Warning: %zd texCoords beyond the half float range were clamped\n", err.texCoordClamped);
+    const void* vertexData = attributes.data();
+    const glm::vec3* positionData = positions.data();
+    const size_t vertexSize = sizeof(CompactVertex);
+#else
+    const void* vertexData = meshdata.vertices.data();
+    const glm::vec3* positionData = nullptr;
+    const size_t vertexSize = sizeof(Vertex);
+#endif
+
+#ifdef HIT_RECORDS
+    // Everything GetHitObjectData reads from a triangle, in one record.
+    std::vector<HitRecord> hitRecords;
+    CompactErrors hitErr = buildHitRecords(meshdata.vertices, meshdata.indices, meshdata.matIndx, hitRecords);
+    printf("Hit records: %zd bytes for %zd triangles; max normal error %.3g deg, max texCoord error %.3g\n",
+           sizeof(HitRecord)*hitRecords.size(), hitRecords.size(),
+           glm::degrees(hitErr.normal), hitErr.texCoord);
+    const HitRecord* hitRecordData = hitRecords.data();
+#else
+    const HitRecord* hitRecordData = nullptr;
+#endif
+    std::vector<HitRecord> lodHitRecords;  // Of meshdata.lodIndices
+    if (hitRecordData && !meshdata.lodIndices.empty())
+        buildHitRecords(meshdata.vertices, meshdata.lodIndices, meshdata.lodMatIndx, lodHitRecords);
     
-#ifdef SAN_MIGUEL
-    // The San_Miguel model has many useless lights. The myloadModel
-    // procedure adds one useful light.  This keeps just that one
-    // useful light and tosses out the rest.
-    lightList.erase(lightList.begin(), lightList.end()-1);
+    // Within a memory budget, drop the textures' top mip levels (each
+    // quartering them) until the model fits, or, with a strict budget,
+    // stop here.  Acceleration structures are not estimated; their
+    // allocations are checked as they are made.  The vertex layout
+    // cannot fall back the same way: COMPACT_VERTICES is compiled into
+    // the shaders, so over budget it is only suggested.
+    uint32_t mipDrop = 0;  // For this model alone
+    MemoryStats& memStats = MemoryStats::global();
+    if (memStats.budget() != 0) {
+        VkDeviceSize geometryBytes =
+            (vertexSize + (positionData ? sizeof(glm::vec3) : 0))*meshdata.vertices.size()
+            + sizeof(uint32_t)*meshdata.indices.size()
+            + (sizeof(int32_t) + (hitRecordData ? sizeof(HitRecord) : 0))*meshdata.matIndx.size()
+            + sizeof(Material)*meshdata.materials.size();
+        const bool compressed = textureOptions().compress;
+#ifdef VIRTUAL_TEXTURES
+        const std::vector<std::string> newTextures;  // Paged into m_vtCache, allocated once
+#else
+        const std::vector<std::string> newTextures = m_textureRegistry.unregistered(meshdata.textures);
+#endif
+        auto texturesBytes = [&](uint32_t mipDrop) {
+            VkDeviceSize sum = 0;
+            for (const auto& texName : newTextures)
+                sum += textureBytes(texName, mipDrop, compressed);
+            return sum; };
+        VkDeviceSize fullTextures = texturesBytes(0);
+        printf("Model needs about %.1f MB of geometry and %.1f MB of textures (%.1f MB in use, budget %.1f MB)\n",
+               geometryBytes/(1024.0*1024.0), fullTextures/(1024.0*1024.0),
+               memStats.total()/(1024.0*1024.0), memStats.budget()/(1024.0*1024.0));
+        if (!memStats.fits(geometryBytes + fullTextures)) {
+            if (memStats.strict()) {
+                printf("Model %s does not fit the GPU memory budget\n", filename.c_str());
+                exit(-1); }
+            const uint32_t maxMipDrop = 8;
+            while (mipDrop < maxMipDrop
+                   && !memStats.fits(geometryBytes + texturesBytes(mipDrop)))
+                mipDrop++;
+            printf("  dropping %u texture mip levels: textures %.1f MB\n", mipDrop,
+                   texturesBytes(mipDrop)/(1024.0*1024.0));
+            if (!memStats.fits(geometryBytes + texturesBytes(mipDrop))) {
+                printf("  Warning: still over budget");
+#ifndef COMPACT_VERTICES
+                printf("; rebuilding with COMPACT_VERTICES (shared_structs.h) would save %.1f MB",
+                       (sizeof(Vertex) - sizeof(glm::vec3) - sizeof(CompactVertex))
+                       *meshdata.vertices.size()/(1024.0*1024.0));
+#endif
+                printf("\n"); } } }
+
+    // Creates the textures on the GPU that are not there already; the
+    // materials refer to textures by their slots in m_objText.
+    // (Untextured: attachTextures will add them.)
+    model.materials = meshdata.materials;
+    model.textureMipDrop = mipDrop;
+    if (!untextured) {
+        TextureRegistry::Resolved refs = m_textureRegistry.acquire(meshdata.textures);
+        uploadNewTextures(refs, loadModelTextures(refs.newFiles, mipDrop));
+        model.textureSlots = refs.slots; }
+
+    // All objects made from this model share one buffer of materials.
+    BufferWrap materials;
+    initBufferWrapFromData(materials, slotMaterials(model),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                           | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemCategory::Materials);
+    NAME(materials.buffer, VK_OBJECT_TYPE_BUFFER, "object.matColorBuffer");
+    const uint32_t matIndexBits = materialIndexBits(meshdata.materials.size());
+    printf("Material indices: %u bits each (%zd materials)\n", matIndexBits, meshdata.materials.size());
+
+    // Geometry of one MeshRange, as pointers into the arrays above.
+    auto rangeGeometry = [&](const MeshRange& r) {
+        ObjGeometry geom;
+        geom.vertices    = (const char*)vertexData + size_t(r.firstVertex)*vertexSize;
+        geom.positions   = positionData ? positionData + r.firstVertex : nullptr;
+        geom.nbVertices  = r.vertexCount;
+        geom.indices     = &meshdata.indices[r.firstIndex];
+        geom.matIndx     = &meshdata.matIndx[r.firstIndex/3];
+        geom.matIndexBits = matIndexBits;
+        geom.hitRecords  = hitRecordData ? hitRecordData + r.firstIndex/3 : nullptr;
+        geom.nbIndices   = r.indexCount;
+        geom.firstVertex = r.firstVertex;
+        return geom; };
+
+    // Appends a MeshRange's coarser levels to those of an object
+    // (MESH_LODS), offsetting its indices as (index - r.firstVertex +
+    // base).  A range with fewer levels than the object repeats its
+    // coarsest (or its full detail triangles).
+    auto appendLods = [&](const MeshRange& r, uint32_t base, std::vector<ObjGeometryLod>& lods) {
+        for (uint32_t l=1;  l<=lods.size();  l++) {
+            ObjGeometryLod& lod = lods[l-1];
+            const uint32_t* idx = &meshdata.indices[r.firstIndex];
+            const int32_t* mat = &meshdata.matIndx[r.firstIndex/3];
+            const HitRecord* rec = hitRecordData ? hitRecordData + r.firstIndex/3 : nullptr;
+            uint32_t count = r.indexCount;
+            if (r.nbLods != 0) {
+                const MeshLod& m = meshdata.meshLods[r.firstLod + std::min(l, r.nbLods) - 1];
+                idx = &meshdata.lodIndices[m.firstIndex];
+                mat = &meshdata.lodMatIndx[m.firstIndex/3];
+                rec = hitRecordData ? lodHitRecords.data() + m.firstIndex/3 : nullptr;
+                count = m.indexCount;
+                lod.error = std::max(lod.error, m.error); }
+            for (uint32_t i=0;  i<count;  i++)
+                lod.indices.push_back(idx[i] - r.firstVertex + base);
+            lod.matIndx.insert(lod.matIndx.end(), mat, mat + count/3);
+            if (rec)
+                lod.hitRecords.insert(lod.hitRecords.end(), rec, rec + count/3); } };
+
+    // Each instanced mesh (see ModelData::instanceMeshes) is one
+    // object, with one instance per node that placed it.
+    size_t firstObject = m_objData.size();
+    std::vector<uint32_t> starts = meshdata.instanceStarts();
+    size_t nbInstanced = 0;
+    size_t storedVertices = 0, bakedVertices = 0, storedTriangles = 0, bakedTriangles = 0;
+    for (size_t k=0;  k<meshdata.meshRanges.size();  k++) {
+        const MeshRange& r = meshdata.meshRanges[k];
+        if (r.nbInstances == 0 || r.indexCount == 0) continue;
+        std::vector<glm::mat4> transforms;
+        for (uint32_t i=0;  i<r.nbInstances;  i++)
+            transforms.push_back(transform * meshdata.meshInstances[starts[k]+i].transform);
+        ObjGeometry geom = rangeGeometry(r);
+        geom.lods.resize(r.nbLods);
+        appendLods(r, r.firstVertex, geom.lods);
+        addObject(geom, materials, transforms);
+        nbInstanced++;
+        storedVertices  += r.vertexCount;
+        bakedVertices   += size_t(r.vertexCount) * r.nbInstances;
+        storedTriangles += r.indexCount/3;
+        bakedTriangles  += size_t(r.indexCount/3) * r.nbInstances; }
+
+#ifdef SPLIT_MESHES
+    // One object per placed mesh, each with its own buffers, BLAS and
+    // instance.  (A mesh with no triangles makes no object.)
+    for (const MeshRange& r : meshdata.meshRanges) {
+        if (r.nbInstances != 0 || r.indexCount == 0) continue;
+        ObjGeometry geom = rangeGeometry(r);
+        geom.lods.resize(r.nbLods);
+        appendLods(r, r.firstVertex, geom.lods);
+        addObject(geom, materials, {transform}); }
+#else
+    if (nbInstanced == 0) {
+        // The whole model as a single object.
+        ObjGeometry geom;
+        geom.vertices    = vertexData;
+        geom.positions   = positionData;
+        geom.nbVertices  = static_cast<uint32_t>(meshdata.vertices.size());
+        geom.indices     = meshdata.indices.data();
+        geom.matIndx     = meshdata.matIndx.data();
+        geom.matIndexBits = matIndexBits;
+        geom.hitRecords  = hitRecordData;
+        geom.nbIndices   = static_cast<uint32_t>(meshdata.indices.size());
+        geom.firstVertex = 0;
+        uint32_t nbLods = 0;
+        for (const MeshRange& r : meshdata.meshRanges)
+            nbLods = std::max(nbLods, r.nbLods);
+        geom.lods.resize(nbLods);
+        for (const MeshRange& r : meshdata.meshRanges)
+            appendLods(r, r.firstVertex, geom.lods);
+        addObject(geom, materials, {transform}); }
+    else {
+        // The meshes that are not instanced, gathered into one object.
+        std::vector<char>      vertices;
+        std::vector<glm::vec3> positions;
+        std::vector<uint32_t>  indices;
+        std::vector<int32_t>   matIndx;
+        std::vector<HitRecord> records;
+        uint32_t nbLods = 0;
+        for (const MeshRange& r : meshdata.meshRanges)
+            if (r.nbInstances == 0) nbLods = std::max(nbLods, r.nbLods);
+        std::vector<ObjGeometryLod> lods(nbLods);
+        for (const MeshRange& r : meshdata.meshRanges) {
+            if (r.nbInstances != 0) continue;
+            uint32_t base = uint32_t(vertices.size()/vertexSize);
+            const char* v = (const char*)vertexData + size_t(r.firstVertex)*vertexSize;
+            vertices.insert(vertices.end(), v, v + size_t(r.vertexCount)*vertexSize);
+            if (positionData)
+                positions.insert(positions.end(), positionData + r.firstVertex,
+                                 positionData + r.firstVertex + r.vertexCount);
+            for (uint32_t i=0;  i<r.indexCount;  i++)
+                indices.push_back(meshdata.indices[r.firstIndex+i] - r.firstVertex + base);
+            matIndx.insert(matIndx.end(), meshdata.matIndx.begin() + r.firstIndex/3,
+                           meshdata.matIndx.begin() + (r.firstIndex + r.indexCount)/3);
+            if (hitRecordData)
+                records.insert(records.end(), hitRecordData + r.firstIndex/3,
+                               hitRecordData + (r.firstIndex + r.indexCount)/3);
+            appendLods(r, base, lods); }
+        if (!indices.empty()) {
+            ObjGeometry geom;
+            geom.vertices    = vertices.data();
+            geom.positions   = positionData ? positions.data() : nullptr;
+            geom.nbVertices  = static_cast<uint32_t>(vertices.size()/vertexSize);
+            geom.indices     = indices.data();
+            geom.matIndx     = matIndx.data();
+            geom.matIndexBits = matIndexBits;
+            geom.hitRecords  = hitRecordData ? records.data() : nullptr;
+            geom.nbIndices   = static_cast<uint32_t>(indices.size());
+            geom.firstVertex = 0;
+            geom.lods        = std::move(lods);
+            addObject(geom, materials, {transform}); } }
 #endif
 
-    // @@ Project 4b is optional, but if you do it, here is where you
-    // send the above lightList to the shader.  The project 4b
-    // document provides details.
+    if (nbInstanced) {
+        // Savings over baking each instance's transform into its own copy.
+        size_t perVertex = vertexSize + (positionData ? sizeof(glm::vec3) : 0);
+        double perTriangle = 3*sizeof(uint32_t) + matIndexBits/8.0;
+        double saved = (bakedVertices - storedVertices)*perVertex
+                     + (bakedTriangles - storedTriangles)*perTriangle;
+        printf("Instanced %zd meshes as %zd instances\n", nbInstanced, meshdata.meshInstances.size());
+        printf("  vertices:  %zd stored instead of %zd\n", storedVertices, bakedVertices);
+        printf("  triangles: %zd in BLAS's instead of %zd\n", storedTriangles, bakedTriangles);
+        printf("  memory saved: %.2f MB of vertex and index buffers\n", saved/(1024.0*1024.0)); }
+    printf("%s: %zd objects, %zd instances\n", filename.c_str(),
+           m_objData.size() - firstObject, m_objInst.size());
 
-    for (uint i = 0; i < meshdata.matIndx.size(); i++)
-    {
-        // Get triangle is material
-        Material& mat = meshdata.materials[meshdata.matIndx[i]];
+    // @@ At shutdown:
+    //   Destroy all textures with:  for (t:m_objText) t.destroy(m_device); 
+    //   Destroy the 4 buffers containing each object's data with:
+    //      for (auto& ob : m_objData) {
+    //        ob.vertexBuffer.destroy(m_device); 
+    //        and similar for ob.indexBuffer, ob.matIndexBuffer ... }
+    //   The ob.matColorBuffer's of one model's objects are all the same
+    //   buffer; destroy it just once.  (See destroySceneObjects.)
+
+    model.nbObjects = m_objData.size() - model.firstObject;
+    model.nbInstances = m_objInst.size() - model.firstInstance;
+    m_sceneModels.push_back(model);
+    return firstObject;
+}
 
-        // Test if triangle i is an emitter (i.e., has non-zero emission)
-        if (glm::dot(mat.emission, mat.emission) > 0.0f)
-        {
-            // Retrieve the triangles vertices
-            vec3 v0 = meshdata.vertices[meshdata.indices[3 * i + 0]].pos;
-            vec3 v1 = meshdata.vertices[meshdata.indices[3 * i + 1]].pos;
-            vec3 v2 = meshdata.vertices[meshdata.indices[3 * i + 2]].pos;
+// A model's materials as the shaders see them: each texture index is
+// the texture's slot in m_objText, or with TEXTURE_ATLAS in
+// m_textureRects (or -1 while the model has no textures; see
+// attachTextures).
+std::vector<Material> VkApp::slotMaterials(const SceneModel& model)
+{
+    std::vector<Material> materials = model.materials;
+    for (Material& mat : materials)
+        if (mat.textureId >= 0)
+            mat.textureId = model.textureSlots.empty() ? -1 : int(model.textureSlots[mat.textureId]);
+    return materials;
+}
 
-            // Calculate the normal and area of the triangle
-            vec3 normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
-            float area = glm::length(glm::cross(v1 - v0, v2 - v0)) / 2.0f;
+// Creates the new textures of a model uploaded untextured by
+// uploadModel (refs, as acquired from m_textureRegistry, and the
+// textures of its newFiles), and replaces its objects' materials
+// with ones that use them.
+void VkApp::attachTextures(size_t firstObject, const TextureRegistry::Resolved& refs,
+                           const std::vector<DecodedTexture>& textures)
+{
+    uploadNewTextures(refs, textures);
+
+    SceneModel* model = nullptr;
+    for (SceneModel& m : m_sceneModels)
+        if (m.firstObject == firstObject) model = &m;
+    assert(model);
+    model->textureSlots = refs.slots;
+
+    BufferWrap materials;
+    initBufferWrapFromData(materials, slotMaterials(*model),
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
+                           | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT, MemCategory::Materials);
+    NAME(materials.buffer, VK_OBJECT_TYPE_BUFFER, "object.matColorBuffer");
+
+    if (model->nbObjects != 0)
+        m_objData[firstObject].matColorBuffer.destroy(m_device);  // Shared by all the model's objects
+    for (size_t i=firstObject;  i<firstObject + model->nbObjects;  i++) {
+        m_objData[i].matColorBuffer = materials;
+        m_objDesc[i].materialAddress = getBufferDeviceAddress(m_device, materials.buffer); }
+}
 
-            // Set the emission, potentially scaling it for brightness
-            vec3 emission = 4.0f * mat.emission;
+// Creates the buffers of one object from the given vertices and
+// triangles, along with its ObjDesc and an ObjInst placing it with
+// each of the given transforms.
+void VkApp::addObject(const ObjGeometry& geom, const BufferWrap& materials,
+                      const std::vector<glm::mat4>& transforms)
+{
+#ifdef COMPACT_VERTICES
+    const VkDeviceSize vertexSize = sizeof(CompactVertex);
+#else
+    const VkDeviceSize vertexSize = sizeof(Vertex);
+#endif
 
-            // Create an Emitter instance and add it to the list
-            Emitter emitter = { i, v0, v1, v2, emission, normal, area};
-            lightList.push_back(emitter);
-        }
-    }
-    
-    initBufferWrap(m_lightBuff, sizeof(lightList[0]) * lightList.size(),
-                                   VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
-                                   | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
-                                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
-    vkCmdUpdateBuffer(commandBuffer, m_lightBuff.buffer, 0,
-                      sizeof(lightList[0]) * lightList.size(), lightList.data());
-    submitTempCmdBuffer(commandBuffer);
-    
     ObjData object;
-    object.nbIndices  = static_cast<uint32_t>(meshdata.indices.size());
-    object.nbVertices = static_cast<uint32_t>(meshdata.vertices.size());
+    object.nbIndices  = geom.nbIndices;
+    object.nbVertices = geom.nbVertices;
+    object.matColorBuffer = materials;
+
+    // Indices into a range of a larger vertex array are made relative
+    // to the start of that range.  Coarser levels of detail follow the
+    // full detail triangles, each starting on a 16 byte boundary, as
+    // the shaders' buffer references into them expect.
+    std::vector<uint32_t> rebased;
+    const uint32_t* indices = geom.indices;
+    size_t nbIndices = geom.nbIndices;
+    if (geom.firstVertex != 0 || !geom.lods.empty()) {
+        rebased.assign(geom.indices, geom.indices + geom.nbIndices);
+        for (auto& i : rebased) i -= geom.firstVertex;
+        for (const ObjGeometryLod& lod : geom.lods) {
+            rebased.resize((rebased.size() + 3) & ~size_t(3), 0);
+            object.lods.push_back({uint32_t(rebased.size()), uint32_t(lod.indices.size()), 0, 0, lod.error});
+            for (uint32_t i : lod.indices)
+                rebased.push_back(i - geom.firstVertex); }
+        indices = rebased.data();
+        nbIndices = rebased.size(); }
+
+    // Material indices and hit records likewise.
+    std::vector<uint32_t> packedMatIndx = packMaterialIndices(geom.matIndx, geom.nbIndices/3,
+                                                              geom.matIndexBits);
+    std::vector<HitRecord> records;
+    const HitRecord* hitRecords = geom.hitRecords;
+    size_t nbTriangles = geom.nbIndices/3;
+    if (hitRecords && !geom.lods.empty())
+        records.assign(geom.hitRecords, geom.hitRecords + nbTriangles);
+    for (size_t l=0;  l<geom.lods.size();  l++) {
+        const ObjGeometryLod& lod = geom.lods[l];
+        packedMatIndx.resize((packedMatIndx.size() + 3) & ~size_t(3), 0);
+        object.lods[l].firstMatWord = uint32_t(packedMatIndx.size());
+        std::vector<uint32_t> packed = packMaterialIndices(lod.matIndx.data(), lod.matIndx.size(),
+                                                           geom.matIndexBits);
+        packedMatIndx.insert(packedMatIndx.end(), packed.begin(), packed.end());
+        object.lods[l].firstTriangle = uint32_t(nbTriangles);
+        if (hitRecords)
+            records.insert(records.end(), lod.hitRecords.begin(), lod.hitRecords.end());
+        nbTriangles += lod.indices.size()/3; }
+    if (!records.empty())
+        hitRecords = records.data();
+    m_lodLevels = std::max(m_lodLevels, uint32_t(object.lods.size()) + 1);
+
+    // A bounding sphere (about the center of the bounding box), by
+    // which rasterize() chooses a level of detail.
+    if (geom.nbVertices != 0) {
+        auto position = [&](uint32_t v) {
+            return geom.positions ? geom.positions[v] : ((const Vertex*)geom.vertices)[v].pos; };
+        glm::vec3 lo = position(0), hi = position(0);
+        for (uint32_t v=1;  v<geom.nbVertices;  v++) {
+            lo = glm::min(lo, position(v));
+            hi = glm::max(hi, position(v)); }
+        glm::vec3 center = 0.5f*(lo + hi);
+        float radius = 0.0f;
+        for (uint32_t v=0;  v<geom.nbVertices;  v++)
+            radius = std::max(radius, glm::length(position(v) - center));
+        object.bounds = glm::vec4(center, radius); }
 
     // Create the buffers on Device and copy vertices, indices and materials
-    VkCommandBuffer    cmdBuf = createTempCmdBuffer();
-
     VkBufferUsageFlags flag = VK_BUFFER_USAGE_STORAGE_BUFFER_BIT
         | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT;
     VkBufferUsageFlags rtFlags = flag
         | VK_BUFFER_USAGE_ACCELERATION_STRUCTURE_BUILD_INPUT_READ_ONLY_BIT_KHR;
   
-    initBufferWrapFromData(object.vertexBuffer, cmdBuf, meshdata.vertices,
-                         VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rtFlags);
-    initBufferWrapFromData(object.indexBuffer, cmdBuf, meshdata.indices,
-                         VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags);
-    initBufferWrapFromData(object.matColorBuffer, cmdBuf, meshdata.materials, flag);
-    initBufferWrapFromData(object.matIndexBuffer, cmdBuf, meshdata.matIndx, flag);
+#ifdef COMPACT_VERTICES
+    initBufferWrapFromData(object.positionBuffer, sizeof(glm::vec3)*geom.nbVertices,
+                           geom.positions, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rtFlags,
+                           MemCategory::Vertices);
+    initBufferWrapFromData(object.vertexBuffer, vertexSize*geom.nbVertices,
+                           geom.vertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | flag,
+                           MemCategory::Vertices);
+    NAME(object.positionBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.positionBuffer");
+#else
+    initBufferWrapFromData(object.vertexBuffer, vertexSize*geom.nbVertices,
+                           geom.vertices, VK_BUFFER_USAGE_VERTEX_BUFFER_BIT | rtFlags,
+                           MemCategory::Vertices);
+#endif
+    initBufferWrapFromData(object.indexBuffer, sizeof(uint32_t)*nbIndices,
+                           indices, VK_BUFFER_USAGE_INDEX_BUFFER_BIT | rtFlags,
+                           MemCategory::Indices);
+    initBufferWrapFromData(object.matIndexBuffer, sizeof(uint32_t)*packedMatIndx.size(),
+                           packedMatIndx.data(), flag, MemCategory::Materials);
     
     NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.vertexBuffer");
-    NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.indexBuffer");
-    NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.matColorBuffer");
-    NAME(object.vertexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.matIndexBuffer");
-    
-  
-    submitTempCmdBuffer(cmdBuf);
-    
-    // Creates all textures on the GPU
-    auto txtOffset = static_cast<uint32_t>(m_objText.size());  // Offset is current size
-    for(const auto& texName : meshdata.textures)
-        m_objText.push_back(readTextureFile(texName));
-
-    // Assuming one instance of an object with its supplied transform.
-    // Could provide multiple transform here to make a vector of instances of this object.
-    ObjInst instance;
-    instance.transform = transform;
-    instance.objIndex  = static_cast<uint32_t>(m_objData.size()); // Index of current object
-    m_objInst.push_back(instance);
+    NAME(object.indexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.indexBuffer");
+    NAME(object.matIndexBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.matIndexBuffer");
+#ifdef HIT_RECORDS
+    initBufferWrapFromData(object.hitRecordBuffer, sizeof(HitRecord)*nbTriangles,
+                           hitRecords, flag, MemCategory::HitRecords);
+    NAME(object.hitRecordBuffer.buffer, VK_OBJECT_TYPE_BUFFER, "object.hitRecordBuffer");
+#endif
+
+    // One instance of the object per transform.  They are kept
+    // together in m_objInst so rasterize() can draw them all at once.
+    for (const glm::mat4& transform : transforms) {
+        ObjInst instance;
+        instance.transform = transform;
+        instance.objIndex  = static_cast<uint32_t>(m_objData.size()); // Index of current object
+        m_objInst.push_back(instance); }
 
     // Creating information for device access
     ObjDesc desc;
-    desc.txtOffset            = txtOffset;
+    desc.txtOffset            = 0;  // Materials hold slots in m_objText
+    desc.matIndexBits         = geom.matIndexBits;
     desc.vertexAddress        = getBufferDeviceAddress(m_device, object.vertexBuffer.buffer);
     desc.indexAddress         = getBufferDeviceAddress(m_device, object.indexBuffer.buffer);
     desc.materialAddress      = getBufferDeviceAddress(m_device, object.matColorBuffer.buffer);
     desc.materialIndexAddress = getBufferDeviceAddress(m_device, object.matIndexBuffer.buffer);
+#ifdef HIT_RECORDS
+    desc.hitRecordAddress     = getBufferDeviceAddress(m_device, object.hitRecordBuffer.buffer);
+#else
+    desc.hitRecordAddress     = 0;
+#endif
 
     m_objData.emplace_back(object);
     m_objDesc.emplace_back(desc);
+}
 
-    // @@ At shutdown:
-    //   Destroy all textures with:  for (t:m_objText) t.destroy(m_device); 
-    //   Destroy the 4 buffers containing each object's data with:
-    //      for (auto& ob : m_objData) {
-    //        ob.vertexBuffer.destroy(m_device); 
-    //        and similar for ob.indexBuffer, ob.matColorBuffer, ob.matIndexBuffer ... }
-
+bool ModelData::readModelFile(const std::string& path, const char** reader)
+{
+    // OBJ files have a faster reader of their own; it leaves anything
+    // it does not handle to Assimp.
+    if (readObjFile(path, glm::mat4(1.0))) {
+        if (reader) *reader = "OBJ reader"; }
+    else if (readAssimpFile(path, glm::mat4(1.0))) {
+        if (reader) *reader = "Assimp"; }
+    else
+        return false;
+
+    if (skyLight) {
+        // The San_Miguel model has no useful lights.  This adds one
+        // light to mimic a sky above the courtyard: a rectangle of 4
+        // vertices and two triangles, with a new bright emissive
+        // Material.
+        vec3 Z(0,0,0);
+        vec3 Sky(5,5,5);
+        int Nv = vertices.size();
+        int Nm = materials.size();
+        int Ni = indices.size();
+        vertices.push_back({vec3( 6.5,15, 0), vec3(0,1,0), vec2(0,0)});
+        vertices.push_back({vec3( 6.5,15,13), vec3(0,1,0), vec2(0,0)});
+        vertices.push_back({vec3(23.0,15, 0), vec3(0,1,0), vec2(0,0)});
+        vertices.push_back({vec3(23.0,15,13), vec3(0,1,0), vec2(0,0)});
+        indices.push_back(Nv+0);
+        indices.push_back(Nv+1);
+        indices.push_back(Nv+2);
+        indices.push_back(Nv+2);
+        indices.push_back(Nv+1);
+        indices.push_back(Nv+3);
+        materials.push_back({Z, Z, Sky, 0.0, -1});
+        matIndx.push_back(Nm);
+        matIndx.push_back(Nm);
+        meshRanges.push_back({uint32_t(Nv), 4, uint32_t(Ni), 6, ~0u, glm::mat4(1.0)}); }
+
+    dedupMaterials();
+    optimizeMeshes();
+    if (mortonBits != 0)
+        sortTriangles();
+    gatherEmitters();
+    if (lodLevels > 1)
+        buildLods();
+
+    // The San_Miguel model has many dim lights besides the sky light.
+    // All are kept: the power weighted alias table sends few shadow
+    // rays their way.
     return true;
 }
 
@@ -337,18 +794,79 @@ bool ModelData::readAssimpFile(const std::string& path, const mat4& M)
         materials.push_back(newmat);
     }
     
-    recurseModelNodes(this, aiscene, aiscene->mRootNode, modelTr);
+    std::vector<MeshPlacement> placements;
+    recurseModelNodes(placements, aiscene, aiscene->mRootNode, modelTr);
+    auto flattenStart = std::chrono::steady_clock::now();
+    flattenMeshes(this, aiscene, placements);
+    printf("Flattened %zd mesh placements in %.1f ms on %d threads\n", placements.size(),
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - flattenStart).count(),
+           ThreadPool::global().size());
 
     return true;
 
 }
 
+std::vector<uint32_t> ModelData::instanceStarts() const
+{
+    std::vector<uint32_t> starts(meshRanges.size());
+    uint32_t n = 0;
+    for (size_t r=0;  r<meshRanges.size();  r++) {
+        starts[r] = n;
+        n += meshRanges[r].nbInstances; }
+    return starts;
+}
+
+// The raytracer needs a list of lights.  By "light" I mean a triangle
+// in the triangle list such that the triangle's associated material
+// has a non-zero emission.  A triangle of an instanced mesh makes one
+// light per instance, placed by that instance's transform.
+void ModelData::gatherEmitters()
+{
+    emitters.clear();
+    std::vector<uint32_t> starts = instanceStarts();
+    size_t r = 0;               // The MeshRange containing triangle i
+    for (uint i = 0; i < matIndx.size(); i++)
+    {
+        // Get triangle i's material
+        Material& mat = materials[matIndx[i]];
+
+        // Test if triangle i is an emitter (i.e., has non-zero emission)
+        if (glm::dot(mat.emission, mat.emission) > 0.0f)
+        {
+            while (r < meshRanges.size()
+                   && 3*i >= meshRanges[r].firstIndex + meshRanges[r].indexCount) r++;
+            bool inRange = r < meshRanges.size() && 3*i >= meshRanges[r].firstIndex;
+            uint32_t nbInstances = inRange ? meshRanges[r].nbInstances : 0;
+
+            for (uint32_t k = 0; k < std::max(nbInstances, 1u); k++)
+            {
+                mat4 M = nbInstances ? meshInstances[starts[r]+k].transform : mat4(1.0);
+
+                // Retrieve the triangle's vertices
+                vec3 v0 = vec3(M * vec4(vertices[indices[3 * i + 0]].pos, 1.0f));
+                vec3 v1 = vec3(M * vec4(vertices[indices[3 * i + 1]].pos, 1.0f));
+                vec3 v2 = vec3(M * vec4(vertices[indices[3 * i + 2]].pos, 1.0f));
+
+                // Calculate the normal and area of the triangle
+                vec3 normal = glm::normalize(glm::cross(v1 - v0, v2 - v0));
+                float area = glm::length(glm::cross(v1 - v0, v2 - v0)) / 2.0f;
+
+                // Set the emission, potentially scaling it for brightness
+                vec3 emission = 4.0f * mat.emission;
+
+                // Create an Emitter instance and add it to the list
+                Emitter emitter = { i, v0, v1, v2, emission, normal, area};
+                emitters.push_back(emitter);
+            }
+        }
+    }
+}
+
 // Recursively traverses the assimp node hierarchy, accumulating
-// modeling transformations, and creating and transforming any meshes
-// found.  Meshes comming from assimp can have associated surface
-// properties, so each mesh *copies* the current BRDF as a starting
-// point and modifies it from the assimp data structure.
-void recurseModelNodes(ModelData* meshdata,
+// modeling transformations, and recording each mesh found along with
+// its transformation.  The meshes themselves are copied out later,
+// all at once, by flattenMeshes.
+void recurseModelNodes(std::vector<MeshPlacement>& placements,
                        const aiScene* aiscene,
                        const aiNode* node,
                        const aiMatrix4x4& parentTr,
@@ -360,116 +878,365 @@ void recurseModelNodes(ModelData* meshdata,
 
     // Accumulating transformations while traversing down the hierarchy.
     aiMatrix4x4 childTr = parentTr*node->mTransformation;
-    aiMatrix3x3 normalTr = aiMatrix3x3(childTr); // Really should be inverse-transpose for full generality
      
     // Loop through this node's meshes
-    for (unsigned int m=0;  m<node->mNumMeshes; ++m) {
-        aiMesh* aimesh = aiscene->mMeshes[node->mMeshes[m]];
-        //printf("  %d: %d:%d\n", m, aimesh->mNumVertices, aimesh->mNumFaces);
-
-        // Loop through all vertices and record the
-        // vertex/normal/texture/tangent data with the node's model
-        // transformation applied.
-        uint faceOffset = meshdata->vertices.size();
-        for (unsigned int t=0;  t<aimesh->mNumVertices;  ++t) {
-            aiVector3D aipnt = childTr*aimesh->mVertices[t];
-            aiVector3D ainrm = aimesh->HasNormals() ? normalTr*aimesh->mNormals[t] : aiVector3D(0,0,1);
-            aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
-            aiVector3D aitan = aimesh->HasTangentsAndBitangents() ? normalTr*aimesh->mTangents[t] :  aiVector3D(1,0,0);
-
-
-            meshdata->vertices.push_back({{aipnt.x, aipnt.y, aipnt.z},
-                                          {ainrm.x, ainrm.y, ainrm.z},
-                                          {aitex.x, aitex.y}});
-        }
-        
-        // Loop through all faces, recording indices
-        for (unsigned int t=0;  t<aimesh->mNumFaces;  ++t) {
-            aiFace* aiface = &aimesh->mFaces[t];
-            for (int i=2;  i<aiface->mNumIndices;  i++) {
-                meshdata->matIndx.push_back(aimesh->mMaterialIndex);
-                meshdata->indices.push_back(aiface->mIndices[0]+faceOffset);
-                meshdata->indices.push_back(aiface->mIndices[i-1]+faceOffset);
-                meshdata->indices.push_back(aiface->mIndices[i]+faceOffset); } }; }
-
+    for (unsigned int m=0;  m<node->mNumMeshes; ++m)
+        placements.push_back({node->mMeshes[m], childTr});
 
     // Recurse onto this node's children
     for (unsigned int i=0;  i<node->mNumChildren;  ++i)
-        recurseModelNodes(meshdata, aiscene, node->mChildren[i], childTr, level+1);
+        recurseModelNodes(placements, aiscene, node->mChildren[i], childTr, level+1);
 }
 
-ImageWrap VkApp::readTextureFile(std::string fileName)
+// Meshes are copied in chunks of this many vertices or faces, so that
+// even a model made of one huge mesh keeps all threads busy.
+static const size_t flattenChunk = 1<<16;
+
+// Copies every placed mesh, with its transformation applied, into the
+// vertices, indices and matIndx arrays.
+//
+// The first pass counts each mesh's triangles and gives every
+// placement its exact offsets in the output arrays with a prefix sum.
+// The arrays are then sized once, and the second pass transforms and
+// writes all chunks of all meshes in parallel, each into its own
+// slice of the arrays.
+void flattenMeshes(ModelData* meshdata,
+                   const aiScene* aiscene,
+                   std::vector<MeshPlacement>& placements)
 {
-    for (int i=0;  i<fileName.size();  i++)
-        if (fileName[i] == '\\') fileName[i] = '/';
+    ThreadPool& pool = ThreadPool::global();
+
+    // Instancing: a mesh placed by more than one node is copied just
+    // once, untransformed, and each of its placements is recorded as
+    // a MeshInstance of that copy instead.
+    std::vector<MeshInstance> instances;
+    if (meshdata->instanceMeshes) {
+        std::vector<unsigned> uses(aiscene->mNumMeshes, 0);
+        for (const auto& place : placements) uses[place.meshId]++;
+
+        std::vector<uint32_t> rangeOf(aiscene->mNumMeshes, UINT32_MAX);
+        std::vector<MeshPlacement> kept;
+        for (const auto& place : placements) {
+            if (uses[place.meshId] < 2) {
+                kept.push_back(place);
+                continue; }
+            glm::mat4 M = toGlm(place.transform);
+            if (rangeOf[place.meshId] == UINT32_MAX) {
+                rangeOf[place.meshId] = uint32_t(meshdata->meshRanges.size() + kept.size());
+                kept.push_back({place.meshId, aiMatrix4x4()}); }
+            instances.push_back({rangeOf[place.meshId], M}); }
+        placements.swap(kept);
+        std::stable_sort(instances.begin(), instances.end(),
+                         [](const MeshInstance& a, const MeshInstance& b) { return a.range < b.range; }); }
+
+    // Triangles in each chunk of faces of each mesh.  A face with n>2
+    // indices is a fan of n-2 triangles; points and lines make none.
+    std::vector<std::vector<size_t>> chunkTriangles(aiscene->mNumMeshes);
+    pool.parallelFor(aiscene->mNumMeshes, [&](size_t m) {
+        const aiMesh* aimesh = aiscene->mMeshes[m];
+        for (size_t b=0;  b<aimesh->mNumFaces;  b += flattenChunk) {
+            size_t e = std::min(b + flattenChunk, size_t(aimesh->mNumFaces));
+            size_t n = 0;
+            for (size_t t=b;  t<e;  ++t)
+                if (aimesh->mFaces[t].mNumIndices > 2) n += aimesh->mFaces[t].mNumIndices - 2;
+            chunkTriangles[m].push_back(n); } });
+
+    // Prefix sum over the placements gives each its output offsets.
+    size_t nbVertices  = meshdata->vertices.size();
+    size_t nbTriangles = meshdata->matIndx.size();
+    for (auto& place : placements) {
+        const aiMesh* aimesh = aiscene->mMeshes[place.meshId];
+        place.firstVertex   = nbVertices;
+        place.firstTriangle = nbTriangles;
+        nbVertices += aimesh->mNumVertices;
+        for (size_t n : chunkTriangles[place.meshId])
+            nbTriangles += n;
+
+        meshdata->meshRanges.push_back({uint32_t(place.firstVertex), aimesh->mNumVertices,
+                                        uint32_t(3*place.firstTriangle),
+                                        uint32_t(3*(nbTriangles - place.firstTriangle)),
+                                        place.meshId, toGlm(place.transform)}); }
+
+    for (const auto& inst : instances)
+        meshdata->meshRanges[inst.range].nbInstances++;
+    meshdata->meshInstances.insert(meshdata->meshInstances.end(), instances.begin(), instances.end());
+
+    if (3*nbTriangles > UINT32_MAX || nbVertices > UINT32_MAX) {
+        printf("Model too large for 32 bit indices.\n");
+        exit(-1); }
     
-    //VkImage& textureImage, VkDeviceMemory& textureImageMemory
-    int texWidth, texHeight, texChannels;
+    meshdata->vertices.resize(nbVertices);
+    meshdata->indices.resize(3*nbTriangles);
+    meshdata->matIndx.resize(nbTriangles);
 
-    stbi_set_flip_vertically_on_load(true);
-    stbi_uc* pixels = stbi_load(fileName.c_str(), &texWidth, &texHeight, &texChannels,
-                                STBI_rgb_alpha);
-    VkDeviceSize imageSize = texWidth * texHeight * 4;
+    // One task per chunk of vertices or faces of each placement.
+    struct FlattenTask
+    {
+        const MeshPlacement* place;
+        bool   faces;
+        size_t begin, end;       // Range of vertices or faces within the mesh
+        size_t firstTriangle;    // Output position of this chunk's first triangle
+    };
+    std::vector<FlattenTask> tasks;
+    for (const auto& place : placements) {
+        const aiMesh* aimesh = aiscene->mMeshes[place.meshId];
+        for (size_t b=0;  b<aimesh->mNumVertices;  b += flattenChunk)
+            tasks.push_back({&place, false, b, std::min(b + flattenChunk, size_t(aimesh->mNumVertices)), 0});
+        size_t tri = place.firstTriangle;
+        for (size_t c=0;  c<chunkTriangles[place.meshId].size();  c++) {
+            size_t b = c*flattenChunk;
+            tasks.push_back({&place, true, b, std::min(b + flattenChunk, size_t(aimesh->mNumFaces)), tri});
+            tri += chunkTriangles[place.meshId][c]; } }
+
+    pool.parallelFor(tasks.size(), [&](size_t k) {
+        const FlattenTask& task = tasks[k];
+        const aiMesh* aimesh = aiscene->mMeshes[task.place->meshId];
+
+        if (!task.faces) {
+            // Record the vertex/normal/texture data with the node's
+            // model transformation applied (normals by its
+            // inverse-transpose, in SIMD batches).
+            Vertex* out = &meshdata->vertices[task.place->firstVertex];
+            size_t b = task.begin;
+            VertexSource source{&aimesh->mVertices[b].x,
+                                aimesh->HasNormals() ? &aimesh->mNormals[b].x : nullptr, nullptr, 3};
+            transformVertices(VertexTransform(toGlm(task.place->transform)), source, task.end - b, out + b);
+            for (size_t t=task.begin;  t<task.end;  ++t) {
+                aiVector3D aitex = aimesh->HasTextureCoords(0) ? aimesh->mTextureCoords[0][t] : aiVector3D(0,0,0);
+                out[t].texCoord = {aitex.x, aitex.y}; }
+            return; }
+
+        // Record the faces' triangles as indices
+        uint32_t faceOffset = uint32_t(task.place->firstVertex);
+        int32_t  matIndex   = int32_t(aimesh->mMaterialIndex);
+        uint32_t* indices = &meshdata->indices[3*task.firstTriangle];
+        int32_t*  matIndx = &meshdata->matIndx[task.firstTriangle];
+        for (size_t t=task.begin;  t<task.end;  ++t) {
+            const aiFace* aiface = &aimesh->mFaces[t];
+            for (unsigned int i=2;  i<aiface->mNumIndices;  i++) {
+                *matIndx++ = matIndex;
+                *indices++ = aiface->mIndices[0]+faceOffset;
+                *indices++ = aiface->mIndices[i-1]+faceOffset;
+                *indices++ = aiface->mIndices[i]+faceOffset; } } });
+}
 
-    if (!pixels) {
-        throw std::runtime_error("failed to load texture image!");
-    }
+// Device memory a texture will take with all its mip levels, once
+// mipDrop levels are dropped (compressed: as BC7, the larger format).
+// 0 if the file cannot be read.
+static VkDeviceSize textureBytes(std::string fileName, uint32_t mipDrop, bool compressed)
+{
+    for (size_t i=0;  i<fileName.size();  i++)
+        if (fileName[i] == '\\') fileName[i] = '/';
+    int w, h, channels;
+    if (!stbi_info(fileName.c_str(), &w, &h, &channels)) return 0;
+    w = std::max(w >> mipDrop, 1);
+    h = std::max(h >> mipDrop, 1);
+    return VkDeviceSize(w)*h*(compressed ? 1 : 4)*4/3;
+}
+
+// How textures are loaded, as set in vkapp.h.
+TextureOptions VkApp::textureOptions() const
+{
+    TextureOptions options;
+#ifdef TEXTURE_CACHE
+    options.useCache = true;
+#endif
+#if defined(CPU_MIPS) || defined(VIRTUAL_TEXTURES)
+    options.cpuMips = true;  // (Virtual textures are paged from the full chain)
+#endif
+#ifdef TEXTURE_COMPRESSION
+    options.compress = m_textureCompressionBC;
+#endif
+    options.mipFilter = MipFilter::MIP_FILTER;
+    return options;
+}
+
+// The CPU half of loading a model's textures; safe to call on a
+// loader thread.
+std::vector<DecodedTexture> VkApp::loadModelTextures(const std::vector<std::string>& fileNames,
+                                                     uint32_t mipDrop) const
+{
+    return loadTextures(fileNames, mipDrop, textureOptions());
+}
 
-    BufferWrap staging;
-    initBufferWrap(staging, imageSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+// Device memory taken by a texture once uploaded.
+static size_t textureDeviceBytes(const DecodedTexture& texture)
+{
+    size_t bytes = 0;
+    for (const TextureLevel& level : texture.levels)
+        bytes += level.size();
+    if (texture.levels.size() != fullMipLevels(texture.width, texture.height))
+        bytes = bytes*4/3;  // The GPU blits the rest
+    return bytes;
+}
 
-    void* data;
-    vkMapMemory(m_device, staging.memory, 0, imageSize, 0, &data);
-    memcpy(data, pixels, static_cast<size_t>(imageSize));
-    vkUnmapMemory(m_device, staging.memory);
+// Uploads the textures loaded for refs.newFiles, into the slots
+// m_textureRegistry gave them, and records them there.  (Virtual
+// textures are numbered as those slots.)
+void VkApp::uploadNewTextures(const TextureRegistry::Resolved& refs,
+                              const std::vector<DecodedTexture>& textures)
+{
+#ifdef VIRTUAL_TEXTURES
+    assert(m_virtualTextures.size() == refs.firstNewSlot && textures.size() == refs.newFiles.size());
+    m_virtualTextures.add(std::vector<DecodedTexture>(textures));
+    createVirtualTextureTables();
+#elif defined(TEXTURE_ATLAS)
+    // The textures left unpacked, then the pages.
+    assert(m_textureRects.size() == refs.firstNewSlot && textures.size() == refs.newFiles.size());
+    TextureAtlas atlas = packTextureAtlas(textures, TEXTURE_ATLAS, textureOptions().mipFilter);
+    const uint32_t firstAlone = uint32_t(m_objText.size());
+    const uint32_t firstPage = uint32_t(firstAlone + textures.size() - atlas.nbPacked);
+    std::vector<const DecodedTexture*> alone, pages;
+    for (size_t t=0;  t<textures.size();  t++) {
+        AtlasRect rect = atlas.rects[t];
+        if (atlas.page[t] >= 0)
+            rect.image = firstPage + uint32_t(atlas.page[t]);
+        else {
+            rect.image = firstAlone + uint32_t(alone.size());
+            alone.push_back(&textures[t]); }
+        m_textureRects.push_back(rect); }
+    for (const DecodedTexture& page : atlas.pages)
+        pages.push_back(&page);
+    uploadTextures(alone);
+    if (!pages.empty())
+        uploadTextures(pages, float(ATLAS_LEVELS - 1));  // Coarser levels mix the textures
+    createTextureRectBuffer();
+#else
+    assert(m_objText.size() == refs.firstNewSlot && textures.size() == refs.newFiles.size());
+    std::vector<const DecodedTexture*> all;
+    for (const DecodedTexture& texture : textures)
+        all.push_back(&texture);
+    uploadTextures(all);
+#endif
+    std::vector<size_t> bytes;
+    for (const DecodedTexture& texture : textures)
+        bytes.push_back(textureDeviceBytes(texture));
+    m_textureRegistry.uploaded(refs, bytes);
+}
 
-    stbi_image_free(pixels);
+#ifdef TEXTURE_ATLAS
+// Binding 4 of m_scDesc: m_textureRects, never empty so the binding
+// always has a buffer.
+void VkApp::createTextureRectBuffer()
+{
+    std::vector<AtlasRect> rects = m_textureRects;
+    if (rects.empty()) rects.push_back(AtlasRect{});
+    finishUploads();  // None may be left copying to the old buffer
+    m_textureRectBuff.destroy(m_device);
+    initBufferWrapFromData(m_textureRectBuff, rects,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemCategory::Textures);
+}
+#endif
 
-    uint mipLevels = std::floor(std::log2(std::max(texWidth, texHeight))) + 1;
-    
-    ImageWrap myImage;
-    VkExtent2D texSize{static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight)};
-    initImageWrap(myImage, texSize, VK_FORMAT_R8G8B8A8_UNORM,
-                  VK_IMAGE_USAGE_TRANSFER_DST_BIT
-                  | VK_IMAGE_USAGE_SAMPLED_BIT
-                  | VK_IMAGE_USAGE_TRANSFER_SRC_BIT,
-                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
-                  VK_IMAGE_ASPECT_COLOR_BIT,
-                  VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
-                  mipLevels);
-
-    initTextureSampler(myImage);
-    
-    // Copy staging buffer contents to the image (via a vkCmdCopyBufferToImage)
-    VkCommandBuffer commandBuffer = createTempCmdBuffer();
-
-    VkBufferImageCopy region{};
-    region.bufferOffset = 0;
-    region.bufferRowLength = 0;
-    region.bufferImageHeight = 0;
-    region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
-    region.imageSubresource.mipLevel = 0;
-    region.imageSubresource.baseArrayLayer = 0;
-    region.imageSubresource.layerCount = 1;
-    region.imageOffset = {0, 0, 0};
-    region.imageExtent = {static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight), 1};
-
-    vkCmdCopyBufferToImage(commandBuffer, staging.buffer, myImage.image,
-                           VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region);
-    
-    submitTempCmdBuffer(commandBuffer);
+// The Vulkan format of a texture's levels.
+static VkFormat textureVkFormat(TextureFormat format)
+{
+    switch (format) {
+    case TextureFormat::BC1: return VK_FORMAT_BC1_RGB_UNORM_BLOCK;
+    case TextureFormat::BC7: return VK_FORMAT_BC7_UNORM_BLOCK;
+    default:                 return VK_FORMAT_R8G8B8A8_UNORM; }
+}
 
-    // Done with staging buffer
-    staging.destroy(m_device);
+// Creates decoded textures on the GPU, appending them to m_objText,
+// with samplers that read levels 0 to maxLod.
+// Their layout transitions, copies and mipmap blits are recorded with
+// the uploads (see vkapp_upload.cpp), each level staged in the upload
+// ring, so a model's textures go to the GPU in a few submits that
+// nothing waits for.  A texture with all its mip levels (from the
+// texture cache) needs no blits; a compressed one always has them
+// all, as blocks cannot be blitted.
+void VkApp::uploadTextures(const std::vector<const DecodedTexture*>& textures, float maxLod)
+{
+    auto start = std::chrono::steady_clock::now();
+    size_t nbBlitted = 0;
+
+    for (const DecodedTexture* t : textures) {
+        const DecodedTexture& texture = *t;
+        int texWidth = texture.width, texHeight = texture.height;
+        uint32_t mipLevels = fullMipLevels(texWidth, texHeight);
+        bool allLevels = texture.levels.size() == mipLevels;
+        VkFormat format = textureVkFormat(texture.format());
+        if (!allLevels && format != VK_FORMAT_R8G8B8A8_UNORM)
+            throw std::runtime_error("compressed texture without all its mip levels");
+
+        // Created in no particular layout; the barrier below is
+        // recorded with the uploads.
+        ImageWrap myImage;
+        VkExtent2D texSize{static_cast<uint32_t>(texWidth), static_cast<uint32_t>(texHeight)};
+        initImageWrap(myImage, texSize, format,
+                      VK_IMAGE_USAGE_TRANSFER_DST_BIT
+                      | VK_IMAGE_USAGE_SAMPLED_BIT
+                      | (allLevels ? 0 : VK_IMAGE_USAGE_TRANSFER_SRC_BIT),
+                      VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
+                      VK_IMAGE_ASPECT_COLOR_BIT,
+                      VK_IMAGE_LAYOUT_UNDEFINED,
+                      mipLevels, MemCategory::Textures);
+
+        initTextureSampler(myImage, maxLod);
 
-    generateMipmap(myImage.image, VK_FORMAT_R8G8B8A8_UNORM, texWidth, texHeight, mipLevels);
-    
-    return myImage;
+        VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+        barrier.oldLayout = VK_IMAGE_LAYOUT_UNDEFINED;
+        barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+        barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+        barrier.image = myImage.image;
+        barrier.subresourceRange.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+        barrier.subresourceRange.baseMipLevel = 0;
+        barrier.subresourceRange.levelCount = mipLevels;
+        barrier.subresourceRange.baseArrayLayer = 0;
+        barrier.subresourceRange.layerCount = 1;
+        barrier.srcAccessMask = 0;
+        barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        vkCmdPipelineBarrier(uploadCommandBuffer(),
+            VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+            0, nullptr,
+            0, nullptr,
+            1, &barrier);
+
+        // Copy this texture's levels, each through the upload ring, to
+        // the image (via a vkCmdCopyBufferToImage).  The copy of a
+        // level is recorded before the next is staged, as staging may
+        // submit the uploads recorded so far.
+        for (uint32_t l=0;  l<texture.levels.size();  l++) {
+            const TextureLevel& level = texture.levels[l];
+            VkBufferImageCopy region{};
+            VkBuffer staging = stageUpload(texture.data() + level.offset, level.size(), region.bufferOffset);
+            region.bufferRowLength = 0;
+            region.bufferImageHeight = 0;
+            region.imageSubresource.aspectMask = VK_IMAGE_ASPECT_COLOR_BIT;
+            region.imageSubresource.mipLevel = l;
+            region.imageSubresource.baseArrayLayer = 0;
+            region.imageSubresource.layerCount = 1;
+            region.imageOffset = {0, 0, 0};
+            region.imageExtent = {static_cast<uint32_t>(level.width), static_cast<uint32_t>(level.height), 1};
+            vkCmdCopyBufferToImage(uploadCommandBuffer(), staging, myImage.image,
+                                   VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL, 1, &region); }
+
+        if (allLevels) {
+            barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+            barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+            barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+            barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+            vkCmdPipelineBarrier(uploadCommandBuffer(),
+                VK_PIPELINE_STAGE_TRANSFER_BIT, VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT, 0,
+                0, nullptr,
+                0, nullptr,
+                1, &barrier); }
+        else {
+            generateMipmap(uploadCommandBuffer(), myImage.image, VK_FORMAT_R8G8B8A8_UNORM,
+                           texWidth, texHeight, mipLevels);
+            nbBlitted++; }
+        m_objText.push_back(myImage); }
+
+    double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+    printf("Texture upload: %zd textures recorded in %.1f ms (%zd with blitted mip levels)\n",
+           textures.size(), ms, nbBlitted);
 }
 
-void VkApp::generateMipmap(VkImage image, VkFormat imageFormat, int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
+// Records the blits that fill each mip level from the one above, and
+// leaves the image ready for the shaders.
+void VkApp::generateMipmap(VkCommandBuffer commandBuffer, VkImage image, VkFormat imageFormat,
+                           int32_t texWidth, int32_t texHeight, uint32_t mipLevels)
 {
         // Check if image format supports linear blitting
         VkFormatProperties formatProperties;
@@ -479,8 +1246,6 @@ void VkApp::generateMipmap(VkImage image, VkFormat imageFormat, int32_t texWidth
             throw std::runtime_error("texture image format does not support linear blitting!");
         }
 
-        VkCommandBuffer commandBuffer = createTempCmdBuffer();
-    
         VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
         barrier.image = image;
         barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
@@ -552,6 +1317,4 @@ void VkApp::generateMipmap(VkImage image, VkFormat imageFormat, int32_t texWidth
             0, nullptr,
             0, nullptr,
             1, &barrier);
-
-    submitTempCmdBuffer(commandBuffer);
     }
@@ -0,0 +1,119 @@
+//////////////////////////////////////////////////////////////////////
+// Levels of detail of the scene's objects (MESH_LODS in vkapp.h).
+//
+// ModelData::buildLods simplifies each mesh at load time, and
+// addObject stores an object's levels after its full detail triangles
+// in its index, material index and hit record buffers.  Each level
+// gets an ObjDesc of its own, pointing into those buffers, so the
+// shaders read a level exactly as they read a whole object.
+//
+// The rasterizer chooses a level per instance, as the coarsest whose
+// simplification error projects to less than m_lodPixelError pixels.
+// The ray tracer traces camera rays against full detail geometry, and
+// (with m_rtLod) all later rays against a second set of BLAS's built
+// from one coarser level of each object; see createTopLevelAS.
+////////////////////////////////////////////////////////////////////////
+
+#include <vector>
+
+#include "vkapp.h"
+#include "vertex_transform.h"
+#include "app.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+// The object descriptions as written to m_objDescriptionBuff:
+// m_objDesc, followed by those of each object's levels of detail,
+// whose index is recorded in ObjData::lodDesc.
+std::vector<ObjDesc> VkApp::objectDescriptions()
+{
+    std::vector<ObjDesc> descs = m_objDesc;
+    for (size_t i=0;  i<m_objData.size();  i++) {
+        ObjData& object = m_objData[i];
+        object.lodDesc = uint32_t(descs.size());
+        for (const ObjLod& lod : object.lods) {
+            ObjDesc desc = m_objDesc[i];
+            desc.indexAddress         += sizeof(uint32_t)*lod.firstIndex;
+            desc.materialIndexAddress += sizeof(uint32_t)*lod.firstMatWord;
+            if (desc.hitRecordAddress != 0)
+                desc.hitRecordAddress += sizeof(HitRecord)*lod.firstTriangle;
+            descs.push_back(desc); } }
+    return descs;
+}
+
+// The instance transforms as written to m_instanceBuff, indexed by
+// the TLAS's instance numbers (and the rasterizer's instance index).
+std::vector<InstanceTransform> VkApp::instanceTransforms() const
+{
+    std::vector<InstanceTransform> transforms;
+    for (const ObjInst& inst : m_objInst)
+        transforms.push_back({inst.transform, glm::mat4(VertexTransform(inst.transform).normal)});
+    if (m_rtLod != 0)  // The TLAS's second copy of each instance
+        for (size_t i=0;  i<m_objInst.size();  i++)
+            transforms.push_back(transforms[i]);
+    return transforms;
+}
+
+// The level at which to draw object, placed by modelView: the
+// coarsest whose error, projected onto the screen at the nearest
+// point of the object's bounding sphere, is within m_lodPixelError.
+uint32_t VkApp::selectLod(const ObjData& object, const glm::mat4& modelView, float pixelsPerUnit) const
+{
+    if (object.lods.empty() || m_lodPixelError <= 0.0f) return 0;
+
+    float scale = std::max(glm::length(vec3(modelView[0])),
+                           std::max(glm::length(vec3(modelView[1])), glm::length(vec3(modelView[2]))));
+    vec3 center = vec3(modelView * vec4(vec3(object.bounds), 1.0f));
+    float distance = glm::length(center) - scale*object.bounds.w;
+    if (distance <= 0.0f) return 0;  // The eye is inside the bounds
+
+    uint32_t level = 0;
+    while (level < object.lods.size()
+           && object.lods[level].error*scale/distance*pixelsPerUnit <= m_lodPixelError)
+        level++;
+    return level;
+}
+
+// (Re)builds the BLAS's the ray tracer's secondary rays see: each
+// object's level m_rtLod (or its coarsest).  Objects without levels
+// get none; their full detail BLAS serves both kinds of ray.
+void VkApp::createLodBlas()
+{
+    m_lodBuilder.destroy();
+    m_lodBlas.assign(m_objData.size(), ~0u);
+    if (m_rtLod == 0) return;
+
+    std::vector<BlasInput> allBlas;
+    uint64_t triangles = 0;
+    for (size_t i=0;  i<m_objData.size();  i++) {
+        const ObjData& object = m_objData[i];
+        if (object.lods.empty()) continue;
+        uint32_t level = std::min<uint32_t>(m_rtLod, uint32_t(object.lods.size()));
+        m_lodBlas[i] = uint32_t(allBlas.size());
+        allBlas.push_back(objectToVkGeometryKHR(object, level));
+        triangles += object.lods[level-1].nbIndices/3; }
+
+    auto start = std::chrono::steady_clock::now();
+    if (!allBlas.empty())
+        m_lodBuilder.buildBlas(allBlas, VK_BUILD_ACCELERATION_STRUCTURE_PREFER_FAST_TRACE_BIT_KHR);
+    m_scratch1.destroy(m_device);
+    printf("LOD BLAS's: level %u, %zd BLAS's, %llu triangles, %.2f ms\n", m_rtLod, allBlas.size(),
+           (unsigned long long)triangles,
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Switches the level of detail seen by secondary rays (0: full detail).
+void VkApp::setRtLod(uint32_t level)
+{
+    if (level == m_rtLod) return;
+    finishUploads();
+    vkDeviceWaitIdle(m_device);  // Nothing in flight may use what is replaced
+    m_rtLod = level;
+    createLodBlas();
+    bool buffersMoved = updateObjDescriptionBuffer();
+    createTopLevelAS();
+    updateSceneDescriptors(buffersMoved);
+}
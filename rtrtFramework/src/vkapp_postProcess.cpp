@@ -21,7 +21,7 @@ void VkApp::createDepthResource()
                   VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT,
                   VK_IMAGE_ASPECT_DEPTH_BIT,
                   VK_IMAGE_LAYOUT_UNDEFINED,
-                  1);
+                  1, MemCategory::RenderTargets);
 
     // @@ To destroy: m_depthImage.destroy(m_device);
 }
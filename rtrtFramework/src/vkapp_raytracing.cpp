@@ -26,14 +26,15 @@ void VkApp::createRtBuffers()
     VkMemoryPropertyFlags mem = VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT;
     VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
     VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
+    MemCategory rt = MemCategory::RenderTargets;
 
-    initImageWrap(m_rtColCurrBuffer, m_windowSize, format, flags, mem, aspect, layout);
+    initImageWrap(m_rtColCurrBuffer, m_windowSize, format, flags, mem, aspect, layout, 1, rt);
     // Here will be 5 more buffers similarly created with initImageWrap.
-    initImageWrap(m_rtColPrevBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    initImageWrap(m_rtNdCurrBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    initImageWrap(m_rtNdPrevBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    initImageWrap(m_rtKdCurrBuffer, m_windowSize, format, flags, mem, aspect, layout);
-    initImageWrap(m_rtKdPrevBuffer, m_windowSize, format, flags, mem, aspect, layout);
+    initImageWrap(m_rtColPrevBuffer, m_windowSize, format, flags, mem, aspect, layout, 1, rt);
+    initImageWrap(m_rtNdCurrBuffer, m_windowSize, format, flags, mem, aspect, layout, 1, rt);
+    initImageWrap(m_rtNdPrevBuffer, m_windowSize, format, flags, mem, aspect, layout, 1, rt);
+    initImageWrap(m_rtKdCurrBuffer, m_windowSize, format, flags, mem, aspect, layout, 1, rt);
+    initImageWrap(m_rtKdPrevBuffer, m_windowSize, format, flags, mem, aspect, layout, 1, rt);
 
     // @@ Destroy with m_rtColCurrBuffer.destroy(m_device) and eventually 5 more destroy calls.
 }
@@ -54,8 +55,17 @@ void VkApp::initRayTracing()
     handleAlignment = rtProps.shaderGroupHandleAlignment;
     baseAlignment   = rtProps.shaderGroupBaseAlignment;
 
+    // Timestamps before and after each frame's vkCmdTraceRaysKHR
+    m_timestampPeriod = prop2.properties.limits.timestampPeriod;
+    VkQueryPoolCreateInfo qpci{VK_STRUCTURE_TYPE_QUERY_POOL_CREATE_INFO};
+    qpci.queryCount = 2;
+    qpci.queryType  = VK_QUERY_TYPE_TIMESTAMP;
+    vkCreateQueryPool(m_device, &qpci, nullptr, &m_traceQueryPool);
+    // @@ Destroy with vkDestroyQueryPool(m_device, m_traceQueryPool, nullptr);
+
     // This initializes the acceleration structure helper class
     m_rtBuilder.setup(this, m_device, m_graphicsQueueIndex);
+    m_lodBuilder.setup(this, m_device, m_graphicsQueueIndex);  // MESH_LODS
 
     // @@ *HERE* Destroy the temporary m_rtBuilder with m_rtBuilder.destroy()
     // There is some question whether this destroy can go here (since
@@ -87,6 +97,8 @@ void VkApp::createRtDescriptorSet()
              VK_SHADER_STAGE_RAYGEN_BIT_KHR},
             {7, VK_DESCRIPTOR_TYPE_STORAGE_IMAGE, 1,  // Previous Color buffer
              VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {8, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,  // Light alias table or BVH
+             VK_SHADER_STAGE_RAYGEN_BIT_KHR},
         });
     
 
@@ -100,6 +112,7 @@ void VkApp::createRtDescriptorSet()
     m_rtDesc.write(m_device, 5, m_rtNdPrevBuffer.Descriptor());           // Previous Normal/Depth
     m_rtDesc.write(m_device, 6, m_rtKdCurrBuffer.Descriptor());           // Current Surface Color
     m_rtDesc.write(m_device, 7, m_rtKdPrevBuffer.Descriptor());           // Previous Surface Color
+    m_rtDesc.write(m_device, 8, m_lightSelectBuff.buffer);                // Light alias table or BVH
     //@@ Destroy the descriptor set with: m_rtDesc.destroy(m_device)
 
 }
@@ -263,13 +276,10 @@ void VkApp::createRtShaderBindingTable()
         std::cout << "vkGetRayTracingShaderGroupHandlesKHR failed: " << result << std::endl;
     }
 
-    // Allocate a buffer for storing the SBT, and a staging buffer for transferring data to it.
+    // Allocate a buffer for storing the SBT, and host memory to fill in before uploading it.
     VkDeviceSize sbtSize = m_rgenRegion.size + m_missRegion.size
         + m_hitRegion.size + m_callRegion.size;
-    BufferWrap staging;
-    initBufferWrap(staging, sbtSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
-                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT
-                   | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT);
+    std::vector<uint8_t> sbtData(sbtSize, 0);
     initBufferWrap(m_shaderBindingTableBuff, sbtSize,
                    VK_BUFFER_USAGE_TRANSFER_DST_BIT
                    | VK_BUFFER_USAGE_SHADER_DEVICE_ADDRESS_BIT
@@ -288,9 +298,8 @@ void VkApp::createRtShaderBindingTable()
     // Helper to retrieve the handle data
     auto getHandle = [&](int i) { return handles.data() + i * handleSize; };
 
-    // Map the SBT buffer and write in the handles.
-    uint8_t* mappedMemAddress;
-    vkMapMemory(m_device, staging.memory, 0, sbtSize, 0, (void**)&mappedMemAddress);
+    // Write the handles into the SBT's host copy.
+    uint8_t* mappedMemAddress = sbtData.data();
     uint8_t offset = 0;
 
     // Raygen
@@ -309,11 +318,7 @@ void VkApp::createRtShaderBindingTable()
         memcpy(mappedMemAddress+offset, getHandle(handleIdx++), handleSize);
         offset += m_hitRegion.stride; }
 
-    vkUnmapMemory(m_device, staging.memory);
-    
-    copyBuffer(staging.buffer, m_shaderBindingTableBuff.buffer, sbtSize);
-
-    staging.destroy(m_device);
+    updateBufferWrap(m_shaderBindingTableBuff, sbtSize, sbtData.data());
 
     // @@ destroy acceleration structure with m_shaderBindingTableBuff.destroy(m_device);
 }
@@ -403,6 +408,7 @@ void VkApp::raytrace()
         m_pcRay.depth++;
 
     m_pcRay.depth = std::min(m_pcRay.depth, 4);
+    m_pcRay.nbEmitters = int(m_emitters.size());
     m_pcRay.clear = app->myCamera.modified;
     app->myCamera.modified = false;
 
@@ -425,9 +431,23 @@ void VkApp::raytrace()
                        0, sizeof(PushConstantRay), &m_pcRay);
     m_pcRay.clear = false;  // Allow accumulation after at least one path tracing pass.
 
+    // The previous frame (finished by now; see prepareFrame) left its
+    // trace time in the timestamp queries.
+    if (m_traceTimed) {
+        uint64_t t[2];
+        if (vkGetQueryPoolResults(m_device, m_traceQueryPool, 0, 2, sizeof(t), t, sizeof(uint64_t),
+                                  VK_QUERY_RESULT_64_BIT) == VK_SUCCESS)
+            m_traceMs = (t[1] - t[0]) * m_timestampPeriod * 1e-6; }
+    vkCmdResetQueryPool(m_commandBuffer, m_traceQueryPool, 0, 2);
+    vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_TOP_OF_PIPE_BIT, m_traceQueryPool, 0);
+
     // This dispatches the ray generation shader for each pixel on screen.
     vkCmdTraceRaysKHR(m_commandBuffer, &m_rgenRegion, &m_missRegion, &m_hitRegion,
                       &m_callRegion, m_windowSize.width, m_windowSize.height, 1);
+
+    vkCmdWriteTimestamp(m_commandBuffer, VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR,
+                        m_traceQueryPool, 1);
+    m_traceTimed = true;
     frameCount++;
 
     
@@ -29,7 +29,8 @@ void VkApp::createRenderTarget()
     VkImageAspectFlagBits aspect = VK_IMAGE_ASPECT_COLOR_BIT;
     VkImageLayout layout = VK_IMAGE_LAYOUT_GENERAL;
 
-    initImageWrap(m_renderTarget, m_windowSize, format, flags, mem, aspect, layout);
+    initImageWrap(m_renderTarget, m_windowSize, format, flags, mem, aspect, layout,
+                  1, MemCategory::RenderTargets);
     initTextureSampler(m_renderTarget);
 
     // @@ Destroy with m_renderTarget.destroy(m_device);
@@ -62,14 +63,25 @@ void VkApp::createMatrixBuffer()
 // Create a Vulkan buffer containing pointers to all object buffers
 // (vertex, triangle indices, materials, and material indices. Will be
 // included in a descriptor set for use in shaders.
+//
+// Also a buffer of the instance transforms, in m_objInst order, so
+// the shaders can find an instance's transform from gl_InstanceIndex
+// (scanline) or gl_InstanceID (ray tracing).
 void VkApp::createObjDescriptionBuffer()
 {
-    VkCommandBuffer cmdBuf = createTempCmdBuffer();
-    initBufferWrapFromData(m_objDescriptionBuff, cmdBuf, m_objDesc,
+    std::vector<ObjDesc> descs = objectDescriptions();
+    std::vector<InstanceTransform> transforms = instanceTransforms();
+
+    initBufferWrapFromData(m_objDescriptionBuff, descs,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
+    initBufferWrapFromData(m_instanceBuff, transforms,
                            VK_BUFFER_USAGE_STORAGE_BUFFER_BIT);
     NAME(m_objDescriptionBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_objDescriptionBuff.buffer");
-    submitTempCmdBuffer(cmdBuf);
+    NAME(m_instanceBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_instanceBuff.buffer");
+    m_objDescCapacity = descs.size();
+    m_instanceCapacity = transforms.size();
     // @@ Destroy with m_objDescriptionBuff.destroy(m_device);
+    // @@ and m_instanceBuff.destroy(m_device);
 }
 
 // The scanline renderpass outputs to m_renderTarget (as wrapped by m_scanlineFramebuffer)
@@ -160,7 +172,12 @@ void VkApp::createScRenderPass()
 
 void VkApp::createScDescriptorSet()
 {
-    auto nbTxt = static_cast<uint32_t>(m_objText.size());
+    // Room for a few more textures than the scene has, so models
+    // added later (see addModel) need not change the layout.
+    m_textureSlots = 0;
+    if (!m_objText.empty())
+        for (m_textureSlots = 1;  m_textureSlots < m_objText.size();  m_textureSlots *= 2) {}
+    uint32_t nbTxt = m_textureSlots;
 
     // This descriptor set is being created for both the scanline and
     // raytracing pipelines; Note the mention of VERTEX, FRAGMENT, and
@@ -172,16 +189,49 @@ void VkApp::createScDescriptorSet()
                 VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT
                 | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
             {2, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, nbTxt,
-                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR}
+                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {3, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+#ifdef VIRTUAL_TEXTURES
+            {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {5, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {6, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+            {7, VK_DESCRIPTOR_TYPE_COMBINED_IMAGE_SAMPLER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+#endif
+#ifdef TEXTURE_ATLAS
+            {4, VK_DESCRIPTOR_TYPE_STORAGE_BUFFER, 1,
+                VK_SHADER_STAGE_FRAGMENT_BIT | VK_SHADER_STAGE_RAYGEN_BIT_KHR},
+#endif
         });
               
     m_scDesc.write(m_device, 0, m_matrixBuff.buffer);
     m_scDesc.write(m_device, 1, m_objDescriptionBuff.buffer);
-    m_scDesc.write(m_device, 2, m_objText);    
+    writeTextureDescriptors();
+    m_scDesc.write(m_device, 3, m_instanceBuff.buffer);
+#ifdef VIRTUAL_TEXTURES
+    writeVirtualTextureDescriptors();
+#endif
+#ifdef TEXTURE_ATLAS
+    m_scDesc.write(m_device, 4, m_textureRectBuff.buffer);
+#endif
 
     // @@ Destroy with m_scDesc.destroy(m_device);
 }
 
+// Binding 2 of m_scDesc: the textures, with any slots beyond the
+// last repeating texture 0.
+void VkApp::writeTextureDescriptors()
+{
+    std::vector<ImageWrap> slots = m_objText;
+    if (!slots.empty())
+        slots.resize(m_textureSlots, m_objText[0]);
+    m_scDesc.write(m_device, 2, slots);
+}
+
 void VkApp::createScPipeline()
 {
     VkPushConstantRange pushConstantRanges = {
@@ -217,18 +267,30 @@ void VkApp::createScPipeline()
 
     VkPipelineShaderStageCreateInfo shaderStages[] = {vertShaderStageInfo, fragShaderStageInfo};
 
-    VkVertexInputBindingDescription bindingDescription
-        {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX};
+#ifdef COMPACT_VERTICES
+    // Binding 0: positions,  binding 1: compact shading attributes
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions {
+        {0, sizeof(vec3), VK_VERTEX_INPUT_RATE_VERTEX},
+        {1, sizeof(CompactVertex), VK_VERTEX_INPUT_RATE_VERTEX}};
+
+    std::vector<VkVertexInputAttributeDescription> attributeDescriptions {
+        {0, 0, VK_FORMAT_R32G32B32_SFLOAT, 0},
+        {1, 1, VK_FORMAT_R32_UINT, static_cast<uint32_t>(offsetof(CompactVertex, nrm))},
+        {2, 1, VK_FORMAT_R32_UINT, static_cast<uint32_t>(offsetof(CompactVertex, texCoord))}};
+#else
+    std::vector<VkVertexInputBindingDescription> bindingDescriptions {
+        {0, sizeof(Vertex), VK_VERTEX_INPUT_RATE_VERTEX}};
 
     std::vector<VkVertexInputAttributeDescription> attributeDescriptions {
         {0, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, pos))},
         {1, 0, VK_FORMAT_R32G32B32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, nrm))},
         {2, 0, VK_FORMAT_R32G32_SFLOAT, static_cast<uint32_t>(offsetof(Vertex, texCoord))}};
+#endif
 
     VkPipelineVertexInputStateCreateInfo
         vertexInputInfo{VK_STRUCTURE_TYPE_PIPELINE_VERTEX_INPUT_STATE_CREATE_INFO};
-    vertexInputInfo.vertexBindingDescriptionCount = 1;
-    vertexInputInfo.pVertexBindingDescriptions = &bindingDescription;
+    vertexInputInfo.vertexBindingDescriptionCount = bindingDescriptions.size();
+    vertexInputInfo.pVertexBindingDescriptions = bindingDescriptions.data();
         
     vertexInputInfo.vertexAttributeDescriptionCount = attributeDescriptions.size();
     vertexInputInfo.pVertexAttributeDescriptions = attributeDescriptions.data();
@@ -347,8 +409,24 @@ void VkApp::rasterize()
     vkCmdBindDescriptorSets(m_commandBuffer, VK_PIPELINE_BIND_POINT_GRAPHICS,
                             m_scPipelineLayout, 0, 1, &m_scDesc.descSet, 0, nullptr);
 
-    for(const ObjInst& inst : m_objInst) {
+    // The instances of an object are adjacent in m_objInst; each run
+    // of them drawn at one level of detail is one instanced draw.  The
+    // vertex shader finds each instance's transform by
+    // gl_InstanceIndex, which starts at the run's first index in
+    // m_objInst.
+    m_drawnTriangles = 0;
+    for (size_t first=0;  first<m_objInst.size();  ) {
+        const ObjInst& inst = m_objInst[first];
         auto& object            = m_objData[inst.objIndex];
+        uint32_t level = selectLod(object, m_view * inst.transform, m_pixelsPerUnit);
+        uint32_t count = 1;
+        while (first+count < m_objInst.size() && m_objInst[first+count].objIndex == inst.objIndex
+               && selectLod(object, m_view * m_objInst[first+count].transform, m_pixelsPerUnit) == level)
+            count++;
+        uint32_t firstIndex = level ? object.lods[level-1].firstIndex : 0;
+        uint32_t nbIndices  = level ? object.lods[level-1].nbIndices : object.nbIndices;
+        m_drawnTriangles += uint64_t(nbIndices/3) * count;
+
         // Information pushed at each draw call
         PushConstantRaster pcRaster{
             scLightPos,
@@ -358,16 +436,23 @@ void VkApp::rasterize()
             inst.objIndex       // instance Id
         };
         
-        pcRaster.objIndex    = inst.objIndex;  // Telling which object is drawn
+        pcRaster.objIndex    = level ? object.lodDesc + level-1 : inst.objIndex;  // Telling which object (and level) is drawn
         pcRaster.modelMatrix = inst.transform;
 
         vkCmdPushConstants(m_commandBuffer, m_scPipelineLayout,
                            VK_SHADER_STAGE_VERTEX_BIT | VK_SHADER_STAGE_FRAGMENT_BIT, 0,
                            sizeof(PushConstantRaster), &pcRaster);
+#ifdef COMPACT_VERTICES
+        VkBuffer vertexBuffers[] = {object.positionBuffer.buffer, object.vertexBuffer.buffer};
+        VkDeviceSize offsets[] = {0, 0};
+        vkCmdBindVertexBuffers(m_commandBuffer, 0, 2, vertexBuffers, offsets);
+#else
         vkCmdBindVertexBuffers(m_commandBuffer, 0, 1, &object.vertexBuffer.buffer, &offset);
+#endif
         vkCmdBindIndexBuffer(m_commandBuffer, object.indexBuffer.buffer, 0,
                              VK_INDEX_TYPE_UINT32);
-        vkCmdDrawIndexed(m_commandBuffer, object.nbIndices, 1, 0, 0, 0); }
+        vkCmdDrawIndexed(m_commandBuffer, nbIndices, count, firstIndex, 0, uint32_t(first));
+        first += count; }
     
     vkCmdEndRenderPass(m_commandBuffer);
 }
@@ -379,6 +464,8 @@ void VkApp::updateCameraBuffer()
     const float    aspectRatio = m_windowSize.width / static_cast<float>(m_windowSize.height);
     glm::mat4    view = app->myCamera.view(glfwGetTime());
     glm::mat4    proj = app->myCamera.perspective(aspectRatio);
+    m_view = view;
+    m_pixelsPerUnit = 0.5f * glm::abs(proj[1][1]) * m_windowSize.height;
     
     m_console_out.append(glm::to_string(view)+"\n");
     m_console_out.append(glm::to_string(proj));
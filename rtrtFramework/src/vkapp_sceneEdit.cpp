@@ -0,0 +1,228 @@
+//////////////////////////////////////////////////////////////////////
+// Adding models to, and removing them from, the scene while the app
+// runs.
+//
+// An added model's objects are appended by uploadModel as at
+// startup.  Then only the new objects' BLAS's are built, the TLAS is
+// rebuilt (a refit cannot change its number of instances), the
+// object descriptions are rewritten into their buffers (reallocated
+// only when they outgrow their capacity), and only the descriptors
+// that changed are written.  The descriptor set layouts, and so the
+// pipelines, are recreated only when the textures outgrow their
+// slots (see createScDescriptorSet).
+////////////////////////////////////////////////////////////////////////
+
+#include <string>
+#include <vector>
+
+#include "vkapp.h"
+#include "app.h"
+
+#define GLM_FORCE_RADIANS
+#define GLM_SWIZZLE
+#include <glm/glm.hpp>
+using namespace glm;
+
+bool VkApp::addModel(const std::string& filename, glm::mat4 transform)
+{
+    SceneEditTiming timing;
+    auto lapStart = std::chrono::steady_clock::now();
+    auto lap = [&]() {
+        auto now = std::chrono::steady_clock::now();
+        double ms = std::chrono::duration<double, std::milli>(now - lapStart).count();
+        lapStart = now;
+        return ms; };
+
+    ModelData meshdata;
+    if (!readModel(filename, meshdata)) {
+        printf("Cannot find model file %s\n", filename.c_str());
+        return false; }
+    timing.readMs = lap();
+
+    finishUploads();
+    vkDeviceWaitIdle(m_device);  // Nothing in flight may use what is replaced
+    size_t firstObject = uploadModel(filename, meshdata, transform);
+    timing.uploadMs = lap();
+
+    createBottomLevelAS(firstObject);
+    createLodBlas();
+    timing.blasMs = lap();
+    // (The object descriptions first: the TLAS refers to their levels'.)
+    bool buffersMoved = updateObjDescriptionBuffer();
+    timing.descMs = lap();
+    createTopLevelAS();
+    timing.tlasMs = lap();
+
+    updateSceneDescriptors(buffersMoved);
+    timing.descMs += lap();
+
+    timing.totalMs = timing.readMs + timing.uploadMs + timing.blasMs + timing.tlasMs + timing.descMs;
+    m_lastEdit = timing;
+    printf("Added %s (%zd objects) to a scene of %zd objects, %zd instances:\n",
+           filename.c_str(), m_objData.size() - firstObject, m_objData.size(), m_objInst.size());
+    printf("  read %.2f ms, upload %.2f ms, BLAS %.2f ms, TLAS %.2f ms, descriptors %.2f ms;"
+           " total %.2f ms\n", timing.readMs, timing.uploadMs, timing.blasMs, timing.tlasMs,
+           timing.descMs, timing.totalMs);
+    return true;
+}
+
+void VkApp::removeModel(size_t index)
+{
+    assert(index < m_sceneModels.size());
+    const SceneModel model = m_sceneModels[index];
+    // The object descriptions cannot be empty.  (A scene without
+    // lights is fine; see createLightBuffers.)
+    if (m_sceneModels.size() == 1) {
+        printf("Not removing %s: the scene would have no objects\n", model.filename.c_str());
+        return; }
+
+    auto start = std::chrono::steady_clock::now();
+    finishUploads();
+    vkDeviceWaitIdle(m_device);
+
+    // Its objects and their BLAS's
+    for (size_t i = model.firstObject;  i < model.firstObject + model.nbObjects;  i++) {
+        ObjData& ob = m_objData[i];
+        ob.vertexBuffer.destroy(m_device);
+        ob.positionBuffer.destroy(m_device);
+        ob.indexBuffer.destroy(m_device);
+        ob.matIndexBuffer.destroy(m_device);
+        ob.hitRecordBuffer.destroy(m_device); }
+    if (model.nbObjects != 0)
+        m_objData[model.firstObject].matColorBuffer.destroy(m_device);  // Shared by all of them
+    m_objData.erase(m_objData.begin() + model.firstObject,
+                    m_objData.begin() + model.firstObject + model.nbObjects);
+    m_objDesc.erase(m_objDesc.begin() + model.firstObject,
+                    m_objDesc.begin() + model.firstObject + model.nbObjects);
+    m_rtBuilder.removeBlas(uint32_t(model.firstObject), uint32_t(model.nbObjects));
+    if (m_rtLod != 0)
+        createLodBlas();  // Renumbered from scratch
+
+    // Its instances; later instances refer to objects that moved down.
+    m_objInst.erase(m_objInst.begin() + model.firstInstance,
+                    m_objInst.begin() + model.firstInstance + model.nbInstances);
+    for (ObjInst& inst : m_objInst)
+        if (inst.objIndex >= model.firstObject + model.nbObjects)
+            inst.objIndex -= uint32_t(model.nbObjects);
+
+    // Its textures that no other model shares; the rest move down.
+    std::vector<int32_t> renumber = m_textureRegistry.release(model.textureSlots);
+    std::vector<ImageWrap> keptTextures;
+#ifdef TEXTURE_ATLAS
+    // An atlas page goes with the last texture packed in it.
+    std::vector<AtlasRect> keptRects;
+    std::vector<bool> imageUsed(m_objText.size(), false);
+    for (size_t t = 0;  t < m_textureRects.size();  t++)
+        if (renumber[t] >= 0) {
+            keptRects.push_back(m_textureRects[t]);
+            imageUsed[m_textureRects[t].image] = true; }
+    std::vector<uint32_t> imageRenumber(m_objText.size(), 0);
+    for (size_t i = 0;  i < m_objText.size();  i++) {
+        if (!imageUsed[i]) m_objText[i].destroy(m_device);
+        else {
+            imageRenumber[i] = uint32_t(keptTextures.size());
+            keptTextures.push_back(m_objText[i]); } }
+    for (AtlasRect& rect : keptRects)
+        rect.image = imageRenumber[rect.image];
+    bool texturesMoved = keptRects.size() != m_textureRects.size();
+    m_textureRects.swap(keptRects);
+    createTextureRectBuffer();
+#else
+    for (size_t t = 0;  t < m_objText.size();  t++) {
+        if (renumber[t] < 0) m_objText[t].destroy(m_device);
+        else keptTextures.push_back(m_objText[t]); }
+    bool texturesMoved = keptTextures.size() != m_objText.size();
+#endif
+    m_objText.swap(keptTextures);
+#ifdef VIRTUAL_TEXTURES
+    texturesMoved = std::find(renumber.begin(), renumber.end(), -1) != renumber.end();
+    if (texturesMoved) {
+        m_virtualTextures.remove(renumber);
+        createVirtualTextureTables(); }
+#endif
+
+    // Its lights
+    m_emitters.erase(m_emitters.begin() + model.firstEmitter,
+                     m_emitters.begin() + model.firstEmitter + model.nbEmitters);
+    createLightBuffers();
+
+    m_sceneModels.erase(m_sceneModels.begin() + index);
+    for (size_t k = index;  k < m_sceneModels.size();  k++) {
+        SceneModel& m = m_sceneModels[k];
+        m.firstObject   -= model.nbObjects;
+        m.firstInstance -= model.nbInstances;
+        m.firstEmitter  -= model.nbEmitters; }
+
+    // Materials whose textures moved down are written again.
+    if (texturesMoved)
+        for (SceneModel& m : m_sceneModels) {
+            for (uint32_t& slot : m.textureSlots)
+                slot = uint32_t(renumber[slot]);
+            if (!m.textureSlots.empty() && m.nbObjects != 0) {
+                std::vector<Material> materials = slotMaterials(m);
+                updateBufferWrap(m_objData[m.firstObject].matColorBuffer,
+                                 sizeof(Material)*materials.size(), materials.data()); } }
+
+    bool buffersMoved = updateObjDescriptionBuffer();
+    createTopLevelAS();
+    updateSceneDescriptors(buffersMoved);
+    printf("Removed %s in %.2f ms\n", model.filename.c_str(),
+           std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count());
+}
+
+// Rewrites the object descriptions and instance transforms into
+// their buffers.  The buffers are reallocated, at double their
+// capacity, only when they are too small.
+bool VkApp::updateObjDescriptionBuffer()
+{
+    std::vector<ObjDesc> descs = objectDescriptions();
+    std::vector<InstanceTransform> transforms = instanceTransforms();
+
+    bool reallocated = false;
+    if (descs.size() > m_objDescCapacity || transforms.size() > m_instanceCapacity) {
+        m_objDescCapacity  = std::max(descs.size(), 2*m_objDescCapacity);
+        m_instanceCapacity = std::max(transforms.size(), 2*m_instanceCapacity);
+        finishUploads();  // None may be left copying to the old buffers
+        m_objDescriptionBuff.destroy(m_device);
+        m_instanceBuff.destroy(m_device);
+        initBufferWrap(m_objDescriptionBuff, sizeof(ObjDesc)*m_objDescCapacity,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        initBufferWrap(m_instanceBuff, sizeof(InstanceTransform)*m_instanceCapacity,
+                       VK_BUFFER_USAGE_STORAGE_BUFFER_BIT | VK_BUFFER_USAGE_TRANSFER_DST_BIT,
+                       VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT);
+        NAME(m_objDescriptionBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_objDescriptionBuff.buffer");
+        NAME(m_instanceBuff.buffer, VK_OBJECT_TYPE_BUFFER, "m_instanceBuff.buffer");
+        reallocated = true; }
+
+    updateBufferWrap(m_objDescriptionBuff, sizeof(ObjDesc)*descs.size(), descs.data());
+    updateBufferWrap(m_instanceBuff, sizeof(InstanceTransform)*transforms.size(), transforms.data());
+    return reallocated;
+}
+
+// Points the descriptor sets at the scene's current TLAS, lights,
+// textures and (if buffersMoved) object description buffers.
+void VkApp::updateSceneDescriptors(bool buffersMoved)
+{
+    if (m_objText.size() > m_textureSlots || (m_objText.empty() && m_textureSlots != 0)) {
+        printf("Texture slots: %zd textures need a new descriptor set layout\n", m_objText.size());
+        recreateScenePipelines();
+        return; }
+
+    if (buffersMoved) {
+        m_scDesc.write(m_device, 1, m_objDescriptionBuff.buffer);
+        m_scDesc.write(m_device, 3, m_instanceBuff.buffer); }
+    writeTextureDescriptors();
+#ifdef VIRTUAL_TEXTURES
+    writeVirtualTextureDescriptors();  // Tables recreated by uploadNewTextures or removeModel
+#endif
+#ifdef TEXTURE_ATLAS
+    m_scDesc.write(m_device, 4, m_textureRectBuff.buffer);  // Likewise
+#endif
+
+    m_rtDesc.write(m_device, 0, m_rtBuilder.getAccelerationStructure());
+    m_rtDesc.write(m_device, 2, m_lightBuff.buffer);
+    m_rtDesc.write(m_device, 8, m_lightSelectBuff.buffer);
+
+    app->myCamera.modified = true;  // Restart the ray tracer's accumulation
+}
@@ -0,0 +1,184 @@
+//////////////////////////////////////////////////////////////////////
+// Uploads of host data to device buffers and images.
+//
+// Each upload used to make its own staging buffer and command buffer,
+// submit it, and wait for the queue to idle: a full round trip to the
+// GPU for every buffer, texture and layout transition, hundreds of
+// them for a large model.  Now:
+//  - stageUpload copies the data into m_uploadRing, a persistently
+//    mapped staging buffer used as a ring;
+//  - the copies (and layout transitions and mip blits) are recorded
+//    into one command buffer, uploadCommandBuffer();
+//  - flushUploads submits that, with a fence, and nothing waits for
+//    it.  It is called before any other submit (the frame's, and
+//    submitTempCmdBuffer's), so uploads are always ahead of their use
+//    on the single queue, and the barriers at either end of each
+//    batch order them with the work before and after.
+// The ring space of a batch is reused once its fence has signalled;
+// only a full ring waits for it.  Data larger than the ring gets a
+// staging buffer of its own, freed with the batch.
+//
+// A buffer or image must not be destroyed while a copy to it is
+// recorded but not submitted: anything replaced outside a frame calls
+// finishUploads first.
+////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "vkapp.h"
+
+static const VkDeviceSize uploadRingSize = 64*1024*1024;
+static const VkDeviceSize uploadAlignment = 16;  // A multiple of every texel block size
+
+void VkApp::createUploadRing()
+{
+    initBufferWrap(m_uploadRing, uploadRingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   MemCategory::Staging);
+    void* data;
+    vkMapMemory(m_device, m_uploadRing.memory, 0, uploadRingSize, 0, &data);
+    m_uploadRingData = (uint8_t*)data;
+    m_uploadHead = 0;
+    m_uploadUsed = 0;
+}
+
+void VkApp::destroyUploadRing()
+{
+    finishUploads();
+    vkUnmapMemory(m_device, m_uploadRing.memory);
+    m_uploadRingData = nullptr;
+    m_uploadRing.destroy(m_device);
+}
+
+// The command buffer uploads are recorded into, begun (behind a
+// barrier on all earlier work, so a copy never overwrites what that
+// still reads) if it was not already.
+VkCommandBuffer VkApp::uploadCommandBuffer()
+{
+    if (m_uploadBatch.cmdBuf != VK_NULL_HANDLE)
+        return m_uploadBatch.cmdBuf;
+
+    VkCommandBufferAllocateInfo allocateInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_ALLOCATE_INFO};
+    allocateInfo.commandBufferCount = 1;
+    allocateInfo.commandPool        = m_cmdPool;
+    allocateInfo.level              = VK_COMMAND_BUFFER_LEVEL_PRIMARY;
+    vkAllocateCommandBuffers(m_device, &allocateInfo, &m_uploadBatch.cmdBuf);
+
+    VkCommandBufferBeginInfo beginInfo{VK_STRUCTURE_TYPE_COMMAND_BUFFER_BEGIN_INFO};
+    beginInfo.flags = VK_COMMAND_BUFFER_USAGE_ONE_TIME_SUBMIT_BIT;
+    vkBeginCommandBuffer(m_uploadBatch.cmdBuf, &beginInfo);
+    vkCmdPipelineBarrier(m_uploadBatch.cmdBuf, VK_PIPELINE_STAGE_ALL_COMMANDS_BIT,
+                         VK_PIPELINE_STAGE_TRANSFER_BIT, 0, 0, nullptr, 0, nullptr, 0, nullptr);
+    return m_uploadBatch.cmdBuf;
+}
+
+// Copies size bytes of data to staging memory for a copy recorded
+// into uploadCommandBuffer(), and returns the staging buffer, with
+// the data at offset in it.  This may submit the batch being
+// recorded (if the ring is full), so take uploadCommandBuffer() after
+// it, and record the copy before staging anything else.
+VkBuffer VkApp::stageUpload(const void* data, VkDeviceSize size, VkDeviceSize& offset)
+{
+    m_uploadStats.bytes += size;
+    if (size > uploadRingSize) {
+        BufferWrap staging;
+        initBufferWrap(staging, size, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                       VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                       MemCategory::Staging);
+        void* dest;
+        vkMapMemory(m_device, staging.memory, 0, size, 0, &dest);
+        memcpy(dest, data, size);
+        vkUnmapMemory(m_device, staging.memory);
+        m_uploadBatch.buffers.push_back(staging);
+        m_uploadStats.dedicated++;
+        offset = 0;
+        return staging.buffer; }
+
+    // The free space is [head, tail), wrapping around the end.
+    for (;;) {
+        if (m_uploadUsed == 0) m_uploadHead = 0;
+        VkDeviceSize tail = (m_uploadHead + uploadRingSize - m_uploadUsed) % uploadRingSize;
+        VkDeviceSize start = (m_uploadHead + uploadAlignment - 1) & ~(uploadAlignment - 1);
+        bool freeToEnd = m_uploadUsed == 0 || m_uploadHead > tail;
+        VkDeviceSize end = freeToEnd ? uploadRingSize : tail;
+        if (start + size > end && freeToEnd && size <= tail) {
+            start = 0;  // Skip the end of the ring
+            end = tail; }
+        if (start + size <= end) {
+            VkDeviceSize taken = (start >= m_uploadHead ? start - m_uploadHead
+                                  : uploadRingSize - m_uploadHead + start) + size;
+            m_uploadBatch.ringBytes += taken;
+            m_uploadUsed += taken;
+            m_uploadHead = (start + size) % uploadRingSize;
+            memcpy(m_uploadRingData + start, data, size);
+            offset = start;
+            return m_uploadRing.buffer; }
+
+        // Full: wait for the oldest batch, submitting this one if it is that.
+        if (m_uploadsInFlight.empty()) flushUploads();
+        if (!m_uploadsInFlight.empty()) {  // (Unless flushUploads retired them all)
+            retireUpload(true);
+            m_uploadStats.ringWaits++; } }
+}
+
+// Submits the uploads recorded so far, behind a barrier that makes
+// them visible to everything submitted after.  Retires the batches
+// already done, without waiting for the others.
+void VkApp::flushUploads()
+{
+    if (m_uploadBatch.cmdBuf != VK_NULL_HANDLE) {
+        VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+        barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+        barrier.dstAccessMask = VK_ACCESS_MEMORY_READ_BIT | VK_ACCESS_MEMORY_WRITE_BIT;
+        vkCmdPipelineBarrier(m_uploadBatch.cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT,
+                             VK_PIPELINE_STAGE_ALL_COMMANDS_BIT, 0, 1, &barrier, 0, nullptr, 0, nullptr);
+        vkEndCommandBuffer(m_uploadBatch.cmdBuf);
+
+        VkFenceCreateInfo fenceInfo{VK_STRUCTURE_TYPE_FENCE_CREATE_INFO};
+        vkCreateFence(m_device, &fenceInfo, nullptr, &m_uploadBatch.fence);
+        VkSubmitInfo submitInfo{VK_STRUCTURE_TYPE_SUBMIT_INFO};
+        submitInfo.commandBufferCount = 1;
+        submitInfo.pCommandBuffers    = &m_uploadBatch.cmdBuf;
+        vkQueueSubmit(m_queue, 1, &submitInfo, m_uploadBatch.fence);
+        m_uploadStats.batches++; }
+    else
+        assert(m_uploadBatch.ringBytes == 0 && m_uploadBatch.buffers.empty());
+
+    if (m_uploadBatch.fence != VK_NULL_HANDLE)
+        m_uploadsInFlight.push_back(m_uploadBatch);
+    m_uploadBatch = UploadBatch();
+
+    while (!m_uploadsInFlight.empty() && retireUpload(false)) {}
+}
+
+// Submits the uploads recorded so far, and waits for all of them.
+void VkApp::finishUploads()
+{
+    flushUploads();
+    while (!m_uploadsInFlight.empty())
+        retireUpload(true);
+}
+
+// Frees the oldest batch in flight, if it is done or (with wait) once
+// it is; false if it is not done.
+bool VkApp::retireUpload(bool wait)
+{
+    UploadBatch& batch = m_uploadsInFlight.front();
+    if (wait) vkWaitForFences(m_device, 1, &batch.fence, VK_TRUE, UINT64_MAX);
+    else if (vkGetFenceStatus(m_device, batch.fence) != VK_SUCCESS) return false;
+
+    vkDestroyFence(m_device, batch.fence, nullptr);
+    vkFreeCommandBuffers(m_device, m_cmdPool, 1, &batch.cmdBuf);
+    for (BufferWrap& staging : batch.buffers)
+        staging.destroy(m_device);
+    m_uploadUsed -= batch.ringBytes;
+    m_uploadsInFlight.pop_front();
+    return true;
+}
+
+void VkApp::printUploadStats()
+{
+    printf("Uploads: %.1f MB staged in %zd submits, %zd waits for ring space, %zd dedicated staging buffers\n",
+           m_uploadStats.bytes/(1024.0*1024.0), m_uploadStats.batches, m_uploadStats.ringWaits,
+           m_uploadStats.dedicated);
+}
@@ -0,0 +1,242 @@
+//////////////////////////////////////////////////////////////////////
+// Virtual textures on the GPU (VIRTUAL_TEXTURES in shared_structs.h).
+//
+// VirtualTextures (virtual_texture.h) decides which tiles are
+// resident; this file gives its tables and its cache to the shaders,
+// as bindings 4 to 7 of m_scDesc:
+//  4  m_vtTextureBuff   the VtTexture of each texture
+//  5  m_vtPageBuff      the page table
+//  6  m_vtFeedbackBuff  a bit per page, set by the shaders for each
+//                       tile they want; host visible, and read back
+//                       once the frame's fence has signalled
+//  7  m_vtCache         the tiles, with their borders
+//
+// Each frame (between prepareFrame and the first draw) takes the last
+// frame's feedback, and records the copies of the tiles streamed since
+// and of the page table entries they changed into m_commandBuffer,
+// from m_vtStaging; at most maxFrameTiles a frame so no frame stalls
+// on a burst of them.
+////////////////////////////////////////////////////////////////////////
+
+#include <string.h>
+
+#include "vkapp.h"
+
+#ifdef VIRTUAL_TEXTURES
+
+static const size_t maxFrameTiles = 16;
+static const VkDeviceSize tileBytes = VkDeviceSize(VT_CACHE_TILE)*VT_CACHE_TILE*4;
+
+// The shader stages that read the cache and the tables.
+static const VkPipelineStageFlags vtShaderStages =
+    VK_PIPELINE_STAGE_FRAGMENT_SHADER_BIT | VK_PIPELINE_STAGE_RAY_TRACING_SHADER_BIT_KHR;
+
+// Records the copies of update's tiles, which are at stagingOffset in
+// staging, into the cache image, and the layout transitions around them.
+static void recordTileCopies(VkCommandBuffer cmdBuf, const VtUpdate& update, VkBuffer staging,
+                             VkDeviceSize stagingOffset, VkImage cache)
+{
+    if (update.tiles.empty()) return;
+
+    VkImageMemoryBarrier barrier{VK_STRUCTURE_TYPE_IMAGE_MEMORY_BARRIER};
+    barrier.oldLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.dstAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.image = cache;
+    barrier.subresourceRange = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 1, 0, 1};
+    vkCmdPipelineBarrier(cmdBuf, vtShaderStages, VK_PIPELINE_STAGE_TRANSFER_BIT, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+
+    std::vector<VkBufferImageCopy> regions;
+    for (const VtUpdate::Tile& tile : update.tiles) {
+        VkBufferImageCopy region{};
+        region.bufferOffset = stagingOffset + tile.offset;
+        region.imageSubresource = {VK_IMAGE_ASPECT_COLOR_BIT, 0, 0, 1};
+        region.imageOffset = {int32_t(tile.x*VT_CACHE_TILE), int32_t(tile.y*VT_CACHE_TILE), 0};
+        region.imageExtent = {VT_CACHE_TILE, VT_CACHE_TILE, 1};
+        regions.push_back(region); }
+    vkCmdCopyBufferToImage(cmdBuf, staging, cache, VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL,
+                           uint32_t(regions.size()), regions.data());
+
+    barrier.oldLayout = VK_IMAGE_LAYOUT_TRANSFER_DST_OPTIMAL;
+    barrier.newLayout = VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL;
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    vkCmdPipelineBarrier(cmdBuf, VK_PIPELINE_STAGE_TRANSFER_BIT, vtShaderStages, 0,
+                         0, nullptr, 0, nullptr, 1, &barrier);
+}
+
+// The cache image and the per-frame staging buffer; their size is
+// fixed by VIRTUAL_TEXTURES, whatever the scene.
+void VkApp::createVirtualTextureCache()
+{
+    VkPhysicalDeviceProperties properties{};
+    vkGetPhysicalDeviceProperties(m_physicalDevice, &properties);
+    uint32_t side = m_virtualTextures.cacheSide()*VT_CACHE_TILE;
+    if (side > properties.limits.maxImageDimension2D) {
+        printf("Virtual texture cache of %u texels is larger than the device allows (%u);"
+               " lower VIRTUAL_TEXTURES\n", side, properties.limits.maxImageDimension2D);
+        exit(-1); }
+
+    VkExtent2D extent{side, side};
+    initImageWrap(m_vtCache, extent, VK_FORMAT_R8G8B8A8_UNORM,
+                  VK_IMAGE_USAGE_TRANSFER_DST_BIT | VK_IMAGE_USAGE_SAMPLED_BIT,
+                  VK_MEMORY_PROPERTY_DEVICE_LOCAL_BIT, VK_IMAGE_ASPECT_COLOR_BIT,
+                  VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL, 1, MemCategory::Textures);
+
+    // Bilinear within a level; the tiles' borders make clamping moot,
+    // and the shaders choose the level.
+    VkSamplerCreateInfo samplerInfo{VK_STRUCTURE_TYPE_SAMPLER_CREATE_INFO};
+    samplerInfo.magFilter = VK_FILTER_LINEAR;
+    samplerInfo.minFilter = VK_FILTER_LINEAR;
+    samplerInfo.addressModeU = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeV = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.addressModeW = VK_SAMPLER_ADDRESS_MODE_CLAMP_TO_EDGE;
+    samplerInfo.anisotropyEnable = VK_FALSE;
+    samplerInfo.borderColor = VK_BORDER_COLOR_INT_OPAQUE_BLACK;
+    samplerInfo.unnormalizedCoordinates = VK_FALSE;
+    samplerInfo.compareEnable = VK_FALSE;
+    samplerInfo.compareOp = VK_COMPARE_OP_ALWAYS;
+    samplerInfo.mipmapMode = VK_SAMPLER_MIPMAP_MODE_NEAREST;
+    samplerInfo.maxLod = 0.0f;
+    vkCreateSampler(m_device, &samplerInfo, nullptr, &m_vtCache.sampler);
+
+    // A frame's tiles, then its page table entries (at most two per
+    // tile: the one placed, and the one it evicted).
+    VkDeviceSize stagingSize = maxFrameTiles*(tileBytes + 2*sizeof(uint32_t));
+    initBufferWrap(m_vtStaging, stagingSize, VK_BUFFER_USAGE_TRANSFER_SRC_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   MemCategory::Staging);
+    void* data;
+    vkMapMemory(m_device, m_vtStaging.memory, 0, stagingSize, 0, &data);
+    m_vtStagingData = (uint8_t*)data;
+
+    createVirtualTextureTables();
+}
+
+// (Re)creates the texture table, the page table and the feedback
+// buffer after textures were added or removed, with the textures'
+// last paged tiles already in the cache.  The caller rewrites the
+// descriptors (createScDescriptorSet or updateSceneDescriptors).
+void VkApp::createVirtualTextureTables()
+{
+    finishUploads();  // None may be left copying to the old tables
+
+    VtUpdate pinned = m_virtualTextures.update(0);
+    if (!pinned.tiles.empty()) {
+        VkDeviceSize offset;
+        VkBuffer staging = stageUpload(pinned.texels.data(), pinned.texels.size(), offset);
+        recordTileCopies(uploadCommandBuffer(), pinned, staging, offset, m_vtCache.image); }
+
+    // Never empty, so the bindings always have a buffer.
+    std::vector<VtTexture> textures = m_virtualTextures.textureTable();
+    std::vector<uint32_t> pages = m_virtualTextures.pageTable();
+    if (textures.empty()) textures.push_back(VtTexture{});
+    if (pages.empty()) pages.push_back(0);
+
+    m_vtTextureBuff.destroy(m_device);
+    m_vtPageBuff.destroy(m_device);
+    initBufferWrapFromData(m_vtTextureBuff, textures,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemCategory::Textures);
+    initBufferWrapFromData(m_vtPageBuff, pages,
+                           VK_BUFFER_USAGE_STORAGE_BUFFER_BIT, MemCategory::Textures);
+
+    if (m_vtFeedback) vkUnmapMemory(m_device, m_vtFeedbackBuff.memory);
+    m_vtFeedbackBuff.destroy(m_device);
+    m_vtFeedbackWords = std::max(m_virtualTextures.feedbackWords(), size_t(1));
+    VkDeviceSize feedbackSize = sizeof(uint32_t)*m_vtFeedbackWords;
+    initBufferWrap(m_vtFeedbackBuff, feedbackSize, VK_BUFFER_USAGE_STORAGE_BUFFER_BIT,
+                   VK_MEMORY_PROPERTY_HOST_VISIBLE_BIT | VK_MEMORY_PROPERTY_HOST_COHERENT_BIT,
+                   MemCategory::Textures);
+    void* data;
+    vkMapMemory(m_device, m_vtFeedbackBuff.memory, 0, feedbackSize, 0, &data);
+    m_vtFeedback = (uint32_t*)data;
+    memset(m_vtFeedback, 0, feedbackSize);
+
+    VtStats stats = m_virtualTextures.stats();
+    printf("Virtual textures: %zd textures, %zd pages, %zd of %u cache tiles pinned\n",
+           m_virtualTextures.size(), stats.pages, stats.pinned,
+           m_virtualTextures.cacheSide()*m_virtualTextures.cacheSide());
+}
+
+// Bindings 4 to 7 of m_scDesc.
+void VkApp::writeVirtualTextureDescriptors()
+{
+    m_scDesc.write(m_device, 4, m_vtTextureBuff.buffer);
+    m_scDesc.write(m_device, 5, m_vtPageBuff.buffer);
+    m_scDesc.write(m_device, 6, m_vtFeedbackBuff.buffer);
+    VkDescriptorImageInfo cacheInfo{m_vtCache.sampler, m_vtCache.imageView,
+                                    VK_IMAGE_LAYOUT_SHADER_READ_ONLY_OPTIMAL};
+    m_scDesc.write(m_device, 7, cacheInfo);
+}
+
+// Called with m_commandBuffer begun, after prepareFrame has waited for
+// the last frame: takes its feedback, and records this frame's tile
+// and page table copies ahead of the frame's drawing.
+void VkApp::updateVirtualTextures()
+{
+    m_virtualTextures.feedback(m_vtFeedback, m_vtFeedbackWords);
+    memset(m_vtFeedback, 0, sizeof(uint32_t)*m_vtFeedbackWords);
+
+    VtUpdate update = m_virtualTextures.update(maxFrameTiles);
+    if (update.empty()) return;
+
+    // The tiles, then the entries of each changed range of the page table.
+    assert(update.texels.size() <= maxFrameTiles*tileBytes);
+    memcpy(m_vtStagingData, update.texels.data(), update.texels.size());
+    recordTileCopies(m_commandBuffer, update, m_vtStaging.buffer, 0, m_vtCache.image);
+
+    const std::vector<uint32_t>& pages = m_virtualTextures.pageTable();
+    std::vector<VkBufferCopy> copies;
+    VkDeviceSize offset = maxFrameTiles*tileBytes;
+    for (const auto& range : update.pageRanges) {
+        VkDeviceSize size = sizeof(uint32_t)*(range.second - range.first);
+        assert(offset + size <= m_vtStaging.allocSize);
+        memcpy(m_vtStagingData + offset, &pages[range.first], size);
+        copies.push_back({offset, sizeof(uint32_t)*range.first, size});
+        offset += size; }
+    if (copies.empty()) return;
+    vkCmdCopyBuffer(m_commandBuffer, m_vtStaging.buffer, m_vtPageBuff.buffer,
+                    uint32_t(copies.size()), copies.data());
+
+    VkBufferMemoryBarrier barrier{VK_STRUCTURE_TYPE_BUFFER_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_TRANSFER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_SHADER_READ_BIT;
+    barrier.srcQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.dstQueueFamilyIndex = VK_QUEUE_FAMILY_IGNORED;
+    barrier.buffer = m_vtPageBuff.buffer;
+    barrier.offset = 0;
+    barrier.size = VK_WHOLE_SIZE;
+    vkCmdPipelineBarrier(m_commandBuffer, VK_PIPELINE_STAGE_TRANSFER_BIT, vtShaderStages, 0,
+                         0, nullptr, 1, &barrier, 0, nullptr);
+}
+
+// Called before m_commandBuffer ends: makes the shaders' feedback
+// writes visible to the host once the frame's fence signals.
+void VkApp::finishVirtualTextureFrame()
+{
+    VkMemoryBarrier barrier{VK_STRUCTURE_TYPE_MEMORY_BARRIER};
+    barrier.srcAccessMask = VK_ACCESS_SHADER_WRITE_BIT;
+    barrier.dstAccessMask = VK_ACCESS_HOST_READ_BIT;
+    vkCmdPipelineBarrier(m_commandBuffer, vtShaderStages, VK_PIPELINE_STAGE_HOST_BIT, 0,
+                         1, &barrier, 0, nullptr, 0, nullptr);
+}
+
+void VkApp::destroyVirtualTextures()
+{
+    m_virtualTextures.clear();
+    if (m_vtFeedback) vkUnmapMemory(m_device, m_vtFeedbackBuff.memory);
+    if (m_vtStagingData) vkUnmapMemory(m_device, m_vtStaging.memory);
+    m_vtFeedback = nullptr;
+    m_vtStagingData = nullptr;
+    m_vtTextureBuff.destroy(m_device);
+    m_vtPageBuff.destroy(m_device);
+    m_vtFeedbackBuff.destroy(m_device);
+    m_vtStaging.destroy(m_device);
+    m_vtCache.destroy(m_device);
+}
+
+#endif